@@ -6,129 +6,411 @@
  * It creates a TCP socket, binds to a port, listens for connections,
  * and handles sender communication. It showcases:
  * - TCP socket creation
- * - Socket binding and listening
+ * - Socket binding and listening, dual-stack: one IPv6 socket accepts IPv4 and IPv6 senders
  * - Accepting sender connections
  * - Sending and receiving data over a TCP connection
  * - Handling multiple senders
+ * - Edge-triggered epoll event loop for many concurrent senders
+ * - Sharding connections across pinned worker threads with SO_REUSEPORT
+ * - io_uring event loop with multishot accept/recv and provided buffers (-DENABLE_IO_URING=ON)
+ * - Length-prefixed framing parsed in place, so coalesced or split segments do not break messages
+ * - Echo mode: every frame goes back to its sender unchanged, so load generators can measure latency
+ * - File mode: one file is spliced from the socket into a destination file through a pipe, without
+ *   copying it through user space, optionally written with O_DIRECT
+ * - Socket options (buffer sizes, TCP_NODELAY, busy polling, ...) from a config file or the command line
+ * - Per-message and per-connection logging through the asynchronous logger, with the level and sampling
+ *   switchable at runtime (SIGUSR1 / SIGUSR2)
+ * - Connection, frame, byte and error counters served to Prometheus (--metrics-port)
+ * - Spin mode (epoll mode): the loop polls epoll without sleeping on pinned, optionally SCHED_FIFO threads
+ *   with locked memory, and reports busy and idle time (see net/busy_poll.h)
+ * - Hot restart (epoll mode): a new receiver started with the same --hot-restart PATH takes over the listen
+ *   sockets with their accept queues; the old one stops accepting, drains its open connections and exits
  * - Socket cleanup
  *
+ * Usage: 01-receiver [--mode blocking|epoll|io_uring|file] [--backlog N] [--workers N] [--cpus 0,1,...] [--echo]
+ *                    [--output FILE] [--direct]
+ *                    [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                    [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                    [--metrics-port PORT [--metrics-address IP]] [--hot-restart PATH [--drain-timeout SECONDS]]
+ *                    [--spin [--spin-cpu N] [--rt-priority 1-99]] [--mlock]
+ *
  * @note Uses SOCK_STREAM socket type (TCP protocol)
+ * @note The listen backlog is capped by the kernel at net.core.somaxconn
+ * @note Accepted connections inherit the listen socket's options
+ * @note With --workers, --cpus pins the spinning workers; --spin-cpu is for a single loop
+ * @note A hot restart to fewer --workers closes the listen sockets left over, resetting connections queued on them
+ * @note --sockopt v6only=1 makes the listen socket IPv6-only; IPv4 peers are printed as IPv4, not ::ffff:a.b.c.d
  */
 
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "net/bulk_transfer.h"
+#include "net/busy_poll.h"
+#include "net/framing.h"
+#include "net/hot_restart.h"
+#include "net/logger.h"
+#include "net/metrics.h"
+#include "net/socket.h"
+#ifdef ENABLE_IO_URING
+#include "net/io_uring.h"
+#endif
+
 #define SERVER_ADDRESS "127.0.0.1"
 #define SERVER_PORT 8080
 #define BUFFER_SIZE 1024
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
 #define MAX_PENDING_CONNECTIONS 5
+#define MAX_EPOLL_EVENTS 256
+#define FRAME_BUFFER_SIZE 65536
+#define MAX_FRAME_SIZE 65536
+#define FRAME_RING_POOL_IDLE 64 // Idle rings an event loop keeps for the next connection with a partial frame
 
-int main(int argc, char** argv)
+#define URING_ENTRIES 4096
+#define URING_BUFFER_COUNT 4096
+#define URING_BUFFER_GROUP 0
+
+enum class ReceiverMode
+{
+    Blocking,
+    Epoll,
+    IoUring,
+    File
+};
+
+struct ReceiverOptions
 {
-    int sockfd;
-    sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
+    ReceiverMode mode = ReceiverMode::Blocking;
+    int backlog = MAX_PENDING_CONNECTIONS;
+    int workers = 1;
+    std::vector<int> cpus; // CPU for worker i is cpus[i % cpus.size()]; empty means i % CPU count
+    bool echo = false;     // Send every frame back instead of printing it (blocking and epoll modes)
+    std::string outputPath; // File mode: where the received file is written
+    bool direct = false;    // File mode: write it with O_DIRECT
+    SocketOptions socket = SocketOptions()
+                               .reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR)
+                               .reusePort(SOCKET_OPTION_ENABLE_REUSEPORT)
+                               .v6Only(false); // Dual-stack listener
+    LogOptions log;
+    MetricsOptions metrics;
+    HotRestartOptions restart;
+    SpinOptions spin;
+};
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1)
+// Per-connection state kept by the epoll and io_uring loops
+struct Connection
+{
+    Connection(int fd, const SocketAddress& address, RingBufferPool& rings)
+        : fd(fd), address(address), bytes_received(0), decoder(rings, MAX_FRAME_SIZE)
     {
-        std::cerr << "Failed to create socket\n";
-        exit(EXIT_FAILURE);
     }
-    /*
-    sockfd: socket file descriptor
-
-    socket(int domain, int type, int protocol)
-    1st arg: Address Family
-        AF_INET: IPv4
-        AF_INET6: IPv6
-    2nd arg: Socket Type
-        SOCK_STREAM: TCP
-        SOCK_DGRAM: UDP
-    3rd arg: Protocol
-        0: default protocol
-
-    return socket descriptor if success
-    return -1 if failed
-    */
 
-    int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1)
+    int fd;
+    SocketAddress address;
+    size_t bytes_received;
+    FrameDecoder decoder;     // Leases a ring from the loop's pool while it holds a partial frame
+    std::vector<char> outbox; // Echoed frames the socket has not accepted yet
+};
+
+static Gauge& openConnections = Metrics::instance().gauge("tcp_connections_open", "Accepted connections still open");
+static Counter& acceptedConnections =
+    Metrics::instance().counter("tcp_connections_accepted_total", "Connections accepted");
+
+static void printFrame(int fd, uint8_t type, std::string_view payload)
+{
+    if (type == FRAME_TYPE_TEXT)
+    {
+        LOG_INFO("Message from client {}: {}", fd, payload);
+    }
+    else
+    {
+        LOG_INFO("Frame from client {}: type {}, {} bytes", fd, type, payload.size());
+    }
+}
+
+static void appendFrame(std::vector<char>& out, uint8_t type, std::string_view payload)
+{
+    char header[FRAME_MAX_HEADER_SIZE];
+    size_t header_length = encodeFrameHeader(type, static_cast<uint32_t>(payload.size()), header);
+    out.insert(out.end(), header, header + header_length);
+    out.insert(out.end(), payload.begin(), payload.end());
+    trafficMetrics().packetsSent.add(); // Its bytes are counted when flushOutbox() sends them
+}
+
+// Send as much of outbox as the socket takes: all of it when blocking, until EAGAIN otherwise. False on error.
+static bool flushOutbox(int fd, std::vector<char>& outbox)
+{
+    size_t sent = 0;
+    while (sent < outbox.size())
+    {
+        ssize_t bytes_sent = send(fd, outbox.data() + sent, outbox.size() - sent, MSG_NOSIGNAL);
+        if (bytes_sent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                trafficMetrics().errors.add();
+                return false;
+            }
+            trafficMetrics().wouldBlock.add();
+            break;
+        }
+        sent += bytes_sent;
+    }
+    trafficMetrics().bytesSent.add(sent);
+    outbox.erase(outbox.begin(), outbox.begin() + sent);
+    return true;
+}
+
+static const char* frameError(FrameStatus status)
+{
+    return status == FrameStatus::TooLarge ? "frame too large" : "malformed frame header";
+}
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--mode blocking|epoll|io_uring|file] [--backlog N] [--workers N]"
+              << " [--cpus 0,1,...] [--echo] [--output FILE] [--direct] " << SocketOptions::usage() << " "
+              << LogOptions::usage() << " " << MetricsOptions::usage() << " " << HotRestartOptions::usage() << " "
+              << SpinOptions::usage() << "\n";
+}
+
+static ReceiverOptions parseOptions(int argc, char** argv)
+{
+    ReceiverOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            if (options.socket.parseArgument(argc, argv, i) || options.log.parseArgument(argc, argv, i) ||
+                options.metrics.parseArgument(argc, argv, i) || options.restart.parseArgument(argc, argv, i) ||
+                options.spin.parseArgument(argc, argv, i))
+            {
+                continue;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        }
+
+        std::string arg = argv[i];
+        if (arg == "--mode" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "blocking")
+            {
+                options.mode = ReceiverMode::Blocking;
+            }
+            else if (mode == "epoll")
+            {
+                options.mode = ReceiverMode::Epoll;
+            }
+            else if (mode == "io_uring")
+            {
+#ifdef ENABLE_IO_URING
+                options.mode = ReceiverMode::IoUring;
+#else
+                std::cerr << "Built without io_uring support (configure with -DENABLE_IO_URING=ON)\n";
+                exit(EXIT_FAILURE);
+#endif
+            }
+            else if (mode == "file")
+            {
+                options.mode = ReceiverMode::File;
+            }
+            else
+            {
+                printUsage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            options.workers = atoi(argv[++i]);
+            if (options.workers <= 0)
+            {
+                printUsage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--cpus" && i + 1 < argc)
+        {
+            std::stringstream list(argv[++i]);
+            std::string cpu;
+            while (std::getline(list, cpu, ','))
+            {
+                options.cpus.push_back(atoi(cpu.c_str()));
+            }
+        }
+        else if (arg == "--backlog" && i + 1 < argc)
+        {
+            options.backlog = atoi(argv[++i]);
+            if (options.backlog <= 0)
+            {
+                printUsage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--echo")
+        {
+            options.echo = true;
+        }
+        else if (arg == "--output" && i + 1 < argc)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (arg == "--direct")
+        {
+            options.direct = true;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options.echo && options.mode == ReceiverMode::IoUring)
     {
-        std::cerr << "Failed to set SO_REUSEADDR\n";
-        close(sockfd);
+        std::cerr << "--echo is supported in blocking and epoll mode only\n";
         exit(EXIT_FAILURE);
     }
-    opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void*)&opt, sizeof(opt)) == -1)
+    if (options.mode == ReceiverMode::File && (options.outputPath.empty() || options.workers > 1))
     {
-        std::cerr << "Failed to set SO_REUSEPORT\n";
-        close(sockfd);
+        std::cerr << "--mode file needs --output FILE and serves a single sender\n";
         exit(EXIT_FAILURE);
     }
-    /*
-    Set the socket option to reuse the address and port immediately after the program exits
+    // Only the epoll loop watches for the stop and drains its connections
+    if (options.restart.enabled() && options.mode != ReceiverMode::Epoll)
+    {
+        std::cerr << "--hot-restart is supported in epoll mode only\n";
+        exit(EXIT_FAILURE);
+    }
+    try
+    {
+        options.spin.validate();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (options.spin.enabled() && options.mode != ReceiverMode::Epoll)
+    {
+        std::cerr << "--spin is supported in epoll mode only\n";
+        exit(EXIT_FAILURE);
+    }
+    if (options.spin.cpu != -1 && options.workers > 1)
+    {
+        std::cerr << "--spin-cpu pins a single loop; pin workers with --cpus\n";
+        exit(EXIT_FAILURE);
+    }
+    return options;
+}
 
-    setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
-    level: SOL_SOCKET: socket layer
-    optname: SO_REUSEADDR - Reuse the address immediately after the program exits
-             SO_REUSEPORT - Reuse the port immediately after the program exits
-    optval: Pointer for the value of the option
-    optlen: Length of the option value
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1)
+    {
+        return false;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+/*
+fcntl(int fd, int cmd, ...)
+F_GETFL / F_SETFL: Get / set the file status flags
+O_NONBLOCK: accept(), recv() and send() return -1 with errno EAGAIN instead of blocking
+*/
 
-    return 0 if success
-    return -1 if failed
-    */
+static bool pinToCpu(int cpu)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+}
+/*
+pthread_setaffinity_np(pthread_t thread, size_t cpusetsize, const cpu_set_t *cpuset)
+Restrict the calling thread to the CPUs in cpuset, so its socket, epoll instance and connections stay on one core
+return 0 if success
+*/
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+// Accept one sender and write the file it sends to output_path; report the throughput
+static int receiveFileFromClient(int sockfd, const std::string& output_path, bool direct)
+{
+    int output_fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
     /*
-    sin_family: Address Family
-    sin_port: Port number. 2 bytes(short). Value should be in network byte order(Big Endian).
-    sin_addr.s_addr: IP address. 4 bytes
-    INADDR_ANY: 0.0.0.0 - Allow all IP addresses
+    O_DIRECT: Write straight from the caller's memory to the device, bypassing the page cache.
+              Buffers, lengths and file offsets must be aligned to the device's logical block size.
+              Some filesystems (tmpfs) do not support it and fail with EINVAL.
     */
+    if (output_fd == -1)
+    {
+        std::cerr << "Failed to open " << output_path << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
 
-    if (bind(sockfd, (sockaddr*)&server_addr, sizeof(server_addr)) == -1)
+    int result = EXIT_SUCCESS;
+    int client_socket = accept(sockfd, nullptr, nullptr);
+    if (client_socket == -1)
     {
-        std::cerr << "Failed to bind socket\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        std::cerr << "Failed to accept connection\n";
+        close(output_fd);
+        return EXIT_FAILURE;
     }
-    /*
-    bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
-    return 0 if success
-    return -1 if failed
-    */
+    std::cout << "Connection accepted\n";
 
-    if (listen(sockfd, MAX_PENDING_CONNECTIONS) == -1)
+    try
     {
-        std::cerr << "Failed to listen\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        TransferStats stats = receiveFile(client_socket, output_fd, direct);
+        trafficMetrics().bytesReceived.add(stats.bytes);
+        std::cout << "Received " << stats << "\n";
     }
-    /*
-    listen(int sockfd, int backlog)
-    return 0 if success
-    return -1 if failed
-    */
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        result = EXIT_FAILURE;
+    }
+    close(client_socket);
+    close(output_fd);
+    return result;
+}
 
-    sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    int client_socket = accept(sockfd, (sockaddr*)&client_addr, &client_addr_len);
+static int serveSingleClient(int sockfd, bool echo)
+{
+    SocketAddress client_addr;
+    socklen_t client_addr_len = SocketAddress::capacity();
+    int client_socket = accept(sockfd, client_addr.data(), &client_addr_len);
     if (client_socket == -1)
     {
         std::cerr << "Failed to accept connection\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
     /*
     accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
@@ -136,29 +418,723 @@ int main(int argc, char** argv)
     return client socket descriptor if success
     return -1 if failed
     */
-    std::cout << "Connection accepted\n";
+    LOG_INFO("Connection accepted from {}", client_addr.unmapped());
+    acceptedConnections.add();
+    openConnections.add(1);
 
+    // Frames are parsed in place, so recv() writes straight into the decoder's ring buffer
+    FrameDecoder decoder(FRAME_BUFFER_SIZE, MAX_FRAME_SIZE);
+    std::vector<char> outbox;
     while (true)
     {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        ssize_t bytes_received = recv(client_socket, decoder.writePointer(), decoder.writableBytes(), 0);
         if (bytes_received == -1)
         {
-            std::cerr << "Failed to receive message from client\n";
-            close(client_socket);
+            LOG_ERROR("Failed to receive message from client: {}", LogError{errno});
+            trafficMetrics().errors.add();
             break;
         }
         else if (bytes_received == 0)
         {
-            std::cout << "Client disconnected\n";
+            LOG_INFO("Client disconnected");
+            break;
+        }
+        decoder.commitWrite(bytes_received);
+        trafficMetrics().bytesReceived.add(bytes_received);
+
+        FrameStatus status = decoder.drain([client_socket, echo, &outbox](uint8_t type, std::string_view payload) {
+            trafficMetrics().packetsReceived.add();
+            if (echo)
+            {
+                appendFrame(outbox, type, payload);
+            }
+            else
+            {
+                printFrame(client_socket, type, payload);
+            }
+        });
+        if (status != FrameStatus::Ok)
+        {
+            LOG_WARNING("Closing connection: {}", frameError(status));
+            break;
+        }
+        if (!flushOutbox(client_socket, outbox))
+        {
+            LOG_ERROR("Failed to echo to client: {}", LogError{errno});
+            break;
+        }
+    }
+
+    close(client_socket); // Close client socket
+    openConnections.add(-1);
+    return EXIT_SUCCESS;
+}
+
+static void closeConnection(int epoll_fd, std::unordered_map<int, Connection>& connections, int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    if (connections.erase(fd) != 0)
+    {
+        openConnections.add(-1);
+    }
+}
+
+// Failing to set up one client's state closes that client only; the listen socket keeps accepting
+static bool addConnection(std::unordered_map<int, Connection>& connections, int fd, const SocketAddress& address,
+                          RingBufferPool& rings)
+{
+    try
+    {
+        connections.emplace(std::piecewise_construct, std::forward_as_tuple(fd),
+                            std::forward_as_tuple(fd, address, rings));
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR("Failed to set up client from {}: {}", address.unmapped(), e.what());
+        trafficMetrics().errors.add();
+        close(fd);
+        return false;
+    }
+}
+
+// Accept until EAGAIN: with EPOLLET the listen socket is only reported again when a new connection arrives
+static void acceptConnections(int epoll_fd, int sockfd, std::unordered_map<int, Connection>& connections,
+                              RingBufferPool& rings, bool echo)
+{
+    while (true)
+    {
+        SocketAddress client_addr;
+        socklen_t client_addr_len = SocketAddress::capacity();
+        int client_socket = accept4(sockfd, client_addr.data(), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_ERROR("Failed to accept connection: {}", LogError{errno});
+                trafficMetrics().errors.add();
+            }
+            return;
+        }
+        /*
+        accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+        Same as accept(), but SOCK_NONBLOCK is applied to the new socket without an extra fcntl() call
+        */
+
+        // The connection exists before epoll can report it
+        if (!addConnection(connections, client_socket, client_addr, rings))
+        {
+            continue;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        if (echo)
+        {
+            // Echoing also needs to know when a full send buffer has room again
+            event.events |= EPOLLOUT;
+        }
+        event.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1)
+        {
+            LOG_ERROR("Failed to add client to epoll: {}", LogError{errno});
+            trafficMetrics().errors.add();
+            connections.erase(client_socket);
             close(client_socket);
+            continue;
+        }
+        acceptedConnections.add();
+        openConnections.add(1);
+        LOG_INFO("Connection accepted from {} ({} open)", client_addr.unmapped(), connections.size());
+    }
+}
+
+// Drain until EAGAIN: with EPOLLET unread data does not trigger another event. Every connection of the loop
+// receives into the same scratch buffer (FRAME_BUFFER_SIZE bytes), where complete frames are parsed in place.
+static void readConnection(int epoll_fd, std::unordered_map<int, Connection>& connections, int fd, char* scratch,
+                           bool echo)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+    {
+        return;
+    }
+    Connection& connection = it->second;
+
+    while (true)
+    {
+        ssize_t bytes_received = recv(fd, scratch, FRAME_BUFFER_SIZE, 0);
+        if (bytes_received > 0)
+        {
+            connection.bytes_received += bytes_received;
+            trafficMetrics().bytesReceived.add(bytes_received);
+            FrameStatus status;
+            try
+            {
+                status = connection.decoder.feed(scratch, bytes_received,
+                                                 [fd, echo, &connection](uint8_t type, std::string_view payload) {
+                                                     trafficMetrics().packetsReceived.add();
+                                                     if (echo)
+                                                     {
+                                                         appendFrame(connection.outbox, type, payload);
+                                                     }
+                                                     else
+                                                     {
+                                                         printFrame(fd, type, payload);
+                                                     }
+                                                 });
+            }
+            catch (const std::exception& e)
+            {
+                // No ring for the partial frame: this connection cannot continue, the others can
+                LOG_ERROR("Closing client {}: {}", fd, e.what());
+                trafficMetrics().errors.add();
+                closeConnection(epoll_fd, connections, fd);
+                return;
+            }
+            if (status != FrameStatus::Ok)
+            {
+                LOG_WARNING("Closing client {}: {}", fd, frameError(status));
+                closeConnection(epoll_fd, connections, fd);
+                return;
+            }
+            // Whatever the socket does not take now goes out on the next EPOLLOUT
+            if (!flushOutbox(fd, connection.outbox))
+            {
+                LOG_ERROR("Failed to echo to client {}: {}", fd, LogError{errno});
+                closeConnection(epoll_fd, connections, fd);
+                return;
+            }
+            continue;
+        }
+        if (bytes_received == 0)
+        {
+            LOG_INFO("Client {} disconnected after {} bytes", fd, connection.bytes_received);
+            closeConnection(epoll_fd, connections, fd);
+            return;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG_ERROR("Failed to receive message from client {}: {}", fd, LogError{errno});
+            trafficMetrics().errors.add();
+            closeConnection(epoll_fd, connections, fd);
+            return;
+        }
+        trafficMetrics().wouldBlock.add();
+        return;
+    }
+}
+
+// EPOLLOUT: the send buffer has room again for echoed frames left over from readConnection()
+static void writeConnection(int epoll_fd, std::unordered_map<int, Connection>& connections, int fd)
+{
+    auto it = connections.find(fd);
+    if (it != connections.end() && !flushOutbox(fd, it->second.outbox))
+    {
+        LOG_ERROR("Failed to echo to client {}: {}", fd, LogError{errno});
+        closeConnection(epoll_fd, connections, fd);
+    }
+}
+
+// With stop_fd, the loop stops accepting once it turns readable, serves its open connections for up to drain_timeout
+// and returns EXIT_SUCCESS. With spin, it polls without ever sleeping and reports its busy and idle time.
+static int runEpollLoop(int sockfd, bool echo, int stop_fd = -1,
+                        std::chrono::seconds drain_timeout = std::chrono::seconds(0), bool spin = false)
+{
+    if (!setNonBlocking(sockfd))
+    {
+        std::cerr << "Failed to set O_NONBLOCK on listen socket\n";
+        return EXIT_FAILURE;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        std::cerr << "Failed to create epoll instance\n";
+        return EXIT_FAILURE;
+    }
+    /*
+    epoll_create1(int flags)
+    return epoll file descriptor if success
+    return -1 if failed
+    */
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = sockfd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &event) == -1)
+    {
+        std::cerr << "Failed to add listen socket to epoll\n";
+        close(epoll_fd);
+        return EXIT_FAILURE;
+    }
+    /*
+    epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+    op: EPOLL_CTL_ADD / EPOLL_CTL_MOD / EPOLL_CTL_DEL
+    events: EPOLLIN - Readable (new connection on a listen socket, data on a client socket)
+            EPOLLRDHUP - Peer closed its writing half
+            EPOLLET - Edge-triggered: report only state changes, so each fd must be drained until EAGAIN
+    */
+
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd;
+    if (stop_fd != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) == -1)
+    {
+        std::cerr << "Failed to add the hot restart event to epoll\n";
+        close(epoll_fd);
+        return EXIT_FAILURE;
+    }
+
+    // Declared before the connections, whose decoders return their rings to it
+    RingBufferPool rings(FRAME_BUFFER_SIZE, FRAME_RING_POOL_IDLE);
+    std::vector<char> scratch(FRAME_BUFFER_SIZE);
+    std::unordered_map<int, Connection> connections;
+    epoll_event events[MAX_EPOLL_EVENTS];
+    std::cout << "Waiting for connections (epoll)\n";
+
+    std::optional<SpinMeter> spin_meter;
+    auto next_spin_report = std::chrono::steady_clock::now() + std::chrono::milliseconds(SPIN_REPORT_INTERVAL_MS);
+    if (spin)
+    {
+        spin_meter.emplace();
+    }
+
+    bool draining = false;
+    auto drain_deadline = std::chrono::steady_clock::now();
+    while (!draining || (!connections.empty() && std::chrono::steady_clock::now() < drain_deadline))
+    {
+        int timeout_ms = spin ? 0 : -1;
+        if (draining)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(drain_deadline -
+                                                                                std::chrono::steady_clock::now());
+            timeout_ms = static_cast<int>(left.count()) + 1;
+        }
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout_ms);
+        /*
+        timeout 0 (spin): return at once with whatever is ready, so the thread never sleeps waiting for a wakeup
+        */
+        if (spin_meter)
+        {
+            auto now = spin_meter->poll(ready > 0);
+            if (now >= next_spin_report)
+            {
+                std::cerr << "Spin: " << spin_meter->take() << "\n";
+                next_spin_report = now + std::chrono::milliseconds(SPIN_REPORT_INTERVAL_MS);
+            }
+        }
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "Failed to wait for events: " << strerror(errno) << "\n";
             break;
         }
-        std::cout << "Message from client: " << buffer << "\n";
+
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == stop_fd)
+            {
+                // The next process accepts from the same queue now; this one only finishes what it has
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sockfd, nullptr);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, stop_fd, nullptr);
+                draining = true;
+                drain_deadline = std::chrono::steady_clock::now() + drain_timeout;
+                std::cout << "Stopped accepting, draining " << connections.size() << " connections\n";
+            }
+            else if (fd == sockfd)
+            {
+                acceptConnections(epoll_fd, sockfd, connections, rings, echo);
+            }
+            else if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                closeConnection(epoll_fd, connections, fd);
+            }
+            else
+            {
+                if (events[i].events & EPOLLOUT)
+                {
+                    writeConnection(epoll_fd, connections, fd);
+                }
+                // EPOLLRDHUP is handled by reading until recv() returns 0
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                {
+                    readConnection(epoll_fd, connections, fd, scratch.data(), echo);
+                }
+            }
+        }
+    }
+
+    if (draining && !connections.empty())
+    {
+        std::cout << "Drain timeout, closing " << connections.size() << " connections\n";
+    }
+    for (auto& entry : connections)
+    {
+        close(entry.first);
+    }
+    close(epoll_fd);
+    return draining ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#ifdef ENABLE_IO_URING
+enum : uint64_t
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV = 2
+};
+
+// user_data carries the operation in the upper 32 bits and the socket in the lower 32 bits
+static uint64_t uringUserData(uint64_t op, int fd)
+{
+    return (op << 32) | static_cast<uint32_t>(fd);
+}
+
+static void handleUringAccept(IoUring& ring, const io_uring_cqe& cqe, int sockfd,
+                              std::unordered_map<int, Connection>& connections, RingBufferPool& rings)
+{
+    if (cqe.res >= 0)
+    {
+        int client_socket = cqe.res;
+        SocketAddress client_addr;
+        socklen_t client_addr_len = SocketAddress::capacity();
+        getpeername(client_socket, client_addr.data(), &client_addr_len);
+        if (addConnection(connections, client_socket, client_addr, rings))
+        {
+            IoUring::prepareMultishotRecv(ring.getSqe(), client_socket, URING_BUFFER_GROUP,
+                                          uringUserData(URING_OP_RECV, client_socket));
+            acceptedConnections.add();
+            openConnections.add(1);
+            LOG_INFO("Connection accepted from {} ({} open)", client_addr.unmapped(), connections.size());
+        }
+    }
+    else
+    {
+        LOG_ERROR("Failed to accept connection: {}", LogError{-cqe.res});
+        trafficMetrics().errors.add();
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+    {
+        IoUring::prepareMultishotAccept(ring.getSqe(), sockfd, uringUserData(URING_OP_ACCEPT, sockfd));
+    }
+}
+
+static void handleUringRecv(IoUring& ring, ProvidedBufferRing& buffers, const io_uring_cqe& cqe, int fd,
+                            std::unordered_map<int, Connection>& connections)
+{
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    auto it = connections.find(fd);
+    if (it == connections.end())
+    {
+        return;
+    }
+    Connection& connection = it->second;
+
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t buffer_id = ProvidedBufferRing::bufferId(cqe);
+        connection.bytes_received += cqe.res;
+        trafficMetrics().bytesReceived.add(cqe.res);
+        // Complete frames are parsed inside the provided buffer; only a trailing partial frame is copied
+        FrameStatus status = FrameStatus::Ok;
+        try
+        {
+            status = connection.decoder.feed(buffers.buffer(buffer_id), cqe.res,
+                                             [fd](uint8_t type, std::string_view payload) {
+                                                 trafficMetrics().packetsReceived.add();
+                                                 printFrame(fd, type, payload);
+                                             });
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR("Closing client {}: {}", fd, e.what());
+            trafficMetrics().errors.add();
+            shutdown(fd, SHUT_RDWR);
+        }
+        buffers.recycle(buffer_id);
+        if (status != FrameStatus::Ok)
+        {
+            // shutdown() ends the multishot recv with EOF, whose completion closes the connection
+            LOG_WARNING("Closing client {}: {}", fd, frameError(status));
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    else if (cqe.res != -ENOBUFS)
+    {
+        // EOF and errors end the multishot request; only -ENOBUFS (buffer group exhausted) is retried
+        if (cqe.res == 0)
+        {
+            LOG_INFO("Client {} disconnected after {} bytes", fd, connection.bytes_received);
+        }
+        else
+        {
+            LOG_ERROR("Failed to receive message from client {}: {}", fd, LogError{-cqe.res});
+            trafficMetrics().errors.add();
+        }
+        close(fd);
+        connections.erase(fd);
+        openConnections.add(-1);
+        return;
+    }
+
+    if (!more)
+    {
+        IoUring::prepareMultishotRecv(ring.getSqe(), fd, URING_BUFFER_GROUP, uringUserData(URING_OP_RECV, fd));
+    }
+}
+
+static int runIoUringLoop(int sockfd)
+{
+    RingBufferPool rings(FRAME_BUFFER_SIZE, FRAME_RING_POOL_IDLE);
+    std::unordered_map<int, Connection> connections;
+    try
+    {
+        IoUring ring(URING_ENTRIES);
+        ProvidedBufferRing buffers(ring, URING_BUFFER_GROUP, URING_BUFFER_COUNT, BUFFER_SIZE);
+
+        IoUring::prepareMultishotAccept(ring.getSqe(), sockfd, uringUserData(URING_OP_ACCEPT, sockfd));
+        std::cout << "Waiting for connections (io_uring)\n";
+
+        while (true)
+        {
+            // One io_uring_enter submits every SQE queued while handling the previous batch of completions
+            if (ring.submitAndWait(1) < 0)
+            {
+                std::cerr << "Failed to submit to io_uring: " << strerror(errno) << "\n";
+                break;
+            }
+
+            ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+                uint64_t op = cqe.user_data >> 32;
+                int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+                if (op == URING_OP_ACCEPT)
+                {
+                    handleUringAccept(ring, cqe, sockfd, connections, rings);
+                }
+                else
+                {
+                    handleUringRecv(ring, buffers, cqe, fd, connections);
+                }
+            });
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+
+    for (auto& entry : connections)
+    {
+        close(entry.first);
+    }
+    return EXIT_FAILURE;
+}
+#endif
+
+static int runEventLoop(const ReceiverOptions& options, int sockfd, const HotRestart* restart = nullptr)
+{
+#ifdef ENABLE_IO_URING
+    if (options.mode == ReceiverMode::IoUring)
+    {
+        return runIoUringLoop(sockfd);
+    }
+#endif
+    return runEpollLoop(sockfd, options.echo, restart != nullptr ? restart->stopFd() : -1,
+                        options.restart.drainTimeout, options.spin.enabled());
+}
+
+// Create a TCP socket bound to SERVER_PORT and listening with the given backlog. It is an IPv6 socket on :: with
+// IPV6_V6ONLY off, so IPv4 senders reach it too (as ::ffff:a.b.c.d), unless the host has no IPv6. With restart, the
+// previous process's listen socket for the same worker is taken over instead, and offered to the next.
+static int createListenSocket(const ReceiverOptions& options, int worker = 0, HotRestart* restart = nullptr)
+{
+    /*
+    sockaddr_in6 for ::, port SERVER_PORT (sockaddr_in for 0.0.0.0 without IPv6)
+    sin6_family: Address Family, AF_INET6
+    sin6_port: Port number, in network byte order (Big Endian)
+    sin6_addr: IP address. 16 bytes. ::, like INADDR_ANY, allows all addresses
+    */
+
+    try
+    {
+        std::string tag = "tcp-listen " + std::to_string(worker);
+        Socket listen_socket = restart != nullptr ? restart->adopt(tag) : Socket();
+        if (listen_socket.fd() != -1)
+        {
+            // Bound and listening already, with its queue of connections; the backlog may have changed
+            listen_socket.apply(SocketOptions(options.socket).keepV6Only()).listen(options.backlog);
+            restart->offer(listen_socket.fd(), tag);
+            return listen_socket.release();
+        }
+
+        // socket() + setsockopt() + bind() + listen(); see net/socket.cpp
+        int family = AF_INET6;
+        try
+        {
+            listen_socket = Socket(family, SOCK_STREAM);
+        }
+        catch (const std::exception&)
+        {
+            family = AF_INET;
+            listen_socket = Socket(family, SOCK_STREAM);
+        }
+        listen_socket.apply(options.socket).bind(SocketAddress::any(family, SERVER_PORT)).listen(options.backlog);
+        if (restart != nullptr)
+        {
+            restart->offer(listen_socket.fd(), tag);
+        }
+        return listen_socket.release();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+}
+
+// Once every socket is offered: the previous process stops accepting, and this one answers the next
+static bool startHotRestart(HotRestart* restart)
+{
+    try
+    {
+        if (restart != nullptr)
+        {
+            restart->start();
+        }
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// Each worker owns a SO_REUSEPORT listen socket and an event loop (epoll unless --mode io_uring); the kernel hashes new connections across them
+static int runShardedWorkers(const ReceiverOptions& options, HotRestart* restart)
+{
+    unsigned int cpu_count = std::thread::hardware_concurrency();
+    if (cpu_count == 0)
+    {
+        cpu_count = 1;
+    }
+
+    // Bind every listen socket before starting the loops so no worker can miss connections hashed to a late bind
+    std::vector<int> listen_sockets;
+    for (int i = 0; i < options.workers; ++i)
+    {
+        int sockfd = createListenSocket(options, i, restart);
+        if (sockfd == -1)
+        {
+            for (int fd : listen_sockets)
+            {
+                close(fd);
+            }
+            return EXIT_FAILURE;
+        }
+        listen_sockets.push_back(sockfd);
+    }
+    if (!startHotRestart(restart))
+    {
+        for (int fd : listen_sockets)
+        {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.workers; ++i)
+    {
+        int cpu = options.cpus.empty() ? static_cast<int>(i % cpu_count) : options.cpus[i % options.cpus.size()];
+        int sockfd = listen_sockets[i];
+        // options outlives the workers: they are joined below
+        workers.emplace_back([i, cpu, sockfd, &options, restart]() {
+            if (!pinToCpu(cpu))
+            {
+                std::cerr << "Worker " << i << ": failed to pin to CPU " << cpu << "\n";
+            }
+            else
+            {
+                std::cout << "Worker " << i << " pinned to CPU " << cpu << "\n";
+            }
+            runEventLoop(options, sockfd, restart);
+        });
+    }
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    for (int fd : listen_sockets)
+    {
+        close(fd);
+    }
+    // The loops only return on their own once the sockets were handed over
+    return restart != nullptr && restart->stopped() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv)
+{
+    ReceiverOptions options = parseOptions(argc, argv);
+    options.log.apply();
+    // Takes the sockets over from a receiver running with the same path, before any of them is opened
+    std::unique_ptr<HotRestart> restart;
+    try
+    {
+        if (options.restart.enabled())
+        {
+            restart = std::make_unique<HotRestart>(options.restart.path);
+        }
+        options.metrics.apply(restart.get());
+        // Workers started from here inherit the SCHED_FIFO priority
+        options.spin.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.workers > 1)
+    {
+        return runShardedWorkers(options, restart.get());
+    }
+
+    int sockfd = createListenSocket(options, 0, restart.get());
+    if (sockfd == -1 || !startHotRestart(restart.get()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    int result;
+    if (options.mode == ReceiverMode::File)
+    {
+        result = receiveFileFromClient(sockfd, options.outputPath, options.direct);
+    }
+    else if (options.mode == ReceiverMode::Blocking)
+    {
+        result = serveSingleClient(sockfd, options.echo);
+    }
+    else
+    {
+        result = runEventLoop(options, sockfd, restart.get());
     }
 
     // Clean up
-    close(client_socket); // Close client socket
-    close(sockfd);        // Close server socket
-    return 0;
-}
\ No newline at end of file
+    close(sockfd); // Close server socket
+    return result;
+}
@@ -6,10 +6,28 @@
  * It creates a TCP socket, connects to a receiver, and sends/receives data
  * using stream-based communication. It showcases:
  * - TCP socket creation
- * - Connecting to a remote receiver
+ * - Connecting to a remote receiver over IPv4 or IPv6
  * - Sending and receiving data over a TCP connection
+ * - Length-prefixed framing so the receiver can split the byte stream back into messages
+ * - Sending through io_uring instead of send() (-DENABLE_IO_URING=ON)
+ * - Stream mode: a file or stdin is sent line by line from a non-blocking socket, with queued frames
+ *   coalesced into scatter-gather sendmsg calls, optional TCP_CORK/MSG_MORE and MSG_ZEROCOPY
+ * - File mode: a file is sent with sendfile(), straight from the page cache, and its throughput reported
+ * - Load mode: thousands of non-blocking connections over several threads and source addresses,
+ *   each sending requests at a fixed open-loop rate and timing the echoes (01-receiver --echo)
+ * - Socket options (TCP_NODELAY, buffer sizes, ...) from a config file or the command line
+ * - Per-message logging through the asynchronous logger (see net/logger.h)
+ * - Frame, byte and error counters served to Prometheus (--metrics-port, see net/metrics.h)
  * - Socket cleanup
  *
+ * Usage: 01-sender [--mode blocking|io_uring|stream|file|load] [--server IP[:PORT]|[IPV6]:PORT] [--input FILE]
+ *                  [--cork] [--msg-more] [--zerocopy] [--zerocopy-threshold BYTES]
+ *                  [--connections N] [--threads N] [--rate N] [--duration SECONDS] [--size BYTES]
+ *                  [--source-ips A.B.C.D[-A.B.C.D|,...]] [--source-ports FIRST-LAST] [--report FILE]
+ *                  [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                  [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                  [--metrics-port PORT [--metrics-address IP]]
+ *
  * @note Uses SOCK_STREAM socket type (TCP protocol)
  */
 
@@ -17,14 +35,30 @@
  * TCP Sender
  *
  */
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "net/bulk_transfer.h"
+#include "net/framing.h"
+#include "net/load_generator.h"
+#include "net/logger.h"
+#include "net/metrics.h"
+#include "net/socket.h"
+#include "net/stream_sender.h"
+#ifdef ENABLE_IO_URING
+#include "net/io_uring.h"
+#endif
+
 #define SERVER_ADDRESS "127.0.0.1"
 #define SERVER_PORT 8080
 #define BUFFER_SIZE 1024
@@ -33,92 +67,359 @@
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
 #define EXIT_COMMAND "exit"
+#define URING_ENTRIES 8
 
-int main(int argc, char** argv)
+enum class SenderMode
 {
-    int sockfd;
-    struct sockaddr_in client_addr;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
+    Blocking,
+    IoUring,
+    Stream,
+    File,
+    Load
+};
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1)
+// "IP", "IP:PORT", "IPV6" or "[IPV6]:PORT"; the port defaults to SERVER_PORT
+static bool parseServer(const std::string& text, SocketAddress& server)
+{
+    try
     {
-        std::cerr << "Failed to create socket\n";
-        exit(EXIT_FAILURE);
+        // A bare IPv6 address has several colons, an IPv4 address with a port exactly one
+        size_t colons = std::count(text.begin(), text.end(), ':');
+        server = text[0] == '[' || colons == 1 ? SocketAddress::parse(text) : SocketAddress::parse(text, SERVER_PORT);
     }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    return server.port() != 0;
+}
 
-    int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+static SenderMode parseOptions(int argc, char** argv, SocketOptions& socketOptions, StreamSenderOptions& streamOptions,
+                               LoadOptions& loadOptions, LogOptions& logOptions, MetricsOptions& metricsOptions,
+                               SocketAddress& server, std::string& inputPath)
+{
+    SenderMode mode = SenderMode::Blocking;
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Failed to set socket options\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        try
+        {
+            if (socketOptions.parseArgument(argc, argv, i) || streamOptions.parseArgument(argc, argv, i) ||
+                loadOptions.parseArgument(argc, argv, i) || logOptions.parseArgument(argc, argv, i) ||
+                metricsOptions.parseArgument(argc, argv, i))
+            {
+                continue;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        }
+
+        std::string arg = argv[i];
+        if (arg == "--mode" && i + 1 < argc && std::string(argv[i + 1]) == "blocking")
+        {
+            mode = SenderMode::Blocking;
+            ++i;
+        }
+        else if (arg == "--mode" && i + 1 < argc && std::string(argv[i + 1]) == "io_uring")
+        {
+#ifdef ENABLE_IO_URING
+            mode = SenderMode::IoUring;
+            ++i;
+#else
+            std::cerr << "Built without io_uring support (configure with -DENABLE_IO_URING=ON)\n";
+            exit(EXIT_FAILURE);
+#endif
+        }
+        else if (arg == "--mode" && i + 1 < argc && std::string(argv[i + 1]) == "stream")
+        {
+            mode = SenderMode::Stream;
+            ++i;
+        }
+        else if (arg == "--mode" && i + 1 < argc && std::string(argv[i + 1]) == "file")
+        {
+            mode = SenderMode::File;
+            ++i;
+        }
+        else if (arg == "--mode" && i + 1 < argc && std::string(argv[i + 1]) == "load")
+        {
+            mode = SenderMode::Load;
+            ++i;
+        }
+        else if (arg == "--server" && i + 1 < argc && parseServer(argv[i + 1], server))
+        {
+            ++i;
+        }
+        else if (arg == "--input" && i + 1 < argc)
+        {
+            inputPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--mode blocking|io_uring|stream|file|load]"
+                      << " [--server IP[:PORT]|[IPV6]:PORT] [--input FILE]\n       "
+                      << StreamSenderOptions::usage() << "\n       " << LoadOptions::usage() << "\n       "
+                      << SocketOptions::usage() << "\n       " << LogOptions::usage() << " "
+                      << MetricsOptions::usage() << "\n";
+            exit(EXIT_FAILURE);
+        }
     }
-    opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    return mode;
+}
+
+#ifdef ENABLE_IO_URING
+// Queue an IORING_OP_SEND and reap its completion; submission and wait share one io_uring_enter call
+static ssize_t sendWithIoUring(IoUring& ring, int sockfd, const char* buffer, size_t length)
+{
+    IoUring::prepareSend(ring.getSqe(), sockfd, buffer, length, 0, 0);
+    if (ring.submitAndWait(1) < 0)
     {
-        std::cerr << "Failed to set socket options\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        return -1;
+    }
+
+    ssize_t result = -1;
+    ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+        result = cqe.res;
+        if (cqe.res < 0)
+        {
+            errno = -cqe.res;
+            result = -1;
+        }
+    });
+    return result;
+}
+#endif
+
+// Send the whole input as one frame per line and report how it went out
+static int sendStream(int sockfd, const StreamSenderOptions& options, const std::string& input_path)
+{
+    int input_fd = input_path.empty() ? STDIN_FILENO : open(input_path.c_str(), O_RDONLY);
+    if (input_fd == -1)
+    {
+        std::cerr << "Failed to open " << input_path << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        StreamSender sender(sockfd, options);
+        sender.send(input_fd);
+
+        const StreamSenderStats& stats = sender.stats();
+        std::cout << "Sent " << stats.frames << " frames (" << stats.bytes << " bytes) in " << stats.sendCalls
+                  << " sendmsg calls, " << stats.partialSends << " partial, " << stats.wouldBlock << " EAGAIN";
+        if (options.zeroCopy)
+        {
+            std::cout << ", " << stats.zeroCopySends << " zero-copy (" << stats.zeroCopyCopied
+                      << " copied by the kernel)";
+        }
+        std::cout << "\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
     }
-    /*
-    Set the socket option to reuse the address and port immediately after the program exits
 
-    setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
-    level: SOL_SOCKET: socket layer
-    optname: SO_REUSEADDR - Reuse the address immediately after the program exits
-             SO_REUSEPORT - Reuse the port immediately after the program exits
-    */
+    if (input_fd != STDIN_FILENO)
+    {
+        close(input_fd);
+    }
+    return EXIT_SUCCESS;
+}
 
-    client_addr.sin_family = AF_INET;
-    client_addr.sin_port = htons(ANY_PORT);   // ANY PORT
-    client_addr.sin_addr.s_addr = INADDR_ANY; // ANY IP
-    if (bind(sockfd, (struct sockaddr*)&client_addr, sizeof(client_addr)) == -1)
+// Send the input file with sendfile() and report the throughput
+static int sendWholeFile(int sockfd, const std::string& input_path)
+{
+    if (input_path.empty())
     {
-        std::cerr << "Failed to bind socket\n";
-        close(sockfd);
+        std::cerr << "--mode file needs --input FILE\n";
+        return EXIT_FAILURE;
+    }
+    int input_fd = open(input_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input_fd == -1)
+    {
+        std::cerr << "Failed to open " << input_path << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    try
+    {
+        TransferStats stats = sendFile(sockfd, input_fd);
+        trafficMetrics().bytesSent.add(stats.bytes);
+        std::cout << "Sent " << stats << "\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        result = EXIT_FAILURE;
+    }
+    close(input_fd);
+    return result;
+}
+
+// Open every connection, run the load and print the summary; progress goes to stderr once per second
+static int runLoadMode(const LoadOptions& options, const SocketOptions& socket_options)
+{
+    try
+    {
+        LoadReport report = runLoad(options, socket_options, [](const LoadProgress& progress) {
+            std::cerr << progress.elapsed.count() << "s: " << progress.connected << " connected, " << progress.failed
+                      << " failed, " << progress.sent << " sent, " << progress.received << " received\n";
+        });
+        std::cout << report;
+        if (!options.reportPath.empty())
+        {
+            report.writeCsv(options.reportPath);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    SocketAddress server_addr;
+    char buffer[BUFFER_SIZE];
+    SocketOptions socket_options =
+        SocketOptions().reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR).reusePort(SOCKET_OPTION_ENABLE_REUSEPORT);
+    StreamSenderOptions stream_options;
+    LoadOptions load_options;
+    LogOptions log_options;
+    MetricsOptions metrics_options;
+    std::string input_path;
+    parseServer(SERVER_ADDRESS, server_addr);
+    SenderMode mode = parseOptions(argc, argv, socket_options, stream_options, load_options, log_options,
+                                   metrics_options, server_addr, input_path);
+    log_options.apply();
+    try
+    {
+        metrics_options.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
         exit(EXIT_FAILURE);
     }
+    if (mode == SenderMode::Load)
+    {
+        load_options.server = server_addr;
+        return runLoadMode(load_options, socket_options);
+    }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = inet_addr(SERVER_ADDRESS);
+    // ANY IP, ANY PORT, of the server's family
+    SocketAddress client_addr = SocketAddress::any(server_addr.family(), ANY_PORT);
 
-    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1)
+    // socket() + setsockopt() + bind() + connect(); see net/socket.cpp
+    Socket client_socket;
+    try
     {
-        std::cerr << "Failed to connect to server\n";
-        close(sockfd);
+        client_socket = Socket(server_addr.family(), SOCK_STREAM);
+        client_socket.apply(socket_options).bind(client_addr).connect(server_addr);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
         exit(EXIT_FAILURE);
     }
+    int sockfd = client_socket.fd();
     std::cout << "Connected to server\n";
 
+    if (mode == SenderMode::Stream)
+    {
+        return sendStream(sockfd, stream_options, input_path);
+    }
+    if (mode == SenderMode::File)
+    {
+        return sendWholeFile(sockfd, input_path);
+    }
+
+#ifdef ENABLE_IO_URING
+    std::unique_ptr<IoUring> ring;
+    if (mode == SenderMode::IoUring)
+    {
+        try
+        {
+            ring = std::make_unique<IoUring>(URING_ENTRIES);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+
     while (true)
     {
-        memset(buffer, 0, sizeof(buffer));
-        std::cout << "Enter message to send to server: ";
-        std::cin >> buffer;
+        // The payload is read after room for the largest header, which is then written just in front of it
+        char* payload = buffer + FRAME_MAX_HEADER_SIZE;
+        Logger::instance().flush(); // So the prompt comes after the previous message's log lines
+        std::cout << "Enter message to send to server: " << std::flush;
+        // C++20 dropped operator>> into a char*; a width on a std::string limits the characters read the same way
+        std::string word;
+        if (!(std::cin >> std::setw(BUFFER_SIZE - FRAME_MAX_HEADER_SIZE - 1) >> word))
+        {
+            break;
+        }
+        memcpy(payload, word.c_str(), word.size() + 1);
 
-        if (strcmp(buffer, EXIT_COMMAND) == 0)
+        if (strcmp(payload, EXIT_COMMAND) == 0)
         {
             break;
         }
 
-        int bytes_sent = send(sockfd, buffer, strlen(buffer), 0);
-        std::cout << "Bytes sent: " << bytes_sent << "\n";
+        size_t payload_length = strlen(payload);
+        char header[FRAME_MAX_HEADER_SIZE];
+        size_t header_length = encodeFrameHeader(FRAME_TYPE_TEXT, payload_length, header);
+        char* frame = payload - header_length;
+        memcpy(frame, header, header_length);
+        size_t frame_length = header_length + payload_length;
+
+        // send() may accept only part of the frame; keep going so the receiver never sees a torn frame
+        size_t frame_sent = 0;
+        ssize_t bytes_sent = 0;
+        while (frame_sent < frame_length)
+        {
+#ifdef ENABLE_IO_URING
+            if (ring)
+            {
+                bytes_sent = sendWithIoUring(*ring, sockfd, frame + frame_sent, frame_length - frame_sent);
+            }
+            else
+#endif
+            {
+                bytes_sent = send(sockfd, frame + frame_sent, frame_length - frame_sent, 0);
+            }
+            if (bytes_sent <= 0)
+            {
+                break;
+            }
+            frame_sent += bytes_sent;
+        }
+
+        LOG_INFO("Bytes sent: {}", frame_sent);
+        trafficMetrics().bytesSent.add(frame_sent);
         if (bytes_sent == -1)
         {
-            std::cerr << "Failed to send message to server\n";
+            LOG_ERROR("Failed to send message to server: {}", LogError{errno});
+            trafficMetrics().errors.add();
             break;
         }
         else if (bytes_sent == 0)
         {
-            std::cout << "Server closed the connection\n";
+            LOG_INFO("Server closed the connection");
             break;
         }
+        trafficMetrics().packetsSent.add();
     }
 
-    // Clean up
-    close(sockfd);
+    // The socket is closed when client_socket goes out of scope
     return 0;
 }
\ No newline at end of file
@@ -7,25 +7,72 @@
  * the 'ping' utility. It showcases:
  * - Raw socket creation for ICMP
  * - ICMP packet construction
- * - Calculating checksums for network packets
+ * - Calculating checksums for network packets, patched incrementally (RFC 1624) when only the sequence changes
  * - Sending ICMP echo requests
  * - Receiving and processing ICMP echo replies
  * - Network diagnostics and round-trip time measurement
+ * - Socket options (buffer sizes, IP_TOS, ...) from a config file or the command line
+ * - Probing thousands of hosts at a fixed packet rate: replies are matched asynchronously against an
+ *   in-flight table keyed by (destination, id, sequence) and timeouts expire on a hierarchical timer wheel
+ * - Requests paced from an absolute timerfd schedule instead of sleep_for(), optionally with SO_TXTIME
+ *   launch times (see net/pacer.h)
+ * - RTT from kernel (or NIC) TX and RX timestamps (SO_TIMESTAMPING) instead of clock reads around
+ *   sendto/recvfrom, so scheduler wakeups and reply matching are not counted
+ * - Per-reply logging through the asynchronous logger (see net/logger.h)
+ * - Request, reply and timeout counters and an RTT histogram served to Prometheus (--metrics-port)
+ * - A classic BPF filter (SO_ATTACH_FILTER) on the raw socket that only lets echo replies carrying our
+ *   identifier through, so other processes' ICMP traffic is dropped in the kernel without a wakeup
+ * - Unprivileged ping sockets (--socket dgram): SOCK_DGRAM/IPPROTO_ICMP, where the kernel assigns the
+ *   identifier, fills in the checksum and hands each socket only the replies to its own requests
+ * - ICMPv6 echo (types 128/129) to IPv6 targets: the kernel computes the checksum over the IPv6
+ *   pseudo header, delivers no IP header, reports the hop limit as IPV6_HOPLIMIT and filters by type
+ *   with ICMP6_FILTER
+ *
+ * Usage: 02-icmp [--socket raw|dgram] [--target ADDRESS | --targets FILE [--count N] [--timeout MS]]
+ *                [--rate PPS [--burst N] [--jitter-us US] [--txtime fq|etf]]
+ *                [--timestamps none|software|hardware] [--timestamp-interface IFACE]
+ *                [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                [--metrics-port PORT [--metrics-address IP]]
+ *        Without --targets, pings ADDRESS (GOOGLE_DNS by default) once per second (or at --rate). FILE holds
+ *        one address per line, all IPv4 or all IPv6; targets are probed at PROBE_DEFAULT_RATE unless --rate
+ *        is given.
+ *        Software timestamps are used by default; with none, RTT is measured in userspace.
  *
  * @note Uses raw sockets which typically require root/administrator privileges
+ * @note --socket dgram needs no privileges, but the user's group must be in sysctl net.ipv4.ping_group_range
  */
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <netinet/icmp6.h>
 #include <netinet/in.h>
 #include <netinet/ip_icmp.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "net/checksum.h"
+#include "net/datagram_batch.h"
+#include "net/logger.h"
+#include "net/metrics.h"
+#include "net/pacer.h"
+#include "net/socket.h"
+#include "net/socket_address.h"
+#include "net/socket_filter.h"
+#include "net/timer_wheel.h"
+#include "net/timestamping.h"
 
 #define GOOGLE_DNS "8.8.8.8"
 #define PACKET_SIZE 56
@@ -35,66 +82,613 @@
 #define ADDRESS "127.0.0.1"
 #define PORT 8080
 
-// Function to calculate ICMP checksum
-unsigned short calculate_checksum(void* b, int len)
+#define PING_DEFAULT_RATE 1     // packets per second without --targets
+#define PROBE_DEFAULT_RATE 1000 // packets per second
+#define PROBE_DEFAULT_COUNT 3   // echo requests per host
+#define PROBE_RECEIVE_BATCH 64
+#define PROBE_SEND_BATCH 64     // Most requests one pacer wakeup releases
+#define PROBE_TIMER_TICK_MS 1
+
+static Histogram& rttHistogram = Metrics::instance().histogram("icmp_rtt_seconds", "Echo request to reply time");
+static Counter& timeoutCount =
+    Metrics::instance().counter("icmp_timeouts_total", "Echo requests without a reply in time");
+
+enum class IcmpSocketType
+{
+    Raw,     // SOCK_RAW: needs CAP_NET_RAW, receives whole IP packets
+    Datagram // SOCK_DGRAM ping socket: unprivileged, receives the ICMP message only
+};
+
+struct ProbeOptions
+{
+    IcmpSocketType socketType = IcmpSocketType::Raw;
+    std::string target = GOOGLE_DNS; // Without --targets
+    std::string targetsFile;
+    PacingOptions pacing; // Rate PING_DEFAULT_RATE or PROBE_DEFAULT_RATE unless --rate is given
+    unsigned count = PROBE_DEFAULT_COUNT;
+    unsigned timeoutMs = MAX_WAIT_TIME;
+    TimestampOptions timestamps;
+};
+
+struct HostStats
+{
+    SocketAddress address;
+    unsigned sent = 0;
+    unsigned received = 0;
+    double minRttMs = 0.0;
+    double maxRttMs = 0.0;
+    double sumRttMs = 0.0;
+    double sumSquaresRttMs = 0.0;
+};
+
+// ICMP and ICMPv6 echo messages share a header layout (type, code, checksum, identifier, sequence); only the
+// types differ. The ICMPv6 checksum covers an IPv6 pseudo header, so the kernel computes and verifies it.
+static_assert(sizeof(icmp6_hdr) == sizeof(icmphdr) &&
+              offsetof(icmp6_hdr, icmp6_seq) == offsetof(icmphdr, un.echo.sequence));
+
+static uint8_t echoRequestType(int family)
+{
+    return family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+}
+
+static uint8_t echoReplyType(int family)
 {
-    unsigned short* buf = (unsigned short*)b;
-    unsigned int sum = 0;
-    unsigned short result;
+    return family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY;
+}
+
+/**
+ * Sends echo requests round-robin over all targets at a fixed rate from one non-blocking raw socket.
+ * Every request in flight is kept in a hash table keyed by (destination, id, sequence); replies are
+ * drained with recvmmsg between sends and matched against it, and a timer wheel expires the requests
+ * whose reply did not arrive within the timeout. A Pacer releases the requests and wakes poll() through its
+ * timerfd when the next ones are due.
+ */
+class IcmpProber
+{
+public:
+    IcmpProber(int sockFd, uint16_t identifier, std::vector<SocketAddress> targets, const ProbeOptions& options)
+        : m_sockFd(sockFd), m_family(targets.empty() ? AF_INET : targets[0].family()), m_options(options),
+          m_identifier(identifier), m_nextSequence(0), m_transmitKey(0),
+          m_pacer(options.pacing), m_timeouts(std::chrono::milliseconds(PROBE_TIMER_TICK_MS)),
+          m_replies(sockFd, PROBE_RECEIVE_BATCH, BUFFER_SIZE)
+    {
+        m_pacer.enableTxTime(sockFd);
+        m_hosts.resize(targets.size());
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            m_hosts[i].address = targets[i];
+        }
+        m_inFlight.reserve(static_cast<size_t>(options.pacing.rate * options.timeoutMs / 1000) + 1);
+
+        // Build the echo request once; each send only changes the sequence number
+        struct icmphdr* header = (struct icmphdr*)m_packet;
+        header->type = echoRequestType(m_family);
+        header->code = 0;
+        header->un.echo.id = m_identifier;
+        header->un.echo.sequence = 0;
+        for (size_t i = sizeof(struct icmphdr); i < sizeof(m_packet); i++)
+        {
+            m_packet[i] = i % 256;
+        }
+        header->checksum = 0;
+        header->checksum = internetChecksum(m_packet, sizeof(m_packet));
+    }
+
+    void run()
+    {
+        uint64_t total = static_cast<uint64_t>(m_hosts.size()) * m_options.count;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t sent = 0;
+
+        while (sent < total || !m_inFlight.empty())
+        {
+            // Send every request that is due; the schedule is absolute so a slow iteration does not lower the rate
+            if (sent < total)
+            {
+                uint64_t ready = std::min<uint64_t>(total - sent, PROBE_SEND_BATCH);
+                unsigned released = m_pacer.take(static_cast<unsigned>(ready));
+                auto now = std::chrono::steady_clock::now();
+                for (unsigned i = 0; i < released; ++i, ++sent)
+                {
+                    sendProbe(sent % m_hosts.size(), now, m_pacer.launchTimeNs(i));
+                }
+            }
 
-    for (sum = 0; len > 1; len -= 2)
+            // TX timestamps first: on a fast path the reply is queued as soon as the request has left
+            receiveTransmitTimestamps();
+            receiveReplies();
+            auto expire = [this](uint64_t key) {
+                auto flight = m_inFlight.find(key);
+                if (flight != m_inFlight.end())
+                {
+                    timeoutCount.add();
+                }
+                forget(flight);
+            };
+            m_timeouts.advance(std::chrono::steady_clock::now(), expire);
+
+            if (sent == total && m_inFlight.empty())
+            {
+                break; // Every reply is in: the pending timeouts are stale
+            }
+
+            // Sleep in poll() until the next send (the pacer's timer), timeout or reply
+            int timeoutMs = -1;
+            if (m_timeouts.size() > 0)
+            {
+                auto delay = std::chrono::ceil<std::chrono::milliseconds>(m_timeouts.nextExpiry() -
+                                                                          std::chrono::steady_clock::now());
+                timeoutMs = delay.count() > 0 ? static_cast<int>(delay.count()) : 0;
+            }
+            pollfd descriptors[2] = {{m_sockFd, POLLIN, 0}, {sent < total ? m_pacer.fd() : -1, POLLIN, 0}};
+            poll(descriptors, 2, timeoutMs);
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printReport(elapsed);
+        std::cout << "Pacing: " << m_pacer.stats() << std::endl;
+    }
+
+private:
+    struct InFlight
     {
-        sum += *buf++;
+        size_t host;
+        uint32_t transmitKey;  // SOF_TIMESTAMPING_OPT_ID of the send
+        PacketTimestamps sent; // Userspace send time until the kernel TX timestamp arrives
+    };
+
+    int m_sockFd;
+    int m_family; // Of every target and the socket
+    ProbeOptions m_options;
+    uint16_t m_identifier;
+    uint16_t m_nextSequence;
+    uint32_t m_transmitKey; // The kernel numbers timestamped sends from 0 in the same order
+    std::unordered_map<uint32_t, uint64_t> m_transmits; // TX timestamp key -> in-flight key
+    char m_packet[PACKET_SIZE + sizeof(struct icmphdr)];
+    std::vector<HostStats> m_hosts;
+    std::unordered_map<uint64_t, InFlight> m_inFlight;
+    Pacer m_pacer;
+    HierarchicalTimerWheel<uint64_t> m_timeouts;
+    DatagramBatch m_replies;
+
+    static uint64_t flightKey(uint32_t destination, uint16_t identifier, uint16_t sequence)
+    {
+        return static_cast<uint64_t>(destination) << 32 | static_cast<uint64_t>(identifier) << 16 | sequence;
     }
-    if (len == 1)
+
+    // The IPv4 address itself, or the four words of an IPv6 address folded into one. Folded addresses can
+    // collide, so a reply is also checked against the address of the host it matched.
+    static uint32_t destinationKey(const SocketAddress& address)
     {
-        sum += *(unsigned char*)buf;
+        if (!address.isIpv6())
+        {
+            return address.ipv4().sin_addr.s_addr;
+        }
+        const uint32_t* words = address.ipv6().sin6_addr.s6_addr32;
+        return words[0] ^ words[1] ^ words[2] ^ words[3];
     }
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
-    result = ~sum;
-    return result;
+
+    void sendProbe(size_t host, std::chrono::steady_clock::time_point now, uint64_t launchTimeNs)
+    {
+        struct icmphdr* header = (struct icmphdr*)m_packet;
+        uint16_t sequence = m_nextSequence++;
+        if (m_family == AF_INET)
+        {
+            header->checksum = checksumUpdate16(header->checksum, header->un.echo.sequence, sequence);
+        }
+        header->un.echo.sequence = sequence;
+
+        HostStats& stats = m_hosts[host];
+        ++stats.sent;
+        struct iovec iov = {m_packet, sizeof(m_packet)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = stats.address.data();
+        msg.msg_namelen = stats.address.size();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[TXTIME_CONTROL_SIZE];
+        if (launchTimeNs != 0)
+        {
+            setLaunchTime(msg, control, launchTimeNs);
+        }
+        if (sendmsg(m_sockFd, &msg, 0) <= 0)
+        {
+            trafficMetrics().errors.add();
+            return; // Counted as lost
+        }
+        trafficMetrics().packetsSent.add();
+        trafficMetrics().bytesSent.add(sizeof(m_packet));
+
+        // A sequence number reused while its previous request is still in flight replaces the old entry
+        uint64_t key = flightKey(destinationKey(stats.address), m_identifier, header->un.echo.sequence);
+        PacketTimestamps sentAt;
+        sentAt.softwareNs = realtimeNs();
+        forget(m_inFlight.find(key));
+        m_inFlight[key] = InFlight{host, m_transmitKey, sentAt};
+        if (m_options.timestamps.transmit)
+        {
+            m_transmits[m_transmitKey] = key;
+        }
+        ++m_transmitKey;
+        m_timeouts.schedule(now + std::chrono::milliseconds(m_options.timeoutMs), key);
+    }
+
+    void forget(std::unordered_map<uint64_t, InFlight>::iterator flight)
+    {
+        if (flight != m_inFlight.end())
+        {
+            m_transmits.erase(flight->second.transmitKey);
+            m_inFlight.erase(flight);
+        }
+    }
+
+    void receiveTransmitTimestamps()
+    {
+        uint32_t transmitKey;
+        PacketTimestamps timestamps;
+        while (m_options.timestamps.transmit && readTransmitTimestamp(m_sockFd, transmitKey, timestamps))
+        {
+            auto transmit = m_transmits.find(transmitKey);
+            auto flight = transmit != m_transmits.end() ? m_inFlight.find(transmit->second) : m_inFlight.end();
+            if (flight != m_inFlight.end())
+            {
+                flight->second.sent.merge(timestamps);
+            }
+        }
+    }
+
+    void receiveReplies()
+    {
+        while (true)
+        {
+            int count = m_replies.receive(MSG_DONTWAIT);
+            if (count <= 0)
+            {
+                return;
+            }
+            int64_t now = realtimeNs();
+            for (int i = 0; i < count; ++i)
+            {
+                const Datagram& datagram = m_replies.datagrams()[i];
+                PacketTimestamps received = datagram.timestamps;
+                received.softwareNs = received.softwareNs != 0 ? received.softwareNs : now;
+                handleReply(const_cast<char*>(datagram.data), datagram.length, *datagram.sender, received);
+            }
+        }
+    }
+
+    void handleReply(char* packet, size_t length, const SocketAddress& source, const PacketTimestamps& received)
+    {
+        // A ping socket, and any ICMPv6 socket, delivers the ICMP message without the IP header
+        size_t ip_header_length = 0;
+        if (m_options.socketType == IcmpSocketType::Raw && m_family == AF_INET)
+        {
+            if (length < sizeof(struct iphdr))
+            {
+                return;
+            }
+            ip_header_length = ((struct iphdr*)packet)->ihl * 4;
+        }
+        if (length < ip_header_length + sizeof(struct icmphdr))
+        {
+            return;
+        }
+        struct icmphdr* reply = (struct icmphdr*)(packet + ip_header_length);
+        if (reply->type != echoReplyType(m_family) || reply->un.echo.id != m_identifier)
+        {
+            return;
+        }
+
+        auto flight = m_inFlight.find(flightKey(destinationKey(source), reply->un.echo.id, reply->un.echo.sequence));
+        if (flight == m_inFlight.end())
+        {
+            return; // Late reply to a request that already timed out, or a duplicate
+        }
+        HostStats& stats = m_hosts[flight->second.host];
+        if (m_family == AF_INET6 &&
+            memcmp(&source.ipv6().sin6_addr, &stats.address.ipv6().sin6_addr, sizeof(in6_addr)) != 0)
+        {
+            return;
+        }
+
+        // Summing a packet together with its checksum gives 0 when it is intact (the kernel checked ICMPv6)
+        if (m_family == AF_INET && internetChecksum(reply, length - ip_header_length) != 0)
+        {
+            return;
+        }
+
+        int64_t rttNs = elapsedNs(flight->second.sent, received);
+        rttHistogram.record(rttNs > 0 ? rttNs : 0);
+        double rtt = rttNs / 1000000.0;
+        stats.minRttMs = stats.received == 0 ? rtt : std::min(stats.minRttMs, rtt);
+        stats.maxRttMs = std::max(stats.maxRttMs, rtt);
+        stats.sumRttMs += rtt;
+        stats.sumSquaresRttMs += rtt * rtt;
+        ++stats.received;
+        forget(flight);
+    }
+
+    void printReport(double elapsedSeconds) const
+    {
+        size_t reachable = 0;
+        std::cout << std::fixed << std::setprecision(3);
+        for (const HostStats& stats : m_hosts)
+        {
+            std::cout << stats.address.host() << ": " << stats.sent << " sent, " << stats.received
+                      << " received, " << std::setprecision(1)
+                      << (stats.sent ? 100.0 * (stats.sent - stats.received) / stats.sent : 0.0) << "% loss"
+                      << std::setprecision(3);
+            if (stats.received > 0)
+            {
+                double average = stats.sumRttMs / stats.received;
+                double deviation = std::sqrt(std::max(0.0, stats.sumSquaresRttMs / stats.received - average * average));
+                std::cout << ", rtt min/avg/max/mdev = " << stats.minRttMs << "/" << average << "/" << stats.maxRttMs
+                          << "/" << deviation << " ms";
+                ++reachable;
+            }
+            std::cout << "\n";
+        }
+        std::cout << reachable << " of " << m_hosts.size() << " hosts reachable, probed in " << elapsedSeconds
+                  << " s" << std::endl;
+    }
+};
+
+// One socket serves either family, so the list may not mix them
+static std::vector<SocketAddress> loadTargets(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open target list " + path + ": " + std::string(strerror(errno)));
+    }
+
+    std::vector<SocketAddress> targets;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty())
+        {
+            continue;
+        }
+
+        // Port is not needed for ICMP - Only IP address is needed
+        SocketAddress target = SocketAddress::parse(line, 0);
+        if (!targets.empty() && target.family() != targets[0].family())
+        {
+            throw std::runtime_error("Target " + line + " is not of the same address family as " +
+                                     targets[0].host() + "; probe IPv4 and IPv6 hosts in separate runs");
+        }
+        targets.push_back(target);
+    }
+    return targets;
+}
+
+// Accepts echo replies whose identifier is ours and drops every other ICMP message. On a raw IP socket the
+// program sees the packet from the IP header on.
+static SocketFilter echoReplyFilter(uint16_t identifier)
+{
+    SocketFilter filter;
+    filter.statement(BPF_LDX | BPF_B | BPF_MSH, 0)                                         // X = IP header length
+        .statement(BPF_LD | BPF_B | BPF_IND, offsetof(struct icmphdr, type))               // A = ICMP type
+        .jump(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 3)
+        .statement(BPF_LD | BPF_H | BPF_IND, offsetof(struct icmphdr, un.echo.id))         // A = identifier
+        .jump(BPF_JMP | BPF_JEQ | BPF_K, ntohs(identifier), 0, 1)                          // Loads are big-endian
+        .statement(BPF_RET | BPF_K, SOCKET_FILTER_ACCEPT)
+        .statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    return filter;
+}
+
+// ICMPv6 sockets see every ICMPv6 message, neighbour discovery included, so only echo replies are let through.
+// The identifier is still checked by hand: unlike a BPF program, ICMP6_FILTER only looks at the type.
+static void passEchoRepliesOnly(int fd)
+{
+    icmp6_filter filter;
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+    if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) == -1)
+    {
+        throw std::runtime_error("Failed to set ICMP6_FILTER: " + std::string(strerror(errno)));
+    }
+    /*
+    ICMP6_FILTER: A 256-bit mask of the ICMPv6 types a raw ICMPv6 socket receives (RFC 3542),
+    applied by the kernel before the message is queued
+    */
+}
+
+static Socket openIcmpSocket(IcmpSocketType type, int family)
+{
+    int protocol = family == AF_INET6 ? static_cast<int>(IPPROTO_ICMPV6) : static_cast<int>(IPPROTO_ICMP);
+    if (type == IcmpSocketType::Raw)
+    {
+        return Socket(family, SOCK_RAW, protocol);
+    }
+    /*
+    socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)
+    A ping socket: only echo requests can be sent, and the kernel replaces their identifier
+    with the socket's own (its "port", chosen at bind time) and computes the checksum.
+    Replies are demultiplexed by that identifier, so the socket never sees anything else.
+    Allowed for the groups in net.ipv4.ping_group_range, no CAP_NET_RAW needed.
+    */
+    try
+    {
+        return Socket(family, SOCK_DGRAM, protocol);
+    }
+    catch (const std::runtime_error& e)
+    {
+        throw std::runtime_error(std::string(e.what()) + " (is the group in net.ipv4.ping_group_range?)");
+    }
+}
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program
+              << " [--socket raw|dgram] [--target ADDRESS | --targets FILE [--count N] [--timeout MS]] "
+              << PacingOptions::usage() << " " << TimestampOptions::usage() << " " << SocketOptions::usage() << " "
+              << LogOptions::usage() << " " << MetricsOptions::usage() << "\n";
 }
 
 int main(int argc, char** argv)
 {
-    int sockfd;
-    struct sockaddr_in source_addr;
-    struct sockaddr_in target_addr;
+    SocketAddress source_addr;
+    SocketAddress target_addr;
+    std::vector<SocketAddress> targets;
     char send_buffer[PACKET_SIZE + sizeof(struct icmphdr)];
     char recv_buffer[BUFFER_SIZE];
+    char recv_control[TIMESTAMP_CONTROL_SIZE + CMSG_SPACE(sizeof(int))]; // Timestamps and IP_TTL/IPV6_HOPLIMIT
+    uint16_t identifier = getpid() & 0xFFFF;
     int send_count = 10;
     int sequence = 0;
+    uint32_t transmit_count = 0; // SOF_TIMESTAMPING_OPT_ID of the next send
 
-    sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-    if (sockfd == -1)
-    {
-        std::cerr << "Failed to create socket\n";
-        exit(EXIT_FAILURE);
-    }
+    SocketOptions socket_options = SocketOptions().reuseAddress(true).reusePort(true);
+    ProbeOptions probe_options;
+    LogOptions log_options;
+    MetricsOptions metrics_options;
+    probe_options.timestamps.source = TimestampSource::Software;
+    probe_options.timestamps.transmit = true;
 
-    int opt = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    Socket icmp_socket;
+    try
     {
-        std::cerr << "Failed to set socket options\n";
-        close(sockfd);
-        exit(EXIT_FAILURE);
+        for (int i = 1; i < argc; ++i)
+        {
+            if (socket_options.parseArgument(argc, argv, i) || probe_options.timestamps.parseArgument(argc, argv, i) ||
+                probe_options.pacing.parseArgument(argc, argv, i) || log_options.parseArgument(argc, argv, i) ||
+                metrics_options.parseArgument(argc, argv, i))
+            {
+                continue;
+            }
+
+            std::string arg = argv[i];
+            int value = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            std::string next = i + 1 < argc ? argv[i + 1] : "";
+            if (arg == "--socket" && (next == "raw" || next == "dgram"))
+            {
+                probe_options.socketType = next == "raw" ? IcmpSocketType::Raw : IcmpSocketType::Datagram;
+                ++i;
+            }
+            else if (arg == "--target" && i + 1 < argc)
+            {
+                probe_options.target = argv[++i];
+            }
+            else if (arg == "--targets" && i + 1 < argc)
+            {
+                probe_options.targetsFile = argv[++i];
+            }
+            else if (arg == "--count" && value > 0)
+            {
+                probe_options.count = value;
+                ++i;
+            }
+            else if (arg == "--timeout" && value > 0)
+            {
+                probe_options.timeoutMs = value;
+                ++i;
+            }
+            else
+            {
+                printUsage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (!probe_options.pacing.enabled())
+        {
+            probe_options.pacing.rate = probe_options.targetsFile.empty() ? PING_DEFAULT_RATE : PROBE_DEFAULT_RATE;
+        }
+        log_options.apply();
+        metrics_options.apply();
+
+        // The targets decide the address family of the socket
+        if (!probe_options.targetsFile.empty())
+        {
+            targets = loadTargets(probe_options.targetsFile);
+            target_addr = targets.empty() ? SocketAddress::any(AF_INET, 0) : targets[0];
+        }
+        else
+        {
+            target_addr = SocketAddress::parse(probe_options.target, 0);
+        }
+        int family = target_addr.family();
+        bool ipv6 = family == AF_INET6;
+
+        icmp_socket = openIcmpSocket(probe_options.socketType, family);
+        // The port is the echo identifier of a ping socket: let the kernel pick a free one
+        source_addr = SocketAddress::any(family, probe_options.socketType == IcmpSocketType::Raw && !ipv6 ? PORT : 0);
+        if (ipv6 && probe_options.socketType == IcmpSocketType::Raw)
+        {
+            passEchoRepliesOnly(icmp_socket.fd());
+        }
+        else if (probe_options.socketType == IcmpSocketType::Raw)
+        {
+            // Anything queued before the filter is attached is still checked by hand below
+            echoReplyFilter(identifier).attach(icmp_socket.fd());
+        }
+        icmp_socket.apply(socket_options).bind(source_addr);
+
+        // Without the IP header the TTL (hop limit) of a reply only arrives as a control message
+        int enable = 1;
+        if ((ipv6 && setsockopt(icmp_socket.fd(), IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &enable, sizeof(enable)) == -1) ||
+            (!ipv6 && probe_options.socketType == IcmpSocketType::Datagram &&
+             setsockopt(icmp_socket.fd(), IPPROTO_IP, IP_RECVTTL, &enable, sizeof(enable)) == -1))
+        {
+            throw std::runtime_error("Failed to request the reply TTL: " + std::string(strerror(errno)));
+        }
+        /*
+        IP_RECVTTL / IPV6_RECVHOPLIMIT: Pass each reply's TTL (IPv6: hop limit) as an IP_TTL / IPV6_HOPLIMIT
+        control message. Needed on ping sockets and on any ICMPv6 socket, which deliver no IP header.
+        */
+        if (probe_options.socketType == IcmpSocketType::Datagram)
+        {
+            socklen_t length = SocketAddress::capacity();
+            if (getsockname(icmp_socket.fd(), source_addr.data(), &length) == -1)
+            {
+                throw std::runtime_error("Failed to set up ping socket: " + std::string(strerror(errno)));
+            }
+            /*
+            getsockname() returns the identifier the kernel picked in sin_port (sin6_port); it is used
+            as is (network byte order) in the echo header.
+            */
+            identifier = htons(source_addr.port());
+        }
+        probe_options.timestamps.apply(icmp_socket.fd());
     }
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    catch (const std::exception& e)
     {
-        std::cerr << "Failed to set socket options\n";
-        close(sockfd);
+        std::cerr << e.what() << "\n";
         exit(EXIT_FAILURE);
     }
+    int sockfd = icmp_socket.fd();
 
-    source_addr.sin_family = AF_INET;
-    source_addr.sin_port = htons(PORT);
-    source_addr.sin_addr.s_addr = INADDR_ANY;
+    if (!probe_options.targetsFile.empty())
+    {
+        try
+        {
+            IcmpProber prober(sockfd, identifier, std::move(targets), probe_options);
+            prober.run();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
 
-    if (bind(sockfd, (struct sockaddr*)&source_addr, sizeof(source_addr)) == -1)
+    // Requests go out on the pacer's schedule; the reply wait below does not shift it
+    std::unique_ptr<Pacer> pacer;
+    try
     {
-        std::cerr << "Failed to bind socket\n";
-        close(sockfd);
+        pacer = std::make_unique<Pacer>(probe_options.pacing);
+        pacer->enableTxTime(sockfd);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
         exit(EXIT_FAILURE);
     }
 
@@ -109,15 +703,14 @@ int main(int argc, char** argv)
     }
 
     // Port is not needed for ICMP - Only IP address is needed
-    memset(&target_addr, 0, sizeof(target_addr));
-    target_addr.sin_family = AF_INET;
-    target_addr.sin_addr.s_addr = inet_addr(GOOGLE_DNS);
+    bool ipv6 = target_addr.isIpv6();
+    std::string target_name = target_addr.host(); // Formatted once, for the reply log
 
-    // Initialize ICMP header
+    // Initialize ICMP header (the ICMPv6 echo header has the same layout)
     struct icmphdr* icmp_header = (struct icmphdr*)send_buffer;
-    icmp_header->type = ICMP_ECHO;
+    icmp_header->type = echoRequestType(target_addr.family());
     icmp_header->code = 0;
-    icmp_header->un.echo.id = getpid() & 0xFFFF;
+    icmp_header->un.echo.id = identifier;
 
     // Fill payload with some data
     // Detecting packet corruption
@@ -127,32 +720,73 @@ int main(int argc, char** argv)
     {
         send_buffer[i] = i % 256;
     }
+    icmp_header->un.echo.sequence = sequence;
+    icmp_header->checksum = 0;
+    if (!ipv6)
+    {
+        icmp_header->checksum = internetChecksum(icmp_header, PACKET_SIZE + sizeof(struct icmphdr));
+    }
 
     while (send_count > 0)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        pacer->wait();
 
-        // Update sequence number and calculate checksum
+        // Update sequence number and patch the checksum for the changed field (RFC 1624); ICMPv6 is left to the kernel
+        if (!ipv6)
+        {
+            icmp_header->checksum = checksumUpdate16(icmp_header->checksum, icmp_header->un.echo.sequence, sequence);
+        }
         icmp_header->un.echo.sequence = sequence;
-        icmp_header->checksum = 0;
-        icmp_header->checksum = calculate_checksum(icmp_header, PACKET_SIZE + sizeof(struct icmphdr));
 
         auto start = std::chrono::high_resolution_clock::now();
+        // Replaced by the kernel TX timestamp below when timestamping is enabled
+        PacketTimestamps sent_at;
+        sent_at.softwareNs = realtimeNs();
 
-        if (sendto(sockfd, send_buffer, PACKET_SIZE + sizeof(struct icmphdr), 0, (struct sockaddr*)&target_addr,
-                   sizeof(target_addr)) <= 0)
+        struct iovec send_iov = {send_buffer, PACKET_SIZE + sizeof(struct icmphdr)};
+        struct msghdr send_msg;
+        memset(&send_msg, 0, sizeof(send_msg));
+        send_msg.msg_name = target_addr.data();
+        send_msg.msg_namelen = target_addr.size();
+        send_msg.msg_iov = &send_iov;
+        send_msg.msg_iovlen = 1;
+        char send_control[TXTIME_CONTROL_SIZE];
+        if (pacer->launchTimeNs(0) != 0)
         {
-            std::cerr << "Failed to send ICMP packet\n";
+            setLaunchTime(send_msg, send_control, pacer->launchTimeNs(0));
+        }
+        if (sendmsg(sockfd, &send_msg, 0) <= 0)
+        {
+            LOG_ERROR("Failed to send ICMP packet: {}", LogError{errno});
+            trafficMetrics().errors.add();
             continue;
         }
+        trafficMetrics().packetsSent.add();
+        trafficMetrics().bytesSent.add(PACKET_SIZE + sizeof(struct icmphdr));
+        uint32_t transmit_key = transmit_count++;
 
         bool received = false;
         while (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start)
                    .count() < MAX_WAIT_TIME)
         {
-            int recv_len = recvfrom(sockfd, recv_buffer, sizeof(recv_buffer), 0, NULL, NULL);
-            auto end = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+            struct iovec recv_iov = {recv_buffer, sizeof(recv_buffer)};
+            struct msghdr recv_msg;
+            memset(&recv_msg, 0, sizeof(recv_msg));
+            recv_msg.msg_iov = &recv_iov;
+            recv_msg.msg_iovlen = 1;
+            recv_msg.msg_control = recv_control;
+            recv_msg.msg_controllen = sizeof(recv_control);
+            int recv_len = recvmsg(sockfd, &recv_msg, 0);
+            /*
+            recvmsg(int sockfd, struct msghdr *msg, int flags)
+            recvfrom() plus ancillary data: with SO_TIMESTAMPING, msg_control receives the time the
+            kernel (or NIC) received the reply, which excludes the wakeup delay of this process
+            */
+            PacketTimestamps received_at;
+            if (!parseTimestamps(recv_msg, received_at))
+            {
+                received_at.softwareNs = realtimeNs();
+            }
 
             if (recv_len == -1)
             {
@@ -161,23 +795,51 @@ int main(int argc, char** argv)
             }
             else
             {
-                struct iphdr* ip_header = (struct iphdr*)recv_buffer;
-                struct icmphdr* recv_icmp = (struct icmphdr*)(recv_buffer + (ip_header->ihl * 4));
+                trafficMetrics().packetsReceived.add();
+                trafficMetrics().bytesReceived.add(recv_len);
+                // A raw IPv4 socket receives the IP header too; the others pass the TTL as IP_TTL or IPV6_HOPLIMIT
+                int ip_header_length = 0;
+                int ttl = 0;
+                if (probe_options.socketType == IcmpSocketType::Raw && !ipv6)
+                {
+                    struct iphdr* ip_header = (struct iphdr*)recv_buffer;
+                    ip_header_length = ip_header->ihl * 4;
+                    ttl = ip_header->ttl;
+                }
+                for (cmsghdr* cmsg = CMSG_FIRSTHDR(&recv_msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&recv_msg, cmsg))
+                {
+                    if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL) ||
+                        (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT))
+                    {
+                        memcpy(&ttl, CMSG_DATA(cmsg), sizeof(ttl));
+                    }
+                }
+                if (recv_len < ip_header_length + (int)sizeof(struct icmphdr))
+                {
+                    continue;
+                }
+                struct icmphdr* recv_icmp = (struct icmphdr*)(recv_buffer + ip_header_length);
 
-                if (recv_icmp->type == ICMP_ECHOREPLY && recv_icmp->un.echo.id == (getpid() & 0xFFFF) &&
+                if (recv_icmp->type == echoReplyType(target_addr.family()) && recv_icmp->un.echo.id == identifier &&
                     recv_icmp->un.echo.sequence == sequence)
                 {
-                    unsigned short original_checksum = recv_icmp->checksum;
-                    recv_icmp->checksum = 0;
-                    unsigned short calculated_checksum = calculate_checksum(recv_icmp, recv_len - (ip_header->ihl * 4));
-                    recv_icmp->checksum = original_checksum;
-
-                    if (original_checksum == calculated_checksum)
+                    // Summing a packet together with its checksum gives 0 when it is intact (the kernel checked ICMPv6)
+                    if (ipv6 || internetChecksum(recv_icmp, recv_len - ip_header_length) == 0)
                     {
-                        std::cout << "64 bytes from " << inet_ntoa(target_addr.sin_addr)
-                                  << ": icmp_seq=" << recv_icmp->un.echo.sequence << " ttl=" << (int)ip_header->ttl
-                                  << " time=" << std::fixed << std::setprecision(2) << duration.count() / 1000000.0
-                                  << " ms\n";
+                        // The TX timestamp is queued on the error queue by the time the reply is back
+                        uint32_t key;
+                        PacketTimestamps transmitted;
+                        while (probe_options.timestamps.transmit && readTransmitTimestamp(sockfd, key, transmitted))
+                        {
+                            if (key == transmit_key)
+                            {
+                                sent_at.merge(transmitted);
+                            }
+                        }
+                        int64_t rtt_ns = elapsedNs(sent_at, received_at);
+                        rttHistogram.record(rtt_ns > 0 ? rtt_ns : 0);
+                        LOG_INFO("64 bytes from {}: icmp_seq={} ttl={} time={} ms", target_name,
+                                 recv_icmp->un.echo.sequence, ttl, rtt_ns / 1000000.0);
                         received = true;
                         break;
                     }
@@ -187,10 +849,10 @@ int main(int argc, char** argv)
 
         if (!received)
         {
-            std::cerr << "Request timed out\n";
+            timeoutCount.add();
+            LOG_WARNING("Request timed out");
         }
     }
 
-    close(sockfd);
     return 0;
 }
\ No newline at end of file
@@ -6,24 +6,51 @@
  * It creates a UDP socket to send messages to all hosts on a network.
  * It showcases:
  * - UDP socket creation
- * - Enabling broadcast permissions with SO_BROADCAST
+ * - Enabling broadcast permissions with SO_BROADCAST, from a socket type configured at compile time
+ *   (UdpEndpoint<BroadcastRole>, see net/udp_endpoint.h)
  * - Sending messages to broadcast address (255.255.255.255)
  * - One-to-all communication pattern
+ * - Batched publishing with sendmmsg and optional UDP GSO (UDP_SEGMENT)
+ * - Paced sending at a fixed message rate from a timerfd schedule, optionally with SO_TXTIME launch
+ *   times so the fq or etf qdisc releases each datagram on time (see net/pacer.h)
+ * - Waiting for buffer space with poll() instead of retrying in a loop when a send would block
+ * - Socket options (buffer sizes, IP_TOS, ...) from a config file or the command line
+ * - Send errors reported through the asynchronous logger (see net/logger.h)
+ * - Datagram, byte and error counters served to Prometheus (--metrics-port, see net/metrics.h)
+ *
+ * Usage: 03-broadcast [--batch N] [--batch-bytes B] [--flush-us U] [--gso]
+ *                     [--rate MSGS [--burst N] [--jitter-us US] [--txtime fq|etf]]
+ *                     [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                     [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                     [--metrics-port PORT [--metrics-address IP]]
+ *        With --batch, messages are read line by line from stdin and flushed by count, bytes or deadline.
+ *        With --rate, they are read from stdin and sent at that many per second; messages due within
+ *        --jitter-us of each other share one wakeup and, with --batch, one sendmmsg().
  *
  * @note Uses SOCK_DGRAM socket type (UDP protocol)
  * @note Broadcasts are limited to the local network segment
  */
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <arpa/inet.h>
 #include <cstring>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "net/datagram_publisher.h"
+#include "net/logger.h"
+#include "net/metrics.h"
+#include "net/pacer.h"
+#include "net/socket.h"
+#include "net/udp_endpoint.h"
+
 #define SERVER_ADDRESS "127.0.0.1"
 #define SERVER_PORT 53771
 #define BROADCAST_ADDRESS "255.255.255.255"
@@ -32,44 +59,20 @@
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
 #define BROADCAST_TIMEOUT_SECONDS 1
-#define INVALID_SOCKET -1
+#define BROADCAST_BACKOFF_MIN_US 10   // First wait after ENOBUFS, doubled up to the maximum
+#define BROADCAST_BACKOFF_MAX_US 1000
 
 class Broadcast
 {
 public:
-    Broadcast()
+    // The socket gets socketOptions, then SO_BROADCAST from its role
+    explicit Broadcast(const SocketOptions& socketOptions) : m_socket(socketOptions)
     {
-        m_s32_socketFd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (m_s32_socketFd == INVALID_SOCKET)
-        {
-            std::cerr << "Failed to create socket" << std::endl;
-            throw std::runtime_error("Failed to create socket");
-        }
-
-        int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
-        {
-            throw std::runtime_error("Failed to set socket options: REUSEADDR" + std::string(strerror(errno)));
-        }
-        opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
-        {
-            throw std::runtime_error("Failed to set socket options: REUSEPORT" + std::string(strerror(errno)));
-        }
-
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt)) == -1)
-        {
-            throw std::runtime_error("Failed to set socket options: BROADCAST" + std::string(strerror(errno)));
-        }
-
         m_serverAddress.sin_family = AF_INET;
         m_serverAddress.sin_addr.s_addr = inet_addr(SERVER_ADDRESS);
         m_serverAddress.sin_port = htons(SERVER_PORT);
 
-        if (bind(m_s32_socketFd, (struct sockaddr*)&m_serverAddress, sizeof(m_serverAddress)) == -1)
-        {
-            throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
-        }
+        m_socket.bind(m_serverAddress);
 
         m_broadcastAddress.sin_family = AF_INET;
         m_broadcastAddress.sin_addr.s_addr = inet_addr(BROADCAST_ADDRESS);
@@ -79,58 +82,244 @@ public:
         std::cout << "Broadcast address: " << BROADCAST_ADDRESS << ":" << BROADCAST_PORT << std::endl;
     }
 
-    ~Broadcast()
+    // A UDP datagram is sent whole or not at all; only transient buffer shortages are retried until the timeout.
+    // A non-zero launchTimeNs goes with it as SCM_TXTIME (see enablePacing()).
+    void sendMessage(const std::string& message, uint64_t launchTimeNs = 0)
     {
-        if (m_s32_socketFd != INVALID_SOCKET)
+        struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &m_broadcastAddress;
+        msg.msg_namelen = sizeof(m_broadcastAddress);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[TXTIME_CONTROL_SIZE];
+        if (launchTimeNs != 0)
         {
-            close(m_s32_socketFd);
+            setLaunchTime(msg, control, launchTimeNs);
         }
-    }
-
-    void sendMessage(const std::string& message)
-    {
-        auto start = std::chrono::steady_clock::now();
-        size_t message_length = message.length();
-        int bytesSentTotal = 0;
 
-        while (std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count() <
-               BROADCAST_TIMEOUT_SECONDS)
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(BROADCAST_TIMEOUT_SECONDS);
+        auto backoff = std::chrono::microseconds(BROADCAST_BACKOFF_MIN_US);
+        while (true)
         {
-            ssize_t bytesSent = sendto(m_s32_socketFd, message.c_str(), message.size(), 0,
-                                       (struct sockaddr*)&m_broadcastAddress, sizeof(m_broadcastAddress));
+            ssize_t bytesSent = sendmsg(m_socket.fd(), &msg, 0);
+            if (bytesSent == static_cast<ssize_t>(message.size()))
+            {
+                trafficMetrics().packetsSent.add();
+                trafficMetrics().bytesSent.add(bytesSent);
+                return;
+            }
 
-            if (bytesSent == -1)
+            int error = errno;
+            bool transient = bytesSent == -1 && (error == EINTR || error == EAGAIN || error == ENOBUFS);
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (!transient || remaining <= std::chrono::steady_clock::duration::zero())
             {
-                std::cerr << "Failed to send message" << std::endl;
-                break;
+                LOG_ERROR("Failed to send message: {}", LogError{error});
+                trafficMetrics().errors.add();
+                return;
             }
+            if (error == EAGAIN)
+            {
+                // The send buffer is full: sleep until it drains
+                trafficMetrics().wouldBlock.add();
+                pollfd descriptor{m_socket.fd(), POLLOUT, 0};
+                poll(&descriptor, 1, static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count()));
+            }
+            else if (error == ENOBUFS)
+            {
+                // The device queue is full and nothing wakes the socket when it drains: back off instead
+                auto wait = std::min<std::chrono::steady_clock::duration>(backoff, remaining);
+                timespec delay{0, static_cast<long>(std::chrono::nanoseconds(wait).count())};
+                ppoll(nullptr, 0, &delay, nullptr);
+                backoff = std::min(backoff * 2, std::chrono::microseconds(BROADCAST_BACKOFF_MAX_US));
+            }
+        }
+        /*
+        poll(POLLOUT): Writable once the socket's send buffer has room again. ENOBUFS comes from the
+        device queue instead, which does not wake the socket, so it is retried after a growing delay.
+        */
+    }
+
+    // Queue messages and send them with sendmmsg (or one UDP GSO send) instead of one sendto each
+    void enableBatching(const PublisherOptions& options)
+    {
+        m_publisher = std::make_unique<DatagramPublisher>(m_socket.fd(), m_broadcastAddress, options);
+    }
 
-            bytesSentTotal += bytesSent;
-            if (bytesSentTotal == message_length)
+    // Send queued messages at a fixed rate; with SO_TXTIME each one also gets its launch time
+    void enablePacing(const PacingOptions& options, unsigned maxMessages)
+    {
+        m_pacer = std::make_unique<Pacer>(options);
+        m_pacer->enableTxTime(m_socket.fd());
+        m_pacedMessages = maxMessages;
+    }
+
+    void queueMessage(const std::string& message)
+    {
+        uint64_t launchTimeNs = 0;
+        if (m_pacer)
+        {
+            if (m_released == 0)
             {
-                break;
+                m_released = m_pacer->wait(m_pacedMessages);
+                m_releasedIndex = 0;
             }
+            launchTimeNs = m_pacer->launchTimeNs(m_releasedIndex++);
+            --m_released;
         }
 
-        if (bytesSentTotal != message_length)
+        if (!m_publisher)
         {
-            std::cerr << "Failed to send message" << std::endl;
+            sendMessage(message, launchTimeNs);
+            return;
         }
+        if (!m_publisher->publish(message, launchTimeNs))
+        {
+            LOG_ERROR("Failed to send batch: {}", LogError{errno});
+        }
+        if (m_pacer && m_released == 0)
+        {
+            flush(); // The messages of one wakeup go together, without waiting for the batch to fill
+        }
+    }
+
+    void flush()
+    {
+        if (m_publisher && !m_publisher->flush())
+        {
+            LOG_ERROR("Failed to send batch: {}", LogError{errno});
+        }
+    }
+
+    const PublisherStats* publisherStats() const
+    {
+        return m_publisher ? &m_publisher->stats() : nullptr;
+    }
+
+    const PacerStats* pacerStats() const
+    {
+        return m_pacer ? &m_pacer->stats() : nullptr;
     }
 
 private:
-    int32_t m_s32_socketFd;
+    UdpEndpoint<BroadcastRole> m_socket;
     struct sockaddr_in m_serverAddress;
     struct sockaddr_in m_broadcastAddress;
+    std::unique_ptr<DatagramPublisher> m_publisher;
+    std::unique_ptr<Pacer> m_pacer;
+    unsigned m_pacedMessages = 1; // Most messages one wakeup may release
+    unsigned m_released = 0;      // Released by the last wakeup and not queued yet
+    unsigned m_releasedIndex = 0;
 };
 
-int main()
+static bool parseOptions(int argc, char** argv, PublisherOptions& options, bool& batching, PacingOptions& pacing,
+                         SocketOptions& socketOptions, LogOptions& logOptions, MetricsOptions& metricsOptions)
 {
-    Broadcast broadcast;
+    batching = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (pacing.parseArgument(argc, argv, i) || socketOptions.parseArgument(argc, argv, i) ||
+            logOptions.parseArgument(argc, argv, i) || metricsOptions.parseArgument(argc, argv, i))
+        {
+            continue;
+        }
+
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--batch" && hasValue)
+        {
+            options.maxMessages = strtoul(argv[++i], nullptr, 10);
+            batching = true;
+        }
+        else if (arg == "--batch-bytes" && hasValue)
+        {
+            options.maxBytes = strtoul(argv[++i], nullptr, 10);
+            batching = true;
+        }
+        else if (arg == "--flush-us" && hasValue)
+        {
+            options.maxDelay = std::chrono::microseconds(strtoul(argv[++i], nullptr, 10));
+            batching = true;
+        }
+        else if (arg == "--gso")
+        {
+            options.gso = true;
+            batching = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    PublisherOptions options;
+    SocketOptions socketOptions =
+        SocketOptions().reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR).reusePort(SOCKET_OPTION_ENABLE_REUSEPORT);
+    LogOptions logOptions;
+    MetricsOptions metricsOptions;
+    PacingOptions pacing;
+    bool batching;
+    try
+    {
+        if (!parseOptions(argc, argv, options, batching, pacing, socketOptions, logOptions, metricsOptions))
+        {
+            std::cerr << "Usage: " << argv[0] << " [--batch N] [--batch-bytes B] [--flush-us U] [--gso] "
+                      << PacingOptions::usage() << " " << SocketOptions::usage() << " " << LogOptions::usage()
+                      << " " << MetricsOptions::usage() << std::endl;
+            return 1;
+        }
+        logOptions.apply();
+        metricsOptions.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    Broadcast broadcast(socketOptions);
+
+    if (batching || pacing.enabled())
+    {
+        if (batching)
+        {
+            broadcast.enableBatching(options);
+        }
+        if (pacing.enabled())
+        {
+            broadcast.enablePacing(pacing, batching ? options.maxMessages : 1);
+        }
+        std::string message;
+        while (std::getline(std::cin, message))
+        {
+            broadcast.queueMessage(message);
+        }
+        broadcast.flush();
+        Logger::instance().flush();
+
+        if (const PublisherStats* stats = broadcast.publisherStats())
+        {
+            std::cout << "Sent " << stats->datagrams << " datagrams (" << stats->bytes << " bytes) in "
+                      << stats->systemCalls << " system calls, " << stats->errors << " errors" << std::endl;
+        }
+        if (const PacerStats* stats = broadcast.pacerStats())
+        {
+            std::cout << "Pacing: " << *stats << std::endl;
+        }
+        return 0;
+    }
+
     while (true)
     {
         std::string message;
-        std::cout << "Enter a message to send: ";
+        Logger::instance().flush(); // So the prompt comes after the previous message's log lines
+        std::cout << "Enter a message to send: " << std::flush;
         std::getline(std::cin, message);
         broadcast.sendMessage(message);
     }
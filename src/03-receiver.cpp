@@ -7,114 +7,447 @@
  * It showcases:
  * - UDP socket creation
  * - Binding to INADDR_ANY to receive from any interface
- * - Setting socket options (SO_REUSEADDR) for shared port usage
+ * - Setting socket options (SO_REUSEADDR, SO_REUSEPORT) for shared port usage
  * - Receiving broadcast messages
  * - Handling data from multiple senders
+ * - Multishot recvmsg through io_uring with provided buffers (-DENABLE_IO_URING=ON)
+ * - Batched receive with recvmmsg and SO_RXQ_OVFL kernel drop counters, into fixed-size arrays with a
+ *   loop compiled for the batch depth when it is one of UDP_FIXED_BATCH_SIZES (see net/udp_endpoint.h)
+ * - Socket options (SO_RCVBUF, SO_BUSY_POLL, ...) from a config file or the command line
+ * - Kernel and hardware arrival timestamps (SO_TIMESTAMPING) read from recvmsg control messages
+ * - Pipeline mode: the I/O thread only receives into pooled buffers and hands descriptors to a
+ *   worker pool over lock-free rings, with backpressure and queue depth reporting
+ * - Per-datagram logging through the asynchronous logger: records are formatted on a background
+ *   thread, and the level and sampling can be changed while running (SIGUSR1 / SIGUSR2)
+ * - Packet, byte, drop and receive delay metrics served to Prometheus (--metrics-port, see net/metrics.h)
+ *
+ * Usage: 03-receiver [--mode blocking|batch|io_uring|pipeline] [--batch N] [--buffer-size N]
+ *                    [--workers N] [--queue N] [--backpressure block|drop]
+ *                    [--timestamps none|software|hardware] [--timestamp-interface IFACE]
+ *                    [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                    [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                    [--metrics-port PORT [--metrics-address IP]]
  *
  * @note Uses SOCK_DGRAM socket type (UDP protocol)
  * @note Broadcasts are limited to the local network segment
  */
 
+#include <chrono>
+#include <cstdio>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <arpa/inet.h>
 #include <cstring>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#define BUFFER_SIZE 1024
+#include "net/datagram_batch.h"
+#include "net/logger.h"
+#include "net/metrics.h"
+#include "net/receive_pipeline.h"
+#include "net/socket.h"
+#include "net/timestamping.h"
+#include "net/udp_endpoint.h"
+#ifdef ENABLE_IO_URING
+#include "net/io_uring.h"
+#endif
+
 #define BROADCAST_PORT 53772
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
-#define INVALID_SOCKET -1
 #define RECEIVE_ERROR -1
+#define DEFAULT_BATCH_SIZE 64
+#define DEFAULT_BUFFER_SIZE 9216 // Largest datagram received whole: a 9000-byte jumbo frame payload fits
+#define DEFAULT_PIPELINE_WORKERS 2
+#define DEFAULT_PIPELINE_QUEUE 1024
+#define URING_ENTRIES 64
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_GROUP 0
+
+// One line per datagram, with how long it waited between the kernel stamping it and the application reading it.
+// Formatting happens on the logger's thread, so this only copies the address, payload and the timestamp fields,
+// which are formatted here because either may be missing. prefix tags the receiving thread ("[worker 2] ") or is
+// empty.
+static void logDatagram(std::string_view prefix, const SocketAddress& sender, std::string_view payload,
+                        const PacketTimestamps& timestamps, int64_t nowNs)
+{
+    char stamps[64];
+    int length = 0;
+    if (timestamps.softwareNs != 0)
+    {
+        length += snprintf(stamps, sizeof(stamps), " [kernel rx %lld us ago]",
+                           static_cast<long long>((nowNs - timestamps.softwareNs) / 1000));
+    }
+    if (timestamps.hardwareNs != 0)
+    {
+        length += snprintf(stamps + length, sizeof(stamps) - length, " [hardware rx %lld ns]",
+                           static_cast<long long>(timestamps.hardwareNs));
+    }
+    LOG_INFO("{}Received from {} - {}{}", prefix, sender, payload, std::string_view(stamps, length));
+}
 
 class BroadcastReceiver
 {
 public:
-    BroadcastReceiver()
+    BroadcastReceiver(const SocketOptions& socketOptions, const TimestampOptions& timestampOptions, size_t bufferSize)
+        : m_socket(AF_INET, SOCK_DGRAM), m_timestamps(timestampOptions.enabled()), m_bufferSize(bufferSize),
+          m_buffer(bufferSize + 1)
+    {
+        // Allow multiple sockets to use the same PORT number (SO_REUSEADDR, SO_REUSEPORT)
+        m_socket.apply(socketOptions);
+        timestampOptions.apply(m_socket.fd());
+
+        // Bind to any address and the specified port. Broadcast only exists in IPv4; IPv6 sends to all nodes with
+        // the multicast group ff02::1 instead (04-multicast --group '[ff02::1]:PORT@IFACE').
+        m_clientAddress = SocketAddress::any(AF_INET, BROADCAST_PORT);
+
+        m_socket.bind(m_clientAddress);
+    }
+
+    void receiveMessages()
     {
-        m_s32_socketFd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (m_s32_socketFd == INVALID_SOCKET)
+        char* buffer = m_buffer.data();
+        char control[TIMESTAMP_CONTROL_SIZE];
+        SocketAddress senderAddress;
+        struct iovec iov = {buffer, m_bufferSize}; // One byte spare for the terminating NUL
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = senderAddress.data();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+
+        std::cout << "Listening for broadcast messages on port " << BROADCAST_PORT << std::endl;
+        while (true)
         {
-            throw std::runtime_error("Failed to create socket");
+            // The kernel overwrites the name and control lengths, so restore them before every call
+            msg.msg_namelen = SocketAddress::capacity();
+            msg.msg_controllen = sizeof(control);
+            ssize_t bytesReceived = recvmsg(m_socket.fd(), &msg, 0);
+            /*
+            recvmsg(int sockfd, struct msghdr *msg, int flags)
+            recvfrom() plus ancillary data: msg_control receives control messages such as SCM_TIMESTAMPING
+            MSG_TRUNC in msg_flags: The datagram was larger than the buffer
+            return number of bytes received if success
+            return -1 if failed
+            */
+
+            if (bytesReceived == RECEIVE_ERROR)
+            {
+                LOG_ERROR("Failed to receive message: {}", LogError{errno});
+                trafficMetrics().errors.add();
+                continue;
+            }
+
+            PacketTimestamps timestamps;
+            parseTimestamps(msg, timestamps);
+            int64_t now = realtimeNs();
+            trafficMetrics().countReceived(bytesReceived, timestamps.softwareNs, now);
+
+            if (msg.msg_flags & MSG_TRUNC)
+            {
+                LOG_WARNING("Buffer overflow");
+                trafficMetrics().truncated.add();
+                continue;
+            }
+
+            logDatagram("", senderAddress, std::string_view(buffer, bytesReceived), timestamps, now);
         }
+    }
 
-        // Allow multiple sockets to use the same PORT number
-        int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    // One recvmmsg call per batch; handler sees every datagram of the batch at once. Batch sizes in
+    // UDP_FIXED_BATCH_SIZES with the default buffer size get a FixedDatagramBatch and a loop compiled for them.
+    template <typename Handler>
+    void receiveBatches(unsigned batchSize, const Handler& handler)
+    {
+        if (m_bufferSize != DEFAULT_BUFFER_SIZE ||
+            !withBatchSize<UDP_FIXED_BATCH_SIZES>(batchSize, [&]<unsigned N>() {
+                FixedDatagramBatch<N, DEFAULT_BUFFER_SIZE> batch(m_socket.fd());
+                receiveBatches(batch, handler);
+            }))
         {
-            throw std::runtime_error("Failed to set socket options");
+            DatagramBatch batch(m_socket.fd(), batchSize, m_bufferSize);
+            receiveBatches(batch, handler);
         }
-        opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    }
+
+    template <typename Batch, typename Handler>
+    void receiveBatches(Batch& batch, const Handler& handler)
+    {
+        if (!DatagramBatch::enableDropCounter(m_socket.fd()))
         {
-            throw std::runtime_error("Failed to set socket options");
+            std::cerr << "Failed to enable SO_RXQ_OVFL, drops will not be reported" << std::endl;
         }
+        auto lastDropReport = std::chrono::steady_clock::now();
 
-        // Bind to any address and the specified port
-        m_clientAddress.sin_family = AF_INET;
-        m_clientAddress.sin_addr.s_addr = INADDR_ANY;
-        m_clientAddress.sin_port = htons(BROADCAST_PORT);
-
-        if (bind(m_s32_socketFd, (struct sockaddr*)&m_clientAddress, sizeof(m_clientAddress)) == -1)
+        std::cout << "Listening for broadcast messages on port " << BROADCAST_PORT << " (recvmmsg, batch "
+                  << batch.batchSize() << ")" << std::endl;
+        while (true)
         {
-            throw std::runtime_error("Failed to bind socket");
+            int count = batch.receive();
+            if (count == RECEIVE_ERROR)
+            {
+                if (errno != EINTR)
+                {
+                    LOG_ERROR("Failed to receive messages: {}", LogError{errno});
+                }
+                continue;
+            }
+
+            handler(batch.datagrams(), count);
+
+            // Report kernel queue overflows at most once per second
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastDropReport >= std::chrono::seconds(1))
+            {
+                uint32_t drops = batch.takeNewDrops();
+                if (drops > 0)
+                {
+                    LOG_WARNING("Kernel dropped {} packets ({} total)", drops, batch.droppedPackets());
+                }
+                lastDropReport = now;
+            }
         }
     }
 
-    ~BroadcastReceiver()
+    // This thread only receives; handler runs on the pipeline's worker threads
+    void receivePipeline(const PipelineOptions& options, const ReceivePipeline::Handler& handler)
     {
-        if (m_s32_socketFd != INVALID_SOCKET)
+        if (!DatagramBatch::enableDropCounter(m_socket.fd()))
         {
-            close(m_s32_socketFd);
+            std::cerr << "Failed to enable SO_RXQ_OVFL, drops will not be reported" << std::endl;
         }
+        ReceivePipeline pipeline(m_socket.fd(), options, handler);
+
+        std::cout << "Listening for broadcast messages on port " << BROADCAST_PORT << " (pipeline, "
+                  << options.workers << " workers)" << std::endl;
+        pipeline.run([](const PipelineStats& stats) { std::cerr << "Pipeline: " << stats << std::endl; });
     }
 
-    void receiveMessages()
+#ifdef ENABLE_IO_URING
+    // One multishot recvmsg request delivers every datagram; the kernel picks a provided buffer per datagram
+    void receiveMessagesIoUring()
     {
-        char buffer[BUFFER_SIZE];
-        struct sockaddr_in senderAddress;
-        socklen_t senderLen = sizeof(senderAddress);
+        IoUring ring(URING_ENTRIES);
+        size_t controlSize = m_timestamps ? TIMESTAMP_CONTROL_SIZE : 0;
+        ProvidedBufferRing buffers(ring, URING_BUFFER_GROUP, URING_BUFFER_COUNT,
+                                   sizeof(io_uring_recvmsg_out) + SocketAddress::capacity() + controlSize +
+                                       m_bufferSize);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_namelen = SocketAddress::capacity();
+        msg.msg_controllen = controlSize;
 
-        std::cout << "Listening for broadcast messages on port " << BROADCAST_PORT << std::endl;
+        std::cout << "Listening for broadcast messages on port " << BROADCAST_PORT << " (io_uring)" << std::endl;
+        IoUring::prepareMultishotRecvmsg(ring.getSqe(), m_socket.fd(), &msg, URING_BUFFER_GROUP, 0);
         while (true)
         {
-            ssize_t bytesReceived =
-                recvfrom(m_s32_socketFd, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr*)&senderAddress, &senderLen);
-
-            if (bytesReceived == RECEIVE_ERROR)
+            if (ring.submitAndWait(1) < 0)
             {
-                std::cerr << "Failed to receive message" << std::endl;
-                continue;
+                throw std::runtime_error("Failed to submit to io_uring: " + std::string(strerror(errno)));
             }
 
-            if (bytesReceived > BUFFER_SIZE - 1)
-            {
-                std::cerr << "Buffer overflow" << std::endl;
-                continue;
-            }
+            ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+                if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+                {
+                    uint16_t bufferId = ProvidedBufferRing::bufferId(cqe);
+                    RecvmsgPayload payload = IoUring::parseRecvmsg(buffers.buffer(bufferId), cqe.res, msg);
+                    SocketAddress senderAddress(payload.name, payload.nameLength);
+                    int64_t now = realtimeNs();
+                    trafficMetrics().countReceived(payload.length, payload.timestamps.softwareNs, now);
+                    if (payload.truncated)
+                    {
+                        LOG_WARNING("Buffer overflow");
+                        trafficMetrics().truncated.add();
+                    }
+                    else
+                    {
+                        logDatagram("", senderAddress, std::string_view(payload.data, payload.length),
+                                    payload.timestamps, now);
+                    }
+                    buffers.recycle(bufferId);
+                }
+                else if (cqe.res < 0 && cqe.res != -ENOBUFS)
+                {
+                    LOG_ERROR("Failed to receive message: {}", LogError{-cqe.res});
+                    trafficMetrics().errors.add();
+                }
 
-            buffer[bytesReceived] = '\0';
-            std::cout << "Received from " << inet_ntoa(senderAddress.sin_addr) << ":" << ntohs(senderAddress.sin_port)
-                      << " - " << buffer << std::endl;
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    IoUring::prepareMultishotRecvmsg(ring.getSqe(), m_socket.fd(), &msg, URING_BUFFER_GROUP, 0);
+                }
+            });
         }
     }
+#endif
 
 private:
-    int32_t m_s32_socketFd;
-    struct sockaddr_in m_clientAddress;
+    Socket m_socket;
+    SocketAddress m_clientAddress;
+    bool m_timestamps;
+    size_t m_bufferSize;        // Largest datagram every mode receives without truncation
+    std::vector<char> m_buffer; // Blocking mode, allocated once
+};
+
+enum class ReceiveMode
+{
+    Blocking,
+    Batch,
+    IoUring,
+    Pipeline
 };
 
-int main()
+static void printBatch(const Datagram* datagrams, size_t count)
 {
-    BroadcastReceiver receiver;
+    int64_t now = realtimeNs();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Datagram& datagram = datagrams[i];
+        if (datagram.truncated)
+        {
+            LOG_WARNING("Buffer overflow");
+            continue;
+        }
+        logDatagram("", *datagram.sender, std::string_view(datagram.data, datagram.length), datagram.timestamps, now);
+    }
+}
+
+// Runs on the pipeline workers; each has its own log ring, so no lock is needed to keep lines whole
+static void printDatagram(unsigned worker, const Datagram& datagram)
+{
+    if (datagram.truncated)
+    {
+        LOG_WARNING("[worker {}] Buffer overflow", worker);
+        return;
+    }
+    // Every worker runs on a thread of its own, so its tag is formatted once
+    thread_local const std::string prefix = "[worker " + std::to_string(worker) + "] ";
+    logDatagram(prefix, *datagram.sender, std::string_view(datagram.data, datagram.length), datagram.timestamps,
+                realtimeNs());
+}
+
+int main(int argc, char** argv)
+{
+    ReceiveMode mode = ReceiveMode::Blocking;
+    unsigned batchSize = DEFAULT_BATCH_SIZE;
+    size_t bufferSize = DEFAULT_BUFFER_SIZE;
+    PipelineOptions pipelineOptions;
+    pipelineOptions.workers = DEFAULT_PIPELINE_WORKERS;
+    pipelineOptions.queueCapacity = DEFAULT_PIPELINE_QUEUE;
+    SocketOptions socketOptions =
+        SocketOptions().reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR).reusePort(SOCKET_OPTION_ENABLE_REUSEPORT);
+    TimestampOptions timestampOptions;
+    LogOptions logOptions;
+    MetricsOptions metricsOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            if (socketOptions.parseArgument(argc, argv, i) || timestampOptions.parseArgument(argc, argv, i) ||
+                logOptions.parseArgument(argc, argv, i) || metricsOptions.parseArgument(argc, argv, i))
+            {
+                continue;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--mode" && (value == "blocking" || value == "batch" || value == "io_uring" || value == "pipeline"))
+        {
+            mode = value == "blocking"   ? ReceiveMode::Blocking
+                   : value == "batch"    ? ReceiveMode::Batch
+                   : value == "io_uring" ? ReceiveMode::IoUring
+                                         : ReceiveMode::Pipeline;
+            ++i;
+        }
+        else if (arg == "--batch" && atoi(value.c_str()) > 0)
+        {
+            batchSize = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--buffer-size" && atoi(value.c_str()) > 0)
+        {
+            bufferSize = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--workers" && atoi(value.c_str()) > 0)
+        {
+            pipelineOptions.workers = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--queue" && atoi(value.c_str()) > 0)
+        {
+            pipelineOptions.queueCapacity = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--backpressure" && (value == "block" || value == "drop"))
+        {
+            pipelineOptions.backpressure = value == "block" ? Backpressure::Block : Backpressure::Drop;
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--mode blocking|batch|io_uring|pipeline] [--batch N] "
+                      << "[--buffer-size N] [--workers N] [--queue N] [--backpressure block|drop] "
+                      << TimestampOptions::usage() << " " << SocketOptions::usage() << " " << LogOptions::usage()
+                      << " " << MetricsOptions::usage() << std::endl;
+            return 1;
+        }
+    }
+#ifndef ENABLE_IO_URING
+    if (mode == ReceiveMode::IoUring)
+    {
+        std::cerr << "Built without io_uring support (configure with -DENABLE_IO_URING=ON)" << std::endl;
+        return 1;
+    }
+#endif
+
+    logOptions.apply();
+    try
+    {
+        metricsOptions.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    pipelineOptions.bufferSize = bufferSize;
+    BroadcastReceiver receiver(socketOptions, timestampOptions, bufferSize);
     while (true)
     {
         try
         {
-            receiver.receiveMessages();
+#ifdef ENABLE_IO_URING
+            if (mode == ReceiveMode::IoUring)
+            {
+                receiver.receiveMessagesIoUring();
+            }
+            else
+#endif
+            if (mode == ReceiveMode::Batch)
+            {
+                receiver.receiveBatches(batchSize, printBatch);
+            }
+            else if (mode == ReceiveMode::Pipeline)
+            {
+                pipelineOptions.batchSize = batchSize;
+                receiver.receivePipeline(pipelineOptions, printDatagram);
+            }
+            else
+            {
+                receiver.receiveMessages();
+            }
         }
         catch (const std::exception& e)
         {
@@ -124,4 +457,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -6,125 +6,670 @@
  * It creates a UDP socket to send messages to a specific multicast group.
  * It showcases:
  * - UDP socket creation for multicast
- * - Setting the multicast TTL (Time To Live)
- * - Configuring multicast loopback
- * - Sending messages to a multicast address (238.238.238.238)
+ * - Setting the multicast TTL (Time To Live) and loopback from a socket type configured at compile
+ *   time, with bad combinations rejected by static_assert (UdpEndpoint<MulticastRole>, net/udp_endpoint.h)
+ * - Sending messages to a multicast address (238.238.238.238, or any group with --group)
+ * - IPv6 groups ([ff15::1]:PORT) from an AF_INET6 socket, with IPV6_MULTICAST_HOPS and IPV6_MULTICAST_LOOP
+ * - Choosing the outgoing interface with IP_MULTICAST_IF (IPv6: IPV6_MULTICAST_IF, by interface index)
  * - One-to-many communication pattern
+ * - Batched publishing with sendmmsg and optional UDP GSO (UDP_SEGMENT)
+ * - Paced sending at a fixed message rate from a timerfd schedule, optionally with SO_TXTIME launch
+ *   times so the fq or etf qdisc releases each datagram on time (see net/pacer.h)
+ * - A fixed-layout binary message format encoded in place in the send buffers (--format binary)
+ * - A sequence header (stream id, sequence number, send time) for gap detection at the receiver,
+ *   and redundant A/B publishing of one stream to several groups
+ * - A retransmit ring answering unicast NACKs on the bound SERVER_PORT socket, rate limited per
+ *   receiver and in total, with one sendmmsg per batch of replies
+ * - Socket options (buffer sizes, IP_TOS, ...) from a config file or the command line
+ * - Per-message logging through the asynchronous logger (see net/logger.h)
+ * - Datagram, byte and error counters served to Prometheus (--metrics-port, see net/metrics.h)
+ *
+ * Usage: 04-multicast [--group GROUP:PORT[@INTERFACE] | --group [GROUP6]:PORT[@INTERFACE]]...
+ *                     [--sequenced STREAM_ID] [--format text|binary]
+ *                     [--retransmit MESSAGES [--retransmit-bytes B] [--retransmit-rate R] [--receiver-rate R]]
+ *                     [--batch N] [--batch-bytes B] [--flush-us U] [--gso]
+ *                     [--rate MSGS [--burst N] [--jitter-us US] [--txtime fq|etf]]
+ *                     [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                     [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                     [--metrics-port PORT [--metrics-address IP]]
+ *        With --batch, messages are read line by line from stdin and flushed by count, bytes or deadline.
+ *        With --rate, they are read from stdin and sent at that many per second, to every group at once.
+ *        Every message goes to every --group; with --sequenced they carry the same sequence numbers.
+ *        --format binary sends each message as a TextMessage (number, send time, text; see net/message.h).
+ *        --retransmit (needs --sequenced) keeps answering NACKs for RETRANSMIT_LINGER_MS after stdin ends.
  *
  * @note Uses SOCK_DGRAM socket type (UDP protocol)
- * @note Multicast addresses range from 224.0.0.0 to 239.255.255.255
+ * @note Multicast addresses range from 224.0.0.0 to 239.255.255.255, and ff00::/8 for IPv6
+ * @note IPv6 has no broadcast: send to the all-nodes group, --group '[ff02::1]:PORT@IFACE', to reach every host on
+ *       a link
  * @note TTL determines how many network hops the packet can traverse
  */
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <arpa/inet.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "net/datagram_publisher.h"
+#include "net/logger.h"
+#include "net/message.h"
+#include "net/metrics.h"
+#include "net/multicast_groups.h"
+#include "net/pacer.h"
+#include "net/retransmit.h"
+#include "net/sequencer.h"
+#include "net/socket.h"
+#include "net/timestamping.h"
+#include "net/udp_endpoint.h"
+
 #define SERVER_PORT 55555
 #define MULTICAST_ADDRESS "238.238.238.238"
 #define MULTICAST_PORT 55556
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
 
-#define MULTICAST_TTL 32
-#define MULTICAST_LOOPBACK_ENABLE 1
-#define MULTICAST_LOOPBACK_DISABLE 0
+#define MULTICAST_TTL 32 // 0: same host, 1: same subnet, over 1: can be transmitted to the other subnet. default is 1
+#define MULTICAST_LOOPBACK_ENABLE true // Receivers on this host get the datagrams too, for testing
+#define MULTICAST_LOOPBACK_DISABLE false
+
+#define RETRANSMIT_LINGER_MS 2000 // NACKs are still answered this long after the last message
+#define STDIN_CHUNK 65536
+
+// Checked at compile time: a TTL over 255, or TTL 0 without loopback, does not build (see net/udp_endpoint.h)
+using MulticastEndpoint = UdpEndpoint<MulticastRole<MULTICAST_TTL, MULTICAST_LOOPBACK_ENABLE>>;
 
 /*
 Multicast Addresses:
 224.0.0.0 - 239.255.255.255
+ff00::/8 (the 4th hex digit is the scope: ff02:: link, ff05:: site, ff0e:: global)
 */
 
 class Multicast
 {
 public:
-    Multicast()
+    Multicast(const SocketOptions& socketOptions, const GroupSubscription& group)
+        : m_socket(socketOptions, group.group.family()), m_groupName(group.toString()), m_sequenced(false),
+          m_binary(false), m_nextId(0)
     {
-        m_s32_socketFd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (m_s32_socketFd == -1)
-        {
-            std::cerr << "Failed to create socket" << std::endl;
-            throw std::runtime_error("Failed to create socket");
-        }
+        bool ipv6 = group.group.isIpv6();
+        m_serverAddress = SocketAddress::any(group.group.family(), SERVER_PORT);
 
-        int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+        // The TTL and loopback were set by the socket's role (MulticastEndpoint)
+        std::cout << "Set multicast TTL to " << static_cast<int>(MulticastEndpoint::Role::ttl) << std::endl;
+        std::cout << "Multicast loopback " << (MulticastEndpoint::Role::loopback ? "enabled" : "disabled") << std::endl;
+
+        if (ipv6 && group.interfaceIndex != 0)
         {
-            throw std::runtime_error("Failed to set socket options: REUSEADDR" + std::string(strerror(errno)));
+            if (setsockopt(m_socket.fd(), IPPROTO_IPV6, IPV6_MULTICAST_IF, &group.interfaceIndex,
+                           sizeof(group.interfaceIndex)) < 0)
+            {
+                throw std::runtime_error("Failed to set socket options: IPV6_MULTICAST_IF" +
+                                         std::string(strerror(errno)));
+            }
+            /*
+            IPV6_MULTICAST_IF: Send multicast from the interface with this index. Required for link-local
+            groups (ff02::/16), which have no route of their own.
+            */
+            std::cout << "Sending through " << group.interfaceName << std::endl;
         }
-        opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-        if (setsockopt(m_s32_socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+        else if (!ipv6 && !group.interfaceName.empty())
         {
-            throw std::runtime_error("Failed to set socket options: REUSEPORT" + std::string(strerror(errno)));
+            if (setsockopt(m_socket.fd(), IPPROTO_IP, IP_MULTICAST_IF, &group.interface, sizeof(group.interface)) < 0)
+            {
+                throw std::runtime_error("Failed to set socket options: IP_MULTICAST_IF" +
+                                         std::string(strerror(errno)));
+            }
+            /*
+            IP_MULTICAST_IF: Send multicast from the interface with this address instead of the one the
+            routing table picks for the group
+            */
+            std::cout << "Sending through " << group.interfaceName << std::endl;
         }
 
-        memset(&m_serverAddress, 0, sizeof(m_serverAddress));
-        m_serverAddress.sin_family = AF_INET;
-        m_serverAddress.sin_addr.s_addr = INADDR_ANY;
-        m_serverAddress.sin_port = htons(SERVER_PORT);
+        m_socket.bind(m_serverAddress);
+        m_multicastAddress = group.group;
+    }
+
+    // Put a SequenceHeader in front of every message from now on, numbering them from 0
+    void enableSequencing(uint32_t stream)
+    {
+        m_sequenced = true;
+        m_nextHeader = SequenceHeader();
+        m_nextHeader.flags = SEQUENCE_FLAG_FIRST;
+        m_nextHeader.stream = stream;
+    }
+
+    // Keep the datagrams sent from now on and answer NACKs for them; needs enableSequencing() first
+    void enableRetransmission(const RetransmitOptions& options)
+    {
+        m_retransmit = std::make_unique<RetransmitService>(m_socket.fd(), m_nextHeader.stream, options);
+    }
+
+    // The bound SERVER_PORT socket, readable when NACKs arrive
+    int fd() const
+    {
+        return m_socket.fd();
+    }
 
-        // 0: same host, 1: same subnet, over 1: can be transmitted to the other subnet. default is 1
-        unsigned char ttl = MULTICAST_TTL; // Increased from 1 to 32 to allow more hops
-        if (setsockopt(m_s32_socketFd, IPPROTO_IP, IP_MULTICAST_TTL, (void*)&ttl, sizeof(ttl)) < 0)
+    void serveRetransmits()
+    {
+        if (m_retransmit)
         {
-            throw std::runtime_error("Failed to set socket options: IP_MULTICAST_TTL" + std::string(strerror(errno)));
+            m_retransmit->serve();
         }
-        std::cout << "Set multicast TTL to " << (int)ttl << std::endl;
+    }
+
+    const RetransmitStats* retransmitStats() const
+    {
+        return m_retransmit ? &m_retransmit->stats() : nullptr;
+    }
 
-        unsigned char loopch = MULTICAST_LOOPBACK_ENABLE; // Changed to 1 to enable loopback for testing
-        if (setsockopt(m_s32_socketFd, IPPROTO_IP, IP_MULTICAST_LOOP, (void*)&loopch, sizeof(loopch)) < 0)
+    // Time until queued messages are due, as a poll() timeout: -1 if nothing is queued
+    int flushTimeoutMs() const
+    {
+        if (!m_publisher || m_publisher->pendingMessages() == 0)
         {
-            throw std::runtime_error("Failed to set socket options: IP_MULTICAST_LOOP" + std::string(strerror(errno)));
+            return -1;
         }
-        std::cout << "Multicast loopback " << (loopch ? "enabled" : "disabled") << std::endl;
+        auto delay = m_publisher->timeUntilDeadline();
+        return static_cast<int>((delay.count() + 999) / 1000);
+    }
 
-        if (bind(m_s32_socketFd, (struct sockaddr*)&m_serverAddress, sizeof(m_serverAddress)) == -1)
+    void pollPublisher()
+    {
+        if (m_publisher && !m_publisher->poll())
         {
-            throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
+            LOG_ERROR("Failed to send batch: {}", LogError{errno});
         }
-
-        memset(&m_multicastAddress, 0, sizeof(m_multicastAddress));
-        m_multicastAddress.sin_family = AF_INET;
-        m_multicastAddress.sin_addr.s_addr = inet_addr(MULTICAST_ADDRESS);
-        m_multicastAddress.sin_port = htons(MULTICAST_PORT);
     }
 
-    ~Multicast()
+    // Send every message from now on as a TextMessage (net/message.h), numbered from 0
+    void enableBinaryFormat()
     {
-        close(m_s32_socketFd);
+        m_binary = true;
     }
 
-    void sendToMulticast(const std::string& message)
+    // A non-zero launchTimeNs goes with the datagram as SCM_TXTIME (see enableTxTime())
+    void sendToMulticast(const std::string& message, uint64_t launchTimeNs = 0)
     {
-        std::cout << "Sending message to " << MULTICAST_ADDRESS << ":" << MULTICAST_PORT << std::endl;
-        if (sendto(m_s32_socketFd, message.c_str(), message.length(), 0, (struct sockaddr*)&m_multicastAddress,
-                   sizeof(m_multicastAddress)) == -1)
+        LOG_INFO("Sending message to {}", m_groupName);
+        const char* data = message.c_str();
+        size_t length = message.length();
+        if (m_sequenced || m_binary)
+        {
+            // Headers and payload go out as one datagram; the buffer only grows to the longest message
+            length = datagramLength(message);
+            m_sendBuffer.resize(length);
+            writeDatagram(message, m_sendBuffer.data(), length);
+            data = m_sendBuffer.data();
+        }
+        struct iovec iov = {const_cast<char*>(data), length};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = m_multicastAddress.data();
+        msg.msg_namelen = m_multicastAddress.size();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[TXTIME_CONTROL_SIZE];
+        if (launchTimeNs != 0)
         {
+            setLaunchTime(msg, control, launchTimeNs);
+        }
+        if (sendmsg(m_socket.fd(), &msg, 0) == -1)
+        {
+            trafficMetrics().errors.add();
             std::cerr << "Failed to send message: " << strerror(errno) << std::endl;
             throw std::runtime_error("Failed to send message: " + std::string(strerror(errno)));
         }
+        trafficMetrics().packetsSent.add();
+        trafficMetrics().bytesSent.add(length);
+    }
+
+    // Queue messages and send them with sendmmsg (or one UDP GSO send) instead of one sendto each
+    void enableBatching(const PublisherOptions& options)
+    {
+        m_publisher = std::make_unique<DatagramPublisher>(m_socket.fd(), m_multicastAddress, options);
+    }
+
+    // Set SO_TXTIME for the pacer's launch times
+    void enableTxTime(const Pacer& pacer)
+    {
+        pacer.enableTxTime(m_socket.fd());
+    }
+
+    void queueMessage(const std::string& message, uint64_t launchTimeNs = 0)
+    {
+        if (!m_publisher)
+        {
+            sendToMulticast(message, launchTimeNs);
+            return;
+        }
+        if (!m_sequenced && !m_binary)
+        {
+            if (!m_publisher->publish(message, launchTimeNs))
+            {
+                LOG_ERROR("Failed to send batch: {}", LogError{errno});
+            }
+            return;
+        }
+
+        // Written straight into the publisher's slab, headers first
+        size_t length = datagramLength(message);
+        char* slot = m_publisher->reserve(length);
+        if (slot == nullptr)
+        {
+            LOG_WARNING("Message of {} bytes does not fit in a batch", message.length());
+            return;
+        }
+        writeDatagram(message, slot, length);
+        if (!m_publisher->commit(length, launchTimeNs))
+        {
+            LOG_ERROR("Failed to send batch: {}", LogError{errno});
+        }
+    }
+
+    void flush()
+    {
+        if (m_publisher && !m_publisher->flush())
+        {
+            LOG_ERROR("Failed to send batch: {}", LogError{errno});
+        }
+    }
+
+    const PublisherStats* publisherStats() const
+    {
+        return m_publisher ? &m_publisher->stats() : nullptr;
     }
 
 private:
-    int32_t m_s32_socketFd;
-    struct sockaddr_in m_serverAddress;
-    struct sockaddr_in m_multicastAddress;
+    MulticastEndpoint m_socket;
+    std::string m_groupName;
+    SocketAddress m_serverAddress;
+    SocketAddress m_multicastAddress;
+    std::unique_ptr<DatagramPublisher> m_publisher;
+    bool m_sequenced;
+    SequenceHeader m_nextHeader;
+    bool m_binary;
+    uint64_t m_nextId; // Of the next TextMessage
+    std::vector<char> m_sendBuffer; // Headers plus payload, for sendToMulticast()
+    std::unique_ptr<RetransmitService> m_retransmit;
+
+    // Bytes the datagram for message takes: the sequence header, then the text or a TextMessage holding it
+    size_t datagramLength(const std::string& message) const
+    {
+        return (m_sequenced ? SEQUENCE_HEADER_SIZE : 0) + (m_binary ? sizeof(TextMessage) : 0) + message.length();
+    }
+
+    // Write the datagram for message at out, datagramLength() bytes. A TextMessage is encoded where it is sent
+    // from, so the text is the only copy.
+    void writeDatagram(const std::string& message, char* out, size_t length)
+    {
+        char* payload = m_sequenced ? out + SEQUENCE_HEADER_SIZE : out;
+        if (m_binary)
+        {
+            TextMessage* text = encodeMessage<TextMessage>(payload, length - (payload - out), message.length());
+            text->id = m_nextId++;
+            text->sendTimeNs = realtimeNs();
+            payload = messageTail(text);
+        }
+        memcpy(payload, message.data(), message.length());
+        if (m_sequenced)
+        {
+            writeHeader(out, length);
+        }
+    }
+
+    // Fill in the header of the datagram at out, whose payload is already in place, and keep a copy for NACKs
+    void writeHeader(char* out, size_t length)
+    {
+        m_nextHeader.sendTimeNs = realtimeNs();
+        encodeSequenceHeader(m_nextHeader, out);
+        if (m_retransmit)
+        {
+            m_retransmit->store(m_nextHeader.sequence, out, length);
+        }
+        ++m_nextHeader.sequence;
+        m_nextHeader.flags = 0;
+    }
 };
 
-int main()
+static bool parseOptions(int argc, char** argv, PublisherOptions& options, bool& batching, PacingOptions& pacing,
+                         SocketOptions& socketOptions, std::vector<GroupSubscription>& groups, bool& sequenced,
+                         uint32_t& stream, bool& binary, RetransmitOptions& retransmitOptions, LogOptions& logOptions,
+                         MetricsOptions& metricsOptions)
+{
+    batching = false;
+    sequenced = false;
+    binary = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (pacing.parseArgument(argc, argv, i) || socketOptions.parseArgument(argc, argv, i) ||
+            retransmitOptions.parseArgument(argc, argv, i) || logOptions.parseArgument(argc, argv, i) ||
+            metricsOptions.parseArgument(argc, argv, i))
+        {
+            continue;
+        }
+
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--group" && hasValue)
+        {
+            groups.push_back(GroupSubscription::parse(argv[++i]));
+        }
+        else if (arg == "--sequenced" && hasValue)
+        {
+            stream = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+            sequenced = true;
+        }
+        else if (arg == "--format" && hasValue &&
+                 (strcmp(argv[i + 1], "text") == 0 || strcmp(argv[i + 1], "binary") == 0))
+        {
+            binary = strcmp(argv[++i], "binary") == 0;
+        }
+        else if (arg == "--batch" && hasValue)
+        {
+            options.maxMessages = strtoul(argv[++i], nullptr, 10);
+            batching = true;
+        }
+        else if (arg == "--batch-bytes" && hasValue)
+        {
+            options.maxBytes = strtoul(argv[++i], nullptr, 10);
+            batching = true;
+        }
+        else if (arg == "--flush-us" && hasValue)
+        {
+            options.maxDelay = std::chrono::microseconds(strtoul(argv[++i], nullptr, 10));
+            batching = true;
+        }
+        else if (arg == "--gso")
+        {
+            options.gso = true;
+            batching = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Queue released messages from the front of lines on every sender, with their launch times from the pacer
+static void queueReleased(std::vector<std::unique_ptr<Multicast>>& senders, std::deque<std::string>& lines,
+                          unsigned released, const Pacer* pacer)
+{
+    for (unsigned i = 0; i < released; ++i)
+    {
+        uint64_t launchTimeNs = pacer ? pacer->launchTimeNs(i) : 0;
+        for (auto& multicast : senders)
+        {
+            multicast->queueMessage(lines.front(), launchTimeNs);
+        }
+        lines.pop_front();
+    }
+}
+
+// Publish stdin line by line while answering NACKs: one poll() over stdin, the socket of every sender and, when
+// paced, the pacer's timer
+static void publishWithRetransmits(std::vector<std::unique_ptr<Multicast>>& senders, Pacer* pacer,
+                                   unsigned maxReleased)
 {
-    Multicast multicast;
+    std::vector<pollfd> fds(senders.size() + 2);
+    fds[0] = pollfd{STDIN_FILENO, POLLIN, 0};
+    fds[1] = pollfd{pacer ? pacer->fd() : -1, POLLIN, 0};
+    for (size_t i = 0; i < senders.size(); ++i)
+    {
+        fds[i + 2] = pollfd{senders[i]->fd(), POLLIN, 0};
+    }
+
+    std::string pending;
+    std::deque<std::string> lines; // Read and not yet released by the pacer
+    char chunk[STDIN_CHUNK];
+    bool input = true;
+    auto lingerUntil = std::chrono::steady_clock::time_point::max();
+    while (input || !lines.empty() || std::chrono::steady_clock::now() < lingerUntil)
+    {
+        int timeout = -1;
+        if (!input && lines.empty())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(lingerUntil -
+                                                                              std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<int64_t>(left.count(), 0));
+        }
+        for (auto& multicast : senders)
+        {
+            int due = multicast->flushTimeoutMs();
+            if (due >= 0 && (timeout < 0 || due < timeout))
+            {
+                timeout = due;
+            }
+        }
+        fds[0].fd = input ? STDIN_FILENO : -1; // poll() skips negative descriptors
+        fds[1].fd = pacer && !lines.empty() ? pacer->fd() : -1;
+        if (poll(fds.data(), fds.size(), timeout) == -1 && errno != EINTR)
+        {
+            throw std::runtime_error("Failed to poll: " + std::string(strerror(errno)));
+        }
+
+        if (input && (fds[0].revents & (POLLIN | POLLHUP)))
+        {
+            ssize_t length = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (length > 0)
+            {
+                pending.append(chunk, length);
+            }
+            size_t start = 0;
+            size_t newline;
+            while ((newline = pending.find('\n', start)) != std::string::npos)
+            {
+                lines.push_back(pending.substr(start, newline - start));
+                start = newline + 1;
+            }
+            pending.erase(0, start);
+
+            if (length <= 0)
+            {
+                if (!pending.empty())
+                {
+                    lines.push_back(pending);
+                }
+                input = false;
+            }
+        }
+
+        if (!lines.empty())
+        {
+            unsigned released = static_cast<unsigned>(lines.size());
+            if (pacer)
+            {
+                released = pacer->take(std::min(released, maxReleased));
+            }
+            queueReleased(senders, lines, released, pacer);
+            if (pacer && released > 0)
+            {
+                for (auto& multicast : senders)
+                {
+                    multicast->flush(); // The messages of one wakeup go together
+                }
+            }
+        }
+        if (!input && lines.empty() && lingerUntil == std::chrono::steady_clock::time_point::max())
+        {
+            for (auto& multicast : senders)
+            {
+                multicast->flush();
+            }
+            lingerUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRANSMIT_LINGER_MS);
+        }
+
+        for (auto& multicast : senders)
+        {
+            multicast->serveRetransmits();
+            multicast->pollPublisher();
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    PublisherOptions options;
+    SocketOptions socketOptions =
+        SocketOptions().reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR).reusePort(SOCKET_OPTION_ENABLE_REUSEPORT);
+    bool batching;
+    bool sequenced;
+    bool binary;
+    PacingOptions pacing;
+    uint32_t stream = 0;
+    std::vector<GroupSubscription> groups;
+    RetransmitOptions retransmitOptions;
+    LogOptions logOptions;
+    MetricsOptions metricsOptions;
+    try
+    {
+        if (!parseOptions(argc, argv, options, batching, pacing, socketOptions, groups, sequenced, stream, binary,
+                          retransmitOptions, logOptions, metricsOptions))
+        {
+            std::cerr << "Usage: " << argv[0] << " [--group GROUP:PORT[@INTERFACE]]... [--sequenced STREAM_ID]"
+                      << " [--format text|binary] " << RetransmitOptions::usage() << "\n"
+                      << "       [--batch N] [--batch-bytes B] [--flush-us U] [--gso] " << PacingOptions::usage()
+                      << "\n       " << SocketOptions::usage() << " " << LogOptions::usage() << " "
+                      << MetricsOptions::usage() << std::endl;
+            return 1;
+        }
+        logOptions.apply();
+        metricsOptions.apply();
+        if (retransmitOptions.enabled() && !sequenced)
+        {
+            throw std::runtime_error("--retransmit needs --sequenced");
+        }
+        if (groups.empty())
+        {
+            groups.push_back(
+                GroupSubscription::parse(std::string(MULTICAST_ADDRESS) + ":" + std::to_string(MULTICAST_PORT)));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // One sender per group. They see the same messages, so with --sequenced they number them alike, which is what
+    // lets a receiver of several groups (A/B feeds) merge them. One pacer releases each message to all of them.
+    std::unique_ptr<Pacer> pacer = pacing.enabled() ? std::make_unique<Pacer>(pacing) : nullptr;
+    unsigned maxReleased = batching ? options.maxMessages : 1;
+    std::vector<std::unique_ptr<Multicast>> senders;
+    for (const GroupSubscription& group : groups)
+    {
+        senders.push_back(std::make_unique<Multicast>(socketOptions, group));
+        if (sequenced)
+        {
+            senders.back()->enableSequencing(stream);
+        }
+        if (binary)
+        {
+            senders.back()->enableBinaryFormat();
+        }
+        if (retransmitOptions.enabled())
+        {
+            senders.back()->enableRetransmission(retransmitOptions);
+        }
+        if (batching)
+        {
+            senders.back()->enableBatching(options);
+        }
+        if (pacer)
+        {
+            senders.back()->enableTxTime(*pacer);
+        }
+    }
+
+    if (retransmitOptions.enabled())
+    {
+        publishWithRetransmits(senders, pacer.get(), maxReleased);
+        Logger::instance().flush();
+        for (auto& multicast : senders)
+        {
+            if (const PublisherStats* stats = multicast->publisherStats())
+            {
+                std::cout << "Sent " << stats->datagrams << " datagrams (" << stats->bytes << " bytes) in "
+                          << stats->systemCalls << " system calls, " << stats->errors << " errors" << std::endl;
+            }
+            std::cout << "Retransmit: " << *multicast->retransmitStats() << std::endl;
+        }
+        if (pacer)
+        {
+            std::cout << "Pacing: " << pacer->stats() << std::endl;
+        }
+        return 0;
+    }
+
+    if (batching || pacer)
+    {
+        std::string message;
+        unsigned released = 0; // Slots of the last pacer wakeup that no message has taken yet
+        unsigned index = 0;
+        while (std::getline(std::cin, message))
+        {
+            uint64_t launchTimeNs = 0;
+            if (pacer)
+            {
+                if (released == 0)
+                {
+                    released = pacer->wait(maxReleased);
+                    index = 0;
+                }
+                launchTimeNs = pacer->launchTimeNs(index++);
+                --released;
+            }
+            for (auto& multicast : senders)
+            {
+                multicast->queueMessage(message, launchTimeNs);
+                if (pacer && released == 0)
+                {
+                    multicast->flush(); // The messages of one wakeup go together
+                }
+            }
+        }
+        for (auto& multicast : senders)
+        {
+            multicast->flush();
+            Logger::instance().flush();
+            if (const PublisherStats* stats = multicast->publisherStats())
+            {
+                std::cout << "Sent " << stats->datagrams << " datagrams (" << stats->bytes << " bytes) in "
+                          << stats->systemCalls << " system calls, " << stats->errors << " errors" << std::endl;
+            }
+        }
+        if (pacer)
+        {
+            std::cout << "Pacing: " << pacer->stats() << std::endl;
+        }
+        return 0;
+    }
 
     while (true)
     {
         std::string message;
-        std::cout << "Enter a message to send: ";
-        std::getline(std::cin, message);
-        multicast.sendToMulticast(message);
+        Logger::instance().flush(); // So the prompt comes after the previous message's log lines
+        std::cout << "Enter a message to send: " << std::flush;
+        if (!std::getline(std::cin, message))
+        {
+            break;
+        }
+        for (auto& multicast : senders)
+        {
+            multicast->sendToMulticast(message);
+        }
     }
     return 0;
 }
@@ -8,117 +8,1109 @@
  * - UDP socket creation for multicast
  * - Setting socket options (SO_REUSEADDR, SO_REUSEPORT) for shared port usage
  * - Joining a multicast group using IP_ADD_MEMBERSHIP
+ * - Joining many groups on several interfaces, including source-specific joins (IP_ADD_SOURCE_MEMBERSHIP)
+ * - One socket per group, bound to the group address with IP_MULTICAST_ALL off, demultiplexed on one
+ *   epoll or io_uring loop and dispatched through a per-group handler table
  * - Receiving messages from the multicast group
  * - Leaving the multicast group with IP_DROP_MEMBERSHIP
+ * - Multishot recvmsg through io_uring with provided buffers (-DENABLE_IO_URING=ON)
+ * - Binary TextMessage payloads (04-multicast --format binary) read in place, without parsing or copies
+ * - Batched receive with recvmmsg and SO_RXQ_OVFL kernel drop counters, into fixed-size arrays with a
+ *   loop compiled for the batch depth when it is one of UDP_FIXED_BATCH_SIZES (see net/udp_endpoint.h)
+ * - Socket options (SO_RCVBUF, SO_BUSY_POLL, ...) from a config file or the command line
+ * - Kernel and hardware arrival timestamps (SO_TIMESTAMPING) read from recvmsg control messages
+ * - Pipeline mode: the I/O thread only receives into pooled buffers and hands descriptors to a
+ *   worker pool over lock-free rings, with backpressure and queue depth reporting
+ * - Coroutine mode: one C++20 coroutine per group awaiting recvmmsg batches, all on one single-threaded
+ *   event loop over epoll or io_uring readiness (see net/async.h)
+ * - Packet ring mode: frames come from a PACKET_MMAP TPACKET_V3 ring filtered by a BPF program built
+ *   from the groups, with Ethernet/IP/UDP parsed in userspace, instead of the UDP stack (see net/packet_ring.h)
+ * - Sequenced streams: gap detection, a bounded reorder window and A/B arbitration of several
+ *   groups carrying the same stream (first copy wins), with gap and duplicate counters
+ * - NACKs for holes sent to the publisher over unicast, with the retransmissions received on
+ *   the same socket and merged like one more feed
+ * - Per-message logging through the asynchronous logger: records are formatted on a background
+ *   thread, and the level and sampling can be changed while running (SIGUSR1 / SIGUSR2)
+ * - Packet, byte, drop and receive delay metrics served to Prometheus (--metrics-port, see net/metrics.h)
+ * - Spin mode: the blocking, batch and packet ring loops poll epoll without sleeping on a pinned, optionally
+ *   SCHED_FIFO thread with locked memory, and report their busy and idle time (see net/busy_poll.h)
+ * - Hot restart: a new receiver started with the same --hot-restart PATH takes over the group sockets, with
+ *   their memberships and queued datagrams, and the old one exits without leaving the groups (see net/hot_restart.h)
+ *
+ * Usage: 04-receiver [--join GROUP:PORT[@INTERFACE][/SOURCE]]...
+ *                    [--mode blocking|batch|io_uring|pipeline|packet_ring|coroutine] [--loop epoll|io_uring]
+ *                    [--batch N] [--buffer-size N]
+ *                    [--sequenced [--reorder-window N] [--reorder-delay-us U]]
+ *                    [--nack [--nack-delay-us U] [--nack-interval-us U]]
+ *                    [--workers N] [--queue N] [--backpressure block|drop]
+ *                    [--ring-interface IFACE] [--ring-block-size BYTES] [--ring-blocks N] [--ring-timeout-ms MS]
+ *                    [--timestamps none|software|hardware] [--timestamp-interface IFACE]
+ *                    [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *                    [--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]
+ *                    [--metrics-port PORT [--metrics-address IP]] [--hot-restart PATH]
+ *                    [--spin [--spin-cpu N] [--rt-priority 1-99]] [--mlock]
  *
  * @note Uses SOCK_DGRAM socket type (UDP protocol)
  * @note Must bind to the same port that the sender uses for multicast
+ * @note Without --join, the receiver joins 238.238.238.238:55556 on any interface
+ * @note Pipeline mode takes a single group and no --sequenced
+ * @note Packet ring mode needs root and receives every group on every interface (or --ring-interface); the group
+ *       sockets only hold the memberships and drop their copies in the kernel
+ * @note Spin mode works in blocking, batch and packet ring modes
+ * @note Hot restart works in blocking and batch modes; the NACK socket is not handed over, a new one is opened
+ * @note io_uring mode only gives up on a hole when the next message arrives; the other modes also check every
+ *       SEQUENCER_TICK_MS
  * @note Multiple receivers can join the same multicast group
  */
 
 #include <arpa/inet.h>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "net/async.h"
+#include "net/busy_poll.h"
+#include "net/datagram_batch.h"
+#include "net/hot_restart.h"
+#include "net/logger.h"
+#include "net/message.h"
+#include "net/metrics.h"
+#include "net/multicast_groups.h"
+#include "net/packet_ring.h"
+#include "net/receive_pipeline.h"
+#include "net/retransmit.h"
+#include "net/sequencer.h"
+#include "net/socket.h"
+#include "net/timestamping.h"
+#include "net/udp_endpoint.h"
+#ifdef ENABLE_IO_URING
+#include "net/io_uring.h"
+#endif
+
 #define MULTICAST_ADDRESS "238.238.238.238"
 #define MULTICAST_PORT 55556
 #define SOCKET_OPTION_ENABLE_REUSEADDR 1
 #define SOCKET_OPTION_ENABLE_REUSEPORT 1
-#define BUFFER_SIZE 1024
+#define DEFAULT_BATCH_SIZE 64
+#define DEFAULT_BUFFER_SIZE 9216 // Largest datagram received whole: a 9000-byte jumbo frame payload fits
+#define DEFAULT_PIPELINE_WORKERS 2
+#define DEFAULT_PIPELINE_QUEUE 1024
+#define URING_ENTRIES 64
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_GROUP 0
+#define MAX_EPOLL_EVENTS 64
+#define PACKET_RING_EVENT UINT32_MAX // epoll tag of the packet ring; sockets are tagged with their index
+#define HOT_RESTART_EVENT (UINT32_MAX - 1) // epoll tag of HotRestart::stopFd()
+#define SEQUENCER_TICK_MS 1 // How often idle sequenced streams are checked for holes that timed out
+
+// One record per datagram, with how long it waited between the kernel stamping it and the application reading it.
+// Formatting happens on the logger's thread, so this only copies the address, payload and numbers.
+// A TextMessage (04-multicast --format binary) is read where it was received: its fields are loads from the buffer
+// and its text a view of it. prefix tags the receiving thread ("[worker 2] ") and group names the group the
+// datagram came in on; either may be empty.
+static void logDatagram(std::string_view prefix, std::string_view group, const Datagram& datagram, int64_t nowNs)
+{
+    std::string_view on = group.empty() ? "" : " on ";
+    if (const TextMessage* message = readMessage<TextMessage>(datagram.data, datagram.length))
+    {
+        LOG_INFO("{}Received message #{}{}{} from {} ({} us after sending)\nMessage: {}", prefix, message->id.get(),
+                 on, group, *datagram.sender, (nowNs - message->sendTimeNs.get()) / 1000, messageTail(*message));
+        return;
+    }
+    std::string_view payload(datagram.data, datagram.length);
+    std::string_view truncated = datagram.truncated ? " (truncated)" : "";
+    const PacketTimestamps& timestamps = datagram.timestamps;
+    int64_t waitedUs = (nowNs - timestamps.softwareNs) / 1000;
+    if (timestamps.softwareNs != 0 && timestamps.hardwareNs != 0)
+    {
+        LOG_INFO("{}Received message{}{} from {} [kernel rx {} us ago] [hardware rx {} ns]\nMessage: {}{}", prefix,
+                 on, group, *datagram.sender, waitedUs, timestamps.hardwareNs, payload, truncated);
+    }
+    else if (timestamps.softwareNs != 0)
+    {
+        LOG_INFO("{}Received message{}{} from {} [kernel rx {} us ago]\nMessage: {}{}", prefix, on, group,
+                 *datagram.sender, waitedUs, payload, truncated);
+    }
+    else if (timestamps.hardwareNs != 0)
+    {
+        LOG_INFO("{}Received message{}{} from {} [hardware rx {} ns]\nMessage: {}{}", prefix, on, group,
+                 *datagram.sender, timestamps.hardwareNs, payload, truncated);
+    }
+    else
+    {
+        LOG_INFO("{}Received message{}{} from {}\nMessage: {}{}", prefix, on, group, *datagram.sender, payload,
+                 truncated);
+    }
+}
+
+// The same for the pipeline workers, tagged with the worker instead of the group
+static void logWorkerDatagram(unsigned worker, const Datagram& datagram, int64_t nowNs)
+{
+    // Every worker runs on a thread of its own, so its tag is formatted once
+    thread_local const std::string prefix = "[worker " + std::to_string(worker) + "] ";
+    logDatagram(prefix, "", datagram, nowNs);
+}
+
+// Called with the datagrams of one receive call, all from the group the handler is registered for
+using GroupHandler = std::function<void(const Datagram* datagrams, size_t count)>;
 
 class MulticastReceiver
 {
 public:
-    MulticastReceiver()
+    MulticastReceiver(const std::vector<GroupSubscription>& subscriptions, const SocketOptions& socketOptions,
+                      const TimestampOptions& timestampOptions, size_t bufferSize, HotRestart* restart = nullptr)
+        : m_groups(subscriptions, socketOptions, timestampOptions, restart), m_epollFd(epoll_create1(EPOLL_CLOEXEC)),
+          m_timestamps(timestampOptions.enabled()), m_bufferSize(bufferSize), m_buffer(bufferSize)
     {
-        m_sockFd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (m_sockFd == -1)
+        if (m_epollFd == -1)
+        {
+            throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+        }
+        for (size_t group = 0; group < m_groups.size(); ++group)
         {
-            throw std::runtime_error("Failed to create socket");
+            try
+            {
+                addSocket(m_groups.fd(group), m_groups.name(group));
+            }
+            catch (const std::exception&)
+            {
+                close(m_epollFd);
+                throw;
+            }
+            std::cout << "Listening for multicast messages on " << m_groups.name(group) << std::endl;
         }
+    }
+
+    ~MulticastReceiver()
+    {
+        close(m_epollFd);
+    }
+
+    // Sockets 0..N-1 are the groups joined, in order; sockets added with addSocket() follow
+    size_t socketCount() const
+    {
+        return m_fds.size();
+    }
+
+    const std::string& socketName(size_t socket) const
+    {
+        return m_names[socket];
+    }
 
-        int opt = SOCKET_OPTION_ENABLE_REUSEADDR;
-        if (setsockopt(m_sockFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    // Receive from one more non-blocking datagram socket in the same loop (not in pipeline mode). Returns its index
+    // in the handler table.
+    size_t addSocket(int fd, const std::string& name)
+    {
+        // The socket index rides along in the event, so a ready socket maps straight to its handler
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = static_cast<uint32_t>(m_fds.size());
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
         {
-            throw std::runtime_error("Failed to set SO_REUSEADDR");
+            throw std::runtime_error("Failed to add " + name + " to epoll: " + std::string(strerror(errno)));
         }
-        opt = SOCKET_OPTION_ENABLE_REUSEPORT;
-        if (setsockopt(m_sockFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+        m_fds.push_back(fd);
+        m_names.push_back(name);
+        return m_fds.size() - 1;
+    }
+
+    // Poll without sleeping in the blocking, batch and packet ring loops
+    void spin()
+    {
+        m_spinMeter = std::make_unique<SpinMeter>();
+        m_nextTick = std::chrono::steady_clock::now();
+        m_nextSpinReport = m_nextTick + std::chrono::milliseconds(SPIN_REPORT_INTERVAL_MS);
+    }
+
+    // The blocking and batch loops return once fd turns readable
+    void stopOn(int fd)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = HOT_RESTART_EVENT;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
         {
-            throw std::runtime_error("Failed to set SO_REUSEPORT");
+            throw std::runtime_error("Failed to add the hot restart event to epoll: " + std::string(strerror(errno)));
         }
+    }
+
+    // The group sockets live on in the process that took them over
+    void keepMemberships()
+    {
+        m_groups.keepMemberships();
+    }
+
+    // Call tick at least every intervalMs, even while no datagrams arrive (blocking and batch modes)
+    void setTick(std::function<void()> tick, int intervalMs)
+    {
+        m_tick = std::move(tick);
+        m_tickIntervalMs = intervalMs;
+    }
+
+    // One recvmsg per readable group and wakeup; handlers[i] gets the datagrams of group i
+    void receiveMessages(const std::vector<GroupHandler>& handlers)
+    {
+        epoll_event events[MAX_EPOLL_EVENTS];
 
-        m_receiverAddress.sin_family = AF_INET;
-        m_receiverAddress.sin_addr.s_addr = INADDR_ANY;
-        m_receiverAddress.sin_port = htons(MULTICAST_PORT); // MUST BE SAME AS THE PORT IN MULTICAST SENDER
+        std::cout << "Waiting for multicast messages..." << std::endl;
+        while (!m_stopped)
+        {
+            int count = waitForGroups(events);
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t socket = events[i].data.u32;
+                receiveOne(socket, handlers[socket]);
+            }
+        }
+    }
 
-        if (bind(m_sockFd, (struct sockaddr*)&m_receiverAddress, sizeof(m_receiverAddress)) == -1)
+    // One recvmmsg call per readable group and wakeup, so a busy group cannot starve the others. Batch sizes in
+    // UDP_FIXED_BATCH_SIZES with the default buffer size get FixedDatagramBatches and a loop compiled for them.
+    void receiveBatches(unsigned batchSize, const std::vector<GroupHandler>& handlers)
+    {
+        if (m_bufferSize != DEFAULT_BUFFER_SIZE ||
+            !withBatchSize<UDP_FIXED_BATCH_SIZES>(batchSize, [&]<unsigned N>() {
+                receiveBatches<FixedDatagramBatch<N, DEFAULT_BUFFER_SIZE>>(handlers);
+            }))
         {
-            throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
+            receiveBatches<DatagramBatch>(handlers, batchSize, m_bufferSize);
         }
+    }
 
-        // Set up multicast group membership
-        m_mreq.imr_multiaddr.s_addr = inet_addr(MULTICAST_ADDRESS);
-        m_mreq.imr_interface.s_addr = INADDR_ANY;
+    // Batch is constructed from a socket and batchArgs
+    template <typename Batch, typename... BatchArgs>
+    void receiveBatches(const std::vector<GroupHandler>& handlers, const BatchArgs&... batchArgs)
+    {
+        std::vector<std::unique_ptr<Batch>> batches;
+        for (size_t group = 0; group < m_fds.size(); ++group)
+        {
+            batches.push_back(std::make_unique<Batch>(m_fds[group], batchArgs...));
+            if (!DatagramBatch::enableDropCounter(m_fds[group]))
+            {
+                std::cerr << "Failed to enable SO_RXQ_OVFL, drops will not be reported" << std::endl;
+            }
+        }
+        auto lastDropReport = std::chrono::steady_clock::now();
+        epoll_event events[MAX_EPOLL_EVENTS];
 
-        if (setsockopt(m_sockFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &m_mreq, sizeof(m_mreq)) == -1)
+        std::cout << "Waiting for multicast messages (recvmmsg, batch " << batches[0]->batchSize() << ")..."
+                  << std::endl;
+        while (!m_stopped)
         {
-            std::cerr << "Failed to join multicast group: " << strerror(errno) << std::endl;
-            throw std::runtime_error("Failed to join multicast group: " + std::string(strerror(errno)));
+            int ready = waitForGroups(events);
+            for (int i = 0; i < ready; ++i)
+            {
+                uint32_t group = events[i].data.u32;
+                int count = batches[group]->receive();
+                if (count == -1)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    {
+                        continue;
+                    }
+                    std::cerr << "Failed to receive message: " << strerror(errno) << std::endl;
+                    throw std::runtime_error("Failed to receive message");
+                }
+                handlers[group](batches[group]->datagrams(), count);
+            }
+
+            // Report kernel queue overflows at most once per second
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastDropReport >= std::chrono::seconds(1))
+            {
+                for (size_t group = 0; group < batches.size(); ++group)
+                {
+                    uint32_t drops = batches[group]->takeNewDrops();
+                    if (drops > 0)
+                    {
+                        LOG_WARNING("Kernel dropped {} packets on {} ({} total)", drops, m_names[group],
+                                    batches[group]->droppedPackets());
+                    }
+                }
+                lastDropReport = now;
+            }
         }
-        std::cout << "Successfully joined multicast group " << MULTICAST_ADDRESS << std::endl;
-        std::cout << "Listening for multicast messages on " << MULTICAST_ADDRESS << ":" << MULTICAST_PORT << std::endl;
     }
 
-    ~MulticastReceiver()
+    // This thread only receives; handler runs on the pipeline's worker threads. The pipeline reads a single
+    // socket, so this mode takes one group.
+    void receivePipeline(const PipelineOptions& options, const ReceivePipeline::Handler& handler)
     {
-        if (setsockopt(m_sockFd, IPPROTO_IP, IP_DROP_MEMBERSHIP, (void*)&m_mreq, sizeof(m_mreq)) < 0)
+        int fd = m_groups.fd(0);
+        // ReceivePipeline blocks in recvmmsg
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1)
         {
-            std::cerr << "Failed to drop multicast group: " << std::string(strerror(errno)) << std::endl;
+            throw std::runtime_error("Failed to make socket blocking: " + std::string(strerror(errno)));
         }
-        else
+        if (!DatagramBatch::enableDropCounter(fd))
         {
-            std::cout << "Left multicast group " << MULTICAST_ADDRESS << std::endl;
+            std::cerr << "Failed to enable SO_RXQ_OVFL, drops will not be reported" << std::endl;
         }
-        close(m_sockFd);
+        ReceivePipeline pipeline(fd, options, handler);
+
+        std::cout << "Waiting for multicast messages (pipeline, " << options.workers << " workers)..." << std::endl;
+        pipeline.run([](const PipelineStats& stats) { std::cerr << "Pipeline: " << stats << std::endl; });
     }
 
-    void receiveMessages()
+    // Every group from one TPACKET_V3 ring instead of its socket; sockets added with addSocket() are still read
+    // one datagram at a time
+    void receivePacketRing(const PacketRingOptions& options, const std::vector<GroupHandler>& handlers)
     {
-        char buffer[BUFFER_SIZE];
-        struct sockaddr_in senderAddress;
-        socklen_t senderLen = sizeof(senderAddress);
+        std::vector<PacketFlow> flows;
+        for (size_t group = 0; group < m_groups.size(); ++group)
+        {
+            const std::vector<GroupSubscription>& memberships = m_groups.memberships(group);
+            if (memberships.front().group.isIpv6())
+            {
+                throw std::runtime_error("Packet ring mode only parses IPv4: receive " + m_names[group] +
+                                         " in another mode");
+            }
+            PacketFlow flow;
+            flow.destination = memberships.front().group.ipv4().sin_addr;
+            flow.port = memberships.front().group.port();
+            for (const GroupSubscription& membership : memberships)
+            {
+                if (membership.sourceSpecific)
+                {
+                    flow.sources.push_back(membership.source.ipv4().sin_addr);
+                }
+            }
+            flows.push_back(flow);
 
-        std::cout << "Waiting for multicast messages..." << std::endl;
-        ssize_t bytesRead = recvfrom(m_sockFd, buffer, sizeof(buffer), 0, (struct sockaddr*)&senderAddress, &senderLen);
+            // The socket keeps its memberships, but the UDP stack no longer queues what the ring already has
+            if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, m_groups.fd(group), nullptr) == -1)
+            {
+                throw std::runtime_error("Failed to remove " + m_names[group] + " from epoll: " +
+                                         std::string(strerror(errno)));
+            }
+            SocketFilter::dropAll().attach(m_groups.fd(group));
+        }
 
+        PacketRing ring(flows, options);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = PACKET_RING_EVENT;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, ring.fd(), &event) == -1)
+        {
+            throw std::runtime_error("Failed to add the packet ring to epoll: " + std::string(strerror(errno)));
+        }
+        auto deliver = [&handlers](size_t group, const Datagram& datagram) { handlers[group](&datagram, 1); };
+        auto lastDropReport = std::chrono::steady_clock::now();
+        epoll_event events[MAX_EPOLL_EVENTS];
+
+        std::cout << "Waiting for multicast messages (packet ring on "
+                  << (options.interfaceName.empty() ? "every interface" : options.interfaceName) << ", "
+                  << options.blockCount << " blocks of " << options.blockSize << " bytes)..." << std::endl;
+        while (true)
+        {
+            int count = waitForGroups(events);
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t socket = events[i].data.u32;
+                if (socket == PACKET_RING_EVENT)
+                {
+                    ring.receive(deliver);
+                }
+                else
+                {
+                    receiveOne(socket, handlers[socket]);
+                }
+            }
+
+            // Report ring overflows at most once per second
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastDropReport >= std::chrono::seconds(1))
+            {
+                uint64_t drops = ring.takeNewDrops();
+                if (drops > 0)
+                {
+                    LOG_WARNING("Packet ring dropped {} frames", drops);
+                }
+                lastDropReport = now;
+            }
+        }
+    }
+
+    // One coroutine per socket on a single EventLoop, each awaiting recvmmsg batches for its handler. The tick and the
+    // drop report are coroutines of their own that sleep in between.
+    void receiveCoroutines(LoopBackend backend, unsigned batchSize, const std::vector<GroupHandler>& handlers)
+    {
+        EventLoop loop(backend);
+        std::vector<std::unique_ptr<DatagramBatch>> batches;
+        std::vector<std::unique_ptr<AsyncSocket>> sockets; // Destroyed before the loop
+        for (size_t socket = 0; socket < m_fds.size(); ++socket)
+        {
+            batches.push_back(std::make_unique<DatagramBatch>(m_fds[socket], batchSize, m_bufferSize));
+            if (!DatagramBatch::enableDropCounter(m_fds[socket]))
+            {
+                std::cerr << "Failed to enable SO_RXQ_OVFL, drops will not be reported" << std::endl;
+            }
+            sockets.push_back(std::make_unique<AsyncSocket>(loop, m_fds[socket]));
+            loop.spawn(receiveSocket(loop, *sockets[socket], *batches[socket], handlers[socket]));
+        }
+        if (m_tick)
+        {
+            loop.spawn(tickEvery(loop, std::chrono::milliseconds(m_tickIntervalMs)));
+        }
+        loop.spawn(reportDrops(loop, batches));
+
+        std::cout << "Waiting for multicast messages (" << m_fds.size() << " coroutines on "
+                  << (backend == LoopBackend::Epoll ? "epoll" : "io_uring") << ", batch " << batchSize << ")..."
+                  << std::endl;
+        loop.run();
+    }
+
+#ifdef ENABLE_IO_URING
+    // One multishot recvmsg request per group, tagged with the group index; all of them share one buffer ring
+    void receiveMessagesIoUring(const std::vector<GroupHandler>& handlers)
+    {
+        IoUring ring(URING_ENTRIES);
+        size_t controlSize = m_timestamps ? TIMESTAMP_CONTROL_SIZE : 0;
+        ProvidedBufferRing buffers(ring, URING_BUFFER_GROUP, URING_BUFFER_COUNT,
+                                   sizeof(io_uring_recvmsg_out) + SocketAddress::capacity() + controlSize +
+                                       m_bufferSize);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_namelen = SocketAddress::capacity();
+        msg.msg_controllen = controlSize;
+
+        std::cout << "Waiting for multicast messages (io_uring)..." << std::endl;
+        for (size_t group = 0; group < m_fds.size(); ++group)
+        {
+            IoUring::prepareMultishotRecvmsg(ring.getSqe(), m_fds[group], &msg, URING_BUFFER_GROUP, group);
+        }
+        while (true)
+        {
+            if (ring.submitAndWait(1) < 0)
+            {
+                throw std::runtime_error("Failed to submit to io_uring: " + std::string(strerror(errno)));
+            }
+
+            ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+                size_t group = static_cast<size_t>(cqe.user_data);
+                if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+                {
+                    uint16_t bufferId = ProvidedBufferRing::bufferId(cqe);
+                    RecvmsgPayload payload = IoUring::parseRecvmsg(buffers.buffer(bufferId), cqe.res, msg);
+                    SocketAddress sender(payload.name, payload.nameLength);
+                    Datagram datagram{payload.data, payload.length, &sender, payload.truncated, payload.timestamps};
+                    countDatagram(datagram);
+                    handlers[group](&datagram, 1);
+                    buffers.recycle(bufferId);
+                    if (m_tick)
+                    {
+                        m_tick();
+                    }
+                }
+                else if (cqe.res < 0 && cqe.res != -ENOBUFS)
+                {
+                    trafficMetrics().errors.add();
+                    std::cerr << "Failed to receive message: " << strerror(-cqe.res) << std::endl;
+                    throw std::runtime_error("Failed to receive message");
+                }
+
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    IoUring::prepareMultishotRecvmsg(ring.getSqe(), m_fds[group], &msg, URING_BUFFER_GROUP, group);
+                }
+            });
+        }
+    }
+#endif
+
+private:
+    MulticastGroups m_groups;
+    int m_epollFd;
+    std::vector<int> m_fds; // Indexed like the handler table
+    std::vector<std::string> m_names;
+    bool m_timestamps;
+    size_t m_bufferSize;        // Largest datagram every mode receives without truncation
+    std::vector<char> m_buffer; // Blocking mode, allocated once
+    std::function<void()> m_tick;
+    int m_tickIntervalMs = -1;
+    bool m_stopped = false; // The stopOn() descriptor turned readable
+    std::unique_ptr<SpinMeter> m_spinMeter; // Spin mode
+    std::chrono::steady_clock::time_point m_nextTick;
+    std::chrono::steady_clock::time_point m_nextSpinReport;
+
+    Task<void> receiveSocket(EventLoop& loop, AsyncSocket& socket, DatagramBatch& batch, const GroupHandler& handler)
+    {
+        while (true)
+        {
+            int count = co_await socket.receiveBatch(batch);
+            if (count == -1)
+            {
+                std::cerr << "Failed to receive message: " << strerror(errno) << std::endl;
+                throw std::runtime_error("Failed to receive message");
+            }
+            handler(batch.datagrams(), count);
+            // Back of the queue, so a busy group cannot starve the others
+            co_await loop.yield();
+        }
+    }
+
+    Task<void> tickEvery(EventLoop& loop, std::chrono::milliseconds interval)
+    {
+        while (true)
+        {
+            co_await loop.sleepFor(interval);
+            m_tick();
+        }
+    }
+
+    // Kernel queue overflows, at most once per second
+    Task<void> reportDrops(EventLoop& loop, const std::vector<std::unique_ptr<DatagramBatch>>& batches)
+    {
+        while (true)
+        {
+            co_await loop.sleepFor(std::chrono::seconds(1));
+            for (size_t socket = 0; socket < batches.size(); ++socket)
+            {
+                uint32_t drops = batches[socket]->takeNewDrops();
+                if (drops > 0)
+                {
+                    LOG_WARNING("Kernel dropped {} packets on {} ({} total)", drops, m_names[socket],
+                                batches[socket]->droppedPackets());
+                }
+            }
+        }
+    }
+
+    // Read one datagram from a readable non-blocking socket and hand it to handler
+    void receiveOne(uint32_t socket, const GroupHandler& handler)
+    {
+        char control[TIMESTAMP_CONTROL_SIZE];
+        SocketAddress senderAddress;
+        struct iovec iov = {m_buffer.data(), m_bufferSize};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = senderAddress.data();
+        msg.msg_namelen = SocketAddress::capacity();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t bytesRead = recvmsg(m_fds[socket], &msg, 0);
+        /*
+        recvmsg(int sockfd, struct msghdr *msg, int flags)
+        recvfrom() plus ancillary data: msg_control receives control messages such as SCM_TIMESTAMPING
+        return number of bytes received if success
+        return -1 if failed (EAGAIN: nothing queued on this non-blocking socket)
+        */
         if (bytesRead == -1)
         {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                trafficMetrics().wouldBlock.add();
+                return;
+            }
+            if (errno == EINTR)
+            {
+                return;
+            }
+            trafficMetrics().errors.add();
             std::cerr << "Failed to receive message: " << strerror(errno) << std::endl;
             throw std::runtime_error("Failed to receive message");
         }
 
-        std::cout << "Received message from " << inet_ntoa(senderAddress.sin_addr) << ":"
-                  << ntohs(senderAddress.sin_port) << std::endl;
-        std::cout << "Message: " << std::string(buffer, bytesRead) << std::endl;
+        Datagram datagram{m_buffer.data(), static_cast<size_t>(bytesRead), &senderAddress,
+                          (msg.msg_flags & MSG_TRUNC) != 0, PacketTimestamps()};
+        parseTimestamps(msg, datagram.timestamps);
+        countDatagram(datagram);
+        handler(&datagram, 1);
     }
 
-private:
-    int m_sockFd;
-    struct sockaddr_in m_receiverAddress;
-    struct ip_mreq m_mreq;
+    // DatagramBatch and PacketRing count their own datagrams; the blocking and io_uring paths read one at a time
+    static void countDatagram(const Datagram& datagram)
+    {
+        TrafficMetrics& metrics = trafficMetrics();
+        metrics.countReceived(datagram.length, datagram.timestamps.softwareNs, realtimeNs());
+        if (datagram.truncated)
+        {
+            metrics.truncated.add();
+        }
+    }
+
+    // Poll until something is ready, never sleeping; the tick and the spin report run on schedule in between
+    int spinForGroups(epoll_event* events)
+    {
+        while (true)
+        {
+            int count = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, 0);
+            /*
+            epoll_wait() with a timeout of 0 returns at once, with the sockets ready now or none: the thread
+            stays on its CPU instead of sleeping until the next datagram's wakeup
+            */
+            auto now = m_spinMeter->poll(count > 0);
+            if (m_tick && now >= m_nextTick)
+            {
+                m_tick();
+                m_nextTick = now + std::chrono::milliseconds(m_tickIntervalMs);
+            }
+            if (now >= m_nextSpinReport)
+            {
+                std::cerr << "Spin: " << m_spinMeter->take() << std::endl;
+                m_nextSpinReport = now + std::chrono::milliseconds(SPIN_REPORT_INTERVAL_MS);
+            }
+            if (count != 0)
+            {
+                return count;
+            }
+        }
+    }
+
+    int waitForGroups(epoll_event* events)
+    {
+        while (true)
+        {
+            int count;
+            int error;
+            if (m_spinMeter)
+            {
+                count = spinForGroups(events);
+                error = errno;
+            }
+            else
+            {
+                count = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, m_tick ? m_tickIntervalMs : -1);
+                error = errno;
+                if (m_tick)
+                {
+                    m_tick();
+                }
+            }
+            if (count != -1 || error != EINTR)
+            {
+                if (count == -1)
+                {
+                    throw std::runtime_error("Failed to wait for messages: " + std::string(strerror(error)));
+                }
+                // The stop event is not a socket: take it out and let the caller finish this round
+                int sockets = 0;
+                for (int i = 0; i < count; ++i)
+                {
+                    if (events[i].data.u32 == HOT_RESTART_EVENT)
+                    {
+                        m_stopped = true;
+                    }
+                    else
+                    {
+                        events[sockets++] = events[i];
+                    }
+                }
+                return sockets;
+            }
+        }
+    }
 };
 
+enum class ReceiveMode
+{
+    Blocking,
+    Batch,
+    IoUring,
+    Pipeline,
+    PacketRing,
+    Coroutine
+};
+
+static void printBatch(const std::string& group, const Datagram* datagrams, size_t count)
+{
+    int64_t now = realtimeNs();
+    for (size_t i = 0; i < count; ++i)
+    {
+        logDatagram("", group, datagrams[i], now);
+    }
+}
+
+// Runs on the pipeline workers; each has its own log ring, so no lock is needed to keep messages whole
+static void printDatagram(unsigned worker, const Datagram& datagram)
+{
+    logWorkerDatagram(worker, datagram, realtimeNs());
+}
+
+// A sequenced stream message, delivered in order; the feed is the group its first copy came in on
+static void printSequenced(const std::vector<std::string>& groups, const SequenceHeader& header,
+                           std::string_view payload, unsigned feed)
+{
+    if (const TextMessage* message = readMessage<TextMessage>(payload.data(), payload.size()))
+    {
+        payload = messageTail(*message);
+    }
+    LOG_INFO("Message #{} of stream {} via {} ({} us after sending): {}", header.sequence, header.stream,
+             groups[feed], (realtimeNs() - header.sendTimeNs) / 1000, payload);
+}
+
+static void printGap(uint32_t stream, uint64_t first, uint64_t count)
+{
+    if (count > 1)
+    {
+        LOG_WARNING("Gap in stream {}: lost #{}-#{}", stream, first, first + count - 1);
+    }
+    else
+    {
+        LOG_WARNING("Gap in stream {}: lost #{}", stream, first);
+    }
+}
+
 int main(int argc, char* argv[])
 {
-    MulticastReceiver receiver;
+    ReceiveMode mode = ReceiveMode::Blocking;
+    LoopBackend loopBackend = LoopBackend::Epoll;
+    unsigned batchSize = DEFAULT_BATCH_SIZE;
+    size_t bufferSize = DEFAULT_BUFFER_SIZE;
+    PipelineOptions pipelineOptions;
+    pipelineOptions.workers = DEFAULT_PIPELINE_WORKERS;
+    pipelineOptions.queueCapacity = DEFAULT_PIPELINE_QUEUE;
+    SocketOptions socketOptions =
+        SocketOptions().reuseAddress(SOCKET_OPTION_ENABLE_REUSEADDR).reusePort(SOCKET_OPTION_ENABLE_REUSEPORT);
+    TimestampOptions timestampOptions;
+    std::vector<GroupSubscription> subscriptions;
+    bool sequenced = false;
+    SequencerOptions sequencerOptions;
+    NackOptions nackOptions;
+    PacketRingOptions ringOptions;
+    LogOptions logOptions;
+    MetricsOptions metricsOptions;
+    HotRestartOptions restartOptions;
+    SpinOptions spinOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            if (socketOptions.parseArgument(argc, argv, i) || timestampOptions.parseArgument(argc, argv, i) ||
+                nackOptions.parseArgument(argc, argv, i) || ringOptions.parseArgument(argc, argv, i) ||
+                logOptions.parseArgument(argc, argv, i) || metricsOptions.parseArgument(argc, argv, i) ||
+                restartOptions.parseArgument(argc, argv, i) || spinOptions.parseArgument(argc, argv, i))
+            {
+                continue;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--join" && !value.empty())
+        {
+            try
+            {
+                subscriptions.push_back(GroupSubscription::parse(value));
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            ++i;
+        }
+        else if (arg == "--mode" && (value == "blocking" || value == "batch" || value == "io_uring" ||
+                                     value == "pipeline" || value == "packet_ring" || value == "coroutine"))
+        {
+            mode = value == "blocking"      ? ReceiveMode::Blocking
+                   : value == "batch"       ? ReceiveMode::Batch
+                   : value == "io_uring"    ? ReceiveMode::IoUring
+                   : value == "pipeline"    ? ReceiveMode::Pipeline
+                   : value == "packet_ring" ? ReceiveMode::PacketRing
+                                            : ReceiveMode::Coroutine;
+            ++i;
+        }
+        else if (arg == "--loop" && (value == "epoll" || value == "io_uring"))
+        {
+            loopBackend = value == "epoll" ? LoopBackend::Epoll : LoopBackend::IoUring;
+            ++i;
+        }
+        else if (arg == "--batch" && atoi(value.c_str()) > 0)
+        {
+            batchSize = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--buffer-size" && atoi(value.c_str()) > 0)
+        {
+            bufferSize = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--sequenced")
+        {
+            sequenced = true;
+        }
+        else if (arg == "--reorder-window" && atoi(value.c_str()) > 0)
+        {
+            sequencerOptions.window = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--reorder-delay-us" && atoi(value.c_str()) >= 0 && !value.empty())
+        {
+            sequencerOptions.maxDelay = std::chrono::microseconds(atoi(value.c_str()));
+            ++i;
+        }
+        else if (arg == "--workers" && atoi(value.c_str()) > 0)
+        {
+            pipelineOptions.workers = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--queue" && atoi(value.c_str()) > 0)
+        {
+            pipelineOptions.queueCapacity = atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--backpressure" && (value == "block" || value == "drop"))
+        {
+            pipelineOptions.backpressure = value == "block" ? Backpressure::Block : Backpressure::Drop;
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--join GROUP:PORT[@INTERFACE][/SOURCE]]... "
+                      << "[--mode blocking|batch|io_uring|pipeline|packet_ring|coroutine] [--loop epoll|io_uring] "
+                      << "[--batch N] [--buffer-size N] "
+                      << "[--sequenced [--reorder-window N] [--reorder-delay-us U]] " << NackOptions::usage() << " "
+                      << "[--workers N] [--queue N] [--backpressure block|drop] " << PacketRingOptions::usage() << " "
+                      << TimestampOptions::usage() << " " << SocketOptions::usage() << " " << LogOptions::usage()
+                      << " " << MetricsOptions::usage() << " [--hot-restart PATH] " << SpinOptions::usage()
+                      << std::endl;
+            return 1;
+        }
+    }
+#ifndef ENABLE_IO_URING
+    if (mode == ReceiveMode::IoUring || loopBackend == LoopBackend::IoUring)
+    {
+        std::cerr << "Built without io_uring support (configure with -DENABLE_IO_URING=ON)" << std::endl;
+        return 1;
+    }
+#endif
+
+    if (nackOptions.enabled && !sequenced)
+    {
+        std::cerr << "--nack needs --sequenced" << std::endl;
+        return 1;
+    }
+
+    // The other modes never return to check for the stop, and packet ring mode attaches a drop-all filter to the
+    // group sockets, which the next process would inherit with them
+    if (restartOptions.enabled() && mode != ReceiveMode::Blocking && mode != ReceiveMode::Batch)
+    {
+        std::cerr << "--hot-restart works in blocking and batch modes" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        spinOptions.validate();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    // The other modes wait in io_uring, recvmmsg or the coroutine loop, not in waitForGroups()
+    if (spinOptions.enabled() && mode != ReceiveMode::Blocking && mode != ReceiveMode::Batch &&
+        mode != ReceiveMode::PacketRing)
+    {
+        std::cerr << "--spin works in blocking, batch and packet_ring modes" << std::endl;
+        return 1;
+    }
+
+    if (subscriptions.empty())
+    {
+        subscriptions.push_back(
+            GroupSubscription::parse(std::string(MULTICAST_ADDRESS) + ":" + std::to_string(MULTICAST_PORT)));
+    }
+
+    logOptions.apply();
+    // Takes the sockets over from a receiver running with the same path, before any of them is opened
+    std::unique_ptr<HotRestart> restart;
+    try
+    {
+        if (restartOptions.enabled())
+        {
+            restart = std::make_unique<HotRestart>(restartOptions.path);
+        }
+        metricsOptions.apply(restart.get());
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    pipelineOptions.bufferSize = bufferSize;
+    MulticastReceiver receiver(subscriptions, socketOptions, timestampOptions, bufferSize, restart.get());
+    if (mode == ReceiveMode::Pipeline && (receiver.socketCount() > 1 || sequenced))
+    {
+        std::cerr << "Pipeline mode takes a single group and no --sequenced" << std::endl;
+        return 1;
+    }
+
+    // Retransmitted messages come back on the NACK socket, which is one more feed of the same sequencers
+    std::unique_ptr<NackRequester> nacks;
+    if (nackOptions.enabled)
+    {
+        nacks = std::make_unique<NackRequester>(nackOptions, sequencerOptions.maxStreams);
+        receiver.addSocket(nacks->fd(), "retransmits");
+    }
+
+    // Every socket is offered by now: the previous receiver stops, and this one answers the next
+    if (restart)
+    {
+        try
+        {
+            restart->start();
+            receiver.stopOn(restart->stopFd());
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // Built once: the receive loops index it with the group a socket belongs to
+    std::vector<GroupHandler> handlers;
+    std::vector<std::string> groupNames;
+    for (size_t group = 0; group < receiver.socketCount(); ++group)
+    {
+        groupNames.push_back(receiver.socketName(group));
+    }
+
+    // Sequenced: every group feeds one table, so groups carrying the same stream are merged (A/B arbitration)
+    sequencerOptions.slotSize = bufferSize;
+    SequencerTable sequencers(sequencerOptions);
+    auto deliver = [&groupNames](const SequenceHeader& header, std::string_view payload, unsigned feed) {
+        printSequenced(groupNames, header, payload, feed);
+    };
+    if (sequenced)
+    {
+        for (size_t group = 0; group < receiver.socketCount(); ++group)
+        {
+            handlers.push_back([&, group](const Datagram* datagrams, size_t count) {
+                int64_t now = realtimeNs();
+                for (size_t i = 0; i < count; ++i)
+                {
+                    Sequencer* sequencer =
+                        sequencers.push(group, datagrams[i].data, datagrams[i].length, now, deliver, printGap);
+                    if (sequencer == nullptr)
+                    {
+                        printBatch(groupNames[group], &datagrams[i], 1);
+                    }
+                    else if (nacks)
+                    {
+                        nacks->observe(sequencer->stream(), *datagrams[i].sender);
+                    }
+                }
+            });
+        }
+
+        // Holes time out even when the stream goes quiet; counters are reported once per second while they change
+        auto lastReport = std::chrono::steady_clock::now();
+        uint64_t lastReceived = 0;
+        receiver.setTick(
+            [&]() {
+                int64_t nowNs = realtimeNs();
+                if (nacks)
+                {
+                    nacks->poll(nowNs, sequencers);
+                }
+                sequencers.expire(nowNs, deliver, printGap);
+                auto now = std::chrono::steady_clock::now();
+                if (now - lastReport < std::chrono::seconds(1))
+                {
+                    return;
+                }
+                lastReport = now;
+                SequencerStats stats = sequencers.stats();
+                if (stats.received != lastReceived)
+                {
+                    std::cerr << "Sequencer: " << stats << ", unsequenced " << sequencers.rejected() << std::endl;
+                    if (nacks)
+                    {
+                        std::cerr << "NACK: " << nacks->stats() << std::endl;
+                    }
+                    lastReceived = stats.received;
+                }
+            },
+            SEQUENCER_TICK_MS);
+    }
+    else
+    {
+        for (size_t group = 0; group < receiver.socketCount(); ++group)
+        {
+            const std::string& name = groupNames[group];
+            handlers.push_back(
+                [&name](const Datagram* datagrams, size_t count) { printBatch(name, datagrams, count); });
+        }
+    }
+
+    // Last, so the memory locked includes every buffer and the setup ran at normal priority
+    try
+    {
+        spinOptions.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (spinOptions.enabled())
+    {
+        receiver.spin();
+    }
+
+#ifdef ENABLE_IO_URING
+    if (mode == ReceiveMode::IoUring)
+    {
+        receiver.receiveMessagesIoUring(handlers);
+    }
+#endif
+
+    if (mode == ReceiveMode::Batch)
+    {
+        receiver.receiveBatches(batchSize, handlers);
+    }
+
+    if (mode == ReceiveMode::Pipeline)
+    {
+        pipelineOptions.batchSize = batchSize;
+        receiver.receivePipeline(pipelineOptions, printDatagram);
+    }
+
+    if (mode == ReceiveMode::Coroutine)
+    {
+        receiver.receiveCoroutines(loopBackend, batchSize, handlers);
+    }
+
+    if (mode == ReceiveMode::PacketRing)
+    {
+        ringOptions.hardwareTimestamps = timestampOptions.source == TimestampSource::Hardware;
+        try
+        {
+            receiver.receivePacketRing(ringOptions, handlers);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-    while (true)
+    if (mode == ReceiveMode::Blocking)
     {
-        receiver.receiveMessages();
+        receiver.receiveMessages(handlers);
     }
 
+    // Only a hot restart ends the blocking and batch loops
+    std::cout << "Handed over to the new receiver, exiting" << std::endl;
+    receiver.keepMemberships();
     return 0;
 }
@@ -0,0 +1,758 @@
+/**
+ * @file bench.cpp
+ * @brief Throughput and latency benchmark for the example transports
+ *
+ * Runs a load generator and a sink in one process over the local host for every combination of
+ * transport, address family, message size, connection count and batch size, and reports
+ * messages/s, Gbit/s and p50/p99/p99.9/max one-way latency. It showcases:
+ * - Embedding a CLOCK_MONOTONIC send timestamp in every message (generator and sink share the clock)
+ * - TCP: length-prefixed frames, batch frames coalesced per send(), epoll sink with FrameDecoder
+ * - UDP broadcast/multicast: sendto or DatagramPublisher (sendmmsg) per batch, recvmmsg sink
+ * - One code path for both address families through SocketAddress, so IPv4 and IPv6 runs differ only
+ *   in the family (and IPV6_JOIN_GROUP instead of IP_ADD_MEMBERSHIP for multicast)
+ * - Log-linear latency histograms (net/latency_histogram.h)
+ * - JSON results for tracking regressions
+ * - Live traffic counters and latency served to Prometheus while it runs (--metrics-port, see net/metrics.h)
+ *
+ * Usage: bench [--transport tcp,broadcast,multicast] [--family ipv4,ipv6] [--sizes 64,1024] [--connections 1,4]
+ *              [--batch 1,32]
+ *              [--duration SECONDS] [--rate MSGS_PER_SEC] [--output FILE]
+ *              [--socket-config FILE] [--sockopt KEY=VALUE]...
+ *              [--metrics-port PORT [--metrics-address IP]]
+ *
+ * @note UDP is unreliable: "received" below "sent" means the sink's socket queue overflowed.
+ *       Use --rate to find the sustainable load, or --sockopt rcvbuf=N to absorb bursts.
+ * @note IPv6 has no broadcast, so broadcast runs are IPv4 only
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net/datagram_batch.h"
+#include "net/datagram_publisher.h"
+#include "net/framing.h"
+#include "net/latency_histogram.h"
+#include "net/metrics.h"
+#include "net/socket.h"
+
+#define BENCH_TCP_ADDRESS "127.0.0.1"
+#define BENCH_TCP_ADDRESS6 "::1"
+#define BENCH_TCP_PORT 18080
+#define BENCH_BROADCAST_ADDRESS "255.255.255.255"
+#define BENCH_BROADCAST_PORT 18772
+#define BENCH_MULTICAST_ADDRESS "238.238.238.239"
+#define BENCH_MULTICAST_ADDRESS6 "ff15::eeef" // Site-local scope, like the 238/8 IPv4 group
+#define BENCH_MULTICAST_PORT 18773
+#define BENCH_LISTEN_BACKLOG 1024
+#define BENCH_IDLE_TIMEOUT_MS 200 // The UDP sink stops after this long without datagrams once generators finish
+#define BENCH_MAX_EPOLL_EVENTS 64
+#define BENCH_DEFAULT_OUTPUT "bench-results.json"
+
+// Every message starts with this header; the rest of the payload is filler
+struct MessageHeader
+{
+    uint64_t sendTimeNs;
+    uint64_t sequence;
+};
+
+enum class Transport
+{
+    Tcp,
+    Broadcast,
+    Multicast
+};
+
+struct BenchConfig
+{
+    std::vector<Transport> transports = {Transport::Tcp, Transport::Broadcast, Transport::Multicast};
+    std::vector<int> families = {AF_INET};
+    std::vector<size_t> sizes = {64, 1024};
+    std::vector<unsigned> connections = {1, 4};
+    std::vector<unsigned> batches = {1, 32};
+    double duration = 1.0;
+    uint64_t rate = 0; // Messages per second per connection, 0 = as fast as possible
+    std::string output = BENCH_DEFAULT_OUTPUT;
+    SocketOptions socket = SocketOptions().reuseAddress(true).reusePort(true);
+    MetricsOptions metrics;
+};
+
+struct RunResult
+{
+    Transport transport;
+    int family;
+    size_t messageSize;
+    unsigned connections;
+    unsigned batch;
+    uint64_t sent;
+    uint64_t received;
+    double seconds;
+    LatencyHistogram latency;
+};
+
+static const char* transportName(Transport transport)
+{
+    switch (transport)
+    {
+    case Transport::Tcp:
+        return "tcp";
+    case Transport::Broadcast:
+        return "broadcast";
+    default:
+        return "multicast";
+    }
+}
+
+static const char* familyName(int family)
+{
+    return family == AF_INET6 ? "ipv6" : "ipv4";
+}
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static void stampMessage(char* message, uint64_t sequence)
+{
+    MessageHeader header{nowNs(), sequence};
+    memcpy(message, &header, sizeof(header));
+}
+
+static Histogram& oneWayLatency =
+    Metrics::instance().histogram("bench_latency_seconds", "One-way latency of every run so far");
+
+static void recordMessage(const char* message, size_t length, LatencyHistogram& latency)
+{
+    if (length < sizeof(MessageHeader))
+    {
+        return;
+    }
+    MessageHeader header;
+    memcpy(&header, message, sizeof(header));
+    uint64_t latencyNs = nowNs() - header.sendTimeNs;
+    latency.record(latencyNs);
+    oneWayLatency.record(latencyNs);
+}
+
+// Sleep until message number sent is due when pacing with --rate
+static void pace(uint64_t rate, uint64_t startNs, uint64_t sent)
+{
+    if (rate == 0)
+    {
+        return;
+    }
+    uint64_t dueNs = startNs + sent * 1000000000ULL / rate;
+    uint64_t now = nowNs();
+    if (dueNs > now)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - now));
+    }
+}
+
+static SocketAddress makeAddress(int family, const char* ipv4, const char* ipv6, int port)
+{
+    return SocketAddress::parse(family == AF_INET6 ? ipv6 : ipv4, static_cast<uint16_t>(port));
+}
+
+static bool sendAll(int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t bytesSent = send(fd, data, length, MSG_NOSIGNAL);
+        if (bytesSent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            trafficMetrics().errors.add();
+            return false;
+        }
+        trafficMetrics().bytesSent.add(bytesSent);
+        data += bytesSent;
+        length -= bytesSent;
+    }
+    return true;
+}
+
+// One generator thread per connection writes batch frames per send(); the calling thread drains every
+// connection with edge-triggered epoll
+static RunResult runTcp(const BenchConfig& config, int family, size_t messageSize, unsigned connections,
+                        unsigned batch)
+{
+    RunResult result{Transport::Tcp, family, messageSize, connections, batch, 0, 0, 0.0, {}};
+    SocketAddress address = makeAddress(family, BENCH_TCP_ADDRESS, BENCH_TCP_ADDRESS6, BENCH_TCP_PORT);
+
+    Socket listener(family, SOCK_STREAM);
+    listener.apply(config.socket).bind(address).listen(BENCH_LISTEN_BACKLOG);
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1)
+    {
+        throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+    }
+
+    std::vector<Socket> clients;
+    std::unordered_map<int, FrameDecoder> decoders;
+    size_t maxFrameSize = messageSize + FRAME_MAX_HEADER_SIZE;
+    for (unsigned i = 0; i < connections; ++i)
+    {
+        Socket client(family, SOCK_STREAM);
+        client.apply(config.socket).connect(address);
+        clients.push_back(std::move(client));
+
+        int fd = accept4(listener.fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            break;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        decoders.emplace(std::piecewise_construct, std::forward_as_tuple(fd),
+                         std::forward_as_tuple(std::max<size_t>(maxFrameSize * batch, 1 << 18), maxFrameSize));
+    }
+    if (decoders.size() != connections)
+    {
+        int error = errno;
+        for (auto& entry : decoders)
+        {
+            close(entry.first);
+        }
+        close(epollFd);
+        throw std::runtime_error("Failed to accept benchmark connection: " + std::string(strerror(error)));
+    }
+
+    std::atomic<uint64_t> sent{0};
+    uint64_t startNs = nowNs();
+    uint64_t stopNs = startNs + static_cast<uint64_t>(config.duration * 1e9);
+    std::vector<std::thread> generators;
+    for (Socket& client : clients)
+    {
+        int fd = client.fd();
+        generators.emplace_back([&config, &sent, fd, messageSize, batch, startNs, stopNs]() {
+            char header[FRAME_MAX_HEADER_SIZE];
+            size_t headerLength = encodeFrameHeader(FRAME_TYPE_BINARY, messageSize, header);
+            size_t frameLength = headerLength + messageSize;
+            std::vector<char> frames(frameLength * batch, 0);
+            for (unsigned i = 0; i < batch; ++i)
+            {
+                memcpy(&frames[i * frameLength], header, headerLength);
+            }
+
+            uint64_t count = 0;
+            while (nowNs() < stopNs)
+            {
+                pace(config.rate, startNs, count);
+                for (unsigned i = 0; i < batch; ++i)
+                {
+                    stampMessage(&frames[i * frameLength + headerLength], count + i);
+                }
+                if (!sendAll(fd, frames.data(), frames.size()))
+                {
+                    break;
+                }
+                count += batch;
+                trafficMetrics().packetsSent.add(batch);
+            }
+            sent += count;
+            shutdown(fd, SHUT_WR);
+        });
+    }
+
+    // Sink: drain until every generator has closed its side
+    uint64_t lastReceiveNs = startNs;
+    epoll_event events[BENCH_MAX_EPOLL_EVENTS];
+    while (!decoders.empty())
+    {
+        int ready = epoll_wait(epollFd, events, BENCH_MAX_EPOLL_EVENTS, -1);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+        }
+
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+            FrameDecoder& decoder = decoders.at(fd);
+            bool closed = false;
+            while (true)
+            {
+                ssize_t bytesReceived = recv(fd, decoder.writePointer(), decoder.writableBytes(), 0);
+                if (bytesReceived <= 0)
+                {
+                    closed = bytesReceived == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+                    if (bytesReceived == -1 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    break;
+                }
+                decoder.commitWrite(bytesReceived);
+                trafficMetrics().bytesReceived.add(bytesReceived);
+                FrameStatus status = decoder.drain([&result](uint8_t, std::string_view payload) {
+                    recordMessage(payload.data(), payload.size(), result.latency);
+                    ++result.received;
+                    trafficMetrics().packetsReceived.add();
+                });
+                lastReceiveNs = nowNs();
+                if (status != FrameStatus::Ok)
+                {
+                    closed = true;
+                    break;
+                }
+            }
+            if (closed)
+            {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                decoders.erase(fd);
+            }
+        }
+    }
+    close(epollFd);
+
+    for (std::thread& generator : generators)
+    {
+        generator.join();
+    }
+    result.sent = sent;
+    result.seconds = (lastReceiveNs - startNs) / 1e9;
+    return result;
+}
+
+// One generator thread per sender socket (sendto, or DatagramPublisher when batch > 1); the calling thread
+// receives with recvmmsg until the generators are done and the socket stays idle for BENCH_IDLE_TIMEOUT_MS
+static RunResult runUdp(const BenchConfig& config, Transport transport, int family, size_t messageSize,
+                        unsigned connections, unsigned batch)
+{
+    RunResult result{transport, family, messageSize, connections, batch, 0, 0, 0.0, {}};
+    bool multicast = transport == Transport::Multicast;
+    if (!multicast && family == AF_INET6)
+    {
+        throw std::runtime_error("IPv6 has no broadcast");
+    }
+    int port = multicast ? BENCH_MULTICAST_PORT : BENCH_BROADCAST_PORT;
+    SocketAddress destination = multicast
+                                    ? makeAddress(family, BENCH_MULTICAST_ADDRESS, BENCH_MULTICAST_ADDRESS6, port)
+                                    : SocketAddress::parse(BENCH_BROADCAST_ADDRESS, static_cast<uint16_t>(port));
+
+    Socket sink(family, SOCK_DGRAM);
+    sink.apply(config.socket).bind(SocketAddress::any(family, port));
+    if (multicast && family == AF_INET6)
+    {
+        ipv6_mreq mreq{};
+        mreq.ipv6mr_multiaddr = destination.ipv6().sin6_addr;
+        mreq.ipv6mr_interface = 0; // The interface the route to the group goes through
+        if (setsockopt(sink.fd(), IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == -1)
+        {
+            throw std::runtime_error("Failed to join multicast group: " + std::string(strerror(errno)));
+        }
+    }
+    else if (multicast)
+    {
+        ip_mreq mreq;
+        mreq.imr_multiaddr = destination.ipv4().sin_addr;
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        if (setsockopt(sink.fd(), IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+        {
+            throw std::runtime_error("Failed to join multicast group: " + std::string(strerror(errno)));
+        }
+    }
+    timeval timeout{0, BENCH_IDLE_TIMEOUT_MS * 1000};
+    setsockopt(sink.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::vector<Socket> senders;
+    for (unsigned i = 0; i < connections; ++i)
+    {
+        Socket sender(family, SOCK_DGRAM);
+        sender.apply(config.socket);
+        int enable = 1;
+        if (multicast && family == AF_INET6)
+        {
+            unsigned int loop = 1;
+            setsockopt(sender.fd(), IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+        }
+        else if (multicast)
+        {
+            unsigned char loop = 1;
+            setsockopt(sender.fd(), IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        }
+        else if (setsockopt(sender.fd(), SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable)) == -1)
+        {
+            throw std::runtime_error("Failed to set SO_BROADCAST: " + std::string(strerror(errno)));
+        }
+        senders.push_back(std::move(sender));
+    }
+
+    std::atomic<uint64_t> sent{0};
+    std::atomic<unsigned> finished{0};
+    uint64_t startNs = nowNs();
+    uint64_t stopNs = startNs + static_cast<uint64_t>(config.duration * 1e9);
+    std::vector<std::thread> generators;
+    for (Socket& sender : senders)
+    {
+        int fd = sender.fd();
+        generators.emplace_back([&config, &sent, &finished, &destination, fd, messageSize, batch, startNs, stopNs]() {
+            std::vector<char> message(messageSize, 0);
+            uint64_t count = 0;
+            if (batch > 1)
+            {
+                PublisherOptions options;
+                options.maxMessages = batch;
+                options.maxBytes = batch * messageSize;
+                options.maxDelay = std::chrono::seconds(1);
+                DatagramPublisher publisher(fd, destination, options);
+                for (uint64_t attempted = 0; nowNs() < stopNs; ++attempted)
+                {
+                    pace(config.rate, startNs, attempted);
+                    // Stamp the header straight into the send slab; the filler is whatever the slab held
+                    stampMessage(publisher.reserve(messageSize), attempted);
+                    publisher.commit(messageSize);
+                }
+                publisher.flush();
+                count = publisher.stats().datagrams;
+            }
+            else
+            {
+                for (uint64_t attempted = 0; nowNs() < stopNs; ++attempted)
+                {
+                    pace(config.rate, startNs, attempted);
+                    stampMessage(message.data(), attempted);
+                    if (sendto(fd, message.data(), message.size(), 0, destination.data(), destination.size()) ==
+                        static_cast<ssize_t>(message.size()))
+                    {
+                        ++count;
+                        trafficMetrics().packetsSent.add();
+                        trafficMetrics().bytesSent.add(message.size());
+                    }
+                    else
+                    {
+                        trafficMetrics().errors.add();
+                    }
+                }
+            }
+            sent += count;
+            ++finished;
+        });
+    }
+
+    unsigned connectionCount = connections;
+    DatagramBatch datagrams(sink.fd(), batch, messageSize);
+    uint64_t lastReceiveNs = startNs;
+    while (true)
+    {
+        int count = datagrams.receive();
+        if (count == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (finished == connectionCount)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("Failed to receive datagrams: " + std::string(strerror(errno)));
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const Datagram& datagram = datagrams.datagrams()[i];
+            recordMessage(datagram.data, datagram.length, result.latency);
+        }
+        result.received += count;
+        lastReceiveNs = nowNs();
+    }
+
+    for (std::thread& generator : generators)
+    {
+        generator.join();
+    }
+    result.sent = sent;
+    result.seconds = (lastReceiveNs - startNs) / 1e9;
+    return result;
+}
+
+static double messagesPerSecond(const RunResult& result)
+{
+    return result.seconds > 0 ? result.received / result.seconds : 0.0;
+}
+
+static double gigabitsPerSecond(const RunResult& result)
+{
+    return result.seconds > 0 ? result.received * result.messageSize * 8 / result.seconds / 1e9 : 0.0;
+}
+
+static void printResult(const RunResult& result)
+{
+    const LatencyHistogram& latency = result.latency;
+    std::cout << std::left << std::setw(10) << transportName(result.transport) << std::setw(7)
+              << familyName(result.family) << std::right << std::setw(7) << result.messageSize << std::setw(6)
+              << result.connections << std::setw(6) << result.batch << std::setw(11) << result.sent << std::setw(11)
+              << result.received << std::fixed << std::setprecision(0) << std::setw(12) << messagesPerSecond(result)
+              << std::setprecision(3) << std::setw(9) << gigabitsPerSecond(result) << std::setprecision(1)
+              << std::setw(10) << latency.percentile(50) / 1e3 << std::setw(10) << latency.percentile(99) / 1e3
+              << std::setw(10) << latency.percentile(99.9) / 1e3 << std::setw(10) << latency.max() / 1e3 << std::endl;
+}
+
+static void writeJson(const BenchConfig& config, const std::vector<RunResult>& results)
+{
+    std::ofstream out(config.output);
+    if (!out)
+    {
+        std::cerr << "Failed to open " << config.output << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"duration_s\": " << config.duration << ",\n  \"rate_per_connection\": " << config.rate
+        << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RunResult& result = results[i];
+        const LatencyHistogram& latency = result.latency;
+        out << (i ? ",\n" : "\n") << "    {\"transport\": \"" << transportName(result.transport)
+            << "\", \"family\": \"" << familyName(result.family) << "\", \"message_size\": " << result.messageSize
+            << ", \"connections\": " << result.connections << ", \"batch\": " << result.batch << ", \"sent\": "
+            << result.sent << ", \"received\": " << result.received << ", \"seconds\": " << result.seconds
+            << ", \"msgs_per_sec\": " << messagesPerSecond(result)
+            << ", \"gbit_per_sec\": " << gigabitsPerSecond(result)
+            << ", \"latency_ns\": {\"p50\": " << latency.percentile(50) << ", \"p99\": " << latency.percentile(99)
+            << ", \"p999\": " << latency.percentile(99.9) << ", \"max\": " << latency.max() << "}}";
+    }
+    out << "\n  ]\n}\n";
+    std::cout << "Results written to " << config.output << std::endl;
+}
+
+template <typename T>
+static bool parseList(const std::string& text, std::vector<T>& values)
+{
+    values.clear();
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        char* end = nullptr;
+        unsigned long value = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || value == 0)
+        {
+            return false;
+        }
+        values.push_back(static_cast<T>(value));
+    }
+    return !values.empty();
+}
+
+static bool parseTransports(const std::string& text, std::vector<Transport>& transports)
+{
+    transports.clear();
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        if (item == "tcp")
+        {
+            transports.push_back(Transport::Tcp);
+        }
+        else if (item == "broadcast")
+        {
+            transports.push_back(Transport::Broadcast);
+        }
+        else if (item == "multicast")
+        {
+            transports.push_back(Transport::Multicast);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return !transports.empty();
+}
+
+static bool parseFamilies(const std::string& text, std::vector<int>& families)
+{
+    families.clear();
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        if (item == "ipv4")
+        {
+            families.push_back(AF_INET);
+        }
+        else if (item == "ipv6")
+        {
+            families.push_back(AF_INET6);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return !families.empty();
+}
+
+static bool parseOptions(int argc, char** argv, BenchConfig& config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (config.socket.parseArgument(argc, argv, i) || config.metrics.parseArgument(argc, argv, i))
+        {
+            continue;
+        }
+
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        bool valid = true;
+        if (arg == "--transport")
+        {
+            valid = parseTransports(value, config.transports);
+        }
+        else if (arg == "--family")
+        {
+            valid = parseFamilies(value, config.families);
+        }
+        else if (arg == "--sizes")
+        {
+            valid = parseList(value, config.sizes);
+        }
+        else if (arg == "--connections")
+        {
+            valid = parseList(value, config.connections);
+        }
+        else if (arg == "--batch")
+        {
+            valid = parseList(value, config.batches);
+        }
+        else if (arg == "--duration")
+        {
+            config.duration = atof(value.c_str());
+            valid = config.duration > 0;
+        }
+        else if (arg == "--rate")
+        {
+            config.rate = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--output")
+        {
+            config.output = value;
+        }
+        else
+        {
+            valid = false;
+        }
+        if (!valid)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    try
+    {
+        if (!parseOptions(argc, argv, config))
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--transport tcp,broadcast,multicast] [--family ipv4,ipv6] [--sizes 64,1024]"
+                      << " [--connections 1,4] [--batch 1,32] [--duration SECONDS] [--rate MSGS_PER_SEC]"
+                      << " [--output FILE] "
+                      << SocketOptions::usage() << " " << MetricsOptions::usage() << std::endl;
+            return 1;
+        }
+        config.metrics.apply();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // A message must hold the embedded timestamp and sequence number
+    for (size_t& size : config.sizes)
+    {
+        size = std::max(size, sizeof(MessageHeader));
+    }
+
+    std::cout << std::left << std::setw(10) << "transport" << std::setw(7) << "family" << std::right << std::setw(7)
+              << "size" << std::setw(6)
+              << "conns" << std::setw(6) << "batch" << std::setw(11) << "sent" << std::setw(11) << "received"
+              << std::setw(12) << "msgs/s" << std::setw(9) << "Gbit/s" << std::setw(10) << "p50 us" << std::setw(10)
+              << "p99 us" << std::setw(10) << "p99.9 us" << std::setw(10) << "max us" << std::endl;
+
+    std::vector<RunResult> results;
+    for (Transport transport : config.transports)
+    {
+        for (int family : config.families)
+        {
+            // Broadcast is IPv4 only; skipping it keeps --family ipv4,ipv6 usable with every transport
+            if (transport == Transport::Broadcast && family == AF_INET6)
+            {
+                continue;
+            }
+            for (size_t size : config.sizes)
+            {
+                for (unsigned connections : config.connections)
+                {
+                    for (unsigned batch : config.batches)
+                    {
+                        try
+                        {
+                            RunResult result = transport == Transport::Tcp
+                                                   ? runTcp(config, family, size, connections, batch)
+                                                   : runUdp(config, transport, family, size, connections, batch);
+                            printResult(result);
+                            results.push_back(std::move(result));
+                        }
+                        catch (const std::exception& e)
+                        {
+                            std::cerr << transportName(transport) << " " << familyName(family) << " size " << size
+                                      << " connections " << connections << " batch " << batch << ": " << e.what()
+                                      << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    writeJson(config, results);
+    return 0;
+}
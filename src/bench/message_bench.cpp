@@ -0,0 +1,241 @@
+/**
+ * @file message_bench.cpp
+ * @brief Verification and microbenchmark for the binary message format
+ *
+ * First checks the TextMessage encoding byte for byte (little-endian fields, header length),
+ * reads it back at every misalignment and checks that truncated, foreign and mistyped
+ * messages are rejected. Then measures, per text length, the cost of one message each way:
+ * - text: the publisher formats "id sendTime text" into a std::string and copies it into the
+ *   send buffer; the receiver copies the datagram into a std::string and parses the numbers
+ * - binary: the publisher encodes a TextMessage in place in a pool buffer; the receiver reads
+ *   the fields and the text where they lie (net/message.h)
+ * It showcases:
+ * - Zero-copy, allocation-free encoding and decoding of fixed-layout messages
+ * - Heap allocations per message, counted by replacing the global operator new
+ *
+ * Usage: message-bench [--sizes 16,64,256,1024] [--iterations N]
+ *
+ * @note Exits with status 1 if a check fails
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "net/buffer_pool.h"
+#include "net/message.h"
+
+#define DEFAULT_ITERATIONS 2000000
+#define BENCH_BUFFER_SIZE 9216
+#define CHECK_ID 0x0102030405060708ULL
+#define CHECK_SEND_TIME -2
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+struct PathResult
+{
+    double encodeNs = 0;
+    double decodeNs = 0;
+    double allocations = 0; // Per message, both sides
+};
+
+static bool check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::cerr << "Check failed: " << what << std::endl;
+    }
+    return condition;
+}
+
+static bool verifyFormat()
+{
+    alignas(8) char buffer[64 + MESSAGE_ALIGNMENT];
+    std::string_view text = "hello";
+    bool ok = true;
+
+    TextMessage* message = encodeMessage<TextMessage>(buffer, sizeof(buffer), text.size());
+    message->id = CHECK_ID;
+    message->sendTimeNs = CHECK_SEND_TIME;
+    memcpy(messageTail(message), text.data(), text.size());
+    size_t length = sizeof(TextMessage) + text.size();
+
+    const unsigned char expected[] = {0xCE, 0xD1, 0x01, 0x00, 0x1D, 0x00, 0x00, 0x00, 0x08, 0x07, 0x06, 0x05,
+                                      0x04, 0x03, 0x02, 0x01, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    ok &= check(memcmp(buffer, expected, sizeof(expected)) == 0, "wire bytes are little-endian");
+    ok &= check(encodeMessage<TextMessage>(buffer, sizeof(TextMessage) + 4, text.size()) == nullptr,
+                "encode rejects a buffer that is too small");
+
+    // Fields are byte arrays, so a message reads back the same at any address
+    for (size_t offset = 0; offset < MESSAGE_ALIGNMENT; ++offset)
+    {
+        alignas(8) char shifted[sizeof(buffer) + MESSAGE_ALIGNMENT];
+        memcpy(shifted + offset, buffer, length);
+        const TextMessage* read = readMessage<TextMessage>(shifted + offset, length);
+        ok &= check(read != nullptr && read->id == CHECK_ID && read->sendTimeNs == CHECK_SEND_TIME &&
+                        messageTail(*read) == text,
+                    "read back at every misalignment");
+    }
+
+    ok &= check(readMessage<TextMessage>(buffer, length - 1) == nullptr, "read rejects a truncated message");
+    ok &= check(readMessage<TextMessage>(buffer, sizeof(TextMessage) - 1) == nullptr, "read rejects a short buffer");
+    message->header.type = MESSAGE_TYPE_TEXT + 1;
+    ok &= check(readMessage<TextMessage>(buffer, length) == nullptr, "read rejects another type");
+    message->header.type = MESSAGE_TYPE_TEXT;
+    buffer[0] = 'h';
+    ok &= check(readMessage<TextMessage>(buffer, length) == nullptr, "read rejects text");
+    return ok;
+}
+
+// "id sendTime text": what a text publisher would send to carry the same fields
+static PathResult benchText(const std::string& text, uint64_t iterations)
+{
+    PathResult result;
+    std::vector<char> wire(BENCH_BUFFER_SIZE);
+    size_t length = 0;
+    volatile uint64_t sink = 0;
+
+    uint64_t before = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        std::string message = std::to_string(i) + " " + std::to_string(static_cast<int64_t>(i) * 1000) + " " + text;
+        memcpy(wire.data(), message.data(), message.size());
+        length = message.size();
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        std::string message(wire.data(), length);
+        char* end = nullptr;
+        uint64_t id = strtoull(message.c_str(), &end, 10);
+        int64_t sendTimeNs = strtoll(end + 1, &end, 10);
+        std::string body = message.substr(end + 1 - message.c_str());
+        sink = sink + id + static_cast<uint64_t>(sendTimeNs) + body.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t after = allocations.load(std::memory_order_relaxed);
+
+    result.encodeNs = std::chrono::duration<double, std::nano>(middle - start).count() / iterations;
+    result.decodeNs = std::chrono::duration<double, std::nano>(end - middle).count() / iterations;
+    result.allocations = static_cast<double>(after - before) / iterations;
+    return result;
+}
+
+static PathResult benchBinary(const std::string& text, BufferPool& pool, uint64_t iterations)
+{
+    PathResult result;
+    PacketBuffer wire = pool.acquire();
+    size_t length = 0;
+    volatile uint64_t sink = 0;
+
+    uint64_t before = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        TextMessage* message = encodeMessage<TextMessage>(wire.data(), wire.capacity(), text.size());
+        message->id = i;
+        message->sendTimeNs = static_cast<int64_t>(i) * 1000;
+        memcpy(messageTail(message), text.data(), text.size());
+        length = message->header.length;
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        const TextMessage* message = readMessage<TextMessage>(wire.data(), length);
+        sink = sink + message->id + static_cast<uint64_t>(message->sendTimeNs.get()) + messageTail(*message).size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t after = allocations.load(std::memory_order_relaxed);
+
+    result.encodeNs = std::chrono::duration<double, std::nano>(middle - start).count() / iterations;
+    result.decodeNs = std::chrono::duration<double, std::nano>(end - middle).count() / iterations;
+    result.allocations = static_cast<double>(after - before) / iterations;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<size_t> sizes = {16, 64, 256, 1024};
+    uint64_t iterations = DEFAULT_ITERATIONS;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc)
+        {
+            sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ','))
+            {
+                sizes.push_back(strtoul(size.c_str(), nullptr, 10));
+            }
+        }
+        else if (arg == "--iterations" && i + 1 < argc)
+        {
+            iterations = std::max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--sizes 16,64,256,1024] [--iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!verifyFormat())
+    {
+        return 1;
+    }
+    std::cout << "Encoding and decoding checks passed" << std::endl;
+
+    BufferPool pool(BENCH_BUFFER_SIZE, 1);
+    std::cout << std::left << std::setw(8) << "format" << std::right << std::setw(8) << "size" << std::setw(14)
+              << "encode ns" << std::setw(14) << "decode ns" << std::setw(14) << "allocs/msg" << std::endl;
+    for (size_t size : sizes)
+    {
+        if (size + sizeof(TextMessage) > BENCH_BUFFER_SIZE)
+        {
+            std::cerr << "Size " << size << " does not fit in a " << BENCH_BUFFER_SIZE << "-byte buffer" << std::endl;
+            return 1;
+        }
+        std::string text(size, 'x');
+        for (const char* format : {"text", "binary"})
+        {
+            PathResult result =
+                strcmp(format, "text") == 0 ? benchText(text, iterations) : benchBinary(text, pool, iterations);
+            std::cout << std::left << std::setw(8) << format << std::right << std::setw(8) << size << std::fixed
+                      << std::setprecision(1) << std::setw(14) << result.encodeNs << std::setw(14) << result.decodeNs
+                      << std::setprecision(2) << std::setw(14) << result.allocations << std::endl;
+        }
+    }
+    return 0;
+}
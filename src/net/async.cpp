@@ -0,0 +1,342 @@
+/**
+ * @file async.cpp
+ * @brief EventLoop backends (epoll and io_uring) and AsyncSocket registration
+ */
+
+#include "net/async.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#ifdef ENABLE_IO_URING
+#include "net/io_uring.h"
+#endif
+
+// io_uring poll requests carry their IoReadiness with the direction in the low bit (the struct is aligned)
+#define POLL_WRITE_BIT 1ULL
+
+EventLoop::EventLoop(LoopBackend backend)
+    : m_backend(backend), m_epollFd(-1), m_ring(nullptr),
+      m_timers(std::chrono::milliseconds(EVENT_LOOP_TIMER_TICK_MS)), m_stopped(false)
+{
+    if (backend == LoopBackend::IoUring)
+    {
+#ifdef ENABLE_IO_URING
+        m_ring = new IoUring(EVENT_LOOP_URING_ENTRIES);
+        return;
+#else
+        throw std::runtime_error("io_uring support is not built in (configure with -DENABLE_IO_URING=ON)");
+#endif
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd == -1)
+    {
+        throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    // Destroying a spawned task destroys the tasks it awaits, innermost last
+    for (void* frame : std::unordered_set<void*>(m_tasks))
+    {
+        std::coroutine_handle<>::from_address(frame).destroy();
+    }
+    if (m_epollFd != -1)
+    {
+        close(m_epollFd);
+    }
+#ifdef ENABLE_IO_URING
+    for (IoReadiness* readiness : m_closing)
+    {
+        delete readiness;
+    }
+    delete m_ring;
+#endif
+}
+
+void EventLoop::spawn(Task<void> task)
+{
+    SpawnedTask spawned = runSpawned(std::move(task));
+    m_tasks.insert(spawned.handle.address());
+    m_ready.push_back(spawned.handle);
+}
+
+EventLoop::SpawnedTask EventLoop::runSpawned(Task<void> task)
+{
+    try
+    {
+        co_await task;
+    }
+    catch (...)
+    {
+        if (!m_error)
+        {
+            m_error = std::current_exception();
+        }
+        m_stopped = true;
+    }
+}
+
+void EventLoop::run()
+{
+    m_stopped = false;
+    while (!m_stopped && !m_tasks.empty())
+    {
+        // Only what is ready now: coroutines that yield go to the back and run in the next round, after a wait
+        // that does not block, so sockets are not starved
+        for (size_t count = m_ready.size(); count > 0 && !m_stopped; --count)
+        {
+            std::coroutine_handle<> handle = m_ready.front();
+            m_ready.pop_front();
+            handle.resume();
+        }
+        if (!m_stopped && !m_tasks.empty())
+        {
+            wait();
+        }
+    }
+    if (m_error)
+    {
+        std::exception_ptr error = std::exchange(m_error, nullptr);
+        std::rethrow_exception(error);
+    }
+}
+
+void EventLoop::wait()
+{
+    int timeoutMs = -1;
+    if (!m_ready.empty())
+    {
+        timeoutMs = 0;
+    }
+    else if (m_timers.size() > 0)
+    {
+        auto delay = std::chrono::ceil<std::chrono::milliseconds>(m_timers.nextExpiry() - Clock::now());
+        timeoutMs = delay.count() > 0 ? static_cast<int>(delay.count()) : 0;
+    }
+
+    if (m_backend == LoopBackend::Epoll)
+    {
+        epoll_event events[EVENT_LOOP_MAX_EVENTS];
+        int count = epoll_wait(m_epollFd, events, EVENT_LOOP_MAX_EVENTS, timeoutMs);
+        if (count == -1 && errno != EINTR)
+        {
+            throw std::runtime_error("Failed to wait for events: " + std::string(strerror(errno)));
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            // Errors and hangups wake both directions; the retried calls report them
+            uint32_t flags = events[i].events;
+            bool failed = (flags & (EPOLLERR | EPOLLHUP)) != 0;
+            dispatch(*static_cast<IoReadiness*>(events[i].data.ptr), failed || (flags & (EPOLLIN | EPOLLRDHUP)),
+                     failed || (flags & EPOLLOUT));
+        }
+    }
+#ifdef ENABLE_IO_URING
+    else
+    {
+        // A timeout request with off = 1 completes after the first other completion, or when the time is up
+        __kernel_timespec timeout{};
+        if (timeoutMs > 0)
+        {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+            io_uring_sqe* sqe = m_ring->getSqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = reinterpret_cast<uint64_t>(&timeout);
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = IoUring::INTERNAL_USER_DATA;
+        }
+        if (m_ring->submitAndWait(timeoutMs == 0 ? 0 : 1) < 0)
+        {
+            throw std::runtime_error("Failed to submit to io_uring: " + std::string(strerror(errno)));
+        }
+        m_ring->forEachCompletion([this](const io_uring_cqe& cqe) {
+            IoReadiness* readiness = reinterpret_cast<IoReadiness*>(cqe.user_data & ~POLL_WRITE_BIT);
+            bool write = (cqe.user_data & POLL_WRITE_BIT) != 0;
+            --readiness->pollsInFlight;
+            if (readiness->closed)
+            {
+                if (readiness->pollsInFlight == 0)
+                {
+                    m_closing.erase(readiness);
+                    delete readiness;
+                }
+                return;
+            }
+            // res is the triggered poll mask, or -errno; either way the retried call tells what happened
+            dispatch(*readiness, !write, write);
+        });
+    }
+#endif
+
+    m_timers.advance(Clock::now(), [this](std::coroutine_handle<> handle) { m_ready.push_back(handle); });
+}
+
+void EventLoop::dispatch(IoReadiness& readiness, bool readable, bool writable)
+{
+    if (readable && readiness.reader != nullptr)
+    {
+        IoWaiter* waiter = readiness.reader;
+        if (waiter->attempt(waiter))
+        {
+            readiness.reader = nullptr;
+            m_ready.push_back(waiter->handle);
+        }
+        else if (m_backend == LoopBackend::IoUring)
+        {
+            armPoll(readiness, false);
+        }
+    }
+    if (writable && readiness.writer != nullptr)
+    {
+        IoWaiter* waiter = readiness.writer;
+        if (waiter->attempt(waiter))
+        {
+            readiness.writer = nullptr;
+            m_ready.push_back(waiter->handle);
+        }
+        else if (m_backend == LoopBackend::IoUring)
+        {
+            armPoll(readiness, true);
+        }
+    }
+}
+
+void EventLoop::watch(IoReadiness& readiness)
+{
+    if (m_backend != LoopBackend::Epoll)
+    {
+        return; // io_uring polls per wait
+    }
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = &readiness;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, readiness.fd, &event) == -1)
+    {
+        throw std::runtime_error("Failed to add socket to epoll: " + std::string(strerror(errno)));
+    }
+    /*
+    EPOLLET: Report a socket when it becomes readable or writable, not as long as it is. A coroutine is only
+    parked after its call failed with EAGAIN, so the next edge is exactly the wakeup it needs, and the
+    socket never has to be re-armed or modified.
+    */
+}
+
+void EventLoop::unwatch(IoReadiness* readiness)
+{
+    if (m_backend == LoopBackend::Epoll)
+    {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, readiness->fd, nullptr);
+        delete readiness;
+        return;
+    }
+#ifdef ENABLE_IO_URING
+    if (readiness->pollsInFlight == 0)
+    {
+        delete readiness;
+        return;
+    }
+    // The polls still reference it: cancel them and free it with the last completion
+    readiness->closed = true;
+    m_closing.insert(readiness);
+    for (uint64_t direction : {0ULL, POLL_WRITE_BIT})
+    {
+        io_uring_sqe* sqe = m_ring->getSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = reinterpret_cast<uint64_t>(readiness) | direction;
+        sqe->user_data = IoUring::INTERNAL_USER_DATA;
+    }
+    m_ring->submit();
+#endif
+}
+
+void EventLoop::park(IoReadiness& readiness, IoWaiter& waiter, bool write)
+{
+    IoWaiter*& slot = write ? readiness.writer : readiness.reader;
+    if (slot != nullptr)
+    {
+        throw std::runtime_error(std::string("Another coroutine is already waiting to ") +
+                                 (write ? "write" : "read") + " this socket");
+    }
+    slot = &waiter;
+    if (m_backend == LoopBackend::IoUring)
+    {
+        armPoll(readiness, write);
+    }
+}
+
+void EventLoop::armPoll(IoReadiness& readiness, bool write)
+{
+#ifdef ENABLE_IO_URING
+    io_uring_sqe* sqe = m_ring->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = readiness.fd;
+    sqe->poll32_events = write ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+    sqe->user_data = reinterpret_cast<uint64_t>(&readiness) | (write ? POLL_WRITE_BIT : 0);
+    ++readiness.pollsInFlight;
+    /*
+    IORING_OP_POLL_ADD: One completion when the file reports one of poll32_events (or an error or hangup),
+    res = the triggered mask. Queued here and submitted with the next wait.
+    */
+#else
+    (void)readiness;
+    (void)write;
+#endif
+}
+
+AsyncSocket::AsyncSocket(EventLoop& loop, int fd) : m_loop(loop), m_readiness(new IoReadiness())
+{
+    m_readiness->fd = fd;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        delete m_readiness;
+        throw std::runtime_error("Failed to make socket non-blocking: " + std::string(strerror(errno)));
+    }
+    try
+    {
+        m_loop.watch(*m_readiness);
+    }
+    catch (const std::exception&)
+    {
+        delete m_readiness;
+        throw;
+    }
+}
+
+AsyncSocket::~AsyncSocket()
+{
+    m_loop.unwatch(m_readiness);
+}
+
+void AsyncSocket::park(IoWaiter& waiter, bool write)
+{
+    m_loop.park(*m_readiness, waiter, write);
+}
+
+void AsyncSocket::countTraffic(ssize_t result, unsigned messages, size_t bytes, bool send)
+{
+    TrafficMetrics& metrics = trafficMetrics();
+    if (result >= 0)
+    {
+        (send ? metrics.packetsSent : metrics.packetsReceived).add(messages);
+        (send ? metrics.bytesSent : metrics.bytesReceived).add(bytes);
+    }
+    else if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        metrics.wouldBlock.add();
+    }
+    else if (result == -1 && errno != EINTR)
+    {
+        metrics.errors.add();
+    }
+}
@@ -0,0 +1,611 @@
+/**
+ * @file async.h
+ * @brief C++20 coroutines over non-blocking sockets: Task, a single-threaded EventLoop and AsyncSocket
+ *
+ * Blocking receive loops need a thread per socket. Callback-driven epoll code scatters one flow's logic over
+ * handlers that share state by hand. Coroutines keep a straight-line flow per session and still run thousands
+ * of them on one thread:
+ * - Task<T> is a lazily started coroutine. Awaiting one runs it and resumes the caller when it returns
+ *   (symmetric transfer, so deep chains do not grow the stack); exceptions propagate to the awaiter.
+ * - AsyncSocket operations try the system call first and only suspend on EAGAIN. The coroutine is parked on
+ *   the socket and the loop retries the call when the socket becomes ready, so a resumed coroutine always
+ *   gets a result and nothing is allocated per operation.
+ * - EventLoop resumes ready coroutines, then waits for readiness and timers on one of two backends:
+ *   epoll (every socket registered once, edge-triggered, no epoll_ctl per wait) or io_uring (a one-shot
+ *   IORING_OP_POLL_ADD per wait, submitted together with the timeout in one io_uring_enter).
+ * - Sleeps go on a HierarchicalTimerWheel, so many sessions with timeouts cost O(1) each, and a
+ *   loop waiting for a distant timer does not wake up every tick.
+ *
+ *     Task<void> echo(AsyncSocket& socket)
+ *     {
+ *         char buffer[1500];
+ *         SocketAddress sender;
+ *         while (true)
+ *         {
+ *             ssize_t length = co_await socket.receive(buffer, sizeof(buffer), &sender);
+ *             if (length == -1)
+ *                 throw std::runtime_error(strerror(errno));
+ *             co_await socket.sendTo(std::string_view(buffer, length), sender);
+ *         }
+ *     }
+ *
+ *     EventLoop loop(LoopBackend::Epoll);
+ *     AsyncSocket socket(loop, fd);
+ *     loop.spawn(echo(socket));
+ *     loop.run();
+ *
+ * @note A loop and its sockets belong to one thread; scale out with one loop per core (e.g. SO_REUSEPORT sockets)
+ * @note One coroutine at a time may wait to read a socket, and one to write it
+ * @note Destroy the AsyncSockets before their loop; ~EventLoop destroys the tasks still suspended
+ */
+
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/datagram_batch.h"
+#include "net/socket_address.h"
+#include "net/timer_wheel.h"
+
+#define EVENT_LOOP_MAX_EVENTS 64
+#define EVENT_LOOP_TIMER_TICK_MS 1 // Sleep resolution; matches the millisecond timeout of epoll_wait
+#define EVENT_LOOP_URING_ENTRIES 256
+
+class EventLoop;
+class IoUring;
+
+// What the final suspend of every Task does: resume whoever awaited it
+class TaskPromiseBase
+{
+public:
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+        {
+            std::coroutine_handle<> continuation = finished.promise().continuation();
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        m_exception = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation() const
+    {
+        return m_continuation;
+    }
+
+    void setContinuation(std::coroutine_handle<> continuation)
+    {
+        m_continuation = continuation;
+    }
+
+protected:
+    void rethrow() const
+    {
+        if (m_exception)
+        {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+private:
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr m_exception;
+};
+
+template <typename T>
+class Task;
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& value)
+    {
+        m_value.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        rethrow();
+        return std::move(*m_value);
+    }
+
+private:
+    std::optional<T> m_value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void()
+    {
+    }
+
+    void result()
+    {
+        rethrow();
+    }
+};
+
+// A coroutine returning T that starts when it is first awaited (or spawned on an EventLoop)
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+    {
+    }
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {}))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle)
+            {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    // Run this task now; it resumes the awaiting coroutine when it returns
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().setContinuation(awaiting);
+        return m_handle;
+    }
+
+    // The returned value, or the exception the task let escape
+    T await_resume()
+    {
+        return m_handle.promise().result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// An operation parked on a socket until a retry no longer fails with EAGAIN
+struct IoWaiter
+{
+    std::coroutine_handle<> handle;
+    bool (*attempt)(IoWaiter* waiter); // Try the operation again; false if it would still block
+};
+
+// The waiters of one socket, registered with its loop
+struct IoReadiness
+{
+    int fd;
+    IoWaiter* reader = nullptr;
+    IoWaiter* writer = nullptr;
+    unsigned pollsInFlight = 0; // io_uring: POLL_ADD requests not completed yet
+    bool closed = false;        // io_uring: the socket is gone; freed when the last poll completes
+};
+
+enum class LoopBackend
+{
+    Epoll,
+    IoUring // Needs a build with -DENABLE_IO_URING=ON
+};
+
+class EventLoop
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Throws std::runtime_error if the backend cannot be set up
+    explicit EventLoop(LoopBackend backend = LoopBackend::Epoll);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    LoopBackend backend() const
+    {
+        return m_backend;
+    }
+
+    // Start task on the next run() iteration. The loop owns it from now on.
+    void spawn(Task<void> task);
+
+    // Run until every spawned task has returned or stop() is called. Rethrows the first exception a spawned task
+    // let escape, which also stops the loop.
+    void run();
+
+    void stop()
+    {
+        m_stopped = true;
+    }
+
+    // Spawned tasks that have not returned yet
+    size_t taskCount() const
+    {
+        return m_tasks.size();
+    }
+
+    struct SleepAwaiter
+    {
+        EventLoop& loop;
+        Clock::time_point deadline;
+
+        bool await_ready() const
+        {
+            return deadline <= Clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            loop.m_timers.schedule(deadline, handle);
+        }
+
+        void await_resume() const
+        {
+        }
+    };
+
+    struct YieldAwaiter
+    {
+        EventLoop& loop;
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            loop.m_ready.push_back(handle);
+        }
+
+        void await_resume() const
+        {
+        }
+    };
+
+    // co_await loop.sleepUntil(deadline): resumes on the first timer tick at or after deadline
+    SleepAwaiter sleepUntil(Clock::time_point deadline)
+    {
+        return SleepAwaiter{*this, deadline};
+    }
+
+    SleepAwaiter sleepFor(Clock::duration duration)
+    {
+        return SleepAwaiter{*this, Clock::now() + duration};
+    }
+
+    // Let the other ready coroutines run first
+    YieldAwaiter yield()
+    {
+        return YieldAwaiter{*this};
+    }
+
+private:
+    friend class AsyncSocket;
+
+    // The coroutine spawn() wraps a task in: it destroys itself when the task returns
+    struct SpawnedTask
+    {
+        struct promise_type
+        {
+            EventLoop& loop;
+
+            promise_type(EventLoop& owner, Task<void>&) : loop(owner)
+            {
+            }
+
+            SpawnedTask get_return_object()
+            {
+                return SpawnedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+
+            std::suspend_always initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            auto final_suspend() noexcept
+            {
+                struct Release
+                {
+                    bool await_ready() noexcept
+                    {
+                        return false;
+                    }
+
+                    void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        handle.promise().loop.m_tasks.erase(handle.address());
+                        handle.destroy();
+                    }
+
+                    void await_resume() noexcept
+                    {
+                    }
+                };
+                return Release{};
+            }
+
+            void return_void()
+            {
+            }
+
+            void unhandled_exception()
+            {
+                std::terminate(); // run() catches everything the task throws
+            }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    LoopBackend m_backend;
+    int m_epollFd;
+    IoUring* m_ring; // io_uring backend only
+    std::unordered_set<IoReadiness*> m_closing; // io_uring: sockets gone whose polls have not completed yet
+    std::deque<std::coroutine_handle<>> m_ready;
+    HierarchicalTimerWheel<std::coroutine_handle<>> m_timers;
+    std::unordered_set<void*> m_tasks; // Frames of the spawned tasks still running
+    std::exception_ptr m_error;
+    bool m_stopped;
+
+    SpawnedTask runSpawned(Task<void> task);
+
+    // Block until a socket is ready or the next timer tick, and queue the coroutines that can continue
+    void wait();
+    void dispatch(IoReadiness& readiness, bool readable, bool writable);
+
+    // AsyncSocket registration and parking
+    void watch(IoReadiness& readiness);
+    void unwatch(IoReadiness* readiness);
+    void park(IoReadiness& readiness, IoWaiter& waiter, bool write);
+    void armPoll(IoReadiness& readiness, bool write);
+};
+
+/**
+ * A non-blocking socket whose operations are awaited. The fd stays owned by the caller (e.g. a Socket) and is
+ * switched to O_NONBLOCK. Every operation returns what its system call returns: the count, or -1 with errno set,
+ * but never -1 with EAGAIN.
+ */
+class AsyncSocket
+{
+public:
+    // Throws std::runtime_error if the fd cannot be made non-blocking or registered
+    AsyncSocket(EventLoop& loop, int fd);
+    ~AsyncSocket();
+
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+    int fd() const
+    {
+        return m_readiness->fd;
+    }
+
+    // Retries operation() each time the socket is ready until it no longer fails with EAGAIN
+    template <typename Operation>
+    class Awaiter : IoWaiter
+    {
+    public:
+        Awaiter(AsyncSocket& socket, bool write, Operation operation)
+            : m_socket(socket), m_write(write), m_operation(std::move(operation)), m_result(-1), m_error(0)
+        {
+            attempt = &retry;
+        }
+
+        bool await_ready()
+        {
+            return tryOnce();
+        }
+
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            handle = awaiting;
+            m_socket.park(*this, m_write);
+        }
+
+        // errno is restored: the loop made other system calls while this coroutine was parked
+        auto await_resume()
+        {
+            errno = m_error;
+            return m_result;
+        }
+
+    private:
+        AsyncSocket& m_socket;
+        bool m_write;
+        Operation m_operation;
+        decltype(std::declval<Operation&>()()) m_result;
+        int m_error;
+
+        bool tryOnce()
+        {
+            do
+            {
+                m_result = m_operation();
+            } while (m_result == -1 && errno == EINTR);
+            m_error = errno;
+            return m_result != -1 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+
+        static bool retry(IoWaiter* waiter)
+        {
+            return static_cast<Awaiter*>(waiter)->tryOnce();
+        }
+    };
+
+    // One datagram (or stream read) into buffer. sender, if given, receives the source address.
+    auto receive(char* buffer, size_t size, SocketAddress* sender = nullptr)
+    {
+        return makeAwaiter(false, [this, buffer, size, sender]() {
+            socklen_t length = SocketAddress::capacity();
+            ssize_t received = recvfrom(fd(), buffer, size, 0, sender != nullptr ? sender->data() : nullptr,
+                                        sender != nullptr ? &length : nullptr);
+            countTraffic(received, received > 0 ? 1 : 0, received > 0 ? static_cast<size_t>(received) : 0, false);
+            return received;
+        });
+    }
+
+    // As many queued datagrams as batch holds, with one recvmmsg call once the socket is readable. batch must be
+    // bound to this socket's fd.
+    auto receiveBatch(DatagramBatch& batch)
+    {
+        return makeAwaiter(false, [&batch]() { return batch.receive(MSG_DONTWAIT); });
+    }
+
+    auto sendTo(std::string_view message, const SocketAddress& destination)
+    {
+        return makeAwaiter(true, [this, message, &destination]() {
+            ssize_t sent = sendto(fd(), message.data(), message.size(), 0, destination.data(), destination.size());
+            countTraffic(sent, sent >= 0 ? 1 : 0, sent > 0 ? static_cast<size_t>(sent) : 0, true);
+            return sent;
+        });
+    }
+
+    // Send messages[0..count) with one sendmmsg call once the socket is writable. Returns how many the kernel
+    // took, which may be fewer than count; await again for the rest.
+    auto sendBatch(mmsghdr* messages, unsigned count)
+    {
+        return makeAwaiter(true, [this, messages, count]() {
+            int sent = sendmmsg(fd(), messages, count, 0);
+            size_t bytes = 0;
+            for (int i = 0; i < sent; ++i)
+            {
+                bytes += messages[i].msg_len;
+            }
+            countTraffic(sent, sent > 0 ? sent : 0, bytes, true);
+            return sent;
+        });
+    }
+
+    // Suspends until the socket reports readiness, for operations of the caller's own: they must have failed
+    // with EAGAIN first, since the epoll backend only reports a change of state
+    class ReadyAwaiter : IoWaiter
+    {
+    public:
+        ReadyAwaiter(AsyncSocket& socket, bool write) : m_socket(socket), m_write(write)
+        {
+            attempt = [](IoWaiter*) { return true; };
+        }
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            handle = awaiting;
+            m_socket.park(*this, m_write);
+        }
+
+        void await_resume() const
+        {
+        }
+
+    private:
+        AsyncSocket& m_socket;
+        bool m_write;
+    };
+
+    ReadyAwaiter readable()
+    {
+        return ReadyAwaiter(*this, false);
+    }
+
+    ReadyAwaiter writable()
+    {
+        return ReadyAwaiter(*this, true);
+    }
+
+private:
+    EventLoop& m_loop;
+    IoReadiness* m_readiness; // Owned by the loop while io_uring polls for it are in flight
+
+    template <typename Operation>
+    Awaiter<Operation> makeAwaiter(bool write, Operation operation)
+    {
+        return Awaiter<Operation>(*this, write, std::move(operation));
+    }
+
+    void park(IoWaiter& waiter, bool write);
+
+    // Traffic metrics for one call that returned result: messages and bytes on success, EAGAIN and errors otherwise
+    static void countTraffic(ssize_t result, unsigned messages, size_t bytes, bool send);
+};
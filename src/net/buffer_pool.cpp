@@ -0,0 +1,219 @@
+/**
+ * @file buffer_pool.cpp
+ * @brief Hugepage-backed pool of fixed-size packet buffers with per-thread free lists
+ */
+
+#include "net/buffer_pool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+HugePageMemory::HugePageMemory(size_t size) : m_data(nullptr), m_size(size), m_mappedSize(0), m_hugePages(false)
+{
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    bool large = size >= HUGE_PAGE_SIZE;
+    size_t unit = large ? HUGE_PAGE_SIZE : pageSize;
+    m_mappedSize = (std::max<size_t>(size, 1) + unit - 1) / unit * unit;
+
+    void* memory = MAP_FAILED;
+    if (large)
+    {
+        memory = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        /*
+        MAP_HUGETLB: Back the mapping with huge pages from the reserved pool (vm.nr_hugepages)
+        MAP_POPULATE: Fault every page in now instead of on first touch
+        return MAP_FAILED with errno ENOMEM if not enough huge pages are reserved
+        */
+        m_hugePages = memory != MAP_FAILED;
+    }
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map buffer memory: " + std::string(strerror(errno)));
+        }
+        if (large)
+        {
+            // Best effort: transparent huge pages may be disabled
+            madvise(memory, m_mappedSize, MADV_HUGEPAGE);
+        }
+        // Touch every page after madvise() so it is faulted in as a huge page where possible
+        for (size_t offset = 0; offset < m_mappedSize; offset += pageSize)
+        {
+            static_cast<volatile char*>(memory)[offset] = 0;
+        }
+    }
+    m_data = static_cast<char*>(memory);
+}
+
+HugePageMemory::~HugePageMemory()
+{
+    munmap(m_data, m_mappedSize);
+}
+
+// A small number per live thread, reused after the thread exits, to index per-thread caches without a lookup
+static unsigned threadOrdinal()
+{
+    static std::mutex mutex;
+    static std::vector<unsigned> released;
+    static unsigned next = 0;
+
+    struct Ordinal
+    {
+        unsigned value;
+
+        Ordinal()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (released.empty())
+            {
+                value = next++;
+            }
+            else
+            {
+                value = released.back();
+                released.pop_back();
+            }
+        }
+
+        // The cache of this ordinal, and the free buffers in it, pass to the next thread that gets it
+        ~Ordinal()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            released.push_back(value);
+        }
+    };
+    thread_local Ordinal ordinal;
+    return ordinal.value;
+}
+
+BufferPool::BufferPool(size_t bufferSize, size_t count)
+    : m_bufferSize(bufferSize),
+      m_stride((bufferSize + BUFFER_POOL_ALIGNMENT - 1) / BUFFER_POOL_ALIGNMENT * BUFFER_POOL_ALIGNMENT),
+      m_count(count), m_memory(m_stride * count), m_references(new std::atomic<uint32_t>[count]),
+      m_next(new std::atomic<uint32_t>[count]), m_top(0), m_caches(new ThreadCache[BUFFER_POOL_MAX_THREADS])
+{
+    if (count == 0 || count >= UINT32_MAX)
+    {
+        throw std::runtime_error("Buffer pool size must be between 1 and 2^32 - 2");
+    }
+    // Push in reverse so the stack hands out buffers in address order
+    for (size_t slot = count; slot-- > 0;)
+    {
+        m_references[slot].store(0, std::memory_order_relaxed);
+        pushShared(static_cast<uint32_t>(slot));
+    }
+}
+
+BufferPool::ThreadCache* BufferPool::localCache() const
+{
+    unsigned ordinal = threadOrdinal();
+    return ordinal < BUFFER_POOL_MAX_THREADS ? &m_caches[ordinal] : nullptr;
+}
+
+PacketBuffer BufferPool::acquire()
+{
+    uint32_t slot;
+    ThreadCache* cache = localCache();
+    if (cache == nullptr)
+    {
+        if (!popShared(slot))
+        {
+            return PacketBuffer();
+        }
+    }
+    else
+    {
+        if (cache->count == 0)
+        {
+            // Refill half a cache at once, so the shared stack is visited once per BUFFER_POOL_CACHE_SIZE / 2 leases
+            while (cache->count < BUFFER_POOL_CACHE_SIZE / 2 && popShared(cache->slots[cache->count]))
+            {
+                ++cache->count;
+            }
+            if (cache->count == 0)
+            {
+                return PacketBuffer();
+            }
+        }
+        slot = cache->slots[--cache->count];
+    }
+    m_references[slot].store(1, std::memory_order_relaxed);
+    return PacketBuffer(this, slot);
+}
+
+void BufferPool::addReference(uint32_t slot)
+{
+    m_references[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+void BufferPool::release(uint32_t slot)
+{
+    // acq_rel: writes through every other reference happen before the buffer is handed out again
+    if (m_references[slot].fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    ThreadCache* cache = localCache();
+    if (cache == nullptr)
+    {
+        pushShared(slot);
+        return;
+    }
+    if (cache->count == BUFFER_POOL_CACHE_SIZE)
+    {
+        // Give half back, keeping the most recently used (cache-warm) buffers here
+        for (uint32_t i = 0; i < BUFFER_POOL_CACHE_SIZE / 2; ++i)
+        {
+            pushShared(cache->slots[i]);
+        }
+        memmove(cache->slots, cache->slots + BUFFER_POOL_CACHE_SIZE / 2,
+                sizeof(uint32_t) * (BUFFER_POOL_CACHE_SIZE - BUFFER_POOL_CACHE_SIZE / 2));
+        cache->count -= BUFFER_POOL_CACHE_SIZE / 2;
+    }
+    cache->slots[cache->count++] = slot;
+}
+
+bool BufferPool::popShared(uint32_t& slot)
+{
+    uint64_t top = m_top.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t index = static_cast<uint32_t>(top);
+        if (index == 0)
+        {
+            return false;
+        }
+        // The tag changes on every push and pop, so a top that was popped and pushed back in between fails the CAS
+        uint64_t replacement = ((top >> 32) + 1) << 32 | m_next[index - 1].load(std::memory_order_relaxed);
+        if (m_top.compare_exchange_weak(top, replacement, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            slot = index - 1;
+            return true;
+        }
+    }
+}
+
+void BufferPool::pushShared(uint32_t slot)
+{
+    uint64_t top = m_top.load(std::memory_order_relaxed);
+    uint64_t replacement;
+    do
+    {
+        m_next[slot].store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+        replacement = ((top >> 32) + 1) << 32 | (slot + 1);
+    } while (!m_top.compare_exchange_weak(top, replacement, std::memory_order_release, std::memory_order_relaxed));
+}
@@ -0,0 +1,205 @@
+/**
+ * @file buffer_pool.h
+ * @brief Hugepage-backed pool of fixed-size packet buffers with per-thread free lists
+ *
+ * Receive paths that hand buffers to other threads or keep them across calls cannot use a
+ * stack array, and allocating one per packet puts malloc on the hot path. BufferPool carves
+ * one mapping into equal buffers up front and leases them out as PacketBuffer handles:
+ * - The mapping uses 2 MB huge pages when the system has them reserved (MAP_HUGETLB), and asks
+ *   for transparent huge pages otherwise, so a large pool costs few TLB entries. It is
+ *   prefaulted, so the first packets do not take page faults.
+ * - Every buffer starts on a cache line, so buffers used by different threads never share one.
+ * - Each thread keeps up to BUFFER_POOL_CACHE_SIZE free buffers of its own. acquire() and the
+ *   last release() normally touch only that cache. The shared lock-free stack behind it is
+ *   used only when a cache runs empty or full, and then for half a cache at a time.
+ * - PacketBuffer is reference counted. Copies share the buffer, the last one to go returns it,
+ *   and it may be released on a different thread from the one that acquired it.
+ *
+ * Buffers in another thread's cache are not visible to acquire(), so size a pool with
+ * BufferPool::countFor(). The pool must outlive every PacketBuffer leased from it.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#define BUFFER_POOL_ALIGNMENT 64  // Buffers start on a cache line
+#define BUFFER_POOL_CACHE_SIZE 64 // Free buffers a thread keeps before returning half of them
+#define BUFFER_POOL_MAX_THREADS 64 // Threads beyond this many go straight to the shared stack
+
+// Anonymous mapping, on huge pages when it is large enough to fill one and the system allows it
+class HugePageMemory
+{
+public:
+    // Throws std::runtime_error if no memory can be mapped
+    explicit HugePageMemory(size_t size);
+    ~HugePageMemory();
+
+    HugePageMemory(const HugePageMemory&) = delete;
+    HugePageMemory& operator=(const HugePageMemory&) = delete;
+
+    char* data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // Explicit huge pages (MAP_HUGETLB); otherwise transparent huge pages were requested, if large enough
+    bool hugePages() const
+    {
+        return m_hugePages;
+    }
+
+private:
+    char* m_data;
+    size_t m_size;
+    size_t m_mappedSize;
+    bool m_hugePages;
+};
+
+class BufferPool;
+
+// Lease on one pool buffer. An empty handle (from an exhausted pool) converts to false.
+class PacketBuffer
+{
+public:
+    PacketBuffer() : m_pool(nullptr), m_slot(0)
+    {
+    }
+
+    PacketBuffer(const PacketBuffer& other);
+    PacketBuffer(PacketBuffer&& other) noexcept : m_pool(other.m_pool), m_slot(other.m_slot)
+    {
+        other.m_pool = nullptr;
+    }
+    PacketBuffer& operator=(PacketBuffer other) noexcept
+    {
+        std::swap(m_pool, other.m_pool);
+        std::swap(m_slot, other.m_slot);
+        return *this;
+    }
+    ~PacketBuffer()
+    {
+        reset();
+    }
+
+    explicit operator bool() const
+    {
+        return m_pool != nullptr;
+    }
+
+    char* data() const;
+    size_t capacity() const;
+
+    // Drop this reference now
+    void reset();
+
+private:
+    friend class BufferPool;
+
+    PacketBuffer(BufferPool* pool, uint32_t slot) : m_pool(pool), m_slot(slot)
+    {
+    }
+
+    BufferPool* m_pool;
+    uint32_t m_slot;
+};
+
+class BufferPool
+{
+public:
+    // count buffers of at least bufferSize bytes each. Throws std::runtime_error if the memory cannot be mapped.
+    BufferPool(size_t bufferSize, size_t count);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Lease a buffer, or return an empty handle if every buffer is in use or cached by other threads.
+    // Never allocates.
+    PacketBuffer acquire();
+
+    size_t bufferSize() const
+    {
+        return m_bufferSize;
+    }
+
+    size_t count() const
+    {
+        return m_count;
+    }
+
+    bool hugePages() const
+    {
+        return m_memory.hugePages();
+    }
+
+    // Pool size that keeps inUse buffers leased while threads that acquire or release buffers hold full caches
+    static size_t countFor(size_t inUse, unsigned threads)
+    {
+        return inUse + static_cast<size_t>(threads) * BUFFER_POOL_CACHE_SIZE;
+    }
+
+private:
+    friend class PacketBuffer;
+
+    struct alignas(BUFFER_POOL_ALIGNMENT) ThreadCache
+    {
+        uint32_t count = 0;
+        uint32_t slots[BUFFER_POOL_CACHE_SIZE];
+    };
+
+    size_t m_bufferSize;
+    size_t m_stride;
+    size_t m_count;
+    HugePageMemory m_memory;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_references;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_next; // Shared stack links, slot + 1 (0 ends the list)
+    alignas(BUFFER_POOL_ALIGNMENT) std::atomic<uint64_t> m_top; // ABA tag << 32 | top slot + 1
+    std::unique_ptr<ThreadCache[]> m_caches;
+
+    char* buffer(uint32_t slot) const
+    {
+        return m_memory.data() + slot * m_stride;
+    }
+
+    ThreadCache* localCache() const;
+    void addReference(uint32_t slot);
+    void release(uint32_t slot);
+    bool popShared(uint32_t& slot);
+    void pushShared(uint32_t slot);
+};
+
+inline PacketBuffer::PacketBuffer(const PacketBuffer& other) : m_pool(other.m_pool), m_slot(other.m_slot)
+{
+    if (m_pool != nullptr)
+    {
+        m_pool->addReference(m_slot);
+    }
+}
+
+inline char* PacketBuffer::data() const
+{
+    return m_pool != nullptr ? m_pool->buffer(m_slot) : nullptr;
+}
+
+inline size_t PacketBuffer::capacity() const
+{
+    return m_pool != nullptr ? m_pool->bufferSize() : 0;
+}
+
+inline void PacketBuffer::reset()
+{
+    if (m_pool != nullptr)
+    {
+        m_pool->release(m_slot);
+        m_pool = nullptr;
+    }
+}
@@ -0,0 +1,341 @@
+/**
+ * @file bulk_transfer.cpp
+ * @brief Zero-copy file transfer over TCP with sendfile() and splice()
+ */
+
+#include "net/bulk_transfer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "net/buffer_pool.h"
+#include "net/framing.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Measures wall and CPU time of the calling thread from construction to finish()
+class TransferClock
+{
+public:
+    TransferClock() : m_start(Clock::now()), m_startCpu(threadCpu())
+    {
+    }
+
+    void finish(TransferStats& stats) const
+    {
+        stats.elapsed = Clock::now() - m_start;
+        stats.cpu = threadCpu() - m_startCpu;
+    }
+
+private:
+    Clock::time_point m_start;
+    std::chrono::nanoseconds m_startCpu;
+
+    static std::chrono::nanoseconds threadCpu()
+    {
+        rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        /*
+        getrusage(int who, struct rusage *usage)
+        RUSAGE_THREAD: Resource usage of the calling thread only (Linux)
+        ru_utime / ru_stime: Time spent in user space / in the kernel on its behalf
+        */
+        auto seconds = std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec);
+        auto microseconds = std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+        return seconds + microseconds;
+    }
+};
+
+// Owning pipe used as the in-kernel buffer between the socket and the file
+class Pipe
+{
+public:
+    Pipe()
+    {
+        if (pipe2(m_fds, O_CLOEXEC) == -1)
+        {
+            throw std::runtime_error("Failed to create pipe: " + std::string(strerror(errno)));
+        }
+        // A larger pipe moves more per splice() call; keep the default 64 KB if the limit is lower
+        int size = fcntl(m_fds[1], F_SETPIPE_SZ, BULK_PIPE_SIZE);
+        m_size = size > 0 ? static_cast<size_t>(size) : static_cast<size_t>(fcntl(m_fds[1], F_GETPIPE_SZ));
+    }
+
+    ~Pipe()
+    {
+        close(m_fds[0]);
+        close(m_fds[1]);
+    }
+
+    Pipe(const Pipe&) = delete;
+    Pipe& operator=(const Pipe&) = delete;
+
+    int readEnd() const
+    {
+        return m_fds[0];
+    }
+
+    int writeEnd() const
+    {
+        return m_fds[1];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    int m_fds[2];
+    size_t m_size;
+};
+
+std::ostream& operator<<(std::ostream& out, const TransferStats& stats)
+{
+    double seconds = std::chrono::duration<double>(stats.elapsed).count();
+    double cpu = std::chrono::duration<double>(stats.cpu).count();
+    double rate = seconds > 0 ? stats.bytes / seconds : 0;
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << stats.bytes << " bytes in " << std::fixed << std::setprecision(3) << seconds << " s ("
+        << std::setprecision(2) << rate * 8 / 1e9 << " Gbit/s, " << std::setprecision(0) << rate / 1e6
+        << " MB/s), " << stats.calls << " calls, CPU " << (seconds > 0 ? 100 * cpu / seconds : 0) << "% of one core";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+TransferStats sendFile(int sockFd, int fileFd)
+{
+    struct stat status;
+    if (fstat(fileFd, &status) == -1 || !S_ISREG(status.st_mode))
+    {
+        throw std::runtime_error("sendfile() needs a regular file as its input");
+    }
+    uint64_t length = static_cast<uint64_t>(status.st_size);
+    posix_fadvise(fileFd, 0, 0, POSIX_FADV_SEQUENTIAL); // Larger readahead for the page cache reads
+
+    TransferStats stats;
+    TransferClock clock;
+
+    char header[FRAME_MAX_HEADER_SIZE + sizeof(length)];
+    size_t headerLength = encodeFrameHeader(FRAME_TYPE_FILE, sizeof(length), header);
+    memcpy(header + headerLength, &length, sizeof(length));
+    headerLength += sizeof(length);
+    // MSG_MORE: the header goes out in the same segment as the start of the file
+    if (send(sockFd, header, headerLength, MSG_NOSIGNAL | MSG_MORE) != static_cast<ssize_t>(headerLength))
+    {
+        throw std::runtime_error("Failed to send file header: " + std::string(strerror(errno)));
+    }
+
+    off_t offset = 0;
+    while (stats.bytes < length)
+    {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - stats.bytes, BULK_SENDFILE_CHUNK));
+        ssize_t sent = sendfile(sockFd, fileFd, &offset, chunk);
+        /*
+        sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+        Copies from in_fd's page cache to out_fd inside the kernel, reading from *offset and advancing it.
+        in_fd's own file offset is not changed.
+        return number of bytes written (0 at end of file)
+        return -1 if failed
+        */
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("sendfile() failed: " + std::string(strerror(errno)));
+        }
+        if (sent == 0)
+        {
+            throw std::runtime_error("File shrank to " + std::to_string(stats.bytes) + " bytes while being sent");
+        }
+        stats.bytes += sent;
+        ++stats.calls;
+    }
+    clock.finish(stats);
+    return stats;
+}
+
+// Receive length bytes into data, or fewer if the connection ends first. MSG_WAITALL still returns early when a
+// signal interrupts it (the logger's SIGUSR1 and SIGUSR2), so it is called until the range is full.
+static size_t receiveAll(int sockFd, char* data, size_t length)
+{
+    size_t filled = 0;
+    while (filled < length)
+    {
+        ssize_t received = recv(sockFd, data + filled, length - filled, MSG_WAITALL);
+        if (received == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("Failed to receive file: " + std::string(strerror(errno)));
+        }
+        if (received == 0)
+        {
+            break;
+        }
+        filled += received;
+    }
+    return filled;
+}
+
+// Read the FRAME_TYPE_FILE header and return the announced length
+static uint64_t receiveHeader(int sockFd)
+{
+    uint64_t length = 0;
+    char header[FRAME_MAX_HEADER_SIZE + sizeof(length)];
+    size_t expected = encodeFrameHeader(FRAME_TYPE_FILE, sizeof(length), header) + sizeof(length);
+    // Read exactly the header, so every later byte belongs to the file and can be spliced
+    if (receiveAll(sockFd, header, expected) != expected)
+    {
+        throw std::runtime_error("Connection ended before the file header");
+    }
+
+    uint8_t type;
+    uint32_t payloadLength;
+    int headerSize = decodeFrameHeader(header, expected, type, payloadLength);
+    if (headerSize <= 0 || type != FRAME_TYPE_FILE || payloadLength != sizeof(length) ||
+        static_cast<size_t>(headerSize) + payloadLength != expected)
+    {
+        throw std::runtime_error("Not a file transfer header");
+    }
+    memcpy(&length, header + headerSize, sizeof(length));
+    return length;
+}
+
+// Write all of data, retrying short writes
+static void writeAll(int fileFd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fileFd, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("Failed to write file: " + std::string(strerror(errno)));
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+static void receiveSpliced(int sockFd, int fileFd, uint64_t length, TransferStats& stats)
+{
+    Pipe pipe;
+    while (stats.bytes < length)
+    {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - stats.bytes, pipe.size()));
+        ssize_t queued = splice(sockFd, nullptr, pipe.writeEnd(), nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        /*
+        splice(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags)
+        Moves up to len bytes between two descriptors, one of which must be a pipe; the pipe takes references
+        to the pages instead of copying them. A NULL offset uses (and advances) the descriptor's file offset.
+        SPLICE_F_MOVE: Move pages instead of copying where the kernel can
+        SPLICE_F_MORE: More data follows, like MSG_MORE
+        return number of bytes moved (0 when the socket reached end of file)
+        return -1 if failed
+        */
+        if (queued == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("splice() from socket failed: " + std::string(strerror(errno)));
+        }
+        if (queued == 0)
+        {
+            throw std::runtime_error("Connection ended after " + std::to_string(stats.bytes) + " of " +
+                                     std::to_string(length) + " bytes");
+        }
+        ++stats.calls;
+
+        // The pipe is empty again before the next socket splice
+        for (size_t pending = static_cast<size_t>(queued); pending > 0;)
+        {
+            ssize_t written = splice(pipe.readEnd(), nullptr, fileFd, nullptr, pending, SPLICE_F_MOVE);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("splice() to file failed: " + std::string(strerror(errno)));
+            }
+            pending -= written;
+            ++stats.calls;
+        }
+        stats.bytes += queued;
+    }
+}
+
+static void receiveDirect(int sockFd, int fileFd, uint64_t length, TransferStats& stats)
+{
+    HugePageMemory buffer(BULK_DIRECT_BUFFER); // Page aligned, so O_DIRECT accepts it
+    while (stats.bytes < length)
+    {
+        // Only the last chunk can end off a block boundary, so every O_DIRECT write before it stays aligned
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - stats.bytes, buffer.size()));
+        size_t received = receiveAll(sockFd, buffer.data(), chunk);
+        if (received < chunk)
+        {
+            throw std::runtime_error("Connection ended after " + std::to_string(stats.bytes + received) + " of " +
+                                     std::to_string(length) + " bytes");
+        }
+
+        size_t aligned = received / BULK_DIRECT_ALIGNMENT * BULK_DIRECT_ALIGNMENT;
+        if (aligned < received)
+        {
+            writeAll(fileFd, buffer.data(), aligned);
+            // The tail is not a whole block; finish it through the page cache
+            int flags = fcntl(fileFd, F_GETFL);
+            if (flags == -1 || fcntl(fileFd, F_SETFL, flags & ~O_DIRECT) == -1)
+            {
+                throw std::runtime_error("Failed to clear O_DIRECT: " + std::string(strerror(errno)));
+            }
+            writeAll(fileFd, buffer.data() + aligned, received - aligned);
+        }
+        else
+        {
+            writeAll(fileFd, buffer.data(), aligned);
+        }
+        stats.bytes += received;
+        stats.calls += 2;
+    }
+}
+
+TransferStats receiveFile(int sockFd, int fileFd, bool direct)
+{
+    TransferStats stats;
+    uint64_t length = receiveHeader(sockFd);
+    TransferClock clock;
+    if (direct)
+    {
+        receiveDirect(sockFd, fileFd, length, stats);
+    }
+    else
+    {
+        receiveSpliced(sockFd, fileFd, length, stats);
+    }
+    clock.finish(stats);
+    return stats;
+}
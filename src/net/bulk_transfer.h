@@ -0,0 +1,50 @@
+/**
+ * @file bulk_transfer.h
+ * @brief Zero-copy file transfer over TCP with sendfile() and splice()
+ *
+ * Copying a file through read() and send() moves every byte through a user-space buffer
+ * twice. Here the payload never leaves the kernel:
+ * - sendFile() hands the file to the socket with sendfile(), straight from the page cache
+ * - receiveFile() moves socket data into a pipe and from the pipe into the destination file
+ *   with splice(); the pipe only passes page references, so nothing is copied in user space
+ *
+ * A transfer is one FRAME_TYPE_FILE frame whose payload is the file length (8 bytes, host
+ * byte order), followed by exactly that many raw bytes on the same connection.
+ *
+ * With direct set, the destination is written with O_DIRECT so a large transfer does not push
+ * everything else out of the page cache. O_DIRECT needs block-aligned memory and lengths,
+ * which the socket pages a pipe carries are not, so this path receives into one aligned
+ * buffer with recv() instead (one copy) and splices nothing. The unaligned tail is written
+ * after O_DIRECT has been switched off again.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#define BULK_PIPE_SIZE (1024 * 1024)             // Requested with F_SETPIPE_SZ; capped by fs.pipe-max-size
+#define BULK_SENDFILE_CHUNK (1024 * 1024 * 1024) // Bytes per sendfile() call
+#define BULK_DIRECT_BUFFER (4 * 1024 * 1024)     // Aligned receive buffer for O_DIRECT
+#define BULK_DIRECT_ALIGNMENT 4096               // Covers the logical block size of common devices
+
+struct TransferStats
+{
+    uint64_t bytes = 0;                  // Payload bytes, without the header
+    uint64_t calls = 0;                  // sendfile(), splice() or recv() + write() calls
+    std::chrono::nanoseconds elapsed{0}; // Wall time from the header to the last byte
+    std::chrono::nanoseconds cpu{0};     // User plus system time of the calling thread
+};
+
+// One line: "N bytes in S s (G Gbit/s, M MB/s), C calls, CPU P% of one core"
+std::ostream& operator<<(std::ostream& out, const TransferStats& stats);
+
+// Send the whole of fileFd (a regular file) over the connected, blocking socket sockFd.
+// Throws std::runtime_error if the file cannot be sent.
+TransferStats sendFile(int sockFd, int fileFd);
+
+// Receive one file sent by sendFile() on sockFd into fileFd, which is written from its current offset. With direct,
+// fileFd must have been opened with O_DIRECT. Throws std::runtime_error if the header is invalid, the connection
+// ends early or writing fails.
+TransferStats receiveFile(int sockFd, int fileFd, bool direct);
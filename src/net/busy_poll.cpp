@@ -0,0 +1,175 @@
+/**
+ * @file busy_poll.cpp
+ * @brief Spin mode for receive loops on dedicated cores, and how their time splits into busy and idle
+ */
+
+#include "net/busy_poll.h"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "net/metrics.h"
+
+// Registered on first use, so only processes that spin export them
+struct SpinMetrics
+{
+    Counter& busyNs;
+    Counter& idleNs;
+    Counter& readyPolls;
+    Counter& emptyPolls;
+};
+
+static SpinMetrics& spinMetrics()
+{
+    static const char* time = "Nanoseconds spinning receive loops spent handling packets or finding none";
+    static const char* polls = "Polls by spinning receive loops, by whether they found anything";
+    Metrics& registry = Metrics::instance();
+    static SpinMetrics metrics{registry.counter("net_spin_nanoseconds_total", time, "state=\"busy\""),
+                               registry.counter("net_spin_nanoseconds_total", time, "state=\"idle\""),
+                               registry.counter("net_spin_polls_total", polls, "result=\"ready\""),
+                               registry.counter("net_spin_polls_total", polls, "result=\"empty\"")};
+    return metrics;
+}
+
+std::ostream& operator<<(std::ostream& out, const SpinStats& stats)
+{
+    uint64_t totalNs = stats.busyNs + stats.idleNs;
+    double busy = totalNs == 0 ? 0.0 : 100.0 * stats.busyNs / totalNs;
+    uint64_t empty = stats.polls == 0 ? 0 : 100 * stats.emptyPolls / stats.polls;
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    out << "busy " << busy << "%, idle " << (totalNs == 0 ? 0.0 : 100.0 - busy) << "%, " << stats.polls
+        << " polls (" << empty << "% empty)";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+SpinMeter::SpinMeter() : m_last(std::chrono::steady_clock::now())
+{
+    spinMetrics();
+}
+
+SpinStats SpinMeter::take()
+{
+    SpinStats stats = m_stats;
+    m_stats = SpinStats();
+    SpinMetrics& metrics = spinMetrics();
+    metrics.busyNs.add(stats.busyNs);
+    metrics.idleNs.add(stats.idleNs);
+    metrics.readyPolls.add(stats.polls - stats.emptyPolls);
+    metrics.emptyPolls.add(stats.emptyPolls);
+    return stats;
+}
+
+bool SpinOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg == "--spin")
+    {
+        spin = true;
+        return true;
+    }
+    if (arg == "--mlock")
+    {
+        lockMemory = true;
+        return true;
+    }
+    if (arg != "--spin-cpu" && arg != "--rt-priority")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    char* end = nullptr;
+    long number = strtol(value.c_str(), &end, 10);
+    if (arg == "--spin-cpu")
+    {
+        if (value.empty() || *end != '\0' || number < 0 || number >= CPU_SETSIZE)
+        {
+            throw std::runtime_error("Invalid CPU '" + value + "'");
+        }
+        cpu = static_cast<int>(number);
+        return true;
+    }
+    if (value.empty() || *end != '\0' || number < sched_get_priority_min(SCHED_FIFO) ||
+        number > sched_get_priority_max(SCHED_FIFO))
+    {
+        throw std::runtime_error("Invalid real-time priority '" + value + "'");
+    }
+    realtimePriority = static_cast<int>(number);
+    return true;
+}
+
+void SpinOptions::validate() const
+{
+    if (!spin && cpu != -1)
+    {
+        throw std::runtime_error("--spin-cpu needs --spin");
+    }
+    if (!spin && realtimePriority != 0)
+    {
+        throw std::runtime_error("--rt-priority needs --spin");
+    }
+}
+
+void SpinOptions::apply() const
+{
+    if (lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+    {
+        throw std::runtime_error("Failed to lock memory: " + std::string(strerror(errno)));
+    }
+    /*
+    mlockall(int flags)
+    MCL_CURRENT: fault in and lock every page mapped now; MCL_FUTURE: also every page mapped later (stacks,
+    heap growth), so the receive path never waits for a page to be read back or zeroed
+    return 0 if success
+    return -1 if failed (ENOMEM: over RLIMIT_MEMLOCK without CAP_IPC_LOCK)
+    */
+    applyToThread(cpu);
+}
+
+void SpinOptions::applyToThread(int threadCpu) const
+{
+    if (threadCpu >= 0)
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(threadCpu, &cpuSet);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if (error != 0)
+        {
+            throw std::runtime_error("Failed to pin to CPU " + std::to_string(threadCpu) + ": " + strerror(error));
+        }
+    }
+
+    if (realtimePriority != 0)
+    {
+        sched_param param{};
+        param.sched_priority = realtimePriority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0)
+        {
+            throw std::runtime_error("Failed to set SCHED_FIFO priority " + std::to_string(realtimePriority) + ": " +
+                                     strerror(error));
+        }
+        /*
+        pthread_setschedparam(pthread_t thread, int policy, const struct sched_param *param)
+        SCHED_FIFO: runs until it blocks or yields, ahead of every SCHED_OTHER thread on its CPU
+        return 0 if success, an error number if failed (EPERM: no CAP_SYS_NICE or RLIMIT_RTPRIO)
+        */
+    }
+}
@@ -0,0 +1,114 @@
+/**
+ * @file busy_poll.h
+ * @brief Spin mode for receive loops on dedicated cores, and how their time splits into busy and idle
+ *
+ * A receive loop that sleeps in epoll_wait() or recvfrom() until a packet arrives pays for the
+ * wakeup on every packet: interrupt, softirq, scheduler and context switch, tens of microseconds
+ * at p99. In spin mode the loop never sleeps and trades a whole CPU for that latency:
+ * - It polls with epoll_wait() and a timeout of 0 and goes straight back when nothing is ready,
+ *   so a packet is picked up as soon as the kernel has queued it.
+ * - With --sockopt busy_poll=US (SO_BUSY_POLL), each receive call on an empty socket also polls
+ *   the NIC queue for up to US microseconds instead of waiting for its interrupt; prefer_busy_poll=1
+ *   (SO_PREFER_BUSY_POLL) keeps the interrupt masked while the application polls. Both need a NIC
+ *   driver with NAPI busy polling.
+ * - SpinOptions pins the thread to one CPU (ideally one kept free with isolcpus= and nohz_full=),
+ *   locks the process's memory so no page fault stalls it, and can give it a SCHED_FIFO priority.
+ * - SpinMeter splits the loop's time into busy (handling what a poll returned) and idle (polling
+ *   and finding nothing), so the CPU spent can be weighed against the latency won.
+ *
+ *     options.apply();                              // Pin, mlockall(), SCHED_FIFO
+ *     SpinMeter meter;
+ *     while (true)
+ *     {
+ *         int count = epoll_wait(epollFd, events, MAX_EVENTS, 0);
+ *         meter.poll(count > 0);
+ *         ... handle the events ...
+ *     }
+ *     std::cerr << "Spin: " << meter.take() << std::endl; // "busy 12.5%, idle 87.5%, 4000000 polls (99% empty)"
+ *
+ * @note A spinning thread keeps its CPU at 100% whether traffic arrives or not
+ * @note A SCHED_FIFO thread that spins starves every normal thread on its CPU, including kernel work queued
+ *       there; only combine --rt-priority with a CPU that runs nothing else
+ * @note SCHED_FIFO needs CAP_SYS_NICE (or an RLIMIT_RTPRIO), mlockall() CAP_IPC_LOCK or a large RLIMIT_MEMLOCK
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#define SPIN_REPORT_INTERVAL_MS 1000 // How often the spinning loops print their SpinStats
+
+struct SpinStats
+{
+    uint64_t busyNs = 0;     // Handling what a poll returned
+    uint64_t idleNs = 0;     // Polling and finding nothing
+    uint64_t polls = 0;
+    uint64_t emptyPolls = 0;
+};
+
+// One line: "busy 12.5%, idle 87.5%, 4000000 polls (99% empty)"
+std::ostream& operator<<(std::ostream& out, const SpinStats& stats);
+
+class SpinMeter
+{
+public:
+    SpinMeter();
+
+    // Call after every poll with whether it found anything. The time since the previous call was busy if that poll
+    // found something and idle if not. Returns the current time, for loops that schedule other work by it.
+    std::chrono::steady_clock::time_point poll(bool ready)
+    {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_last).count();
+        (m_ready ? m_stats.busyNs : m_stats.idleNs) += elapsedNs;
+        m_last = now;
+        m_ready = ready;
+        ++m_stats.polls;
+        m_stats.emptyPolls += ready ? 0 : 1;
+        return now;
+    }
+
+    // What was measured since the last call, which is also added to the net_spin_* metrics
+    SpinStats take();
+
+private:
+    std::chrono::steady_clock::time_point m_last;
+    bool m_ready = false;
+    SpinStats m_stats;
+};
+
+struct SpinOptions
+{
+    bool spin = false;         // Poll without sleeping
+    int cpu = -1;              // Pin the spinning thread to this CPU; -1 leaves it where the scheduler puts it
+    bool lockMemory = false;   // mlockall(MCL_CURRENT | MCL_FUTURE)
+    int realtimePriority = 0;  // SCHED_FIFO priority 1-99; 0 keeps SCHED_OTHER
+
+    // Handle --spin, --spin-cpu N, --mlock and --rt-priority N at argv[index]. Returns false if the argument is not
+    // one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--spin [--spin-cpu N] [--rt-priority 1-99]] [--mlock]";
+    }
+
+    bool enabled() const
+    {
+        return spin;
+    }
+
+    // Pinning and SCHED_FIFO only make sense for a loop that spins: throws std::runtime_error if --spin-cpu or
+    // --rt-priority was given without --spin. --mlock is fine in any mode.
+    void validate() const;
+
+    // Lock memory if asked to, and set up the calling thread with applyToThread(cpu). Throws std::runtime_error
+    // if a step fails.
+    void apply() const;
+
+    // Pin the calling thread to threadCpu (unless -1) and give it realtimePriority (unless 0). Throws
+    // std::runtime_error if either fails.
+    void applyToThread(int threadCpu) const;
+};
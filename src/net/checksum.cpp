@@ -0,0 +1,203 @@
+/**
+ * @file checksum.cpp
+ * @brief Internet checksum (RFC 1071) with SIMD kernels and RFC 1624 incremental updates
+ */
+
+#include "net/checksum.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// A 32-bit SIMD lane takes two 16-bit words per block, so it cannot overflow within this many blocks
+#define CHECKSUM_SIMD_MAX_BLOCKS 32768
+// Below this length the SIMD setup and reduction cost more than they save
+#define CHECKSUM_SIMD_MIN_LENGTH 64
+
+// Inlined into every kernel so the tail is compiled for the kernel's instruction set: calling legacy-SSE code
+// from AVX2 code would pay a state transition penalty on every call
+__attribute__((always_inline)) static inline uint64_t addWords(const uint8_t* data, size_t length)
+{
+    uint64_t sum = 0;
+    while (length >= 16)
+    {
+        uint32_t words[4];
+        memcpy(words, data, sizeof(words));
+        sum += static_cast<uint64_t>(words[0]) + words[1] + words[2] + words[3];
+        data += 16;
+        length -= 16;
+    }
+    while (length >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        sum += word;
+        data += 4;
+        length -= 4;
+    }
+    if (length >= 2)
+    {
+        uint16_t word;
+        memcpy(&word, data, sizeof(word));
+        sum += word;
+        data += 2;
+        length -= 2;
+    }
+    if (length == 1)
+    {
+        // The odd byte is padded with a zero byte after it, whatever the host byte order
+        uint16_t word = 0;
+        memcpy(&word, data, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+static uint64_t addScalar(const uint8_t* data, size_t length)
+{
+    return addWords(data, length);
+}
+
+#if defined(__x86_64__)
+static uint64_t addSse2(const uint8_t* data, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+    while (length >= 16)
+    {
+        size_t blocks = std::min<size_t>(length / 16, CHECKSUM_SIMD_MAX_BLOCKS);
+        __m128i lanes = zero;
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(words, zero));
+            lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(words, zero));
+            data += 16;
+        }
+        length -= blocks * 16;
+
+        uint32_t partial[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(partial), lanes);
+        sum += static_cast<uint64_t>(partial[0]) + partial[1] + partial[2] + partial[3];
+    }
+    return sum + addWords(data, length);
+}
+
+__attribute__((target("avx2"))) static uint64_t addAvx2(const uint8_t* data, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+    while (length >= 32)
+    {
+        size_t blocks = std::min<size_t>(length / 32, CHECKSUM_SIMD_MAX_BLOCKS);
+        __m256i lanes = zero;
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            lanes = _mm256_add_epi32(lanes, _mm256_unpacklo_epi16(words, zero));
+            lanes = _mm256_add_epi32(lanes, _mm256_unpackhi_epi16(words, zero));
+            data += 32;
+        }
+        length -= blocks * 32;
+
+        uint32_t partial[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(partial), lanes);
+        for (uint32_t lane : partial)
+        {
+            sum += lane;
+        }
+    }
+    return sum + addWords(data, length);
+}
+#elif defined(__ARM_NEON)
+static uint64_t addNeon(const uint8_t* data, size_t length)
+{
+    uint64_t sum = 0;
+    while (length >= 16)
+    {
+        size_t blocks = std::min<size_t>(length / 16, CHECKSUM_SIMD_MAX_BLOCKS);
+        uint32x4_t lanes = vdupq_n_u32(0);
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            lanes = vpadalq_u16(lanes, vreinterpretq_u16_u8(vld1q_u8(data)));
+            data += 16;
+        }
+        length -= blocks * 16;
+        sum += vaddlvq_u32(lanes);
+    }
+    return sum + addWords(data, length);
+}
+#endif
+
+std::vector<ChecksumKernel> checksumKernels()
+{
+    std::vector<ChecksumKernel> kernels = {{"scalar", addScalar}};
+#if defined(__x86_64__)
+    kernels.push_back({"sse2", addSse2});
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back({"avx2", addAvx2});
+    }
+#elif defined(__ARM_NEON)
+    kernels.push_back({"neon", addNeon});
+#endif
+    return kernels;
+}
+
+uint64_t checksumAdd(const void* data, size_t length, uint64_t sum)
+{
+    static const auto simdKernel = checksumKernels().back().add;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    return sum + (length < CHECKSUM_SIMD_MIN_LENGTH ? addScalar(bytes, length) : simdKernel(bytes, length));
+}
+
+uint16_t checksumFinish(uint64_t sum)
+{
+    // End-around carry: fold the high halves back in until the sum fits in 16 bits
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    return static_cast<uint16_t>(~sum);
+}
+
+uint16_t checksumUpdate16(uint16_t checksum, uint16_t oldValue, uint16_t newValue)
+{
+    uint64_t sum = static_cast<uint16_t>(~checksum);
+    sum += static_cast<uint16_t>(~oldValue);
+    sum += newValue;
+    return checksumFinish(sum);
+}
+
+uint16_t checksumUpdate32(uint16_t checksum, uint32_t oldValue, uint32_t newValue)
+{
+    uint16_t oldWords[2];
+    uint16_t newWords[2];
+    memcpy(oldWords, &oldValue, sizeof(oldWords));
+    memcpy(newWords, &newValue, sizeof(newWords));
+    checksum = checksumUpdate16(checksum, oldWords[0], newWords[0]);
+    return checksumUpdate16(checksum, oldWords[1], newWords[1]);
+}
+
+uint64_t checksumAddReference(const void* data, size_t length, uint64_t sum)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (; length > 1; length -= 2, bytes += 2)
+    {
+        uint16_t word;
+        memcpy(&word, bytes, sizeof(word));
+        sum += word;
+    }
+    if (length == 1)
+    {
+        uint16_t word = 0;
+        memcpy(&word, bytes, 1);
+        sum += word;
+    }
+    return sum;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file checksum.h
+ * @brief Internet checksum (RFC 1071) with SIMD kernels and RFC 1624 incremental updates
+ *
+ * The Internet checksum used by IPv4, ICMP, UDP and TCP is the ones' complement of the
+ * ones' complement sum of the data taken as 16-bit words. The sum is independent of byte
+ * order and of how the words are grouped, so it can be computed on wide integers or SIMD
+ * lanes and folded back to 16 bits at the very end:
+ * - Scalar: 32-bit words accumulated into a 64-bit sum
+ * - SSE2 / AVX2 (x86-64, AVX2 chosen at runtime) and NEON (AArch64): 16-bit words widened
+ *   into 32-bit lanes
+ *
+ * When only one field of a packet changes (an ICMP sequence number, a TTL, an address),
+ * checksumUpdate16/32 patch the stored checksum instead of summing the whole packet again.
+ *
+ * Partial sums of several buffers (e.g. a UDP pseudo-header and its payload) can be chained
+ * with checksumAdd as long as every buffer but the last has an even length.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Add data to a running 64-bit ones' complement sum using the fastest kernel for this CPU
+uint64_t checksumAdd(const void* data, size_t length, uint64_t sum = 0);
+
+// Fold a running sum to 16 bits and complement it: the value to store in the checksum field
+uint16_t checksumFinish(uint64_t sum);
+
+// Checksum of a whole buffer. Over a packet that already carries a valid checksum the result is 0.
+inline uint16_t internetChecksum(const void* data, size_t length)
+{
+    return checksumFinish(checksumAdd(data, length));
+}
+
+// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m'). Values are taken exactly as stored in the packet.
+uint16_t checksumUpdate16(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+uint16_t checksumUpdate32(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
+// Reference implementation: one 16-bit word at a time, as in RFC 1071
+uint64_t checksumAddReference(const void* data, size_t length, uint64_t sum = 0);
+
+struct ChecksumKernel
+{
+    const char* name;
+    uint64_t (*add)(const uint8_t* data, size_t length); // Unfolded sum of data
+};
+
+// Every kernel compiled in and supported by this CPU, fastest last (for benchmarks and verification)
+std::vector<ChecksumKernel> checksumKernels();
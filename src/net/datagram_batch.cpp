@@ -0,0 +1,168 @@
+/**
+ * @file datagram_batch.cpp
+ * @brief Batched UDP receive with recvmmsg
+ */
+
+#include "net/datagram_batch.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+
+BatchAccounting::BatchAccounting()
+    : m_droppedPackets(0), m_reportedDrops(0), m_countedDrops(0), m_metrics(trafficMetrics())
+{
+}
+
+int BatchAccounting::complete(int count, mmsghdr* headers, Datagram* datagrams)
+{
+    if (count <= 0)
+    {
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            m_metrics.wouldBlock.add();
+        }
+        else if (count == -1 && errno != EINTR)
+        {
+            m_metrics.errors.add();
+        }
+        return count;
+    }
+
+    uint64_t bytes = 0;
+    uint64_t truncated = 0;
+    int64_t nowNs = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        msghdr& msg = headers[i].msg_hdr;
+        Datagram& datagram = datagrams[i];
+        datagram.length = headers[i].msg_len;
+        datagram.truncated = msg.msg_flags & MSG_TRUNC;
+        datagram.timestamps = PacketTimestamps();
+        parseTimestamps(msg, datagram.timestamps);
+        bytes += datagram.length;
+        truncated += datagram.truncated;
+        if (datagram.timestamps.softwareNs != 0)
+        {
+            // One clock read per batch, and only when the kernel stamps datagrams
+            nowNs = nowNs != 0 ? nowNs : realtimeNs();
+            int64_t delayNs = nowNs - datagram.timestamps.softwareNs;
+            m_metrics.receiveDelay.record(delayNs > 0 ? static_cast<uint64_t>(delayNs) : 0);
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+            {
+                memcpy(&m_droppedPackets, CMSG_DATA(cmsg), sizeof(m_droppedPackets));
+            }
+        }
+    }
+
+    m_metrics.packetsReceived.add(count);
+    m_metrics.bytesReceived.add(bytes);
+    if (truncated != 0)
+    {
+        m_metrics.truncated.add(truncated);
+    }
+    if (m_droppedPackets != m_countedDrops)
+    {
+        m_metrics.kernelDrops.add(m_droppedPackets - m_countedDrops);
+        m_countedDrops = m_droppedPackets;
+    }
+    return count;
+}
+
+DatagramBatch::DatagramBatch(int sockFd, unsigned batchSize, size_t bufferSize)
+    : m_sockFd(sockFd), m_ownPool(new BufferPool(bufferSize, BufferPool::countFor(batchSize, 1))),
+      m_pool(m_ownPool.get())
+{
+    setup(batchSize);
+}
+
+DatagramBatch::DatagramBatch(int sockFd, unsigned batchSize, BufferPool& pool) : m_sockFd(sockFd), m_pool(&pool)
+{
+    setup(batchSize);
+}
+
+void DatagramBatch::setup(unsigned batchSize)
+{
+    m_controlSize = CMSG_SPACE(sizeof(uint32_t)) + TIMESTAMP_CONTROL_SIZE;
+    m_headers.resize(batchSize);
+    m_iovecs.resize(batchSize);
+    m_senders.resize(batchSize);
+    m_leases.resize(batchSize);
+    m_control.resize(batchSize * m_controlSize);
+    m_datagrams.resize(batchSize);
+
+    for (unsigned i = 0; i < batchSize; ++i)
+    {
+        PacketBuffer buffer = m_pool->acquire();
+        if (!buffer)
+        {
+            throw std::runtime_error("Buffer pool too small for a batch of " + std::to_string(batchSize));
+        }
+        attach(i, std::move(buffer));
+
+        msghdr& msg = m_headers[i].msg_hdr;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &m_senders[i];
+        msg.msg_iov = &m_iovecs[i];
+        msg.msg_iovlen = 1;
+        msg.msg_control = &m_control[i * m_controlSize];
+
+        m_datagrams[i].sender = &m_senders[i];
+    }
+}
+
+void DatagramBatch::attach(unsigned index, PacketBuffer buffer)
+{
+    m_iovecs[index].iov_base = buffer.data();
+    m_iovecs[index].iov_len = buffer.capacity();
+    m_datagrams[index].data = buffer.data();
+    m_leases[index] = std::move(buffer);
+}
+
+PacketBuffer DatagramBatch::take(unsigned index)
+{
+    PacketBuffer fresh = m_pool->acquire();
+    if (!fresh)
+    {
+        return fresh;
+    }
+    PacketBuffer filled = std::move(m_leases[index]);
+    attach(index, std::move(fresh));
+    return filled;
+}
+
+int DatagramBatch::receive(int flags)
+{
+    // The kernel overwrites the name and control lengths, so restore them before every call
+    for (mmsghdr& header : m_headers)
+    {
+        header.msg_hdr.msg_namelen = SocketAddress::capacity();
+        header.msg_hdr.msg_controllen = m_controlSize;
+    }
+
+    int count = recvmmsg(m_sockFd, m_headers.data(), static_cast<unsigned>(m_headers.size()), flags, nullptr);
+    /*
+    recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+    msgvec[i].msg_len: Bytes received into message i
+    MSG_WAITFORONE: Block until one datagram arrives, then return without waiting for the rest of the batch
+    return number of messages received if success
+    return -1 if failed
+    */
+    return m_accounting.complete(count, m_headers.data(), m_datagrams.data());
+}
+
+bool DatagramBatch::enableDropCounter(int sockFd)
+{
+    int opt = 1;
+    return setsockopt(sockFd, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt)) == 0;
+}
+/*
+SO_RXQ_OVFL: Attach a uint32_t control message to each datagram holding the number of packets
+dropped so far because the socket receive buffer was full
+*/
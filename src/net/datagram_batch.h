@@ -0,0 +1,133 @@
+/**
+ * @file datagram_batch.h
+ * @brief Batched UDP receive with recvmmsg
+ *
+ * recvfrom() costs one system call per datagram. recvmmsg() fills up to N datagrams per call
+ * into mmsghdr/iovec entries that are allocated once and reused for every batch. The buffers
+ * are leased from a BufferPool, so a caller can take() a filled one and keep it without a copy.
+ * It showcases:
+ * - recvmmsg with MSG_WAITFORONE: block for the first datagram, then take whatever else is queued
+ * - SO_RXQ_OVFL: the kernel reports, per datagram, how many packets it dropped because the
+ *   socket receive queue was full
+ * - SO_TIMESTAMPING: kernel/hardware arrival time per datagram, once enabled with TimestampOptions
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/buffer_pool.h"
+#include "net/metrics.h"
+#include "net/socket_address.h"
+#include "net/timestamping.h"
+
+struct Datagram
+{
+    const char* data;
+    size_t length;
+    const SocketAddress* sender;
+    bool truncated; // The datagram was larger than the receive buffer
+    PacketTimestamps timestamps; // Zero unless SO_TIMESTAMPING is enabled on the socket
+};
+
+// What DatagramBatch and FixedDatagramBatch do with the result of a receive call: fill in the Datagram entries, follow
+// the SO_RXQ_OVFL drop counter and update trafficMetrics()
+class BatchAccounting
+{
+public:
+    BatchAccounting();
+
+    // count and errno come straight from recvmmsg (or recvmsg as a batch of one). On success datagrams[0, count)
+    // are filled from headers[0, count). Returns count.
+    int complete(int count, mmsghdr* headers, Datagram* datagrams);
+
+    uint32_t droppedPackets() const
+    {
+        return m_droppedPackets;
+    }
+
+    uint32_t takeNewDrops()
+    {
+        uint32_t newDrops = m_droppedPackets - m_reportedDrops;
+        m_reportedDrops = m_droppedPackets;
+        return newDrops;
+    }
+
+private:
+    uint32_t m_droppedPackets;
+    uint32_t m_reportedDrops;
+    uint32_t m_countedDrops; // Drops already added to trafficMetrics().kernelDrops
+    TrafficMetrics& m_metrics;
+};
+
+class DatagramBatch
+{
+public:
+    // Buffers of bufferSize bytes from a pool of the batch's own. Throws std::runtime_error if it cannot be mapped.
+    DatagramBatch(int sockFd, unsigned batchSize, size_t bufferSize);
+    // Buffers of pool.bufferSize() bytes leased from pool, which must outlive the batch and every buffer taken
+    // from it. Throws std::runtime_error if the pool cannot lease batchSize buffers.
+    DatagramBatch(int sockFd, unsigned batchSize, BufferPool& pool);
+
+    DatagramBatch(const DatagramBatch&) = delete;
+    DatagramBatch& operator=(const DatagramBatch&) = delete;
+
+    // Receive up to batchSize datagrams with one recvmmsg call. Returns the count, or -1 with errno set.
+    int receive(int flags = MSG_WAITFORONE);
+
+    const Datagram* datagrams() const
+    {
+        return m_datagrams.data();
+    }
+
+    // Keep the buffer datagram index was received into and give the entry a fresh lease for the next receive().
+    // Returns an empty handle, and leaves the entry as it was, if the pool has no free buffer.
+    PacketBuffer take(unsigned index);
+
+    size_t bufferSize() const
+    {
+        return m_pool->bufferSize();
+    }
+
+    unsigned batchSize() const
+    {
+        return static_cast<unsigned>(m_headers.size());
+    }
+
+    // Total packets the kernel dropped on this socket (SO_RXQ_OVFL), as of the last received datagram
+    uint32_t droppedPackets() const
+    {
+        return m_accounting.droppedPackets();
+    }
+
+    // Drops reported since the previous call
+    uint32_t takeNewDrops()
+    {
+        return m_accounting.takeNewDrops();
+    }
+
+    // Ask the kernel to attach the SO_RXQ_OVFL drop counter to received datagrams
+    static bool enableDropCounter(int sockFd);
+
+private:
+    int m_sockFd;
+    std::unique_ptr<BufferPool> m_ownPool;
+    BufferPool* m_pool;
+    size_t m_controlSize;
+    std::vector<mmsghdr> m_headers;
+    std::vector<iovec> m_iovecs;
+    std::vector<SocketAddress> m_senders;
+    std::vector<PacketBuffer> m_leases;
+    std::vector<char> m_control;
+    std::vector<Datagram> m_datagrams;
+    BatchAccounting m_accounting;
+
+    void setup(unsigned batchSize);
+    void attach(unsigned index, PacketBuffer buffer);
+};
@@ -0,0 +1,257 @@
+/**
+ * @file datagram_publisher.cpp
+ * @brief Batched UDP send with sendmmsg and UDP GSO
+ */
+
+#include "net/datagram_publisher.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <netinet/udp.h>
+#include <string.h>
+
+#include "net/pacer.h"
+
+DatagramPublisher::DatagramPublisher(int sockFd, const SocketAddress& destination, const PublisherOptions& options)
+    : m_sockFd(sockFd), m_destination(destination), m_options(options),
+      m_slab(std::max<size_t>(options.maxBytes, UDP_GSO_MAX_BYTES)), m_queuedBytes(0), m_timed(false),
+      m_flushFailed(false), m_metrics(trafficMetrics())
+{
+    if (m_options.maxMessages == 0)
+    {
+        m_options.maxMessages = 1;
+    }
+    if (m_options.gso)
+    {
+        m_options.maxBytes = std::min<size_t>(m_options.maxBytes, UDP_GSO_MAX_BYTES);
+    }
+    m_lengths.reserve(m_options.maxMessages);
+    m_launchTimes.reserve(m_options.maxMessages);
+    m_controls.resize(m_options.maxMessages * TXTIME_CONTROL_SIZE);
+    m_headers.resize(m_options.maxMessages);
+    m_iovecs.resize(m_options.maxMessages);
+}
+
+DatagramPublisher::~DatagramPublisher()
+{
+    flush();
+}
+
+bool DatagramPublisher::canSegment(size_t length) const
+{
+    if (m_lengths.empty())
+    {
+        return true;
+    }
+    // Every segment but the last must have the size of the first one
+    size_t segmentSize = m_lengths.front();
+    return m_lengths.size() < UDP_GSO_MAX_SEGMENTS && m_lengths.back() == segmentSize && length <= segmentSize &&
+           m_queuedBytes + length <= UDP_GSO_MAX_BYTES;
+}
+
+bool DatagramPublisher::publish(std::string_view message, uint64_t launchTimeNs)
+{
+    char* payload = reserve(message.size());
+    if (payload == nullptr)
+    {
+        return false;
+    }
+    memcpy(payload, message.data(), message.size());
+    return commit(message.size(), launchTimeNs);
+}
+
+char* DatagramPublisher::reserve(size_t length)
+{
+    if (length > m_slab.size())
+    {
+        ++m_stats.errors;
+        return nullptr;
+    }
+
+    bool full = m_queuedBytes + length > m_options.maxBytes || m_lengths.size() == m_options.maxMessages;
+    if (!m_lengths.empty() && (full || (m_options.gso && !canSegment(length))))
+    {
+        m_flushFailed = !flush() || m_flushFailed;
+    }
+    return m_slab.data() + m_queuedBytes;
+}
+
+bool DatagramPublisher::commit(size_t length, uint64_t launchTimeNs)
+{
+    bool ok = !m_flushFailed;
+    m_flushFailed = false;
+
+    if (m_lengths.empty())
+    {
+        m_oldestQueuedAt = std::chrono::steady_clock::now();
+    }
+    m_queuedBytes += length;
+    m_lengths.push_back(length);
+    m_launchTimes.push_back(launchTimeNs);
+    m_timed = m_timed || launchTimeNs != 0;
+
+    if (m_lengths.size() == m_options.maxMessages || m_queuedBytes >= m_options.maxBytes)
+    {
+        return flush() && ok;
+    }
+    return poll() && ok;
+}
+
+bool DatagramPublisher::poll()
+{
+    if (m_lengths.empty() || std::chrono::steady_clock::now() - m_oldestQueuedAt < m_options.maxDelay)
+    {
+        return true;
+    }
+    return flush();
+}
+
+std::chrono::microseconds DatagramPublisher::timeUntilDeadline() const
+{
+    if (m_lengths.empty())
+    {
+        return std::chrono::microseconds(0);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                         m_oldestQueuedAt);
+    return std::max(std::chrono::microseconds(0), m_options.maxDelay - elapsed);
+}
+
+bool DatagramPublisher::flush()
+{
+    if (m_lengths.empty())
+    {
+        return true;
+    }
+
+    bool ok = m_options.gso && !m_timed && m_lengths.size() > 1 ? flushSegmented() : flushBatch();
+    m_lengths.clear();
+    m_launchTimes.clear();
+    m_timed = false;
+    m_queuedBytes = 0;
+    return ok;
+}
+
+bool DatagramPublisher::flushBatch()
+{
+    size_t count = m_lengths.size();
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_iovecs[i].iov_base = m_slab.data() + offset;
+        m_iovecs[i].iov_len = m_lengths[i];
+        offset += m_lengths[i];
+
+        msghdr& msg = m_headers[i].msg_hdr;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = m_destination.data();
+        msg.msg_namelen = m_destination.size();
+        msg.msg_iov = &m_iovecs[i];
+        msg.msg_iovlen = 1;
+        if (m_launchTimes[i] != 0)
+        {
+            setLaunchTime(msg, &m_controls[i * TXTIME_CONTROL_SIZE], m_launchTimes[i]);
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < count)
+    {
+        int result = sendmmsg(m_sockFd, &m_headers[sent], static_cast<unsigned>(count - sent), 0);
+        /*
+        sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+        return number of messages sent if success; fewer than vlen means the next one failed
+        return -1 if failed
+        */
+        ++m_stats.systemCalls;
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // Drop the rest of the batch; the caller sees the failure through the return value
+            m_stats.errors += count - sent;
+            countFailure();
+            return false;
+        }
+        uint64_t bytes = 0;
+        for (int i = 0; i < result; ++i)
+        {
+            bytes += m_headers[sent + i].msg_len;
+        }
+        m_stats.bytes += bytes;
+        m_stats.datagrams += result;
+        m_metrics.packetsSent.add(result);
+        m_metrics.bytesSent.add(bytes);
+        sent += result;
+    }
+    return true;
+}
+
+bool DatagramPublisher::flushSegmented()
+{
+    iovec iov;
+    iov.iov_base = m_slab.data();
+    iov.iov_len = m_queuedBytes;
+
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = m_destination.data();
+    msg.msg_namelen = m_destination.size();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segmentSize = static_cast<uint16_t>(m_lengths.front());
+    memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+    /*
+    UDP_SEGMENT (Linux 4.18+): The payload is split into segmentSize datagrams, the last one possibly shorter.
+    The stack builds the headers once for the whole buffer, or offloads segmentation to the NIC.
+    */
+
+    ssize_t result;
+    do
+    {
+        result = sendmsg(m_sockFd, &msg, 0);
+    } while (result == -1 && errno == EINTR);
+    ++m_stats.systemCalls;
+
+    if (result == -1)
+    {
+        if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT)
+        {
+            // Segment size above the path MTU or no GSO support on this socket: fall back to sendmmsg for good
+            m_options.gso = false;
+            return flushBatch();
+        }
+        m_stats.errors += m_lengths.size();
+        countFailure();
+        return false;
+    }
+    m_stats.datagrams += m_lengths.size();
+    m_stats.bytes += static_cast<uint64_t>(result);
+    m_metrics.packetsSent.add(m_lengths.size());
+    m_metrics.bytesSent.add(static_cast<uint64_t>(result));
+    return true;
+}
+
+void DatagramPublisher::countFailure()
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        m_metrics.wouldBlock.add();
+    }
+    else
+    {
+        m_metrics.errors.add();
+    }
+}
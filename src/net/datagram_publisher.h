@@ -0,0 +1,116 @@
+/**
+ * @file datagram_publisher.h
+ * @brief Batched UDP send with sendmmsg and UDP GSO
+ *
+ * sendto() costs one system call per datagram. DatagramPublisher copies messages into a
+ * preallocated slab and flushes the whole queue with one sendmmsg() call, or, in GSO mode,
+ * with one sendmsg() carrying a UDP_SEGMENT size so the kernel (or NIC) splits a large
+ * buffer into equal-size datagrams. Callers that build messages can write them straight into
+ * the slab with reserve() and commit() instead of publishing a copy.
+ *
+ * A flush happens when any limit is reached:
+ * - maxMessages queued datagrams
+ * - maxBytes queued payload bytes
+ * - maxDelay elapsed since the oldest queued datagram (checked by publish() and poll())
+ *
+ * Datagrams queued with a launch time (see pacer.h) carry it as an SCM_TXTIME message; a batch
+ * holding any goes out with sendmmsg, since one GSO send can only have one launch time.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/buffer_pool.h"
+#include "net/metrics.h"
+#include "net/socket_address.h"
+
+#define UDP_GSO_MAX_SEGMENTS 64     // Kernel limit on segments per GSO send (UDP_MAX_SEGMENTS)
+#define UDP_GSO_MAX_BYTES 65507     // Largest UDP payload; the GSO buffer must fit in one IP packet length
+
+struct PublisherOptions
+{
+    unsigned maxMessages = 64;
+    size_t maxBytes = 64 * 1024;
+    std::chrono::microseconds maxDelay{100};
+    bool gso = false; // Use UDP_SEGMENT when queued datagrams share one size
+};
+
+struct PublisherStats
+{
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    uint64_t systemCalls = 0;
+    uint64_t errors = 0;
+};
+
+class DatagramPublisher
+{
+public:
+    DatagramPublisher(int sockFd, const SocketAddress& destination, const PublisherOptions& options);
+    ~DatagramPublisher();
+
+    DatagramPublisher(const DatagramPublisher&) = delete;
+    DatagramPublisher& operator=(const DatagramPublisher&) = delete;
+
+    // Queue a copy of message, flushing first or afterwards when a limit is reached. Returns false on send error.
+    // A non-zero launchTimeNs is sent as SCM_TXTIME, for a socket with SO_TXTIME.
+    bool publish(std::string_view message, uint64_t launchTimeNs = 0);
+
+    // Room for the next datagram of length bytes in the slab, flushing first if it would not fit in this batch.
+    // Write the payload there and commit() it. Returns nullptr if length exceeds the slab.
+    char* reserve(size_t length);
+
+    // Queue the datagram written at the last reserve(), of at most the reserved length, and flush when a limit is
+    // reached. Returns false on send error, including one from the flush in reserve().
+    bool commit(size_t length, uint64_t launchTimeNs = 0);
+
+    // Flush if the oldest queued datagram has waited maxDelay. Call this from the caller's loop.
+    bool poll();
+
+    // Send everything queued. Returns false if any datagram could not be sent.
+    bool flush();
+
+    size_t pendingMessages() const
+    {
+        return m_lengths.size();
+    }
+
+    // Time until poll() would flush, or zero when nothing is queued (suitable for an epoll/poll timeout)
+    std::chrono::microseconds timeUntilDeadline() const;
+
+    const PublisherStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    int m_sockFd;
+    SocketAddress m_destination;
+    PublisherOptions m_options;
+    PublisherStats m_stats;
+
+    HugePageMemory m_slab;               // Queued payloads, back to back
+    std::vector<size_t> m_lengths;       // Payload length of each queued datagram
+    std::vector<uint64_t> m_launchTimes; // SCM_TXTIME of each, 0 for none
+    std::vector<char> m_controls;        // TXTIME_CONTROL_SIZE bytes per queued datagram
+    std::vector<mmsghdr> m_headers;      // Preallocated sendmmsg headers
+    std::vector<iovec> m_iovecs;
+    size_t m_queuedBytes;
+    bool m_timed; // A queued datagram has a launch time
+    bool m_flushFailed; // A flush in reserve() failed; reported by the next commit()
+    std::chrono::steady_clock::time_point m_oldestQueuedAt;
+    TrafficMetrics& m_metrics;
+
+    bool flushBatch();
+    bool flushSegmented();
+    void countFailure(); // A send failed: count it as EAGAIN or as an error, from errno
+    bool canSegment(size_t length) const;
+};
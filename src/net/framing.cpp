@@ -0,0 +1,159 @@
+/**
+ * @file framing.cpp
+ * @brief Length-prefixed message framing for TCP streams
+ */
+
+#include "net/framing.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+size_t encodeFrameHeader(uint8_t type, uint32_t payloadLength, char* out)
+{
+    size_t size = 0;
+    while (payloadLength >= 0x80)
+    {
+        out[size++] = static_cast<char>((payloadLength & 0x7F) | 0x80);
+        payloadLength >>= 7;
+    }
+    out[size++] = static_cast<char>(payloadLength);
+    out[size++] = static_cast<char>(type);
+    return size;
+}
+
+static size_t roundUpCapacity(size_t capacity)
+{
+    size_t rounded = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+MirroredRingBuffer::MirroredRingBuffer() : m_data(nullptr), m_capacity(0), m_head(0), m_tail(0)
+{
+}
+
+MirroredRingBuffer::MirroredRingBuffer(size_t capacity) : m_capacity(roundUpCapacity(capacity)), m_head(0), m_tail(0)
+{
+    int fd = memfd_create("frame-ring", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        throw std::runtime_error("Failed to create ring buffer memory: " + std::string(strerror(errno)));
+    }
+    if (ftruncate(fd, static_cast<off_t>(m_capacity)) == -1)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to size ring buffer memory: " + std::string(strerror(errno)));
+    }
+
+    // Reserve 2 * capacity of address space, then map the same pages into both halves
+    void* base = mmap(nullptr, 2 * m_capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to reserve ring buffer: " + std::string(strerror(errno)));
+    }
+    m_data = static_cast<char*>(base);
+
+    if (mmap(m_data, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(m_data + m_capacity, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        int error = errno;
+        munmap(m_data, 2 * m_capacity);
+        close(fd);
+        throw std::runtime_error("Failed to map ring buffer: " + std::string(strerror(error)));
+    }
+    /*
+    memfd_create(const char *name, unsigned int flags): Anonymous file backing the ring pages
+    mmap(addr, len, prot, MAP_SHARED | MAP_FIXED, fd, 0): Map the file exactly at addr; both halves alias it
+    The mappings keep the memory alive, so the descriptor is not needed afterwards
+    */
+    close(fd);
+}
+
+MirroredRingBuffer::~MirroredRingBuffer()
+{
+    if (m_data != nullptr)
+    {
+        munmap(m_data, 2 * m_capacity);
+    }
+}
+
+MirroredRingBuffer::MirroredRingBuffer(MirroredRingBuffer&& other) noexcept
+    : m_data(other.m_data), m_capacity(other.m_capacity), m_head(other.m_head), m_tail(other.m_tail)
+{
+    other.m_data = nullptr;
+    other.m_capacity = 0;
+    other.m_head = 0;
+    other.m_tail = 0;
+}
+
+MirroredRingBuffer& MirroredRingBuffer::operator=(MirroredRingBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_data != nullptr)
+        {
+            munmap(m_data, 2 * m_capacity);
+        }
+        m_data = other.m_data;
+        m_capacity = other.m_capacity;
+        m_head = other.m_head;
+        m_tail = other.m_tail;
+        other.m_data = nullptr;
+        other.m_capacity = 0;
+        other.m_head = 0;
+        other.m_tail = 0;
+    }
+    return *this;
+}
+
+RingBufferPool::RingBufferPool(size_t capacity, size_t maxIdle)
+    : m_capacity(roundUpCapacity(capacity)), m_maxIdle(maxIdle)
+{
+}
+
+MirroredRingBuffer RingBufferPool::lease()
+{
+    if (m_idle.empty())
+    {
+        return MirroredRingBuffer(m_capacity);
+    }
+    MirroredRingBuffer ring = std::move(m_idle.back());
+    m_idle.pop_back();
+    return ring;
+}
+
+void RingBufferPool::release(MirroredRingBuffer ring)
+{
+    ring.consume(ring.readableBytes());
+    if (ring.allocated() && m_idle.size() < m_maxIdle)
+    {
+        m_idle.push_back(std::move(ring));
+    }
+}
+
+FrameDecoder::FrameDecoder(size_t bufferCapacity, size_t maxFrameSize)
+    : m_buffer(bufferCapacity), m_pool(nullptr), m_maxFrameSize(std::min(maxFrameSize, m_buffer.capacity()))
+{
+}
+
+FrameDecoder::FrameDecoder(RingBufferPool& pool, size_t maxFrameSize)
+    : m_pool(&pool), m_maxFrameSize(std::min(maxFrameSize, pool.capacity()))
+{
+}
+
+FrameDecoder::~FrameDecoder()
+{
+    if (m_pool != nullptr && m_buffer.allocated())
+    {
+        m_pool->release(std::move(m_buffer));
+    }
+}
@@ -0,0 +1,317 @@
+/**
+ * @file framing.h
+ * @brief Length-prefixed message framing for TCP streams
+ *
+ * TCP is a byte stream: one send() may arrive as several recv() calls, and several
+ * sends may arrive in a single recv(). Each message is therefore framed as
+ *
+ *     +-----------------------+-----------+-----------------+
+ *     | varint payload length | type (u8) | payload         |
+ *     +-----------------------+-----------+-----------------+
+ *
+ * The length is an unsigned LEB128 varint (7 bits per byte, high bit = continuation),
+ * so short messages pay a 2 byte header.
+ *
+ * FrameDecoder parses frames in place from a mirrored ring buffer: the same pages are
+ * mapped twice back to back, so every readable and writable region is contiguous even
+ * when it wraps. recv() writes straight into the ring and handlers receive
+ * std::string_view views into it - no per-message allocation, copying or clearing.
+ *
+ * A server with many connections gives each decoder a RingBufferPool instead: the decoder
+ * parses whatever it is fed in place and only leases a ring while it holds a partial frame,
+ * so idle connections cost neither memory nor the two mappings (vm.max_map_count) per ring.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define FRAME_MAX_HEADER_SIZE 6 // 5 byte varint for a 32-bit length + 1 type byte
+
+enum FrameType : uint8_t
+{
+    FRAME_TYPE_TEXT = 1,
+    FRAME_TYPE_BINARY = 2,
+    FRAME_TYPE_FILE = 3 // Payload: 8-byte file length; that many raw bytes follow the frame (see bulk_transfer.h)
+};
+
+// Write the frame header into out (at least FRAME_MAX_HEADER_SIZE bytes) and return its size
+size_t encodeFrameHeader(uint8_t type, uint32_t payloadLength, char* out);
+
+// Read the frame header at data. Returns its size, 0 if more than available bytes are needed, or -1 if the varint
+// is longer than 5 bytes or overflows 32 bits.
+inline int decodeFrameHeader(const char* data, size_t available, uint8_t& type, uint32_t& payloadLength)
+{
+    payloadLength = 0;
+    size_t offset = 0;
+    for (int shift = 0;; shift += 7, ++offset)
+    {
+        if (offset == available)
+        {
+            return 0;
+        }
+        if (offset == FRAME_MAX_HEADER_SIZE - 1)
+        {
+            return -1;
+        }
+        uint8_t byte = static_cast<uint8_t>(data[offset]);
+        if (shift == 28 && byte > 0x0F)
+        {
+            return -1;
+        }
+        payloadLength |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            ++offset;
+            break;
+        }
+    }
+    if (offset == available)
+    {
+        return 0;
+    }
+    type = static_cast<uint8_t>(data[offset]);
+    return static_cast<int>(offset + 1);
+}
+
+/**
+ * Ring buffer whose storage is mapped twice consecutively, so [readPointer(), readPointer() + readableBytes())
+ * and [writePointer(), writePointer() + writableBytes()) are always single contiguous ranges.
+ * The capacity is rounded up to a power of two no smaller than the page size.
+ */
+class MirroredRingBuffer
+{
+public:
+    // No storage: capacity() and writableBytes() are 0 until a ring is moved in
+    MirroredRingBuffer();
+    // Throws std::runtime_error if the memory cannot be created or mapped
+    explicit MirroredRingBuffer(size_t capacity);
+    ~MirroredRingBuffer();
+
+    MirroredRingBuffer(MirroredRingBuffer&& other) noexcept;
+    MirroredRingBuffer& operator=(MirroredRingBuffer&& other) noexcept;
+    MirroredRingBuffer(const MirroredRingBuffer&) = delete;
+    MirroredRingBuffer& operator=(const MirroredRingBuffer&) = delete;
+
+    const char* readPointer() const
+    {
+        return m_data + (m_head & (m_capacity - 1));
+    }
+
+    size_t readableBytes() const
+    {
+        return m_tail - m_head;
+    }
+
+    char* writePointer()
+    {
+        return m_data + (m_tail & (m_capacity - 1));
+    }
+
+    size_t writableBytes() const
+    {
+        return m_capacity - readableBytes();
+    }
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    bool allocated() const
+    {
+        return m_data != nullptr;
+    }
+
+    void commitWrite(size_t length)
+    {
+        m_tail += length;
+    }
+
+    void consume(size_t length)
+    {
+        m_head += length;
+    }
+
+private:
+    char* m_data;
+    size_t m_capacity;
+    size_t m_head;
+    size_t m_tail;
+};
+
+/**
+ * Rings of one capacity for the decoders of one event loop. Released rings are kept for the next lease, up to maxIdle
+ * of them. Not thread-safe.
+ */
+class RingBufferPool
+{
+public:
+    RingBufferPool(size_t capacity, size_t maxIdle);
+
+    // Rounded like MirroredRingBuffer's
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    // An idle ring, or a new one; throws std::runtime_error if it cannot be created
+    MirroredRingBuffer lease();
+    // Drops whatever the ring still holds; past maxIdle idle rings it is unmapped
+    void release(MirroredRingBuffer ring);
+
+private:
+    size_t m_capacity;
+    size_t m_maxIdle;
+    std::vector<MirroredRingBuffer> m_idle;
+};
+
+enum class FrameStatus
+{
+    Ok,        // All complete frames were delivered; trailing bytes belong to a partial frame
+    BadHeader, // The varint length is longer than 5 bytes or overflows 32 bits
+    TooLarge   // The announced frame does not fit in maxFrameSize
+};
+
+class FrameDecoder
+{
+public:
+    // maxFrameSize (header included) is clamped to the ring capacity so a partial frame can always complete
+    FrameDecoder(size_t bufferCapacity, size_t maxFrameSize);
+    // Leases a ring from pool only while a partial frame is buffered; such a decoder is only fed through feed().
+    // The pool must outlive the decoder.
+    FrameDecoder(RingBufferPool& pool, size_t maxFrameSize);
+    ~FrameDecoder();
+
+    FrameDecoder(const FrameDecoder&) = delete;
+    FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+    // Region to recv() into, followed by commitWrite() with the number of bytes received (owned ring only)
+    char* writePointer()
+    {
+        return m_buffer.writePointer();
+    }
+
+    size_t writableBytes() const
+    {
+        return m_buffer.writableBytes();
+    }
+
+    void commitWrite(size_t length)
+    {
+        m_buffer.commitWrite(length);
+    }
+
+    size_t bufferedBytes() const
+    {
+        return m_buffer.readableBytes();
+    }
+
+    // Deliver every complete buffered frame to handler(uint8_t type, std::string_view payload).
+    // The view is only valid during the call.
+    template <typename Handler>
+    FrameStatus drain(Handler&& handler)
+    {
+        while (true)
+        {
+            const char* data = m_buffer.readPointer();
+            size_t available = m_buffer.readableBytes();
+            size_t frameSize = 0;
+            FrameStatus status = parse(data, available, handler, frameSize);
+            if (status != FrameStatus::Ok || frameSize == 0)
+            {
+                return status;
+            }
+            m_buffer.consume(frameSize);
+        }
+    }
+
+    // Deliver frames from an external buffer (e.g. an io_uring provided buffer). Complete frames are parsed in
+    // place when nothing is buffered; only a trailing partial frame is copied into the ring. Throws
+    // std::runtime_error if a pooled decoder needs a ring and none can be created.
+    template <typename Handler>
+    FrameStatus feed(const char* data, size_t length, Handler&& handler)
+    {
+        while (m_buffer.readableBytes() == 0 && length > 0)
+        {
+            size_t frameSize = 0;
+            FrameStatus status = parse(data, length, handler, frameSize);
+            if (status != FrameStatus::Ok)
+            {
+                return status;
+            }
+            if (frameSize == 0)
+            {
+                break;
+            }
+            data += frameSize;
+            length -= frameSize;
+        }
+
+        if (length > 0 && m_pool != nullptr && !m_buffer.allocated())
+        {
+            m_buffer = m_pool->lease();
+        }
+        while (length > 0)
+        {
+            size_t chunk = std::min(length, m_buffer.writableBytes());
+            if (chunk == 0)
+            {
+                return FrameStatus::TooLarge;
+            }
+            std::copy(data, data + chunk, m_buffer.writePointer());
+            m_buffer.commitWrite(chunk);
+            data += chunk;
+            length -= chunk;
+
+            FrameStatus status = drain(handler);
+            if (status != FrameStatus::Ok)
+            {
+                return status;
+            }
+        }
+
+        if (m_pool != nullptr && m_buffer.allocated() && m_buffer.readableBytes() == 0)
+        {
+            m_pool->release(std::move(m_buffer));
+        }
+        return FrameStatus::Ok;
+    }
+
+private:
+    MirroredRingBuffer m_buffer;
+    RingBufferPool* m_pool; // nullptr when the decoder owns its ring
+    size_t m_maxFrameSize;
+
+    // Decode one frame starting at data. frameSize is 0 when the frame is still incomplete.
+    template <typename Handler>
+    FrameStatus parse(const char* data, size_t available, Handler& handler, size_t& frameSize)
+    {
+        uint8_t type;
+        uint32_t payloadLength;
+        int headerSize = decodeFrameHeader(data, available, type, payloadLength);
+        if (headerSize <= 0)
+        {
+            return headerSize == 0 ? FrameStatus::Ok : FrameStatus::BadHeader;
+        }
+
+        size_t total = static_cast<size_t>(headerSize) + payloadLength;
+        if (total > m_maxFrameSize)
+        {
+            return FrameStatus::TooLarge;
+        }
+        if (total > available)
+        {
+            return FrameStatus::Ok;
+        }
+
+        handler(type, std::string_view(data + headerSize, payloadLength));
+        frameSize = total;
+        return FrameStatus::Ok;
+    }
+};
@@ -0,0 +1,357 @@
+/**
+ * @file hot_restart.cpp
+ * @brief Hand a running receiver's sockets to its replacement over a UNIX socket (SCM_RIGHTS)
+ */
+
+#include "net/hot_restart.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static sockaddr_un unixAddress(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Invalid hot restart path '" + path + "'");
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+static int createEventFd()
+{
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd == -1)
+    {
+        throw std::runtime_error("Failed to create eventfd: " + std::string(strerror(errno)));
+    }
+    return fd;
+}
+
+static void notify(int eventFd)
+{
+    uint64_t one = 1;
+    if (write(eventFd, &one, sizeof(one)) == -1)
+    {
+        // Only fails if the counter would overflow, and then it is readable already
+    }
+}
+
+HotRestart::HotRestart(const std::string& path) : m_path(path), m_stop(createEventFd()), m_wake(-1)
+{
+    try
+    {
+        m_wake = createEventFd();
+        sockaddr_un address = unixAddress(path);
+        Socket previous(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC);
+        if (connect(previous.fd(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            // Nobody there: the first process, or the last one exited
+            if (errno == ENOENT || errno == ECONNREFUSED)
+            {
+                return;
+            }
+            throw std::runtime_error("Failed to connect to " + path + ": " + std::string(strerror(errno)));
+        }
+        /*
+        SOCK_SEQPACKET: a connected UNIX socket that keeps message boundaries, so the handover arrives as one
+        message with the tags and all the descriptors together
+        */
+        m_previous = std::move(previous);
+        receiveSockets();
+    }
+    catch (const std::exception&)
+    {
+        for (auto& entry : m_inherited)
+        {
+            close(entry.second);
+        }
+        close(m_stop);
+        if (m_wake != -1)
+        {
+            close(m_wake);
+        }
+        throw;
+    }
+}
+
+HotRestart::~HotRestart()
+{
+    if (m_thread.joinable())
+    {
+        notify(m_wake);
+        m_thread.join();
+    }
+    // Once handed over, path is the next process's socket
+    if (m_listener.fd() != -1 && !stopped())
+    {
+        unlink(m_path.c_str());
+    }
+    for (auto& entry : m_inherited)
+    {
+        close(entry.second);
+    }
+    close(m_stop);
+    close(m_wake);
+}
+
+void HotRestart::receiveSockets()
+{
+    std::vector<char> tags(HOT_RESTART_MAX_TAGS);
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HOT_RESTART_MAX_SOCKETS)];
+    iovec iov = {tags.data(), tags.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t length;
+    do
+    {
+        length = recvmsg(m_previous.fd(), &msg, MSG_CMSG_CLOEXEC);
+    } while (length == -1 && errno == EINTR);
+    /*
+    recvmsg() on a UNIX socket: an SCM_RIGHTS control message carries descriptors. The kernel installs a new
+    descriptor in this process for each one, referring to the same open socket as the sender's.
+    MSG_CMSG_CLOEXEC: set close-on-exec on them, as SOCK_CLOEXEC does for sockets opened here
+    */
+    if (length == -1)
+    {
+        throw std::runtime_error("Failed to receive sockets from " + m_path + ": " + std::string(strerror(errno)));
+    }
+
+    // Take the descriptors first, so they are closed again whatever is wrong with the message
+    std::vector<int> fds;
+    for (cmsghdr* header = CMSG_FIRSTHDR(&msg); header != nullptr; header = CMSG_NXTHDR(&msg, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(fd));
+                fds.push_back(fd);
+            }
+        }
+    }
+
+    // The socket count, then one tag per line in the order of the descriptors
+    std::vector<std::string> lines;
+    std::string text(tags.data(), static_cast<size_t>(length));
+    for (size_t start = 0; start < text.size();)
+    {
+        size_t end = text.find('\n', start);
+        lines.push_back(text.substr(start, end - start));
+        start = end == std::string::npos ? text.size() : end + 1;
+    }
+    for (size_t i = 0; i < fds.size(); ++i)
+    {
+        m_inherited.emplace_back(i + 1 < lines.size() ? lines[i + 1] : "", fds[i]);
+    }
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || lines.empty() || lines[0] != std::to_string(fds.size()) ||
+        lines.size() != fds.size() + 1)
+    {
+        throw std::runtime_error("Malformed handover from " + m_path);
+    }
+}
+
+Socket HotRestart::adopt(const std::string& tag)
+{
+    for (auto entry = m_inherited.begin(); entry != m_inherited.end(); ++entry)
+    {
+        if (entry->first == tag)
+        {
+            Socket socket = Socket::fromDescriptor(entry->second);
+            m_inherited.erase(entry);
+            ++m_adopted;
+            return socket;
+        }
+    }
+    return Socket();
+}
+
+void HotRestart::offer(int fd, const std::string& tag)
+{
+    if (tag.find('\n') != std::string::npos)
+    {
+        throw std::runtime_error("Invalid hot restart tag '" + tag + "'");
+    }
+    if (m_offered.size() == HOT_RESTART_MAX_SOCKETS)
+    {
+        throw std::runtime_error("At most " + std::to_string(HOT_RESTART_MAX_SOCKETS) +
+                                 " sockets can be handed over");
+    }
+    m_offered.emplace_back(tag, fd);
+}
+
+void HotRestart::start()
+{
+    for (auto& entry : m_inherited)
+    {
+        std::cout << "Closing inherited socket '" << entry.first << "': not in this configuration" << std::endl;
+        close(entry.second);
+    }
+    m_inherited.clear();
+
+    // The old process still listens on path, so bind next to it and rename over it: a process starting after
+    // this point finds this one
+    std::string next = m_path + ".next";
+    sockaddr_un address = unixAddress(next);
+    m_listener = Socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC);
+    unlink(next.c_str());
+    if (bind(m_listener.fd(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(m_listener.fd(), 1) == -1 || rename(next.c_str(), m_path.c_str()) == -1)
+    {
+        int error = errno;
+        unlink(next.c_str());
+        m_listener.close();
+        throw std::runtime_error("Failed to listen on " + m_path + ": " + std::string(strerror(error)));
+    }
+    /*
+    rename() replaces path atomically. The old listener stays open but can no longer be reached by name,
+    and the old process must not unlink path once it has handed over.
+    */
+
+    if (inherited())
+    {
+        char ready = 'R';
+        if (send(m_previous.fd(), &ready, sizeof(ready), MSG_NOSIGNAL) != sizeof(ready))
+        {
+            std::cerr << "Failed to tell the previous process to stop: " << strerror(errno) << std::endl;
+        }
+        m_previous.close();
+        std::cout << "Took over " << m_adopted << " sockets from the previous process" << std::endl;
+    }
+    m_thread = std::thread(&HotRestart::run, this);
+}
+
+void HotRestart::run()
+{
+    while (true)
+    {
+        pollfd fds[2] = {{m_listener.fd(), POLLIN, 0}, {m_wake, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "Hot restart: poll failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        if (fds[1].revents != 0)
+        {
+            return;
+        }
+
+        int fd = accept4(m_listener.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            continue;
+        }
+        bool handedOver = handOver(fd);
+        close(fd);
+        if (handedOver)
+        {
+            m_stopped.store(true, std::memory_order_release);
+            notify(m_stop);
+            return;
+        }
+    }
+}
+
+// Send every offered socket and wait for the new process to say it has taken over
+bool HotRestart::handOver(int fd)
+{
+    std::string tags = std::to_string(m_offered.size());
+    for (const auto& entry : m_offered)
+    {
+        tags += "\n" + entry.first;
+    }
+    if (tags.size() > HOT_RESTART_MAX_TAGS)
+    {
+        std::cerr << "Hot restart: " << tags.size() << " bytes of tags do not fit in one handover" << std::endl;
+        return false;
+    }
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HOT_RESTART_MAX_SOCKETS)];
+    iovec iov = {tags.data(), tags.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!m_offered.empty())
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * m_offered.size());
+        cmsghdr* header = CMSG_FIRSTHDR(&msg);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * m_offered.size());
+        for (size_t i = 0; i < m_offered.size(); ++i)
+        {
+            memcpy(CMSG_DATA(header) + i * sizeof(int), &m_offered[i].second, sizeof(int));
+        }
+    }
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) == -1)
+    {
+        std::cerr << "Hot restart: failed to send sockets: " << strerror(errno) << std::endl;
+        return false;
+    }
+    /*
+    sendmsg() with SCM_RIGHTS: the kernel passes references to the open sockets, not numbers; the receiver
+    gets descriptors of its own. The sockets stay open here as well until this process closes them.
+    */
+
+    pollfd ready = {fd, POLLIN, 0};
+    char ack = 0;
+    if (poll(&ready, 1, HOT_RESTART_ACK_TIMEOUT_MS) != 1 || recv(fd, &ack, sizeof(ack), 0) != 1 || ack != 'R')
+    {
+        std::cerr << "Hot restart: the new process did not take over, still serving" << std::endl;
+        return false;
+    }
+    std::cout << "Handed " << m_offered.size() << " sockets over to the new process" << std::endl;
+    return true;
+}
+
+bool HotRestartOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--hot-restart" && arg != "--drain-timeout")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--hot-restart")
+    {
+        unixAddress(value); // Throws if it is too long for a UNIX socket
+        path = value;
+        return true;
+    }
+    char* end = nullptr;
+    unsigned long seconds = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || seconds > 86400)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    drainTimeout = std::chrono::seconds(seconds);
+    return true;
+}
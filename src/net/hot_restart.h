@@ -0,0 +1,122 @@
+/**
+ * @file hot_restart.h
+ * @brief Hand a running receiver's sockets to its replacement over a UNIX socket (SCM_RIGHTS)
+ *
+ * Restarting a receiver closes its sockets: connections waiting in the accept queue are reset,
+ * datagrams arriving before the new process has joined its groups again are lost, and the new
+ * sockets start with cold buffers. With a hot restart the new process takes over the open sockets:
+ * - Every process started with --hot-restart PATH listens on a UNIX socket at PATH. The next one
+ *   connects to it, and the running process sends every socket it offered in one SCM_RIGHTS message,
+ *   each with a tag saying what it is ("tcp-listen 0", the subscriptions of a multicast group).
+ * - The new process adopts the sockets whose tags match its configuration and opens the rest as
+ *   usual. An adopted socket keeps its bind, accept queue, memberships and queued datagrams. Sockets
+ *   it does not adopt are closed.
+ * - It then listens on PATH itself (a new socket renamed over the old one, so the process after it
+ *   finds it there) and acknowledges. Only then does the old process let go: stopFd() turns
+ *   readable, its loops stop accepting and receiving, and it drains what it still has before it
+ *   exits. If the new process dies before acknowledging, the old one carries on serving.
+ *
+ *     HotRestart restart(options.path);              // Takes over from the running process, if any
+ *     Socket socket = restart.adopt("tcp-listen 0");
+ *     if (socket.fd() == -1)
+ *         socket = openListenSocket();               // Cold start, or not in the old configuration
+ *     restart.offer(socket.fd(), "tcp-listen 0");
+ *     restart.start();                               // The old process stops; this one serves the next
+ *     ... serve until restart.stopFd() is readable ...
+ *
+ * @note Both processes hold the same socket (one open file description), so options and file
+ *       status flags set by one apply to both, and neither may shutdown() it or leave its groups
+ * @note Until the old process sees stopFd(), both may accept or receive, but every connection and
+ *       datagram still goes to exactly one of them
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "net/socket.h"
+
+#define HOT_RESTART_MAX_SOCKETS 253     // SCM_MAX_FD: descriptors the kernel passes in one message
+#define HOT_RESTART_MAX_TAGS 65536      // Bytes of tags (and the socket count) in the handover message
+#define HOT_RESTART_ACK_TIMEOUT_MS 5000 // How long the old process waits for the new one to take over
+
+class HotRestart
+{
+public:
+    // Connects to the process listening on path, if there is one, and receives its sockets. No process (or
+    // no file) at path is a cold start. Throws std::runtime_error if a process is there but the handover fails.
+    explicit HotRestart(const std::string& path);
+    // Stops answering; removes path unless another process has taken it over
+    ~HotRestart();
+
+    HotRestart(const HotRestart&) = delete;
+    HotRestart& operator=(const HotRestart&) = delete;
+
+    // Whether a previous process handed its sockets over
+    bool inherited() const
+    {
+        return m_previous.fd() != -1;
+    }
+
+    // The inherited socket tagged tag, now owned by the caller; an invalid Socket if there is none
+    Socket adopt(const std::string& tag);
+
+    // Hand fd over to the next process as tag. The caller keeps owning it. Call before start().
+    void offer(int fd, const std::string& tag);
+
+    // Closes inherited sockets nobody adopted, listens on path, tells the previous process to stop and answers
+    // the next process from a background thread. Throws std::runtime_error if path cannot be listened on.
+    void start();
+
+    // Readable (and left readable) once the next process has taken over the offered sockets
+    int stopFd() const
+    {
+        return m_stop;
+    }
+
+    bool stopped() const
+    {
+        return m_stopped.load(std::memory_order_acquire);
+    }
+
+private:
+    std::string m_path;
+    Socket m_previous; // Connection to the process handing over, until start()
+    std::vector<std::pair<std::string, int>> m_inherited;
+    std::vector<std::pair<std::string, int>> m_offered;
+    size_t m_adopted = 0;
+    Socket m_listener;
+    int m_stop; // eventfd
+    int m_wake; // eventfd that ends the background thread
+    std::atomic<bool> m_stopped{false};
+    std::thread m_thread;
+
+    void receiveSockets();
+    void run();
+    bool handOver(int fd);
+};
+
+struct HotRestartOptions
+{
+    std::string path; // Empty: no hot restart
+    std::chrono::seconds drainTimeout{30}; // TCP: how long a stopped process waits for its connections to close
+
+    // Handle --hot-restart PATH and --drain-timeout SECONDS at argv[index]. Returns false if the argument is not
+    // one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--hot-restart PATH [--drain-timeout SECONDS]]";
+    }
+
+    bool enabled() const
+    {
+        return !path.empty();
+    }
+};
@@ -0,0 +1,355 @@
+/**
+ * @file io_uring.cpp
+ * @brief Minimal io_uring I/O engine shared by the examples
+ */
+
+#include "net/io_uring.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sysIoUringSetup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int sysIoUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int sysIoUringRegister(int fd, unsigned opcode, void* arg, unsigned argCount)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, argCount));
+}
+
+static unsigned* ringField(void* ring, uint32_t offset)
+{
+    return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+IoUring::IoUring(unsigned entries) : m_ringFd(-1), m_sqeTail(0), m_sqeSubmitted(0)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ringFd = sysIoUringSetup(entries, &params);
+    if (m_ringFd < 0)
+    {
+        throw std::runtime_error("Failed to set up io_uring: " + std::string(strerror(errno)));
+    }
+    /*
+    io_uring_setup(unsigned entries, struct io_uring_params *p)
+    Creates a submission queue (SQ) and a completion queue (CQ) shared with the kernel.
+    p->sq_off / p->cq_off: Offsets of the ring fields inside the memory mapped below
+    */
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd,
+                    IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+    {
+        close(m_ringFd);
+        throw std::runtime_error("Failed to map io_uring SQ ring: " + std::string(strerror(errno)));
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd,
+                        IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+        {
+            munmap(m_sqRing, m_sqRingSize);
+            close(m_ringFd);
+            throw std::runtime_error("Failed to map io_uring CQ ring: " + std::string(strerror(errno)));
+        }
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        if (m_cqRing != m_sqRing)
+        {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        close(m_ringFd);
+        throw std::runtime_error("Failed to map io_uring SQEs: " + std::string(strerror(errno)));
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    m_sqHead = ringField(m_sqRing, params.sq_off.head);
+    m_sqTail = ringField(m_sqRing, params.sq_off.tail);
+    m_sqRingMask = ringField(m_sqRing, params.sq_off.ring_mask);
+    m_sqRingEntries = ringField(m_sqRing, params.sq_off.ring_entries);
+    m_sqFlags = ringField(m_sqRing, params.sq_off.flags);
+    m_cqHead = ringField(m_cqRing, params.cq_off.head);
+    m_cqTail = ringField(m_cqRing, params.cq_off.tail);
+    m_cqRingMask = ringField(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(m_cqRing) + params.cq_off.cqes);
+
+    // SQ slot i always holds SQE i, so submitting is just publishing a new tail
+    unsigned* array = ringField(m_sqRing, params.sq_off.array);
+    for (unsigned i = 0; i < *m_sqRingEntries; ++i)
+    {
+        array[i] = i;
+    }
+    m_sqeTail = m_sqeSubmitted = *m_sqTail;
+}
+
+IoUring::~IoUring()
+{
+    munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != m_sqRing)
+    {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    munmap(m_sqRing, m_sqRingSize);
+    close(m_ringFd);
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqeTail - head >= *m_sqRingEntries)
+    {
+        if (submit() < 0)
+        {
+            throw std::runtime_error("Failed to submit io_uring SQEs: " + std::string(strerror(errno)));
+        }
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqeTail - head >= *m_sqRingEntries)
+        {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+    }
+
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & *m_sqRingMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitCount)
+{
+    unsigned toSubmit = m_sqeTail - m_sqeSubmitted;
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    m_sqeSubmitted = m_sqeTail;
+
+    if (toSubmit == 0 && waitCount == 0)
+    {
+        return 0;
+    }
+
+    unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted;
+    do
+    {
+        submitted = sysIoUringEnter(m_ringFd, toSubmit, waitCount, flags);
+    } while (submitted < 0 && errno == EINTR);
+    /*
+    io_uring_enter(unsigned fd, unsigned to_submit, unsigned min_complete, unsigned flags, sigset_t *sig)
+    One system call submits every queued SQE and optionally waits for min_complete completions.
+    IORING_ENTER_GETEVENTS: Wait for completions
+    */
+    return submitted;
+}
+
+void IoUring::prepareMultishotAccept(io_uring_sqe* sqe, int fd, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = userData;
+}
+/*
+IORING_ACCEPT_MULTISHOT: One request posts a completion for every accepted connection (cqe.res is the new fd)
+until it fails or is cancelled. IORING_CQE_F_MORE is set while the request stays armed.
+*/
+
+void IoUring::prepareMultishotRecv(io_uring_sqe* sqe, int fd, uint16_t bufferGroup, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufferGroup;
+    sqe->user_data = userData;
+}
+/*
+IORING_RECV_MULTISHOT: Post a completion each time data arrives, using a buffer taken from the provided-buffer
+group. The request ends on EOF (res == 0), on error, or with -ENOBUFS when the group runs out of buffers.
+*/
+
+void IoUring::prepareMultishotRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, uint16_t bufferGroup,
+                                      uint64_t userData)
+{
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufferGroup;
+    sqe->user_data = userData;
+}
+/*
+Multishot recvmsg uses msg only as a template (msg_namelen, msg_controllen). Each selected buffer starts with
+struct io_uring_recvmsg_out, followed by the source address, the control data and finally the payload.
+*/
+
+RecvmsgPayload IoUring::parseRecvmsg(const char* buffer, size_t length, const msghdr& msg)
+{
+    const io_uring_recvmsg_out* out = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+    size_t headerLength = sizeof(*out) + msg.msg_namelen + msg.msg_controllen;
+
+    RecvmsgPayload payload;
+    payload.name = reinterpret_cast<const sockaddr*>(buffer + sizeof(*out));
+    payload.nameLength = std::min<socklen_t>(out->namelen, msg.msg_namelen);
+    payload.data = buffer + headerLength;
+    payload.length = length > headerLength ? std::min<size_t>(out->payloadlen, length - headerLength) : 0;
+    payload.truncated = (out->flags & MSG_TRUNC) || payload.length < out->payloadlen;
+
+    // The control messages sit between the name and the payload, laid out as recvmsg() would write them
+    msghdr control;
+    memset(&control, 0, sizeof(control));
+    control.msg_control = const_cast<char*>(buffer + sizeof(*out) + msg.msg_namelen);
+    control.msg_controllen = std::min<size_t>(out->controllen, msg.msg_controllen);
+    parseTimestamps(control, payload.timestamps);
+    return payload;
+}
+
+void IoUring::prepareSend(io_uring_sqe* sqe, int fd, const void* buffer, size_t length, int flags,
+                          uint64_t userData)
+{
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+    sqe->user_data = userData;
+}
+
+ProvidedBufferRing::ProvidedBufferRing(IoUring& ring, uint16_t groupId, unsigned count, size_t bufferSize,
+                                       bool forceLegacy)
+    : m_ring(ring), m_groupId(groupId), m_count(count), m_bufferSize(bufferSize), m_bufRing(nullptr),
+      m_bufRingSize(0), m_buffers(static_cast<size_t>(count) * bufferSize)
+{
+    if (count == 0 || (count & (count - 1)) != 0 || count > 32768)
+    {
+        throw std::runtime_error("Provided buffer count must be a power of two up to 32768");
+    }
+
+    if (!forceLegacy)
+    {
+        m_bufRingSize = count * sizeof(io_uring_buf);
+        void* bufRing = mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufRing == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to allocate buffer ring: " + std::string(strerror(errno)));
+        }
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+        reg.ring_entries = count;
+        reg.bgid = groupId;
+        if (sysIoUringRegister(m_ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) == 0)
+        {
+            m_bufRing = static_cast<io_uring_buf_ring*>(bufRing);
+        }
+        else
+        {
+            munmap(bufRing, m_bufRingSize);
+            if (errno != EINVAL)
+            {
+                throw std::runtime_error("Failed to register buffer ring: " + std::string(strerror(errno)));
+            }
+        }
+        /*
+        io_uring_register(fd, IORING_REGISTER_PBUF_RING, struct io_uring_buf_reg *reg, 1)
+        Shares a ring of buffer descriptors with the kernel. Userspace publishes free buffers by advancing the tail.
+        return -1 with errno EINVAL on kernels older than 5.19
+        */
+    }
+
+    if (m_bufRing == nullptr)
+    {
+        provideBuffers(0, count);
+        return;
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        io_uring_buf& buf = m_bufRing->bufs[i];
+        buf.addr = reinterpret_cast<uint64_t>(buffer(static_cast<uint16_t>(i)));
+        buf.len = static_cast<uint32_t>(bufferSize);
+        buf.bid = static_cast<uint16_t>(i);
+    }
+    __atomic_store_n(&m_bufRing->tail, static_cast<uint16_t>(count), __ATOMIC_RELEASE);
+}
+
+ProvidedBufferRing::~ProvidedBufferRing()
+{
+    if (m_bufRing != nullptr)
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = m_groupId;
+        sysIoUringRegister(m_ring.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(m_bufRing, m_bufRingSize);
+    }
+}
+
+void ProvidedBufferRing::recycle(uint16_t bufferId)
+{
+    if (m_bufRing == nullptr)
+    {
+        provideBuffers(bufferId, 1);
+        return;
+    }
+
+    uint16_t tail = m_bufRing->tail;
+    io_uring_buf& buf = m_bufRing->bufs[tail & (m_count - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffer(bufferId));
+    buf.len = static_cast<uint32_t>(m_bufferSize);
+    buf.bid = bufferId;
+    __atomic_store_n(&m_bufRing->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+// Queued with the next submission; the kernel processes SQEs in order, so later receives can use the buffers
+void ProvidedBufferRing::provideBuffers(uint16_t firstId, unsigned count)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int32_t>(count);
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(firstId));
+    sqe->len = static_cast<uint32_t>(m_bufferSize);
+    sqe->off = firstId;
+    sqe->buf_group = m_groupId;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = IoUring::INTERNAL_USER_DATA;
+}
+/*
+IORING_OP_PROVIDE_BUFFERS: fd = number of buffers, addr = first buffer, len = buffer size, off = first buffer id
+IOSQE_CQE_SKIP_SUCCESS: Post no completion unless the request fails
+*/
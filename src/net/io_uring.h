@@ -0,0 +1,174 @@
+/**
+ * @file io_uring.h
+ * @brief Minimal io_uring I/O engine shared by the examples
+ *
+ * This file wraps the raw io_uring system calls (no liburing dependency).
+ * It showcases:
+ * - Setting up the submission and completion rings with io_uring_setup
+ * - Batched submission: SQEs are queued and flushed with a single io_uring_enter
+ * - Multishot accept, recv and recvmsg requests
+ * - Registered provided-buffer rings (IORING_REGISTER_PBUF_RING)
+ *
+ * @note Requires Linux 6.0 or newer for multishot recv and provided-buffer rings
+ * @note Built only when CMake is configured with -DENABLE_IO_URING=ON
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include "net/buffer_pool.h"
+#include "net/timestamping.h"
+
+// Sections of a buffer filled by a multishot recvmsg completion
+struct RecvmsgPayload
+{
+    const sockaddr* name;
+    socklen_t nameLength;
+    const char* data;
+    size_t length;
+    bool truncated;
+    PacketTimestamps timestamps; // From the control area, if msg.msg_controllen left room for SCM_TIMESTAMPING
+};
+
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Return a zeroed SQE, flushing queued SQEs to the kernel first if the submission ring is full
+    // Throws std::runtime_error if no SQE can be obtained
+    io_uring_sqe* getSqe();
+
+    // Flush queued SQEs and wait until at least waitCount completions are available
+    int submitAndWait(unsigned waitCount);
+
+    int submit()
+    {
+        return submitAndWait(0);
+    }
+
+    // user_data reserved for requests the engine issues on its own behalf; their completions are not reported
+    static constexpr uint64_t INTERNAL_USER_DATA = ~0ULL;
+
+    // Invoke handler(const io_uring_cqe&) for every available completion and release them to the kernel
+    template <typename Handler>
+    unsigned forEachCompletion(Handler&& handler)
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe = m_cqes[head & *m_cqRingMask];
+            if (cqe.user_data != INTERNAL_USER_DATA)
+            {
+                handler(cqe);
+                ++count;
+            }
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    int fd() const
+    {
+        return m_ringFd;
+    }
+
+    static void prepareMultishotAccept(io_uring_sqe* sqe, int fd, uint64_t userData);
+    static void prepareMultishotRecv(io_uring_sqe* sqe, int fd, uint16_t bufferGroup, uint64_t userData);
+    static void prepareMultishotRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, uint16_t bufferGroup,
+                                        uint64_t userData);
+    // Locate the source address and payload inside a buffer filled by multishot recvmsg (msg is the SQE template)
+    static RecvmsgPayload parseRecvmsg(const char* buffer, size_t length, const msghdr& msg);
+
+    static void prepareSend(io_uring_sqe* sqe, int fd, const void* buffer, size_t length, int flags,
+                            uint64_t userData);
+
+private:
+    int m_ringFd;
+    unsigned m_sqeTail;
+    unsigned m_sqeSubmitted;
+
+    void* m_sqRing;
+    size_t m_sqRingSize;
+    void* m_cqRing;
+    size_t m_cqRingSize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned* m_sqRingMask;
+    unsigned* m_sqRingEntries;
+    unsigned* m_sqFlags;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqRingMask;
+    io_uring_cqe* m_cqes;
+};
+
+/**
+ * A ring of equally sized buffers registered with the kernel under a buffer group id.
+ * Receive requests flagged with IOSQE_BUFFER_SELECT pick a buffer at completion time,
+ * so idle connections do not pin memory. Buffers must be recycled once consumed.
+ * Kernels without IORING_REGISTER_PBUF_RING (or with forceLegacy) fall back to IORING_OP_PROVIDE_BUFFERS.
+ */
+class ProvidedBufferRing
+{
+public:
+    ProvidedBufferRing(IoUring& ring, uint16_t groupId, unsigned count, size_t bufferSize, bool forceLegacy = false);
+    ~ProvidedBufferRing();
+
+    ProvidedBufferRing(const ProvidedBufferRing&) = delete;
+    ProvidedBufferRing& operator=(const ProvidedBufferRing&) = delete;
+
+    char* buffer(uint16_t bufferId) const
+    {
+        return m_buffers.data() + static_cast<size_t>(bufferId) * m_bufferSize;
+    }
+
+    size_t bufferSize() const
+    {
+        return m_bufferSize;
+    }
+
+    uint16_t groupId() const
+    {
+        return m_groupId;
+    }
+
+    // Hand a consumed buffer back to the kernel
+    void recycle(uint16_t bufferId);
+
+    bool isRegisteredRing() const
+    {
+        return m_bufRing != nullptr;
+    }
+
+    // Buffer id carried by a completion flagged with IORING_CQE_F_BUFFER
+    static uint16_t bufferId(const io_uring_cqe& cqe)
+    {
+        return static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+private:
+    IoUring& m_ring;
+    uint16_t m_groupId;
+    unsigned m_count;
+    size_t m_bufferSize;
+    io_uring_buf_ring* m_bufRing;
+    size_t m_bufRingSize;
+    HugePageMemory m_buffers;
+
+    void provideBuffers(uint16_t firstId, unsigned count);
+};
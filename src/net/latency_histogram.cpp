@@ -0,0 +1,70 @@
+/**
+ * @file latency_histogram.cpp
+ * @brief Fixed-size log-linear latency histogram
+ */
+
+#include "net/latency_histogram.h"
+
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < m_counts.size(); ++i)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    if (other.m_count)
+    {
+        m_max = other.m_max > m_max ? other.m_max : m_max;
+        m_min = other.m_min < m_min ? other.m_min : m_min;
+    }
+    m_count += other.m_count;
+}
+
+void LatencyHistogram::reset()
+{
+    m_counts.fill(0);
+    m_count = 0;
+    m_max = 0;
+    m_min = UINT64_MAX;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the requested sample, 1-based, so percentile(100) is the last sample
+    uint64_t rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * m_count));
+    rank = rank == 0 ? 1 : rank;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); ++i)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            uint64_t value = bucketValue(i);
+            return value < m_max ? value : m_max;
+        }
+    }
+    return m_max;
+}
+
+uint64_t LatencyHistogram::bucketValue(size_t index)
+{
+    if (index < 2 * LATENCY_SUB_BUCKETS)
+    {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index / LATENCY_SUB_BUCKETS) - 1;
+    uint64_t mantissa = index - static_cast<uint64_t>(shift) * LATENCY_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file latency_histogram.h
+ * @brief Fixed-size log-linear latency histogram
+ *
+ * Values (nanoseconds) are counted in buckets whose width grows with the value: every power
+ * of two is split into LATENCY_SUB_BUCKETS linear sub-buckets, so any recorded value is
+ * reported within 1 / LATENCY_SUB_BUCKETS (about 6%) of its true value. The whole 64-bit range
+ * fits in under a thousand counters, recording is a few instructions and never allocates,
+ * and histograms from several threads can be merged before computing percentiles.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKET_COUNT ((64 - LATENCY_SUB_BUCKET_BITS) * LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS)
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value)
+    {
+        record(value, 1);
+    }
+
+    // The same as count calls of record(value)
+    void record(uint64_t value, uint64_t count)
+    {
+        m_counts[bucketIndex(value)] += count;
+        m_count += count;
+        if (value > m_max)
+        {
+            m_max = value;
+        }
+        if (value < m_min)
+        {
+            m_min = value;
+        }
+    }
+
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    uint64_t max() const
+    {
+        return m_count ? m_max : 0;
+    }
+
+    uint64_t min() const
+    {
+        return m_count ? m_min : 0;
+    }
+
+    // Smallest recorded bucket value at or above the given percentile (0-100); 0 when empty
+    uint64_t percentile(double percent) const;
+
+    // Values below 2 * LATENCY_SUB_BUCKETS are exact; above that the top LATENCY_SUB_BUCKET_BITS + 1 bits select
+    // the bucket
+    static size_t bucketIndex(uint64_t value)
+    {
+        if (value < 2 * LATENCY_SUB_BUCKETS)
+        {
+            return static_cast<size_t>(value);
+        }
+        unsigned shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BUCKET_BITS;
+        return shift * LATENCY_SUB_BUCKETS + static_cast<size_t>(value >> shift);
+    }
+
+    // Largest value that maps to the bucket
+    static uint64_t bucketValue(size_t index);
+
+private:
+    std::array<uint64_t, LATENCY_BUCKET_COUNT> m_counts;
+    uint64_t m_count;
+    uint64_t m_max;
+    uint64_t m_min;
+};
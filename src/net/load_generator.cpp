@@ -0,0 +1,853 @@
+/**
+ * @file load_generator.cpp
+ * @brief Open-loop TCP load generator with many connections and per-connection latency
+ */
+
+#include "net/load_generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "net/framing.h"
+#include "net/metrics.h"
+#include "net/timer_wheel.h"
+
+#define LOAD_TICK_US 100           // Timer wheel resolution, and so the send schedule's
+#define LOAD_WHEEL_SLOTS 4096      // About 0.4 s per revolution
+#define LOAD_MAX_EVENTS 256
+#define LOAD_RECEIVE_BUFFER 65536
+#define LOAD_SPARE_DESCRIPTORS 64  // Kept free for stdio, the epoll instances and the report file
+#define LOAD_WORST_CONNECTIONS 5   // Connections listed by operator<<
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t parseNumber(const std::string& arg, const std::string& value, uint64_t min, uint64_t max)
+{
+    char* end = nullptr;
+    unsigned long long number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < min || number > max)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    return number;
+}
+
+static in_addr parseAddress(const std::string& text)
+{
+    in_addr address;
+    if (inet_pton(AF_INET, text.c_str(), &address) != 1)
+    {
+        throw std::runtime_error("Invalid IPv4 address '" + text + "'");
+    }
+    return address;
+}
+
+// "A-B" is every address from A to B, "A,B,C" a list
+static std::vector<in_addr> parseAddresses(const std::string& text)
+{
+    std::vector<in_addr> addresses;
+    size_t dash = text.find('-');
+    if (dash != std::string::npos)
+    {
+        uint32_t first = ntohl(parseAddress(text.substr(0, dash)).s_addr);
+        uint32_t last = ntohl(parseAddress(text.substr(dash + 1)).s_addr);
+        if (last < first || last - first >= 65536)
+        {
+            throw std::runtime_error("Invalid source address range '" + text + "'");
+        }
+        for (uint64_t host = first; host <= last; ++host)
+        {
+            addresses.push_back(in_addr{htonl(static_cast<uint32_t>(host))});
+        }
+        return addresses;
+    }
+
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos)
+        {
+            comma = text.size();
+        }
+        addresses.push_back(parseAddress(text.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    return addresses;
+}
+
+bool LoadOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--connections" && arg != "--threads" && arg != "--rate" && arg != "--duration" && arg != "--size" &&
+        arg != "--source-ips" && arg != "--source-ports" && arg != "--report")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--connections")
+    {
+        connections = parseNumber(arg, value, 1, 10000000);
+    }
+    else if (arg == "--threads")
+    {
+        threads = parseNumber(arg, value, 1, 1024);
+    }
+    else if (arg == "--rate")
+    {
+        char* end = nullptr;
+        rate = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !(rate > 0) || rate > 1e6)
+        {
+            throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+        }
+    }
+    else if (arg == "--duration")
+    {
+        duration = parseNumber(arg, value, 1, 86400);
+    }
+    else if (arg == "--size")
+    {
+        messageSize = parseNumber(arg, value, LOAD_REQUEST_HEADER_SIZE, 65536 - FRAME_MAX_HEADER_SIZE);
+    }
+    else if (arg == "--source-ips")
+    {
+        sourceAddresses = parseAddresses(value);
+    }
+    else if (arg == "--source-ports")
+    {
+        size_t dash = value.find('-');
+        if (dash == std::string::npos)
+        {
+            throw std::runtime_error("Invalid source port range '" + value + "'");
+        }
+        firstSourcePort = parseNumber(arg, value.substr(0, dash), 1, 65535);
+        lastSourcePort = parseNumber(arg, value.substr(dash + 1), firstSourcePort, 65535);
+    }
+    else
+    {
+        reportPath = value;
+    }
+    return true;
+}
+
+// Bucket b >= 4 covers [(4 + b % 4) << (b / 4 + 7), (5 + b % 4) << (b / 4 + 7)); 0-3 everything below 1024 ns
+void ConnectionLatency::record(uint64_t nanoseconds)
+{
+    size_t bucket = 0;
+    if (nanoseconds >= 1024)
+    {
+        unsigned top = 63 - __builtin_clzll(nanoseconds);
+        bucket = (top - 9) * 4 + ((nanoseconds >> (top - 2)) & 3);
+    }
+    ++m_counts[std::min<size_t>(bucket, LOAD_CONNECTION_BUCKETS - 1)];
+    ++m_count;
+    m_max = std::max(m_max, nanoseconds);
+}
+
+uint64_t ConnectionLatency::percentile(double percent) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percent / 100.0 * m_count + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < LOAD_CONNECTION_BUCKETS; ++bucket)
+    {
+        seen += m_counts[bucket];
+        if (seen >= rank)
+        {
+            uint64_t upper = bucket < 4 ? 1023 : ((5 + bucket % 4) << (bucket / 4 + 7)) - 1;
+            return std::min(upper, m_max);
+        }
+    }
+    return m_max;
+}
+
+namespace
+{
+struct Connection
+{
+    Socket socket;
+    uint32_t index = 0; // Into LoadReport::connections
+    bool connecting = false; // Handshake in flight
+    bool open = false;       // Connected and not failed
+    Clock::time_point nextSend;
+    uint64_t sequence = 0;
+    std::vector<char> outbox; // Frames the socket has not accepted yet
+    std::vector<char> inbox;  // Start of an echo that has not fully arrived
+};
+
+struct Counters
+{
+    std::atomic<uint64_t> connected{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+};
+
+class Worker
+{
+public:
+    Worker(const LoadOptions& options, const SocketOptions& socketOptions, unsigned ordinal, LoadReport& report,
+           Counters& counters)
+        : m_options(options), m_socketOptions(socketOptions), m_report(report), m_counters(counters),
+          m_interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rate))),
+          m_wheel(std::chrono::microseconds(LOAD_TICK_US), LOAD_WHEEL_SLOTS), m_epollFd(-1), m_pendingConnects(0),
+          m_nextConnect(0), m_random(ordinal + 1), m_receiveBuffer(LOAD_RECEIVE_BUFFER), m_latency(nullptr),
+          m_sending(true), m_metrics(trafficMetrics()),
+          m_responseTime(Metrics::instance().histogram("load_response_time_seconds",
+                                                       "Time from a request's scheduled send to its echo"))
+    {
+        for (uint32_t index = ordinal; index < options.connections; index += options.threads)
+        {
+            m_connections.emplace_back();
+            m_connections.back().index = index;
+        }
+    }
+
+    ~Worker()
+    {
+        if (m_epollFd != -1)
+        {
+            close(m_epollFd);
+        }
+    }
+
+    void run(Clock::time_point start, Clock::time_point end, LatencyHistogram& latency);
+
+private:
+    const LoadOptions& m_options;
+    const SocketOptions& m_socketOptions;
+    LoadReport& m_report;
+    Counters& m_counters;
+    Clock::duration m_interval;
+    TimerWheel<uint32_t> m_wheel; // Local connection index of the next due request
+    int m_epollFd;
+    std::vector<Connection> m_connections;
+    size_t m_pendingConnects;
+    size_t m_nextConnect; // First local connection not yet started
+    std::minstd_rand m_random;
+    std::vector<char> m_receiveBuffer;
+    LatencyHistogram* m_latency;
+    bool m_sending; // False once the duration is over; answers are still read
+    TrafficMetrics& m_metrics;
+    Histogram& m_responseTime;
+
+    void startConnects(Clock::time_point start);
+    void connect(uint32_t local, Clock::time_point start);
+    void completeConnect(uint32_t local, Clock::time_point start);
+    void sendDue(uint32_t local, Clock::time_point now);
+    void flush(uint32_t local);
+    void receive(uint32_t local);
+    void fail(uint32_t local, const std::string& reason);
+    bool idle() const;
+};
+
+void Worker::run(Clock::time_point start, Clock::time_point end, LatencyHistogram& latency)
+{
+    m_latency = &latency;
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd == -1)
+    {
+        throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+    }
+
+    epoll_event events[LOAD_MAX_EVENTS];
+    Clock::time_point drainEnd = end + std::chrono::milliseconds(LOAD_DRAIN_TIMEOUT_MS);
+    while (true)
+    {
+        Clock::time_point now = Clock::now();
+        if (m_sending && now >= end)
+        {
+            m_sending = false;
+        }
+        if (!m_sending && (now >= drainEnd || idle()))
+        {
+            break;
+        }
+
+        startConnects(start);
+        m_wheel.advance(now, [this, now](uint32_t local) { sendDue(local, now); });
+
+        // Sleep until the next wheel tick, so no request goes out more than LOAD_TICK_US late because of the wait
+        Clock::duration wait = std::max(m_wheel.nextTick() - Clock::now(), Clock::duration::zero());
+        timespec timeout{0, static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count())};
+        int count = epoll_pwait2(m_epollFd, events, LOAD_MAX_EVENTS, &timeout, nullptr);
+        /*
+        epoll_pwait2(int epfd, struct epoll_event *events, int maxevents, const struct timespec *timeout,
+                     const sigset_t *sigmask)
+        Like epoll_wait(), but the timeout has nanosecond resolution instead of milliseconds, which the
+        100 microsecond send schedule needs.
+        return number of ready descriptors (0 on timeout)
+        return -1 if failed
+        */
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("Failed to wait for events: " + std::string(strerror(errno)));
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            uint32_t local = events[i].data.u32;
+            Connection& connection = m_connections[local];
+            if (connection.connecting)
+            {
+                completeConnect(local, start);
+                continue;
+            }
+            if (!connection.open)
+            {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                flush(local);
+            }
+            if (connection.open && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+            {
+                receive(local);
+            }
+        }
+    }
+
+    for (Connection& connection : m_connections)
+    {
+        if (connection.open)
+        {
+            ConnectionReport& result = m_report.connections[connection.index];
+            if (result.received < result.sent)
+            {
+                result.error = std::to_string(result.sent - result.received) + " requests unanswered";
+            }
+        }
+        connection.socket.close();
+    }
+}
+
+bool Worker::idle() const
+{
+    if (m_pendingConnects > 0)
+    {
+        return false;
+    }
+    for (const Connection& connection : m_connections)
+    {
+        const ConnectionReport& result = m_report.connections[connection.index];
+        if (connection.open && result.received < result.sent)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Worker::startConnects(Clock::time_point start)
+{
+    while (m_sending && m_pendingConnects < LOAD_MAX_PENDING_CONNECTS && m_nextConnect < m_connections.size())
+    {
+        connect(static_cast<uint32_t>(m_nextConnect++), start);
+    }
+}
+
+void Worker::connect(uint32_t local, Clock::time_point start)
+{
+    Connection& connection = m_connections[local];
+    try
+    {
+        connection.socket = Socket(m_options.server.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC);
+        connection.socket.apply(m_socketOptions);
+
+        // Connection i uses source address i % A and port first + i / A, so every pair is different
+        size_t addresses = m_options.sourceAddresses.size();
+        if (addresses > 0 || m_options.firstSourcePort != 0)
+        {
+            SocketAddress source = SocketAddress::any(m_options.server.family(), 0);
+            if (addresses > 0)
+            {
+                sockaddr_in address = source.ipv4();
+                address.sin_addr = m_options.sourceAddresses[connection.index % addresses];
+                source = address;
+            }
+            if (m_options.firstSourcePort != 0)
+            {
+                source.setPort(m_options.firstSourcePort + connection.index / std::max<size_t>(addresses, 1));
+            }
+            else
+            {
+                int enable = 1;
+                setsockopt(connection.socket.fd(), IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &enable, sizeof(enable));
+                /*
+                IP_BIND_ADDRESS_NO_PORT: bind() only records the address and the port is chosen by connect(),
+                which knows the destination. A port is then only taken per 4-tuple, so one source address can
+                open a full ephemeral range to every server instead of sharing one range across all of them.
+                */
+            }
+            connection.socket.bind(source);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        fail(local, e.what());
+        return;
+    }
+
+    int result = ::connect(connection.socket.fd(), m_options.server.data(), m_options.server.size());
+    /*
+    connect() on a non-blocking socket returns -1 with EINPROGRESS while the handshake runs; the socket
+    turns writable once it has finished, and SO_ERROR then tells whether it succeeded.
+    */
+    if (result == -1 && errno != EINPROGRESS)
+    {
+        fail(local, "Failed to connect: " + std::string(strerror(errno)));
+        return;
+    }
+
+    // Registered once for the life of the connection; edge-triggered, so events are only reported on change
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u32 = local;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, connection.socket.fd(), &event) == -1)
+    {
+        fail(local, "Failed to add connection to epoll: " + std::string(strerror(errno)));
+        return;
+    }
+    if (result == 0)
+    {
+        completeConnect(local, start);
+        return;
+    }
+    connection.connecting = true;
+    ++m_pendingConnects;
+}
+
+void Worker::completeConnect(uint32_t local, Clock::time_point start)
+{
+    Connection& connection = m_connections[local];
+    if (connection.connecting)
+    {
+        connection.connecting = false;
+        --m_pendingConnects;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(connection.socket.fd(), SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+        {
+            error = errno;
+        }
+        if (error != 0)
+        {
+            fail(local, "Failed to connect: " + std::string(strerror(error)));
+            return;
+        }
+    }
+
+    connection.open = true;
+    ConnectionReport& result = m_report.connections[connection.index];
+    result.connected = true;
+    socklen_t length = SocketAddress::capacity();
+    getsockname(connection.socket.fd(), result.source.data(), &length);
+    m_counters.connected.fetch_add(1, std::memory_order_relaxed);
+
+    // The first request goes out at a random point within one interval, and none before the run starts
+    Clock::time_point now = std::max(Clock::now(), start);
+    std::uniform_int_distribution<int64_t> phase(0, m_interval.count());
+    connection.nextSend = now + Clock::duration(phase(m_random));
+    m_wheel.schedule(connection.nextSend, local);
+}
+
+void Worker::sendDue(uint32_t local, Clock::time_point now)
+{
+    Connection& connection = m_connections[local];
+    if (!connection.open || !m_sending)
+    {
+        return;
+    }
+
+    // Catch up on every request that is due, each stamped with the time it should have gone out
+    ConnectionReport& result = m_report.connections[connection.index];
+    uint64_t queued = 0;
+    char header[FRAME_MAX_HEADER_SIZE];
+    size_t headerLength = encodeFrameHeader(FRAME_TYPE_BINARY, static_cast<uint32_t>(m_options.messageSize), header);
+    for (; connection.nextSend <= now; connection.nextSend += m_interval)
+    {
+        if (connection.outbox.size() >= LOAD_MAX_OUTBOX)
+        {
+            ++result.skipped;
+            continue;
+        }
+        uint64_t scheduled = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 connection.nextSend.time_since_epoch())
+                                 .count();
+        uint64_t sequence = connection.sequence++;
+        size_t offset = connection.outbox.size();
+        connection.outbox.resize(offset + headerLength + m_options.messageSize, 'x');
+        char* frame = connection.outbox.data() + offset;
+        memcpy(frame, header, headerLength);
+        memcpy(frame + headerLength, &scheduled, sizeof(scheduled));
+        memcpy(frame + headerLength + sizeof(scheduled), &sequence, sizeof(sequence));
+        ++queued;
+    }
+    result.sent += queued;
+    m_counters.sent.fetch_add(queued, std::memory_order_relaxed);
+    m_metrics.packetsSent.add(queued);
+    m_wheel.schedule(connection.nextSend, local);
+    flush(local);
+}
+
+void Worker::flush(uint32_t local)
+{
+    Connection& connection = m_connections[local];
+    size_t sent = 0;
+    while (sent < connection.outbox.size())
+    {
+        ssize_t bytes = send(connection.socket.fd(), connection.outbox.data() + sent, connection.outbox.size() - sent,
+                             MSG_NOSIGNAL);
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                m_metrics.errors.add();
+                fail(local, "Failed to send: " + std::string(strerror(errno)));
+                return;
+            }
+            m_metrics.wouldBlock.add();
+            break; // The rest goes out on EPOLLOUT
+        }
+        sent += bytes;
+    }
+    m_metrics.bytesSent.add(sent);
+    connection.outbox.erase(connection.outbox.begin(), connection.outbox.begin() + sent);
+}
+
+void Worker::receive(uint32_t local)
+{
+    Connection& connection = m_connections[local];
+    ConnectionReport& result = m_report.connections[connection.index];
+    while (true)
+    {
+        ssize_t bytes = recv(connection.socket.fd(), m_receiveBuffer.data(), m_receiveBuffer.size(), 0);
+        if (bytes == 0)
+        {
+            fail(local, "Server closed the connection");
+            return;
+        }
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                m_metrics.errors.add();
+                fail(local, "Failed to receive: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+        m_metrics.bytesReceived.add(static_cast<uint64_t>(bytes));
+
+        // Parse straight from the receive buffer unless an echo is already half in the inbox
+        const char* data = m_receiveBuffer.data();
+        size_t available = static_cast<size_t>(bytes);
+        if (!connection.inbox.empty())
+        {
+            connection.inbox.insert(connection.inbox.end(), data, data + available);
+            data = connection.inbox.data();
+            available = connection.inbox.size();
+        }
+
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+        uint64_t echoes = 0;
+        size_t consumed = 0;
+        while (true)
+        {
+            uint8_t type;
+            uint32_t payloadLength;
+            int headerSize = decodeFrameHeader(data + consumed, available - consumed, type, payloadLength);
+            if (headerSize == -1 || (headerSize > 0 && payloadLength < LOAD_REQUEST_HEADER_SIZE))
+            {
+                fail(local, "Malformed echo from server");
+                return;
+            }
+            if (headerSize == 0 || available - consumed < headerSize + payloadLength)
+            {
+                break;
+            }
+
+            uint64_t scheduled;
+            memcpy(&scheduled, data + consumed + headerSize, sizeof(scheduled));
+            uint64_t latency = now > scheduled ? now - scheduled : 0;
+            m_latency->record(latency);
+            result.latency.record(latency);
+            m_responseTime.record(latency);
+            ++echoes;
+            consumed += headerSize + payloadLength;
+        }
+        result.received += echoes;
+        m_counters.received.fetch_add(echoes, std::memory_order_relaxed);
+        m_metrics.packetsReceived.add(echoes);
+
+        if (connection.inbox.empty())
+        {
+            connection.inbox.assign(data + consumed, data + available);
+        }
+        else
+        {
+            connection.inbox.erase(connection.inbox.begin(), connection.inbox.begin() + consumed);
+        }
+    }
+}
+
+void Worker::fail(uint32_t local, const std::string& reason)
+{
+    Connection& connection = m_connections[local];
+    ConnectionReport& result = m_report.connections[connection.index];
+    if (!result.connected)
+    {
+        m_counters.failed.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (connection.connecting)
+    {
+        connection.connecting = false;
+        --m_pendingConnects;
+    }
+    result.error = reason;
+    connection.open = false;
+    connection.socket.close(); // Also removes it from the epoll set
+    connection.outbox.clear();
+    connection.outbox.shrink_to_fit();
+    connection.inbox.clear();
+    connection.inbox.shrink_to_fit();
+}
+} // namespace
+
+void LoadReport::writeCsv(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        throw std::runtime_error("Failed to open " + path + ": " + std::string(strerror(errno)));
+    }
+    out << "connection,source,connected,sent,received,skipped,p50_us,p99_us,max_us,error\n" << std::fixed
+        << std::setprecision(1);
+    for (size_t i = 0; i < connections.size(); ++i)
+    {
+        const ConnectionReport& connection = connections[i];
+        out << i << "," << connection.source.toString() << "," << connection.connected << ","
+            << connection.sent << "," << connection.received << "," << connection.skipped << ","
+            << connection.latency.percentile(50) / 1000.0 << "," << connection.latency.percentile(99) / 1000.0 << ","
+            << connection.latency.max() / 1000.0 << ",\"" << connection.error << "\"\n";
+    }
+    if (!out)
+    {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+std::ostream& operator<<(std::ostream& out, const LoadReport& report)
+{
+    uint64_t connected = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t skipped = 0;
+    std::vector<size_t> answered; // Connections with at least one echo, for the p99 spread
+    const std::string* firstError = nullptr;
+    for (size_t i = 0; i < report.connections.size(); ++i)
+    {
+        const ConnectionReport& connection = report.connections[i];
+        connected += connection.connected;
+        sent += connection.sent;
+        received += connection.received;
+        skipped += connection.skipped;
+        if (connection.latency.count() > 0)
+        {
+            answered.push_back(i);
+        }
+        if (firstError == nullptr && !connection.error.empty())
+        {
+            firstError = &connection.error;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(report.elapsed).count();
+    out << "Connections: " << connected << " of " << report.connections.size() << " connected";
+    if (firstError != nullptr)
+    {
+        out << " (first error: " << *firstError << ")";
+    }
+    out << "\n"
+        << "Requests: " << sent << " sent, " << received << " answered, " << skipped << " skipped ("
+        << std::fixed << std::setprecision(0) << (seconds > 0 ? received / seconds : 0) << " answers/s)\n"
+        << std::setprecision(1) << "Latency (us): p50 " << report.latency.percentile(50) / 1000.0 << ", p90 "
+        << report.latency.percentile(90) / 1000.0 << ", p99 " << report.latency.percentile(99) / 1000.0
+        << ", p99.9 " << report.latency.percentile(99.9) / 1000.0 << ", max " << report.latency.max() / 1000.0
+        << "\n";
+    if (answered.empty())
+    {
+        return out;
+    }
+
+    auto p99 = [&report](size_t i) { return report.connections[i].latency.percentile(99); };
+    std::sort(answered.begin(), answered.end(), [&p99](size_t a, size_t b) { return p99(a) < p99(b); });
+    out << "Per-connection p99 (us): best " << p99(answered.front()) / 1000.0 << ", median "
+        << p99(answered[answered.size() / 2]) / 1000.0 << ", worst " << p99(answered.back()) / 1000.0 << "\n";
+
+    out << "Worst connections:";
+    size_t shown = std::min<size_t>(answered.size(), LOAD_WORST_CONNECTIONS);
+    for (size_t n = 0; n < shown; ++n)
+    {
+        size_t i = answered[answered.size() - 1 - n];
+        const ConnectionReport& connection = report.connections[i];
+        out << (n == 0 ? " " : ", ") << "#" << i << " " << connection.source.toString() << " p99 "
+            << p99(i) / 1000.0;
+    }
+    out.unsetf(std::ios::floatfield);
+    return out << std::setprecision(6) << "\n";
+}
+
+// Every connection holds a descriptor; ask for the hard limit rather than failing half way through connecting
+static void raiseDescriptorLimit(size_t needed)
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        throw std::runtime_error("Failed to read RLIMIT_NOFILE: " + std::string(strerror(errno)));
+    }
+    if (limit.rlim_cur >= needed)
+    {
+        return;
+    }
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed)
+    {
+        throw std::runtime_error(std::to_string(needed) + " file descriptors needed, but the hard limit is " +
+                                 std::to_string(limit.rlim_max) + " (raise it with ulimit -Hn)");
+    }
+    limit.rlim_cur = needed;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        throw std::runtime_error("Failed to raise RLIMIT_NOFILE: " + std::string(strerror(errno)));
+    }
+}
+
+LoadReport runLoad(const LoadOptions& options, const SocketOptions& socketOptions,
+                   const std::function<void(const LoadProgress&)>& progress)
+{
+    if (options.firstSourcePort != 0)
+    {
+        size_t pairs = std::max<size_t>(options.sourceAddresses.size(), 1) *
+                       (options.lastSourcePort - options.firstSourcePort + 1);
+        if (pairs < options.connections)
+        {
+            throw std::runtime_error("The source addresses and ports allow only " + std::to_string(pairs) +
+                                     " connections");
+        }
+    }
+    if (!options.sourceAddresses.empty() && options.server.family() != AF_INET)
+    {
+        throw std::runtime_error("--source-ips takes IPv4 addresses, so it needs an IPv4 server");
+    }
+    if (options.messageSize < LOAD_REQUEST_HEADER_SIZE)
+    {
+        throw std::runtime_error("Requests need at least " + std::to_string(LOAD_REQUEST_HEADER_SIZE) + " bytes");
+    }
+    raiseDescriptorLimit(options.connections + options.threads + LOAD_SPARE_DESCRIPTORS);
+
+    LoadReport report;
+    report.connections.resize(options.connections);
+    unsigned threads = std::min(options.threads, options.connections);
+    LoadOptions threadOptions = options;
+    threadOptions.threads = threads;
+
+    Counters counters;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<LatencyHistogram> latencies(threads);
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        workers.push_back(std::make_unique<Worker>(threadOptions, socketOptions, i, report, counters));
+    }
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(options.duration);
+    std::atomic<unsigned> running(threads);
+    std::vector<std::string> errors(threads);
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&, i]() {
+            try
+            {
+                workers[i]->run(start, end, latencies[i]);
+            }
+            catch (const std::exception& e)
+            {
+                errors[i] = e.what();
+            }
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // Report progress from this thread while the workers run
+    Clock::time_point nextReport = start + std::chrono::seconds(1);
+    while (running.load(std::memory_order_acquire) > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        Clock::time_point now = Clock::now();
+        if (progress && now >= nextReport)
+        {
+            LoadProgress snapshot;
+            snapshot.elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - start);
+            snapshot.connected = counters.connected.load(std::memory_order_relaxed);
+            snapshot.failed = counters.failed.load(std::memory_order_relaxed);
+            snapshot.sent = counters.sent.load(std::memory_order_relaxed);
+            snapshot.received = counters.received.load(std::memory_order_relaxed);
+            progress(snapshot);
+            nextReport += std::chrono::seconds(1);
+        }
+    }
+    for (std::thread& thread : pool)
+    {
+        thread.join();
+    }
+    for (const std::string& error : errors)
+    {
+        if (!error.empty())
+        {
+            throw std::runtime_error(error);
+        }
+    }
+
+    report.elapsed = std::min(Clock::now(), end) - start;
+    for (const LatencyHistogram& latency : latencies)
+    {
+        report.latency.merge(latency);
+    }
+    return report;
+}
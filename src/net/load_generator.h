@@ -0,0 +1,140 @@
+/**
+ * @file load_generator.h
+ * @brief Open-loop TCP load generator with many connections and per-connection latency
+ *
+ * runLoad() opens connections to one server from several threads, each thread owning its share
+ * of the connections, one epoll instance and one TimerWheel:
+ * - Connects are non-blocking and paced, at most LOAD_MAX_PENDING_CONNECTS in flight per thread,
+ *   so a connection storm does not overflow the server's SYN or accept queue all at once
+ * - Connections are spread over the given source addresses and ports. Without a port range the
+ *   kernel picks the port at connect() time (IP_BIND_ADDRESS_NO_PORT), so ports are only unique
+ *   per destination and one source address is good for a full ephemeral range per server
+ * - Every connection sends rate requests per second on a fixed schedule, whether or not earlier
+ *   ones were answered (open loop). A random phase keeps connections from firing together.
+ * - A request is a FRAME_TYPE_BINARY frame that carries its scheduled send time, and the server
+ *   echoes it back (01-receiver --echo). Latency runs from the scheduled time, not from when the
+ *   request was actually written, so a stalled connection shows up as latency instead of
+ *   silently sending less (no coordinated omission).
+ *
+ * Latency goes into one LatencyHistogram per thread for the totals and a small
+ * ConnectionLatency per connection, so outliers can be traced to the connection they came from.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "net/latency_histogram.h"
+#include "net/socket.h"
+
+#define LOAD_REQUEST_HEADER_SIZE 16      // Scheduled send time and sequence number at the front of every payload
+#define LOAD_MAX_PENDING_CONNECTS 512    // Non-blocking connects in flight per thread
+#define LOAD_MAX_OUTBOX (1024 * 1024)    // Unsent bytes per connection beyond which due requests are skipped
+#define LOAD_DRAIN_TIMEOUT_MS 1000       // How long to wait for answers once the duration is over
+#define LOAD_CONNECTION_BUCKETS (27 * 4) // ConnectionLatency: below 1 us, then 4 per power of two up to 64 s
+
+struct LoadOptions
+{
+    SocketAddress server;
+    unsigned connections = 100;
+    unsigned threads = 1;
+    double rate = 10;        // Requests per second per connection
+    unsigned duration = 10;  // Seconds of sending, after which answers are awaited for LOAD_DRAIN_TIMEOUT_MS
+    size_t messageSize = 64; // Request payload bytes, at least LOAD_REQUEST_HEADER_SIZE
+    std::vector<in_addr> sourceAddresses; // Empty: the kernel picks the source address. IPv4 servers only.
+    uint16_t firstSourcePort = 0;         // 0: the kernel picks the port
+    uint16_t lastSourcePort = 0;
+    std::string reportPath; // Per-connection CSV written by the caller, if set
+
+    // Handle --connections N, --threads N, --rate N, --duration SECONDS, --size BYTES,
+    // --source-ips A.B.C.D[-A.B.C.D|,A.B.C.D...], --source-ports FIRST-LAST and --report FILE at argv[index].
+    // Returns false if the argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--connections N] [--threads N] [--rate N] [--duration SECONDS] [--size BYTES]\n"
+               "       [--source-ips A.B.C.D[-A.B.C.D|,...]] [--source-ports FIRST-LAST] [--report FILE]";
+    }
+};
+
+// Coarse latency histogram small enough to keep one per connection (LatencyHistogram is about 8 KB, which is
+// close to a gigabyte for 100k connections). Values are reported within 25% of their true value.
+class ConnectionLatency
+{
+public:
+    ConnectionLatency() : m_counts{}, m_count(0), m_max(0)
+    {
+    }
+
+    void record(uint64_t nanoseconds);
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    uint64_t max() const
+    {
+        return m_max;
+    }
+
+    // Upper bound of the bucket holding the given percentile (0-100), capped at max(); 0 when empty
+    uint64_t percentile(double percent) const;
+
+private:
+    std::array<uint32_t, LOAD_CONNECTION_BUCKETS> m_counts;
+    uint32_t m_count;
+    uint64_t m_max;
+};
+
+struct ConnectionReport
+{
+    SocketAddress source; // Local address once connected
+    bool connected = false;
+    uint64_t sent = 0;     // Requests written to the socket
+    uint64_t received = 0; // Echoes read back
+    uint64_t skipped = 0;  // Due requests not sent because the connection had LOAD_MAX_OUTBOX bytes unsent
+    std::string error;     // Why the connection failed or was closed early; empty if it was not
+    ConnectionLatency latency;
+};
+
+struct LoadReport
+{
+    std::vector<ConnectionReport> connections; // In connection order
+    LatencyHistogram latency;                  // Every connection together
+    std::chrono::nanoseconds elapsed{0};       // Sending time, without connecting or draining
+
+    // One line per connection: index, source, connected, sent, received, skipped, p50/p99/max in microseconds,
+    // error. Throws std::runtime_error if the file cannot be written.
+    void writeCsv(const std::string& path) const;
+};
+
+// Totals across every thread, passed to the progress callback about once per second
+struct LoadProgress
+{
+    std::chrono::seconds elapsed{0};
+    uint64_t connected = 0;
+    uint64_t failed = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+};
+
+// Summary: connections, request counts and rate, total latency percentiles, the spread of per-connection p99
+// and the connections with the worst p99
+std::ostream& operator<<(std::ostream& out, const LoadReport& report);
+
+// Run the load and return once every thread has finished draining. socketOptions are applied to every
+// connection. Raises RLIMIT_NOFILE as far as the hard limit allows. Throws std::runtime_error if the options are
+// inconsistent or there are not enough file descriptors; connection failures are reported per connection.
+LoadReport runLoad(const LoadOptions& options, const SocketOptions& socketOptions,
+                   const std::function<void(const LoadProgress&)>& progress = nullptr);
@@ -0,0 +1,190 @@
+/**
+ * @file lockfree_ring.h
+ * @brief Bounded lock-free rings for handing work between threads
+ *
+ * Both rings are fixed-size arrays indexed by free-running counters, so push and pop never
+ * allocate or take a lock, and a full ring is reported to the caller instead of blocking it:
+ * - SpscRing: one producer, one consumer. Head and tail live on separate cache lines and each
+ *   side caches the other's counter, so the fast path touches no shared cache line at all.
+ * - MpscRing: many producers, one consumer (D. Vyukov's bounded queue). Producers claim a cell
+ *   with a compare-and-swap on the tail; a per-cell sequence number tells the consumer when the
+ *   value in it has been published.
+ *
+ * Capacities are rounded up to a power of two.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#define LOCKFREE_CACHE_LINE 64
+
+inline size_t ringCapacity(size_t requested)
+{
+    size_t capacity = 1;
+    while (capacity < requested)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0), m_mask(ringCapacity(capacity) - 1),
+          m_slots(m_mask + 1)
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only. Returns false, leaving value untouched, if the ring is full.
+    template <typename U>
+    bool push(U&& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead > m_mask)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead > m_mask)
+            {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = std::forward<U>(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail)
+            {
+                return false;
+            }
+        }
+        value = std::move(m_slots[head & m_mask]); // Leaves no second owner of a handle in the ring
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Entries queued; exact from either side when the other is idle, approximate otherwise
+    size_t size() const
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail - head <= m_mask + 1 ? tail - head : m_mask + 1;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    // Consumer side
+    alignas(LOCKFREE_CACHE_LINE) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+    // Producer side
+    alignas(LOCKFREE_CACHE_LINE) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+    // Read-only after construction
+    alignas(LOCKFREE_CACHE_LINE) size_t m_mask;
+    std::vector<T> m_slots;
+};
+
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity)
+        : m_tail(0), m_head(0), m_mask(ringCapacity(capacity) - 1), m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Any thread. Returns false, leaving value untouched, if the ring is full.
+    template <typename U>
+    bool push(U&& value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &m_cells[position & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                // The cell is free for this lap: claim it by moving the tail past it
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false; // The consumer has not emptied this cell since the previous lap
+            }
+            else
+            {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::forward<U>(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& value)
+    {
+        Cell& cell = m_cells[m_head & m_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+        {
+            return false;
+        }
+        value = std::move(cell.value);
+        // Hand the cell to producers for the next lap
+        cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    alignas(LOCKFREE_CACHE_LINE) std::atomic<size_t> m_tail;
+    alignas(LOCKFREE_CACHE_LINE) size_t m_head;
+    alignas(LOCKFREE_CACHE_LINE) size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+};
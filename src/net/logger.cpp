@@ -0,0 +1,411 @@
+/**
+ * @file logger.cpp
+ * @brief Asynchronous logger: binary records on the hot path, text on a background thread
+ */
+
+#include "net/logger.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : m_level(LogLevel::Info), m_sampleEvery(1), m_prefix(false), m_dropped(0), m_flushRequested(0),
+      m_flushCompleted(0), m_stopping(false)
+{
+    m_thread = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+int64_t Logger::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+Logger::Ring& Logger::threadRing()
+{
+    // Created on a thread's first message and shared with the background thread, which drains it even after the
+    // thread has exited
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring)
+    {
+        ring = std::make_shared<Ring>(LOG_RING_RECORDS);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rings.push_back(ring);
+    }
+    return *ring;
+}
+
+static std::atomic<Logger*> signalLogger{nullptr};
+
+static void changeLevel(int signal)
+{
+    // Only atomics: safe in a signal handler
+    Logger* logger = signalLogger.load();
+    int level = static_cast<int>(logger->level()) + (signal == SIGUSR1 ? -1 : 1);
+    if (level >= static_cast<int>(LogLevel::Trace) && level <= static_cast<int>(LogLevel::Off))
+    {
+        logger->setLevel(static_cast<LogLevel>(level));
+    }
+}
+
+void Logger::installSignalHandlers()
+{
+    signalLogger.store(this);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = changeLevel;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, nullptr) == -1 || sigaction(SIGUSR2, &action, nullptr) == -1)
+    {
+        throw std::runtime_error("Failed to install log level signal handlers: " + std::string(strerror(errno)));
+    }
+    /*
+    sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
+    SA_RESTART: system calls interrupted by the signal are restarted instead of failing with EINTR, so the
+    receive loops are not disturbed by a level change
+    */
+}
+
+void Logger::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t request = ++m_flushRequested;
+    m_wake.notify_one();
+    m_flushed.wait(lock, [&] { return m_flushCompleted >= request; });
+}
+
+const char* Logger::levelName(LogLevel level)
+{
+    switch (level)
+    {
+    case LogLevel::Trace:
+        return "trace";
+    case LogLevel::Debug:
+        return "debug";
+    case LogLevel::Info:
+        return "info";
+    case LogLevel::Warning:
+        return "warning";
+    case LogLevel::Error:
+        return "error";
+    default:
+        return "off";
+    }
+}
+
+bool Logger::parseLevel(const std::string& text, LogLevel& level)
+{
+    for (int candidate = 0; candidate <= static_cast<int>(LogLevel::Off); ++candidate)
+    {
+        if (text == levelName(static_cast<LogLevel>(candidate)))
+        {
+            level = static_cast<LogLevel>(candidate);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::run()
+{
+    std::string out;
+    std::string errors;
+    out.reserve(LOG_OUTPUT_BUFFER * 2);
+    errors.reserve(LOG_OUTPUT_BUFFER);
+    uint64_t reportedDrops = 0;
+    while (true)
+    {
+        uint64_t request;
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            request = m_flushRequested;
+            stopping = m_stopping;
+        }
+
+        // Everything logged before the flush request or stop was read is drained by this pass
+        bool busy = drain(out, errors);
+        uint64_t drops = dropped();
+        if (drops != reportedDrops)
+        {
+            errors += "Logger: " + std::to_string(drops - reportedDrops) + " records dropped, rings full\n";
+            reportedDrops = drops;
+        }
+        writeAll(STDOUT_FILENO, out);
+        writeAll(STDERR_FILENO, errors);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_flushCompleted < request)
+        {
+            m_flushCompleted = request;
+            m_flushed.notify_all();
+        }
+        if (stopping)
+        {
+            return;
+        }
+        if (!busy)
+        {
+            // Producers never signal: a wakeup per message would cost them a system call
+            m_wake.wait_for(lock, std::chrono::microseconds(LOG_IDLE_WAIT_US),
+                            [&] { return m_stopping || m_flushRequested != request; });
+        }
+    }
+}
+
+bool Logger::drain(std::string& out, std::string& errors)
+{
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Forget the rings of threads that have exited once they are empty
+        m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(),
+                                     [](const std::shared_ptr<Ring>& ring) {
+                                         return ring.use_count() == 1 && ring->size() == 0;
+                                     }),
+                      m_rings.end());
+        rings = m_rings;
+    }
+
+    bool prefix = m_prefix.load(std::memory_order_relaxed);
+    bool busy = false;
+    LogRecord record;
+    for (const std::shared_ptr<Ring>& ring : rings)
+    {
+        while (ring->pop(record))
+        {
+            busy = true;
+            std::string& target = record.level >= LogLevel::Warning ? errors : out;
+            format(record, prefix, target);
+            if (target.size() >= LOG_OUTPUT_BUFFER)
+            {
+                writeAll(&target == &out ? STDOUT_FILENO : STDERR_FILENO, target);
+            }
+        }
+    }
+    return busy;
+}
+
+void Logger::format(const LogRecord& record, bool prefix, std::string& out)
+{
+    if (prefix)
+    {
+        time_t seconds = record.timeNs / 1000000000;
+        tm local;
+        localtime_r(&seconds, &local);
+        char stamp[48];
+        snprintf(stamp, sizeof(stamp), "%02d:%02d:%02d.%06ld %-7s ", local.tm_hour, local.tm_min, local.tm_sec,
+                 static_cast<long>(record.timeNs % 1000000000 / 1000), levelName(record.level));
+        out += stamp;
+    }
+
+    const char* argument = record.arguments;
+    const char* end = record.arguments + record.length;
+    for (const char* f = record.format; *f != '\0'; ++f)
+    {
+        if (f[0] != '{' || f[1] != '}')
+        {
+            out += *f;
+            continue;
+        }
+        ++f;
+        if (argument >= end)
+        {
+            out += "{}";
+            continue;
+        }
+
+        char buffer[64];
+        Tag tag = static_cast<Tag>(*argument++);
+        switch (tag)
+        {
+        case Tag::Signed:
+        {
+            int64_t value;
+            memcpy(&value, argument, sizeof(value));
+            argument += sizeof(value);
+            out += std::to_string(value);
+            break;
+        }
+        case Tag::Unsigned:
+        {
+            uint64_t value;
+            memcpy(&value, argument, sizeof(value));
+            argument += sizeof(value);
+            out += std::to_string(value);
+            break;
+        }
+        case Tag::Double:
+        {
+            double value;
+            memcpy(&value, argument, sizeof(value));
+            argument += sizeof(value);
+            snprintf(buffer, sizeof(buffer), "%g", value);
+            out += buffer;
+            break;
+        }
+        case Tag::Char:
+            out += *argument++;
+            break;
+        case Tag::Bool:
+            out += *argument++ ? "true" : "false";
+            break;
+        case Tag::String:
+        {
+            uint16_t kept;
+            uint32_t omitted;
+            memcpy(&kept, argument, sizeof(kept));
+            memcpy(&omitted, argument + 2, sizeof(omitted));
+            out.append(argument + 6, kept);
+            argument += 6 + kept;
+            if (omitted > 0)
+            {
+                out += "... (" + std::to_string(omitted) + " more bytes)";
+            }
+            break;
+        }
+        case Tag::Address:
+        {
+            in_addr address;
+            uint16_t port;
+            memcpy(&address, argument, 4);
+            memcpy(&port, argument + 4, 2);
+            argument += 6;
+            inet_ntop(AF_INET, &address, buffer, sizeof(buffer));
+            out += buffer;
+            out += ':';
+            out += std::to_string(ntohs(port));
+            break;
+        }
+        case Tag::Address6:
+        {
+            in6_addr address;
+            uint16_t port;
+            uint32_t scope;
+            memcpy(&address, argument, 16);
+            memcpy(&port, argument + 16, 2);
+            memcpy(&scope, argument + 18, 4);
+            argument += 22;
+            inet_ntop(AF_INET6, &address, buffer, sizeof(buffer));
+            out += '[';
+            out += buffer;
+            if (scope != 0)
+            {
+                out += '%';
+                out += if_indextoname(scope, buffer) != nullptr ? std::string(buffer) : std::to_string(scope);
+            }
+            out += "]:";
+            out += std::to_string(ntohs(port));
+            break;
+        }
+        case Tag::Ipv4:
+        {
+            in_addr address;
+            memcpy(&address, argument, sizeof(address));
+            argument += sizeof(address);
+            inet_ntop(AF_INET, &address, buffer, sizeof(buffer));
+            out += buffer;
+            break;
+        }
+        case Tag::Error:
+        {
+            int code;
+            memcpy(&code, argument, sizeof(code));
+            argument += sizeof(code);
+            out += strerror_r(code, buffer, sizeof(buffer));
+            break;
+        }
+        }
+    }
+    out += '\n';
+}
+
+void Logger::writeAll(int fd, std::string& text)
+{
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t result = write(fd, text.data() + written, text.size() - written);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break; // Nowhere left to report it
+        }
+        written += result;
+    }
+    text.clear();
+}
+
+bool LogOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg == "--log-prefix")
+    {
+        prefix = true;
+        return true;
+    }
+    if (arg != "--log-level" && arg != "--log-sample")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--log-level")
+    {
+        if (!Logger::parseLevel(value, level))
+        {
+            throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+        }
+        return true;
+    }
+    char* end = nullptr;
+    unsigned long every = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || every == 0 || every > 1000000000)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    sampleEvery = static_cast<unsigned>(every);
+    return true;
+}
+
+void LogOptions::apply() const
+{
+    Logger& logger = Logger::instance();
+    logger.setLevel(level);
+    logger.setSampling(sampleEvery);
+    logger.setPrefix(prefix);
+    logger.installSignalHandlers();
+}
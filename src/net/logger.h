@@ -0,0 +1,341 @@
+/**
+ * @file logger.h
+ * @brief Asynchronous logger: binary records on the hot path, text on a background thread
+ *
+ * Printing every packet with std::cout << ... << std::endl costs a lock, the formatting and a
+ * write() per line on the thread that should be receiving. LOG_INFO() and friends only copy
+ * their arguments:
+ * - Each logging thread has its own SpscRing of fixed-size LogRecords, so threads never
+ *   contend with each other. A record holds the time, the level, a pointer to the format
+ *   string (which must be a string literal) and the raw arguments with a type tag each.
+ * - A background thread drains all rings and does the formatting, including the things that
+ *   are slow or not thread-safe on the hot path: addresses (instead of inet_ntoa's static
+ *   buffer) and errno text (LogError). It writes many lines per write() call, Warning and
+ *   Error to stderr and the rest to stdout.
+ * - A thread whose ring is full drops the record and counts it instead of waiting; the background
+ *   thread reports new drops on stderr.
+ * - The level and "log one in N" sampling of messages below Warning are atomics, so they can be
+ *   changed while running: setLevel(), setSampling(), or SIGUSR1 (more verbose) and SIGUSR2
+ *   (less verbose) once installSignalHandlers() was called.
+ *
+ * Formats use {} for each argument, e.g.
+ *     LOG_INFO("Received {} bytes from {}", length, senderAddress);
+ * Strings longer than what is left in the record are cut and marked with the number of bytes left out.
+ *
+ * @note Records still queued when the process is killed are lost; flush() waits until everything logged so far
+ *       has been written.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "net/lockfree_ring.h"
+#include "net/socket_address.h"
+
+#define LOG_RECORD_SIZE 512           // Bytes per record, arguments included
+#define LOG_RING_RECORDS 2048         // Records per thread
+#define LOG_OUTPUT_BUFFER (64 * 1024) // Formatted bytes collected before a write()
+#define LOG_IDLE_WAIT_US 1000         // How long the background thread sleeps once every ring is empty
+
+enum class LogLevel : uint8_t
+{
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+// Raw bytes, e.g. a payload, logged as they are
+struct LogBytes
+{
+    const char* data;
+    size_t length;
+};
+
+// An errno value, logged as its strerror() text
+struct LogError
+{
+    int code;
+};
+
+struct LogRecord
+{
+    int64_t timeNs;
+    const char* format;
+    LogLevel level;
+    uint16_t length; // Argument bytes used
+    char arguments[LOG_RECORD_SIZE - 24];
+};
+
+class Logger
+{
+public:
+    static Logger& instance();
+
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Whether a message at level would be logged now; advances the sampling counter for levels below Warning
+    bool shouldLog(LogLevel level)
+    {
+        if (level < m_level.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        unsigned every = m_sampleEvery.load(std::memory_order_relaxed);
+        if (level >= LogLevel::Warning || every <= 1)
+        {
+            return true;
+        }
+        thread_local unsigned counter = 0;
+        return counter++ % every == 0;
+    }
+
+    template <typename... Args>
+    void log(LogLevel level, const char* format, const Args&... args)
+    {
+        LogRecord record;
+        record.timeNs = now();
+        record.format = format;
+        record.level = level;
+        record.length = 0;
+        (encode(record, args), ...);
+        if (!threadRing().push(record))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void setLevel(LogLevel level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    LogLevel level() const
+    {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    // Log one in every messages below Warning (1: all of them)
+    void setSampling(unsigned every)
+    {
+        m_sampleEvery.store(every == 0 ? 1 : every, std::memory_order_relaxed);
+    }
+
+    // Prefix every line with the wall-clock time and level
+    void setPrefix(bool prefix)
+    {
+        m_prefix.store(prefix, std::memory_order_relaxed);
+    }
+
+    // SIGUSR1 lowers the level by one (more output), SIGUSR2 raises it
+    void installSignalHandlers();
+
+    // Block until every record logged before the call has been written
+    void flush();
+
+    // Records dropped because a thread's ring was full
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    static const char* levelName(LogLevel level);
+
+    // "trace", "debug", "info", "warning", "error" or "off". Returns false for anything else.
+    static bool parseLevel(const std::string& text, LogLevel& level);
+
+private:
+    enum class Tag : uint8_t
+    {
+        Signed,
+        Unsigned,
+        Double,
+        Char,
+        Bool,
+        String,
+        Address,  // sockaddr_in, or an IPv4 SocketAddress
+        Address6, // IPv6 SocketAddress
+        Ipv4,     // in_addr
+        Error
+    };
+
+    using Ring = SpscRing<LogRecord>;
+
+    std::atomic<LogLevel> m_level;
+    std::atomic<unsigned> m_sampleEvery;
+    std::atomic<bool> m_prefix;
+    std::atomic<uint64_t> m_dropped;
+
+    std::mutex m_mutex; // Guards the ring list and the flush and stop state below
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    std::vector<std::shared_ptr<Ring>> m_rings;
+    uint64_t m_flushRequested;
+    uint64_t m_flushCompleted;
+    bool m_stopping;
+    std::thread m_thread;
+
+    Logger();
+
+    static int64_t now();
+    Ring& threadRing();
+    void run();
+    bool drain(std::string& out, std::string& errors);
+    static void format(const LogRecord& record, bool prefix, std::string& out);
+    static void writeAll(int fd, std::string& text);
+
+    static bool reserve(LogRecord& record, Tag tag, size_t length)
+    {
+        if (record.length + 1 + length > sizeof(record.arguments))
+        {
+            return false;
+        }
+        record.arguments[record.length++] = static_cast<char>(tag);
+        return true;
+    }
+
+    template <typename T>
+    static void put(LogRecord& record, Tag tag, const T& value)
+    {
+        if (reserve(record, tag, sizeof(value)))
+        {
+            memcpy(record.arguments + record.length, &value, sizeof(value));
+            record.length += sizeof(value);
+        }
+    }
+
+    // Stored as: u16 bytes kept, u32 bytes left out, bytes
+    static void putString(LogRecord& record, const char* data, size_t length)
+    {
+        if (!reserve(record, Tag::String, 6))
+        {
+            return;
+        }
+        uint16_t kept = static_cast<uint16_t>(std::min(length, sizeof(record.arguments) - record.length - 6));
+        uint32_t omitted = static_cast<uint32_t>(length - kept);
+        memcpy(record.arguments + record.length, &kept, sizeof(kept));
+        memcpy(record.arguments + record.length + 2, &omitted, sizeof(omitted));
+        memcpy(record.arguments + record.length + 6, data, kept);
+        record.length += 6 + kept;
+    }
+
+    template <typename T>
+    static void encode(LogRecord& record, const T& value)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            put(record, Tag::Bool, value);
+        }
+        else if constexpr (std::is_same_v<T, char>)
+        {
+            put(record, Tag::Char, value);
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        {
+            put(record, Tag::Signed, static_cast<int64_t>(value));
+        }
+        else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+        {
+            put(record, Tag::Unsigned, static_cast<uint64_t>(value));
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            put(record, Tag::Double, static_cast<double>(value));
+        }
+        else if constexpr (std::is_same_v<T, sockaddr_in>)
+        {
+            char address[6]; // Address and port, in network byte order
+            memcpy(address, &value.sin_addr, 4);
+            memcpy(address + 4, &value.sin_port, 2);
+            put(record, Tag::Address, address);
+        }
+        else if constexpr (std::is_same_v<T, SocketAddress>)
+        {
+            if (!value.isIpv6())
+            {
+                encode(record, value.ipv4());
+                return;
+            }
+            char address[22]; // Address and port in network byte order, then the scope in host byte order
+            memcpy(address, &value.ipv6().sin6_addr, 16);
+            memcpy(address + 16, &value.ipv6().sin6_port, 2);
+            memcpy(address + 18, &value.ipv6().sin6_scope_id, 4);
+            put(record, Tag::Address6, address);
+        }
+        else if constexpr (std::is_same_v<T, in_addr>)
+        {
+            put(record, Tag::Ipv4, value.s_addr);
+        }
+        else if constexpr (std::is_same_v<T, LogError>)
+        {
+            put(record, Tag::Error, value.code);
+        }
+        else if constexpr (std::is_same_v<T, LogBytes>)
+        {
+            putString(record, value.data, value.length);
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+        {
+            std::string_view text(value);
+            putString(record, text.data(), text.size());
+        }
+        else
+        {
+            static_assert(sizeof(T) == 0, "Logger: unsupported argument type");
+        }
+    }
+};
+
+#define LOG_AT(level, ...)                                                                                             \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (Logger::instance().shouldLog(level))                                                                       \
+        {                                                                                                              \
+            Logger::instance().log(level, __VA_ARGS__);                                                                \
+        }                                                                                                              \
+    } while (0)
+
+#define LOG_TRACE(...) LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+struct LogOptions
+{
+    LogLevel level = LogLevel::Info;
+    unsigned sampleEvery = 1;
+    bool prefix = false;
+
+    // Handle --log-level trace|debug|info|warning|error|off, --log-sample N and --log-prefix at argv[index].
+    // Returns false if the argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--log-level trace|debug|info|warning|error|off] [--log-sample N] [--log-prefix]";
+    }
+
+    // Configure Logger::instance() and install its signal handlers
+    void apply() const;
+};
@@ -0,0 +1,186 @@
+/**
+ * @file message.h
+ * @brief Fixed-layout binary messages, written and read in place
+ *
+ * A text payload costs the publisher a formatted std::string per message and the receiver a parse
+ * (and usually a std::string) per datagram. A schema'd message is a struct with a fixed layout
+ * instead, and both sides work on it where it lies:
+ * - A schema is a standard-layout, trivially copyable struct that starts with a MessageHeader and
+ *   names its type as messageType. Every field is a LittleEndian<T> or a byte array, so the layout
+ *   is the same on every compiler and host and the struct has no padding (checked by the
+ *   MessageSchema concept).
+ * - LittleEndian<T> keeps its bytes in little-endian order and converts in get()/set(): a plain
+ *   load on x86 and ARM, a byte swap on big-endian hosts. Its alignment is 1, so a message may be
+ *   read from any address, e.g. after a 24-byte SequenceHeader or a 14-byte Ethernet header.
+ *   Schemas put every field at an offset that is a multiple of its size and are a multiple of
+ *   MESSAGE_ALIGNMENT long, so in an aligned buffer (DatagramBatch and pool buffers are) every
+ *   field load is aligned too.
+ * - encodeMessage() sets up the header in the caller's buffer (a DatagramPublisher slot or a pool
+ *   buffer) and returns the struct to fill in; readMessage() checks the header against the
+ *   datagram and returns a view of the receive buffer. Neither copies or allocates.
+ * - Bytes after the struct, up to the header's length, are the message's tail (messageTail()):
+ *   variable-length data such as the text of a TextMessage.
+ *
+ *     TextMessage* message = encodeMessage<TextMessage>(slot, capacity, text.size());
+ *     message->id = id;
+ *     memcpy(messageTail(message), text.data(), text.size());
+ *
+ *     if (const TextMessage* message = readMessage<TextMessage>(datagram.data, datagram.length))
+ *         use(message->id.get(), messageTail(*message));
+ *
+ * Wire format, little-endian, MESSAGE_HEADER_SIZE bytes before the schema's fields:
+ *
+ *     magic u16 | type u16 | length u32 (header, fields and tail)
+ *
+ * @note The magic's first byte, 0xCE followed by 0xD1, cannot start valid UTF-8, so text and binary
+ *       payloads can share a feed
+ */
+
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+#include <endian.h>
+
+#define MESSAGE_MAGIC 0xD1CE
+#define MESSAGE_HEADER_SIZE 8
+#define MESSAGE_ALIGNMENT 8 // Schemas are a multiple of this long; their fields are aligned to their size up to it
+
+#define MESSAGE_TYPE_TEXT 1
+
+// An integer field stored little-endian, readable at any address
+template <std::integral T>
+class LittleEndian
+{
+public:
+    T get() const
+    {
+        std::make_unsigned_t<T> value;
+        memcpy(&value, m_bytes, sizeof(value));
+        return static_cast<T>(fromLittle(value));
+    }
+
+    void set(T value)
+    {
+        std::make_unsigned_t<T> bytes = fromLittle(static_cast<std::make_unsigned_t<T>>(value));
+        memcpy(m_bytes, &bytes, sizeof(bytes));
+    }
+
+    operator T() const
+    {
+        return get();
+    }
+
+    LittleEndian& operator=(T value)
+    {
+        set(value);
+        return *this;
+    }
+
+private:
+    unsigned char m_bytes[sizeof(T)];
+
+    // The conversion is its own inverse
+    template <typename U>
+    static U fromLittle(U value)
+    {
+        if constexpr (sizeof(U) == 1)
+        {
+            return value;
+        }
+        else if constexpr (sizeof(U) == 2)
+        {
+            return le16toh(value);
+        }
+        else if constexpr (sizeof(U) == 4)
+        {
+            return le32toh(value);
+        }
+        else
+        {
+            return le64toh(value);
+        }
+    }
+};
+
+struct MessageHeader
+{
+    LittleEndian<uint16_t> magic;
+    LittleEndian<uint16_t> type;
+    LittleEndian<uint32_t> length; // Whole message: header, fields and tail
+};
+
+static_assert(sizeof(MessageHeader) == MESSAGE_HEADER_SIZE);
+
+template <typename T>
+concept MessageSchema = std::is_standard_layout_v<T> && std::is_trivially_copyable_v<T> &&
+                        std::has_unique_object_representations_v<T> && alignof(T) == 1 &&
+                        sizeof(T) % MESSAGE_ALIGNMENT == 0 && std::same_as<decltype(T::header), MessageHeader> &&
+                        offsetof(T, header) == 0 && std::convertible_to<decltype(T::messageType), uint16_t>;
+
+// A line of text and where it came from: the payload of the publishers' --format binary
+struct TextMessage
+{
+    static constexpr uint16_t messageType = MESSAGE_TYPE_TEXT;
+
+    MessageHeader header;
+    LittleEndian<uint64_t> id;        // Message number at the publisher, from 0
+    LittleEndian<int64_t> sendTimeNs; // CLOCK_REALTIME at the publisher
+    // Tail: the text, without a terminating NUL
+};
+
+static_assert(MessageSchema<TextMessage>);
+static_assert(offsetof(TextMessage, id) % 8 == 0 && offsetof(TextMessage, sendTimeNs) % 8 == 0);
+
+// Start a T followed by tailLength bytes of tail at out, which has capacity bytes. Returns it with every field
+// zero but the header, or nullptr if it does not fit.
+template <MessageSchema T>
+T* encodeMessage(char* out, size_t capacity, size_t tailLength = 0)
+{
+    if (tailLength > capacity || capacity - tailLength < sizeof(T) || sizeof(T) + tailLength > UINT32_MAX)
+    {
+        return nullptr;
+    }
+    T* message = new (out) T{};
+    message->header.magic = MESSAGE_MAGIC;
+    message->header.type = T::messageType;
+    message->header.length = static_cast<uint32_t>(sizeof(T) + tailLength);
+    return message;
+}
+
+// The T at the start of the length bytes at data, in place. Returns nullptr if they do not start with the header
+// of a T, or are shorter than its header says.
+template <MessageSchema T>
+const T* readMessage(const char* data, size_t length)
+{
+    if (length < sizeof(T))
+    {
+        return nullptr;
+    }
+    const T* message = reinterpret_cast<const T*>(data);
+    if (message->header.magic != MESSAGE_MAGIC || message->header.type != T::messageType ||
+        message->header.length < sizeof(T) || message->header.length > length)
+    {
+        return nullptr;
+    }
+    return message;
+}
+
+// Where the tail of a message being encoded goes
+template <MessageSchema T>
+char* messageTail(T* message)
+{
+    return reinterpret_cast<char*>(message) + sizeof(T);
+}
+
+template <MessageSchema T>
+std::string_view messageTail(const T& message)
+{
+    return std::string_view(reinterpret_cast<const char*>(&message) + sizeof(T), message.header.length - sizeof(T));
+}
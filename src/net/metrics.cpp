@@ -0,0 +1,396 @@
+/**
+ * @file metrics.cpp
+ * @brief Lock-free runtime counters and latency histograms with a Prometheus scrape endpoint
+ */
+
+#include "net/metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "net/hot_restart.h"
+
+#define METRICS_REQUEST_SIZE 4096
+#define METRICS_ACCEPT_BACKOFF_MS 100 // Out of descriptors: how long to wait for a scrape before accepting again
+
+static std::atomic<unsigned> nextShard{0};
+
+unsigned metricsShard()
+{
+    thread_local unsigned shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+    return shard;
+}
+
+uint64_t Counter::value() const
+{
+    uint64_t total = 0;
+    for (const Shard& shard : m_shards)
+    {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram()
+{
+    for (std::unique_ptr<Shard>& shard : m_shards)
+    {
+        shard = std::make_unique<Shard>();
+    }
+}
+
+LatencyHistogram Histogram::snapshot(uint64_t& sumNs, uint64_t& maxNs) const
+{
+    LatencyHistogram histogram;
+    sumNs = 0;
+    maxNs = 0;
+    for (const std::unique_ptr<Shard>& shard : m_shards)
+    {
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+        {
+            uint64_t count = shard->counts[i].load(std::memory_order_relaxed);
+            if (count != 0)
+            {
+                histogram.record(LatencyHistogram::bucketValue(i), count);
+            }
+        }
+        sumNs += shard->sum.load(std::memory_order_relaxed);
+        uint64_t max = shard->max.load(std::memory_order_relaxed);
+        maxNs = max > maxNs ? max : maxNs;
+    }
+    return histogram;
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics* metrics = new Metrics();
+    return *metrics;
+}
+
+Metrics::Series& Metrics::find(const std::string& name, const std::string& help, const std::string& labels,
+                               Type type)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto inserted = m_families.emplace(name, Family{help, type, {}});
+    Family& family = inserted.first->second;
+    if (family.type != type)
+    {
+        throw std::runtime_error("Metric " + name + " is already registered with another type");
+    }
+    for (Series& series : family.series)
+    {
+        if (series.labels == labels)
+        {
+            return series;
+        }
+    }
+
+    Series series;
+    series.labels = labels;
+    switch (type)
+    {
+    case Type::Counter:
+        series.counter = std::make_unique<Counter>();
+        break;
+    case Type::Gauge:
+        series.gauge = std::make_unique<Gauge>();
+        break;
+    case Type::Histogram:
+        series.histogram = std::make_unique<Histogram>();
+        break;
+    }
+    family.series.push_back(std::move(series));
+    return family.series.back();
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return *find(name, help, labels, Type::Counter).counter;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return *find(name, help, labels, Type::Gauge).gauge;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return *find(name, help, labels, Type::Histogram).histogram;
+}
+
+// name{labels} or name{labels,extra}
+static std::string seriesName(const std::string& name, const std::string& labels, const std::string& extra = "")
+{
+    std::string all = labels.empty() ? extra : extra.empty() ? labels : labels + "," + extra;
+    return all.empty() ? name : name + "{" + all + "}";
+}
+
+static std::string seconds(uint64_t ns)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", ns / 1e9);
+    return text;
+}
+
+std::string Metrics::render() const
+{
+    static const char* const typeNames[] = {"counter", "gauge", "summary"};
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    std::string out;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& entry : m_families)
+    {
+        const std::string& name = entry.first;
+        const Family& family = entry.second;
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + " " + typeNames[static_cast<int>(family.type)] + "\n";
+        for (const Series& series : family.series)
+        {
+            if (series.counter)
+            {
+                out += seriesName(name, series.labels) + " " + std::to_string(series.counter->value()) + "\n";
+            }
+            else if (series.gauge)
+            {
+                out += seriesName(name, series.labels) + " " + std::to_string(series.gauge->value()) + "\n";
+            }
+            else
+            {
+                uint64_t sumNs;
+                uint64_t maxNs;
+                LatencyHistogram histogram = series.histogram->snapshot(sumNs, maxNs);
+                for (double quantile : quantiles)
+                {
+                    // A bucket's value can lie above the largest value it holds
+                    uint64_t valueNs = std::min<uint64_t>(histogram.percentile(quantile * 100), maxNs);
+                    char label[32];
+                    snprintf(label, sizeof(label), "quantile=\"%g\"", quantile);
+                    out += seriesName(name, series.labels, label) + " " + seconds(valueNs) + "\n";
+                }
+                out += seriesName(name, series.labels, "quantile=\"1\"") + " " + seconds(maxNs) + "\n";
+                out += seriesName(name + "_sum", series.labels) + " " + seconds(sumNs) + "\n";
+                out += seriesName(name + "_count", series.labels) + " " + std::to_string(histogram.count()) + "\n";
+            }
+        }
+    }
+    return out;
+}
+
+static Socket listenForScrapes(const SocketAddress& address)
+{
+    Socket socket(address.family(), SOCK_STREAM);
+    socket.apply(SocketOptions().reuseAddress(true)).bind(address).listen(METRICS_BACKLOG);
+    return socket;
+}
+
+void Metrics::serve(const SocketAddress& address)
+{
+    serve(listenForScrapes(address));
+}
+
+void Metrics::serve(Socket listenSocket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_listenSocket.fd() != -1)
+    {
+        throw std::runtime_error("Metrics endpoint already running");
+    }
+    m_listenSocket = std::move(listenSocket);
+    // Runs until the process exits; Metrics is never destroyed
+    std::thread(&Metrics::run, this).detach();
+}
+
+void Metrics::run()
+{
+    // Held back for when the process runs out of descriptors
+    int spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    while (true)
+    {
+        int fd = accept4(m_listenSocket.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                shedScrape(spare);
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (spare != -1)
+            {
+                close(spare);
+            }
+            return;
+        }
+        answer(fd);
+        close(fd);
+    }
+}
+
+// accept4() fails at once while the process is out of descriptors, whether or not a scrape is queued. Wait for one
+// instead of retrying, then use the spare descriptor to take it off the queue and close it, so the scraper sees the
+// connection close instead of hanging. Without a spare descriptor, the scrape waits in the queue.
+void Metrics::shedScrape(int& spare)
+{
+    pollfd listening{m_listenSocket.fd(), POLLIN, 0};
+    if (poll(&listening, 1, METRICS_ACCEPT_BACKOFF_MS) <= 0)
+    {
+        return;
+    }
+    if (spare == -1)
+    {
+        // Not poll() again: the queued scrape keeps the listen socket readable
+        std::this_thread::sleep_for(std::chrono::milliseconds(METRICS_ACCEPT_BACKOFF_MS));
+        spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return;
+    }
+    close(spare);
+    int fd = accept4(m_listenSocket.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void Metrics::answer(int fd)
+{
+    // A scraper that stops sending must not stall the endpoint
+    timeval timeout{METRICS_REQUEST_TIMEOUT_MS / 1000, (METRICS_REQUEST_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters; the rest of the header is read so closing does not reset the connection
+    std::string request;
+    char buffer[METRICS_REQUEST_SIZE];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_REQUEST_SIZE)
+    {
+        ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+        if (length <= 0)
+        {
+            if (length == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        request.append(buffer, length);
+    }
+
+    bool found = request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0 ||
+                 request.compare(0, 6, "GET / ") == 0;
+    std::string body = found ? render() : "Not found; try /metrics\n";
+    std::string response = std::string(found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n") +
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        ssize_t length = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (length == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        sent += length;
+    }
+}
+
+TrafficMetrics& trafficMetrics()
+{
+    static TrafficMetrics* metrics = [] {
+        Metrics& registry = Metrics::instance();
+        const char* drops = "Packets lost before the application handled them";
+        return new TrafficMetrics{
+            registry.counter("net_packets_received_total", "Datagrams, frames or replies received"),
+            registry.counter("net_bytes_received_total", "Payload bytes received"),
+            registry.counter("net_packets_sent_total", "Datagrams, frames or requests sent"),
+            registry.counter("net_bytes_sent_total", "Payload bytes sent"),
+            registry.counter("net_drops_total", drops, "reason=\"kernel\""),
+            registry.counter("net_drops_total", drops, "reason=\"truncated\""),
+            registry.counter("net_drops_total", drops, "reason=\"backpressure\""),
+            registry.counter("net_errors_total", "Socket calls that failed"),
+            registry.counter("net_would_block_total", "Non-blocking socket calls that returned EAGAIN"),
+            registry.gauge("net_queue_depth", "Received datagrams waiting between threads"),
+            registry.histogram("net_receive_delay_seconds",
+                               "Time from the kernel receive timestamp to the application reading the packet"),
+        };
+    }();
+    return *metrics;
+}
+
+bool MetricsOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--metrics-port" && arg != "--metrics-address")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--metrics-address")
+    {
+        try
+        {
+            address = SocketAddress::parse(value, address.port());
+        }
+        catch (const std::exception&)
+        {
+            throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+        }
+        return true;
+    }
+    char* end = nullptr;
+    unsigned long port = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || port == 0 || port > 65535)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    address.setPort(static_cast<uint16_t>(port));
+    return true;
+}
+
+void MetricsOptions::apply(HotRestart* restart) const
+{
+    if (!enabled())
+    {
+        return;
+    }
+    if (restart == nullptr)
+    {
+        Metrics::instance().serve(address);
+        return;
+    }
+    std::string tag = "metrics " + address.toString();
+    Socket socket = restart->adopt(tag);
+    if (socket.fd() == -1)
+    {
+        socket = listenForScrapes(address);
+    }
+    restart->offer(socket.fd(), tag);
+    Metrics::instance().serve(std::move(socket));
+}
@@ -0,0 +1,247 @@
+/**
+ * @file metrics.h
+ * @brief Lock-free runtime counters and latency histograms with a Prometheus scrape endpoint
+ *
+ * Counters, gauges and histograms are registered once by name and then updated from any thread
+ * without locks:
+ * - A Counter or Histogram is split into METRICS_SHARDS cache-line-aligned shards. Every thread
+ *   picks a shard on its first update and only touches that one, so threads do not bounce each
+ *   other's cache lines; a scrape adds the shards up.
+ * - Histograms count nanosecond values in the log-linear buckets of LatencyHistogram (about 6%
+ *   resolution over the whole 64-bit range) and are exported as a Prometheus summary in seconds:
+ *   p50, p90, p99, p99.9 and the maximum, plus _sum and _count.
+ * - MetricsOptions::apply() starts a background thread answering "GET /metrics" over HTTP with the
+ *   Prometheus text format, so `curl http://HOST:PORT/metrics` or a Prometheus server can watch a
+ *   running example.
+ *
+ *     Counter& sent = Metrics::instance().counter("app_messages_sent_total", "Messages sent");
+ *     sent.add();
+ *
+ * The metrics every example shares (packets, bytes, drops, errors, EAGAIN, queue depth and receive
+ * delay) are in trafficMetrics(); the shared receive and send code updates them already.
+ *
+ * @note Registration takes a lock; keep the returned reference instead of looking a metric up per packet
+ * @note Labels are given preformatted, e.g. reason="kernel", and are part of a metric's identity
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <netinet/in.h>
+
+#include "net/latency_histogram.h"
+#include "net/socket.h"
+
+class HotRestart;
+
+#define METRICS_SHARDS 16 // Threads beyond this many share shards, which stays correct but contends
+#define METRICS_CACHE_LINE 64
+#define METRICS_BACKLOG 16
+#define METRICS_REQUEST_TIMEOUT_MS 1000 // A scraper that sends nothing for this long is dropped
+
+// The shard the calling thread updates, assigned round robin on first use
+unsigned metricsShard();
+
+class Counter
+{
+public:
+    Counter() = default;
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    void add(uint64_t count = 1)
+    {
+        m_shards[metricsShard()].value.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+
+private:
+    struct alignas(METRICS_CACHE_LINE) Shard
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, METRICS_SHARDS> m_shards;
+};
+
+// A value that goes up and down, e.g. a queue depth. One atomic; the last set() wins.
+class Gauge
+{
+public:
+    Gauge() = default;
+    Gauge(const Gauge&) = delete;
+    Gauge& operator=(const Gauge&) = delete;
+
+    void set(int64_t value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    void add(int64_t delta)
+    {
+        m_value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    int64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(METRICS_CACHE_LINE) std::atomic<int64_t> m_value{0};
+};
+
+class Histogram
+{
+public:
+    Histogram();
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    // Count one value in nanoseconds
+    void record(uint64_t valueNs)
+    {
+        Shard& shard = *m_shards[metricsShard()];
+        shard.counts[LatencyHistogram::bucketIndex(valueNs)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(valueNs, std::memory_order_relaxed);
+        uint64_t max = shard.max.load(std::memory_order_relaxed);
+        while (valueNs > max && !shard.max.compare_exchange_weak(max, valueNs, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Every shard added up. Counts recorded during the call may or may not be included.
+    LatencyHistogram snapshot(uint64_t& sumNs, uint64_t& maxNs) const;
+
+private:
+    struct alignas(METRICS_CACHE_LINE) Shard
+    {
+        std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> counts{};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    std::array<std::unique_ptr<Shard>, METRICS_SHARDS> m_shards;
+};
+
+class Metrics
+{
+public:
+    // Never destroyed, so threads still running at exit can keep updating their metrics
+    static Metrics& instance();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // The metric with this name and labels, created on first use. Throws std::runtime_error if the name is
+    // already registered as another type.
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    // Values in nanoseconds; name should end in _seconds, the unit it is exported in
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    // Everything registered, in the Prometheus text exposition format (version 0.0.4)
+    std::string render() const;
+
+    // Answer HTTP scrapes on address from a background thread. Throws std::runtime_error if the socket cannot
+    // be bound or a server is already running.
+    void serve(const SocketAddress& address);
+    // The same on a socket that is listening already, e.g. one handed over by a hot restart
+    void serve(Socket listenSocket);
+
+private:
+    enum class Type
+    {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    struct Series
+    {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family
+    {
+        std::string help;
+        Type type;
+        std::deque<Series> series; // Grows without moving the series handed out
+    };
+
+    mutable std::mutex m_mutex; // Registration and rendering only; updates never take it
+    std::map<std::string, Family> m_families;
+    Socket m_listenSocket; // Open while the endpoint runs
+
+    Metrics() = default;
+
+    Series& find(const std::string& name, const std::string& help, const std::string& labels, Type type);
+    void run();
+    void shedScrape(int& spare);
+    void answer(int fd);
+};
+
+// The metrics shared by every example
+struct TrafficMetrics
+{
+    Counter& packetsReceived;   // net_packets_received_total: datagrams, frames or replies
+    Counter& bytesReceived;     // net_bytes_received_total
+    Counter& packetsSent;       // net_packets_sent_total
+    Counter& bytesSent;         // net_bytes_sent_total
+    Counter& kernelDrops;       // net_drops_total{reason="kernel"}: socket receive queue overflows (SO_RXQ_OVFL)
+    Counter& truncated;         // net_drops_total{reason="truncated"}: larger than the receive buffer
+    Counter& backpressure;      // net_drops_total{reason="backpressure"}: every worker queue full
+    Counter& errors;            // net_errors_total: socket calls that failed
+    Counter& wouldBlock;        // net_would_block_total: non-blocking socket calls that returned EAGAIN
+    Gauge& queueDepth;          // net_queue_depth: descriptors waiting between threads
+    Histogram& receiveDelay;    // net_receive_delay_seconds: kernel receive timestamp to the application
+
+    // One datagram read outside DatagramBatch. kernelNs is its software receive timestamp, 0 if it has none.
+    void countReceived(size_t length, int64_t kernelNs, int64_t nowNs)
+    {
+        packetsReceived.add();
+        bytesReceived.add(length);
+        if (kernelNs != 0)
+        {
+            receiveDelay.record(nowNs > kernelNs ? static_cast<uint64_t>(nowNs - kernelNs) : 0);
+        }
+    }
+};
+
+TrafficMetrics& trafficMetrics();
+
+struct MetricsOptions
+{
+    SocketAddress address = SocketAddress::any(AF_INET, 0); // Port 0: no endpoint
+
+    // Handle --metrics-port PORT and --metrics-address IP (IPv4 or IPv6) at argv[index]. Returns false if the
+    // argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--metrics-port PORT [--metrics-address IP]]";
+    }
+
+    bool enabled() const
+    {
+        return address.port() != 0;
+    }
+
+    // Start the scrape endpoint if a port was given. With restart, the endpoint's socket is taken over from the
+    // previous process if it had one on the same address, and offered to the next.
+    void apply(HotRestart* restart = nullptr) const;
+};
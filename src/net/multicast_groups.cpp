@@ -0,0 +1,334 @@
+/**
+ * @file multicast_groups.cpp
+ * @brief One receiver for many multicast groups, interfaces and sources
+ */
+
+#include "net/multicast_groups.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "net/hot_restart.h"
+
+// An interface given by name is joined through its primary IPv4 address, which is what ip_mreq takes
+static in_addr interfaceAddress(const std::string& name)
+{
+    in_addr address;
+    if (inet_pton(AF_INET, name.c_str(), &address) == 1)
+    {
+        return address;
+    }
+
+    ifreq request;
+    memset(&request, 0, sizeof(request));
+    if (name.size() >= sizeof(request.ifr_name))
+    {
+        throw std::runtime_error("Invalid interface '" + name + "'");
+    }
+    strncpy(request.ifr_name, name.c_str(), sizeof(request.ifr_name) - 1);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    bool found = fd != -1 && ioctl(fd, SIOCGIFADDR, &request) == 0;
+    /*
+    ioctl(fd, SIOCGIFADDR, struct ifreq *ifr)
+    Fills ifr_addr with the primary IPv4 address of the interface named in ifr_name
+    return -1 with ENODEV if there is no such interface, EADDRNOTAVAIL if it has no IPv4 address
+    */
+    int error = errno;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    if (!found)
+    {
+        throw std::runtime_error("No IPv4 address on interface '" + name + "': " + std::string(strerror(error)));
+    }
+    return reinterpret_cast<const sockaddr_in*>(&request.ifr_addr)->sin_addr;
+}
+
+// IPv6 memberships name the interface by index, not by address
+static unsigned parseInterfaceIndex(const std::string& name)
+{
+    char* end = nullptr;
+    unsigned long index = strtoul(name.c_str(), &end, 10);
+    if (name.empty() || *end != '\0')
+    {
+        index = if_nametoindex(name.c_str());
+    }
+    if (index == 0)
+    {
+        throw std::runtime_error("No interface '" + name + "'");
+    }
+    return static_cast<unsigned>(index);
+}
+
+GroupSubscription GroupSubscription::parse(const std::string& text)
+{
+    GroupSubscription subscription;
+    std::string rest = text;
+
+    std::string source;
+    size_t slash = rest.find('/');
+    if (slash != std::string::npos)
+    {
+        subscription.sourceSpecific = true;
+        source = rest.substr(slash + 1);
+        rest = rest.substr(0, slash);
+    }
+
+    size_t at = rest.find('@');
+    if (at != std::string::npos)
+    {
+        subscription.interfaceName = rest.substr(at + 1);
+        rest = rest.substr(0, at);
+    }
+
+    if (rest.find(':') == std::string::npos)
+    {
+        throw std::runtime_error("Subscription '" + text + "' needs GROUP:PORT");
+    }
+    subscription.group = SocketAddress::parse(rest);
+    if (!subscription.group.isMulticast())
+    {
+        throw std::runtime_error(subscription.group.host() + " is not a multicast address");
+    }
+    if (subscription.group.port() == 0)
+    {
+        throw std::runtime_error("Invalid port '0'");
+    }
+
+    bool ipv6 = subscription.group.isIpv6();
+    subscription.interface.s_addr = htonl(INADDR_ANY);
+    if (!subscription.interfaceName.empty())
+    {
+        if (ipv6)
+        {
+            subscription.interfaceIndex = parseInterfaceIndex(subscription.interfaceName);
+        }
+        else
+        {
+            subscription.interface = interfaceAddress(subscription.interfaceName);
+        }
+    }
+    else if (ipv6)
+    {
+        subscription.interfaceIndex = subscription.group.ipv6().sin6_scope_id; // [ff02::1%eth0]:PORT
+    }
+
+    if (subscription.sourceSpecific)
+    {
+        if (source.size() > 2 && source.front() == '[' && source.back() == ']')
+        {
+            source = source.substr(1, source.size() - 2);
+        }
+        try
+        {
+            subscription.source = SocketAddress::parse(source, 0);
+        }
+        catch (const std::runtime_error&)
+        {
+            throw std::runtime_error("Invalid source address '" + source + "'");
+        }
+        if (subscription.source.family() != subscription.group.family())
+        {
+            throw std::runtime_error("Source " + source + " and group " + subscription.group.host() +
+                                     " are not of the same address family");
+        }
+    }
+    return subscription;
+}
+
+std::string GroupSubscription::toString() const
+{
+    std::string text = group.toString();
+    if (!interfaceName.empty())
+    {
+        text += "@" + interfaceName;
+    }
+    if (sourceSpecific)
+    {
+        text += "/" + source.host();
+    }
+    return text;
+}
+
+MulticastGroups::MulticastGroups(const std::vector<GroupSubscription>& subscriptions,
+                                 const SocketOptions& socketOptions, const TimestampOptions& timestampOptions,
+                                 HotRestart* restart)
+{
+    // Every subscription to the same group and port goes on one socket
+    for (const GroupSubscription& subscription : subscriptions)
+    {
+        Group* group = nullptr;
+        for (Group& existing : m_groups)
+        {
+            if (existing.address == subscription.group)
+            {
+                group = &existing;
+            }
+        }
+        if (group == nullptr)
+        {
+            m_groups.emplace_back();
+            group = &m_groups.back();
+            group->address = subscription.group;
+            group->name = subscription.group.toString();
+        }
+        group->memberships.push_back(subscription);
+    }
+
+    for (Group& group : m_groups)
+    {
+        // A socket is only taken over with exactly the memberships it was joined with
+        std::string tag = "multicast";
+        for (const GroupSubscription& subscription : group.memberships)
+        {
+            tag += " " + subscription.toString();
+        }
+        if (restart != nullptr)
+        {
+            group.socket = restart->adopt(tag);
+        }
+
+        if (group.socket.fd() != -1)
+        {
+            // Bound and joined already; the options may have changed with the new configuration
+            group.socket.apply(socketOptions);
+            timestampOptions.apply(group.socket.fd());
+            for (const GroupSubscription& subscription : group.memberships)
+            {
+                std::cout << "Took over " << subscription.toString() << std::endl;
+            }
+        }
+        else
+        {
+            open(group, socketOptions, timestampOptions);
+            for (const GroupSubscription& subscription : group.memberships)
+            {
+                setMembership(group.socket.fd(), subscription, true);
+                std::cout << "Joined " << subscription.toString() << std::endl;
+            }
+        }
+
+        if (restart != nullptr)
+        {
+            restart->offer(group.socket.fd(), tag);
+        }
+    }
+}
+
+void MulticastGroups::open(Group& group, const SocketOptions& socketOptions, const TimestampOptions& timestampOptions)
+{
+    bool ipv6 = group.address.isIpv6();
+    group.socket = Socket(group.address.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC);
+    int fd = group.socket.fd();
+    group.socket.apply(socketOptions);
+    timestampOptions.apply(fd);
+
+    int disable = 0;
+    if (setsockopt(fd, ipv6 ? IPPROTO_IPV6 : IPPROTO_IP, ipv6 ? IPV6_MULTICAST_ALL : IP_MULTICAST_ALL, &disable,
+                   sizeof(disable)) == -1)
+    {
+        throw std::runtime_error(std::string("Failed to clear ") +
+                                 (ipv6 ? "IPV6_MULTICAST_ALL: " : "IP_MULTICAST_ALL: ") + strerror(errno));
+    }
+    /*
+    IP_MULTICAST_ALL (IPV6_MULTICAST_ALL): When set (the default), a socket bound to a port receives
+    datagrams for every group joined on the system, by any socket. Cleared, it only receives the
+    groups it joined itself.
+    */
+
+    // Bound to the group address, so only datagrams sent to this group reach the socket. A link-local
+    // IPv6 group can only be bound together with its interface.
+    sockaddr_in6 scoped{};
+    if (ipv6)
+    {
+        scoped = group.address.ipv6();
+        scoped.sin6_scope_id = group.memberships.front().interfaceIndex;
+    }
+    group.socket.bind(ipv6 ? SocketAddress(scoped) : group.address);
+}
+
+MulticastGroups::~MulticastGroups()
+{
+    // Handed over: the next process receives on the same sockets, so only this process's descriptors close
+    if (m_keepMemberships)
+    {
+        return;
+    }
+    for (Group& group : m_groups)
+    {
+        for (const GroupSubscription& subscription : group.memberships)
+        {
+            try
+            {
+                setMembership(group.socket.fd(), subscription, false);
+                std::cout << "Left " << subscription.toString() << std::endl;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+void MulticastGroups::setMembership(int fd, const GroupSubscription& subscription, bool join)
+{
+    int result;
+    if (subscription.group.isIpv6() && subscription.sourceSpecific)
+    {
+        group_source_req request{};
+        request.gsr_interface = subscription.interfaceIndex;
+        memcpy(&request.gsr_group, &subscription.group.ipv6(), sizeof(sockaddr_in6));
+        memcpy(&request.gsr_source, &subscription.source.ipv6(), sizeof(sockaddr_in6));
+        result = setsockopt(fd, IPPROTO_IPV6, join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP, &request,
+                            sizeof(request));
+        /*
+        MCAST_JOIN_SOURCE_GROUP: The protocol-independent source-specific join (RFC 3678); IPv6 has no
+        option of its own for it. The host sends an MLDv2 report naming the source.
+        */
+    }
+    else if (subscription.group.isIpv6())
+    {
+        ipv6_mreq request{};
+        request.ipv6mr_multiaddr = subscription.group.ipv6().sin6_addr;
+        request.ipv6mr_interface = subscription.interfaceIndex;
+        result = setsockopt(fd, IPPROTO_IPV6, join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &request, sizeof(request));
+        /*
+        IPV6_JOIN_GROUP: Join the group on the interface with this index (0: the one the route to the group
+        goes through). The host sends an MLD report instead of IGMP.
+        */
+    }
+    else if (subscription.sourceSpecific)
+    {
+        ip_mreq_source request{};
+        request.imr_multiaddr = subscription.group.ipv4().sin_addr;
+        request.imr_interface = subscription.interface;
+        request.imr_sourceaddr = subscription.source.ipv4().sin_addr;
+        result = setsockopt(fd, IPPROTO_IP, join ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP, &request,
+                            sizeof(request));
+        /*
+        IP_ADD_SOURCE_MEMBERSHIP: Join the group for datagrams from imr_sourceaddr only (source-specific
+        multicast). The host sends an IGMPv3 report naming the source, so routers forward nothing else.
+        */
+    }
+    else
+    {
+        ip_mreq request{};
+        request.imr_multiaddr = subscription.group.ipv4().sin_addr;
+        request.imr_interface = subscription.interface;
+        result = setsockopt(fd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &request, sizeof(request));
+    }
+    if (result == -1)
+    {
+        throw std::runtime_error(std::string(join ? "Failed to join " : "Failed to leave ") + subscription.toString() +
+                                 ": " + strerror(errno));
+    }
+}
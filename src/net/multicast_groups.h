@@ -0,0 +1,119 @@
+/**
+ * @file multicast_groups.h
+ * @brief One receiver for many multicast groups, interfaces and sources
+ *
+ * A feed usually spans many groups, often on more than one NIC. MulticastGroups joins all of
+ * them from one process and gives every group:port its own socket:
+ * - The socket is bound to the group address, not INADDR_ANY, and IP_MULTICAST_ALL is off, so
+ *   the kernel delivers to it only datagrams for that group that arrived through one of its
+ *   own memberships. Which socket is readable then says which group a datagram belongs to, and
+ *   the caller can index a handler table with it instead of looking at each datagram.
+ * - Every subscription adds one membership to its group's socket: IP_ADD_MEMBERSHIP for any
+ *   source (ASM), or IP_ADD_SOURCE_MEMBERSHIP for one source (SSM, 232.0.0.0/8). Subscribing a
+ *   group on two interfaces receives it from both NICs.
+ * - IPv6 groups (ff00::/8) get an AF_INET6 socket and join with IPV6_JOIN_GROUP, or
+ *   MCAST_JOIN_SOURCE_GROUP for one source (SSM, ff3x::/32); IPv6 names the interface by index.
+ * - The sockets are non-blocking, for one epoll or io_uring loop over all of them.
+ *
+ * A subscription is written GROUP:PORT[@INTERFACE][/SOURCE], where INTERFACE is an interface
+ * name or address (any interface if omitted), e.g. 232.1.1.1:5000@eth1/10.0.0.5. An IPv6 group is
+ * written in brackets and its interface by name: [ff35::1]:5000@eth1/fd00::5.
+ *
+ * @note Link-local IPv6 groups (ff02::/16) need an interface, since the same group exists on every link
+ * @note With a HotRestart, a group whose subscriptions match one the previous process handed over
+ *       takes over its socket, memberships and queued datagrams instead of joining again
+ * @note A group socket takes either any-source or single-source memberships; the kernel rejects
+ *       mixing them on one socket.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "net/socket.h"
+#include "net/socket_address.h"
+#include "net/timestamping.h"
+
+class HotRestart;
+
+struct GroupSubscription
+{
+    SocketAddress group; // Group address and port, IPv4 or IPv6
+    in_addr interface{}; // IPv4: INADDR_ANY, the kernel picks the interface by route
+    unsigned interfaceIndex = 0; // IPv6: 0, the kernel picks the interface by route
+    std::string interfaceName; // As given; empty if no interface was given
+    bool sourceSpecific = false;
+    SocketAddress source; // Of the group's family; the port is unused
+
+    // Parse GROUP:PORT[@INTERFACE][/SOURCE]. Throws std::runtime_error naming what is wrong.
+    static GroupSubscription parse(const std::string& text);
+
+    // text as accepted by parse()
+    std::string toString() const;
+};
+
+class MulticastGroups
+{
+public:
+    // Opens one socket per distinct group and port and adds every membership. socketOptions and timestampOptions
+    // are applied to every socket. With restart, each socket is adopted from the previous process if it handed
+    // one over for the same subscriptions, and offered to the next one. Throws std::runtime_error if a socket
+    // cannot be set up or a join fails.
+    MulticastGroups(const std::vector<GroupSubscription>& subscriptions, const SocketOptions& socketOptions,
+                    const TimestampOptions& timestampOptions, HotRestart* restart = nullptr);
+    // Drops every membership, unless keepMemberships() was called
+    ~MulticastGroups();
+
+    MulticastGroups(const MulticastGroups&) = delete;
+    MulticastGroups& operator=(const MulticastGroups&) = delete;
+
+    // Groups are numbered 0..size()-1 in the order their first subscription was given
+    size_t size() const
+    {
+        return m_groups.size();
+    }
+
+    int fd(size_t group) const
+    {
+        return m_groups[group].socket.fd();
+    }
+
+    // "GROUP:PORT" or "[GROUP]:PORT", for messages
+    const std::string& name(size_t group) const
+    {
+        return m_groups[group].name;
+    }
+
+    // The subscriptions joined on the group's socket, in the order given; all for the same group and port
+    const std::vector<GroupSubscription>& memberships(size_t group) const
+    {
+        return m_groups[group].memberships;
+    }
+
+    // The sockets have been handed over: close them without leaving the groups, which would leave them for the
+    // process that took over as well
+    void keepMemberships()
+    {
+        m_keepMemberships = true;
+    }
+
+private:
+    struct Group
+    {
+        Socket socket;
+        SocketAddress address; // Group and port
+        std::string name;
+        std::vector<GroupSubscription> memberships;
+    };
+
+    std::vector<Group> m_groups;
+    bool m_keepMemberships = false;
+
+    static void open(Group& group, const SocketOptions& socketOptions, const TimestampOptions& timestampOptions);
+    static void setMembership(int fd, const GroupSubscription& subscription, bool join);
+};
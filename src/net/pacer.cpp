@@ -0,0 +1,258 @@
+/**
+ * @file pacer.cpp
+ * @brief Rate-limited, timer-driven send scheduling
+ */
+
+#include "net/pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <linux/net_tstamp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static int64_t clockNs(clockid_t clock)
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+static uint64_t parseNumber(const std::string& arg, const std::string& value, uint64_t min, uint64_t max)
+{
+    char* end = nullptr;
+    unsigned long long number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < min || number > max)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    return number;
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : m_rate(rate / 1e9), m_burst(burst), m_tokens(burst), m_lastNs(0)
+{
+}
+
+bool TokenBucket::take(int64_t nowNs, double amount)
+{
+    if (m_lastNs != 0)
+    {
+        m_tokens = std::min(m_burst, m_tokens + (nowNs - m_lastNs) * m_rate);
+    }
+    m_lastNs = nowNs;
+    if (m_tokens < amount)
+    {
+        return false;
+    }
+    m_tokens -= amount;
+    return true;
+}
+
+bool PacingOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--rate" && arg != "--burst" && arg != "--jitter-us" && arg != "--txtime")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--rate")
+    {
+        char* end = nullptr;
+        rate = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !(rate > 0) || rate > 1e9)
+        {
+            throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+        }
+    }
+    else if (arg == "--burst")
+    {
+        burst = static_cast<unsigned>(parseNumber(arg, value, 1, PACER_MAX_BURST));
+    }
+    else if (arg == "--jitter-us")
+    {
+        jitter = std::chrono::microseconds(parseNumber(arg, value, 0, 1000000));
+    }
+    else if (value == "fq" || value == "etf")
+    {
+        txtime = value == "fq" ? TxTimeMode::Fq : TxTimeMode::Etf;
+    }
+    else
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg + ": expected fq or etf");
+    }
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& out, const PacerStats& stats)
+{
+    return out << stats.messages << " messages in " << stats.wakeups << " timer wakeups, late p50/p99/max "
+               << stats.lateness.percentile(50) / 1000 << "/" << stats.lateness.percentile(99) / 1000 << "/"
+               << stats.lateness.max() / 1000 << " us";
+}
+
+Pacer::Pacer(const PacingOptions& options)
+    : m_options(options), m_timerFd(-1), m_intervalNs(0), m_toleranceNs(0), m_allowanceNs(0), m_leadNs(0),
+      m_nextNs(0), m_clockOffsetNs(0)
+{
+    if (m_options.enabled())
+    {
+        m_intervalNs = std::max<int64_t>(1, std::llround(1e9 / m_options.rate));
+        m_toleranceNs = static_cast<int64_t>(std::max(m_options.burst, 1U) - 1) * m_intervalNs;
+        m_leadNs = m_options.txtime != TxTimeMode::Off ? PACER_TXTIME_LEAD_US * 1000LL : 0;
+        m_allowanceNs = std::chrono::nanoseconds(m_options.jitter).count() + m_leadNs;
+    }
+    if (m_options.txtime == TxTimeMode::Etf)
+    {
+        m_clockOffsetNs = clockNs(CLOCK_TAI) - clockNs(CLOCK_MONOTONIC);
+    }
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd == -1)
+    {
+        throw std::runtime_error("Failed to create pacing timer: " + std::string(strerror(errno)));
+    }
+    /*
+    timerfd_create(int clockid, int flags)
+    A timer that is read like a file: readable once it expires, read() returns the number of
+    expirations. Armed with absolute CLOCK_MONOTONIC deadlines, it wakes a poll loop with
+    nanosecond resolution, where a poll() timeout only has milliseconds.
+    */
+}
+
+Pacer::~Pacer()
+{
+    if (m_timerFd != -1)
+    {
+        close(m_timerFd);
+    }
+}
+
+unsigned Pacer::wait(unsigned maxMessages)
+{
+    while (true)
+    {
+        unsigned released = take(maxMessages);
+        if (released > 0)
+        {
+            return released;
+        }
+        pollfd descriptor{m_timerFd, POLLIN, 0};
+        if (poll(&descriptor, 1, -1) == -1 && errno != EINTR)
+        {
+            throw std::runtime_error("Failed to wait for pacing timer: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+unsigned Pacer::take(unsigned maxMessages)
+{
+    m_launchTimes.clear();
+    if (!m_options.enabled())
+    {
+        m_stats.messages += maxMessages;
+        return maxMessages;
+    }
+
+    uint64_t expirations;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+        ++m_stats.wakeups;
+    }
+
+    int64_t now = clockNs(CLOCK_MONOTONIC);
+    if (m_nextNs == 0)
+    {
+        m_nextNs = now;
+    }
+    unsigned released = 0;
+    while (released < maxMessages)
+    {
+        // A schedule further behind than the burst tolerance forgets the slots it missed
+        int64_t slot = std::max(m_nextNs, now - m_toleranceNs);
+        if (slot > now + m_allowanceNs)
+        {
+            break;
+        }
+        m_nextNs = slot + m_intervalNs;
+        ++released;
+
+        int64_t sentAt = now;
+        if (m_leadNs > 0)
+        {
+            // Late messages still need a launch time the qdisc can meet
+            sentAt = std::max(slot, now + m_leadNs);
+            m_launchTimes.push_back(static_cast<uint64_t>(sentAt + m_clockOffsetNs));
+        }
+        m_stats.lateness.record(static_cast<uint64_t>(std::max<int64_t>(0, sentAt - slot)));
+    }
+    m_stats.messages += released;
+
+    // Wake at the next slot (ahead by the lead with SO_TXTIME) and take what the jitter allowance adds then
+    arm(std::max(m_nextNs, now - m_toleranceNs) - m_leadNs);
+    return released;
+}
+
+void Pacer::arm(int64_t atNs)
+{
+    itimerspec deadline{};
+    atNs = std::max<int64_t>(atNs, 1); // A zero it_value would disarm the timer
+    deadline.it_value.tv_sec = atNs / 1000000000LL;
+    deadline.it_value.tv_nsec = atNs % 1000000000LL;
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &deadline, nullptr) == -1)
+    {
+        throw std::runtime_error("Failed to arm pacing timer: " + std::string(strerror(errno)));
+    }
+    /*
+    timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value)
+    TFD_TIMER_ABSTIME: it_value is a time on the timer's clock, not a delay, so the time spent between
+    computing the deadline and arming it does not shift the schedule. A deadline in the past expires
+    at once.
+    */
+}
+
+void Pacer::enableTxTime(int sockFd) const
+{
+    if (m_options.txtime == TxTimeMode::Off)
+    {
+        return;
+    }
+    sock_txtime config{};
+    config.clockid = m_options.txtime == TxTimeMode::Fq ? CLOCK_MONOTONIC : CLOCK_TAI;
+    config.flags = 0;
+    if (setsockopt(sockFd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == -1)
+    {
+        throw std::runtime_error("Failed to enable SO_TXTIME: " + std::string(strerror(errno)));
+    }
+    /*
+    setsockopt(SOL_SOCKET, SO_TXTIME, struct sock_txtime) (Linux 4.19+)
+    Packets sent with an SCM_TXTIME control message carry that launch time in the clock given
+    here. The fq qdisc (CLOCK_MONOTONIC) and the etf qdisc (usually CLOCK_TAI, optionally
+    offloaded to the NIC) hold each packet until then; other qdiscs ignore it.
+    */
+}
+
+void setLaunchTime(msghdr& msg, char* control, uint64_t launchTimeNs)
+{
+    memset(control, 0, TXTIME_CONTROL_SIZE);
+    msg.msg_control = control;
+    msg.msg_controllen = TXTIME_CONTROL_SIZE;
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(launchTimeNs));
+    memcpy(CMSG_DATA(cmsg), &launchTimeNs, sizeof(launchTimeNs));
+}
@@ -0,0 +1,162 @@
+/**
+ * @file pacer.h
+ * @brief Rate-limited, timer-driven send scheduling
+ *
+ * Sending at "N messages per second" with sleep_for() after every message drifts by the send
+ * and wakeup time each round, and retrying in a clock-reading loop burns a core. A Pacer keeps
+ * an absolute schedule instead and sleeps on a timerfd armed with TFD_TIMER_ABSTIME for the next
+ * due message:
+ * - The schedule is a token bucket in its virtual scheduling form (GCRA): message k is due one
+ *   interval after message k - 1, and up to burst messages may go back to back to catch up after
+ *   a late wakeup, so the long-run rate never exceeds the configured one.
+ * - Messages due within the jitter allowance are released by the same wakeup, so a caller can
+ *   hand all of them to one sendmmsg(); each is at most that far ahead of its slot.
+ * - With SO_TXTIME, every message also gets its slot as a launch time (SCM_TXTIME). Messages are
+ *   handed to the kernel a little ahead, and the fq or etf qdisc on the interface holds each one
+ *   until its launch time, so the spacing no longer depends on when this process is scheduled.
+ * - fd() is the timerfd, readable when the next message is due, for callers with a poll loop.
+ *
+ *     PacingOptions options;          // --rate 10000 --jitter-us 50 [--txtime fq]
+ *     Pacer pacer(options);
+ *     pacer.enableTxTime(socket.fd());
+ *     unsigned ready = pacer.wait(64); // Blocks until at least one message may go
+ *
+ * TokenBucket is the admission form of the same idea, for callers that drop what is over budget
+ * instead of delaying it (the retransmission service in retransmit.h).
+ *
+ * @note --txtime fq needs the fq qdisc on the outgoing interface (tc qdisc replace dev eth0 root fq);
+ *       without it the kernel ignores launch times and sends right away
+ * @note --txtime etf needs an etf qdisc (CLOCK_TAI, hardware offload where the NIC has it) and drops
+ *       messages whose launch time has passed by the time they reach it
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "net/latency_histogram.h"
+
+#define PACER_DEFAULT_BURST 16  // Messages that may go back to back to catch up after a late wakeup
+#define PACER_MAX_BURST 65536
+#define PACER_TXTIME_LEAD_US 200 // With SO_TXTIME, messages reach the kernel at least this long before launch
+
+// Control buffer space for one SCM_TXTIME message
+#define TXTIME_CONTROL_SIZE CMSG_SPACE(sizeof(uint64_t))
+
+enum class TxTimeMode
+{
+    Off,
+    Fq, // Launch times on CLOCK_MONOTONIC, enforced by the fq qdisc
+    Etf // Launch times on CLOCK_TAI, enforced by the etf qdisc or the NIC
+};
+
+// Meters a rate in any unit (bytes, messages): tokens accrue at rate per second up to burst, and the bucket
+// starts full
+class TokenBucket
+{
+public:
+    TokenBucket(double rate = 0, double burst = 0);
+
+    // Take amount tokens if the bucket holds them
+    bool take(int64_t nowNs, double amount);
+
+private:
+    double m_rate; // Tokens per nanosecond
+    double m_burst;
+    double m_tokens;
+    int64_t m_lastNs;
+};
+
+struct PacingOptions
+{
+    double rate = 0;                      // Messages per second; 0: as fast as the caller sends
+    unsigned burst = PACER_DEFAULT_BURST;
+    std::chrono::microseconds jitter{0};  // Release messages up to this early so that due ones share a wakeup
+    TxTimeMode txtime = TxTimeMode::Off;
+
+    // Handle --rate MSGS, --burst N, --jitter-us US and --txtime fq|etf at argv[index]. Returns false if the
+    // argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--rate MSGS [--burst N] [--jitter-us US] [--txtime fq|etf]]";
+    }
+
+    bool enabled() const
+    {
+        return rate > 0;
+    }
+};
+
+struct PacerStats
+{
+    uint64_t messages = 0;     // Released, whether or not the caller had one to send
+    uint64_t wakeups = 0;      // Timer expirations the pacer waited for
+    LatencyHistogram lateness; // Nanoseconds each message went (or was launched) after its slot
+};
+
+std::ostream& operator<<(std::ostream& out, const PacerStats& stats);
+
+class Pacer
+{
+public:
+    // Throws std::runtime_error if the timerfd cannot be created
+    explicit Pacer(const PacingOptions& options);
+    ~Pacer();
+
+    Pacer(const Pacer&) = delete;
+    Pacer& operator=(const Pacer&) = delete;
+
+    // Block until at least one message is due and release it, together with the ones due within the jitter
+    // allowance, at most maxMessages. Returns how many were released.
+    unsigned wait(unsigned maxMessages = 1);
+
+    // Release the messages due now without blocking, at most maxMessages, and arm fd() for the next one.
+    // Unpaced options release maxMessages every time.
+    unsigned take(unsigned maxMessages = 1);
+
+    // Readable when the next message is due (after take() or wait())
+    int fd() const
+    {
+        return m_timerFd;
+    }
+
+    // SCM_TXTIME launch time of the index-th message released by the last take() or wait(), on the clock of
+    // options.txtime; 0 without SO_TXTIME
+    uint64_t launchTimeNs(unsigned index) const
+    {
+        return index < m_launchTimes.size() ? m_launchTimes[index] : 0;
+    }
+
+    // Set SO_TXTIME on a socket for the configured mode; does nothing when it is off. Throws std::runtime_error.
+    void enableTxTime(int sockFd) const;
+
+    const PacerStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    PacingOptions m_options;
+    int m_timerFd;
+    int64_t m_intervalNs;
+    int64_t m_toleranceNs;   // How far behind the schedule may be caught up at once: (burst - 1) intervals
+    int64_t m_allowanceNs;   // How early a message may be released: the jitter, plus the lead with SO_TXTIME
+    int64_t m_leadNs;
+    int64_t m_nextNs;        // Slot of the next message on CLOCK_MONOTONIC; 0 before the first
+    int64_t m_clockOffsetNs; // From CLOCK_MONOTONIC to the launch time clock
+    std::vector<uint64_t> m_launchTimes;
+    PacerStats m_stats;
+
+    void arm(int64_t atNs);
+};
+
+// Point msg at control, TXTIME_CONTROL_SIZE bytes, holding launchTimeNs as an SCM_TXTIME message
+void setLaunchTime(msghdr& msg, char* control, uint64_t launchTimeNs);
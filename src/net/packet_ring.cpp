@@ -0,0 +1,318 @@
+/**
+ * @file packet_ring.cpp
+ * @brief UDP receive from a PACKET_MMAP TPACKET_V3 ring, bypassing the kernel UDP stack
+ */
+
+#include "net/packet_ring.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PACKET_RING_FRAME_SIZE 2048 // TPACKET_V3 packs frames by their real size; this only has to divide a block
+
+static uint64_t parseNumber(const std::string& arg, const std::string& value, uint64_t min, uint64_t max)
+{
+    char* end = nullptr;
+    unsigned long long number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < min || number > max)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    return number;
+}
+
+bool PacketRingOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--ring-interface" && arg != "--ring-block-size" && arg != "--ring-blocks" &&
+        arg != "--ring-timeout-ms")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--ring-interface")
+    {
+        interfaceName = value;
+    }
+    else if (arg == "--ring-block-size")
+    {
+        blockSize = parseNumber(arg, value, PACKET_RING_FRAME_SIZE, 1ULL << 30);
+        if (blockSize % static_cast<size_t>(getpagesize()) != 0)
+        {
+            throw std::runtime_error("Invalid value '" + value + "' for " + arg + ": not a multiple of the page size");
+        }
+    }
+    else if (arg == "--ring-blocks")
+    {
+        blockCount = static_cast<unsigned>(parseNumber(arg, value, 1, 65536));
+    }
+    else
+    {
+        blockTimeoutMs = static_cast<unsigned>(parseNumber(arg, value, 1, 1000));
+    }
+    return true;
+}
+
+static uint64_t flowKey(in_addr_t destination, uint16_t port)
+{
+    return static_cast<uint64_t>(destination) << 16 | port;
+}
+
+SocketFilter PacketRing::compileFilter(const std::vector<PacketFlow>& flows)
+{
+    // Offsets are from the start of the Ethernet header; loads convert to host byte order
+    SocketFilter filter;
+    filter.statement(BPF_LD | BPF_H | BPF_ABS, 12); // EtherType
+    filter.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 1, 0);
+    filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    filter.statement(BPF_LD | BPF_B | BPF_ABS, ETH_HLEN + 9); // IP protocol
+    filter.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+    filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    filter.statement(BPF_LD | BPF_H | BPF_ABS, ETH_HLEN + 6); // Flags and fragment offset
+    filter.jump(BPF_JMP | BPF_JSET | BPF_K, IP_MF | IP_OFFMASK, 0, 1);
+    filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    filter.statement(BPF_LDX | BPF_B | BPF_MSH, ETH_HLEN); // X = IP header length
+
+    // One block per flow: destination, port, then the sources if any, ending in an accept. A mismatch skips to
+    // the next block, so no jump is longer than a block.
+    for (const PacketFlow& flow : flows)
+    {
+        size_t sources = flow.sources.size();
+        size_t length = 4 + (sources > 0 ? 1 + sources : 0) + 1;
+        if (length > SOCKET_FILTER_MAX_JUMP)
+        {
+            throw std::runtime_error("Too many sources for one group in the packet filter");
+        }
+        filter.statement(BPF_LD | BPF_W | BPF_ABS, ETH_HLEN + 16); // IP destination
+        filter.jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(flow.destination.s_addr), 0, static_cast<uint8_t>(length - 2));
+        filter.statement(BPF_LD | BPF_H | BPF_IND, ETH_HLEN + 2); // UDP destination port, X bytes into IP
+        filter.jump(BPF_JMP | BPF_JEQ | BPF_K, flow.port, 0, static_cast<uint8_t>(length - 4));
+        if (sources > 0)
+        {
+            filter.statement(BPF_LD | BPF_W | BPF_ABS, ETH_HLEN + 12); // IP source
+            for (size_t i = 0; i < sources; ++i)
+            {
+                size_t position = 5 + i;
+                uint8_t toAccept = static_cast<uint8_t>(length - 2 - position);
+                uint8_t toNext = i + 1 == sources ? static_cast<uint8_t>(length - 1 - position) : 0;
+                filter.jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(flow.sources[i].s_addr), toAccept, toNext);
+            }
+        }
+        filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_ACCEPT);
+    }
+    filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    return filter;
+}
+
+PacketRing::PacketRing(const std::vector<PacketFlow>& flows, const PacketRingOptions& options)
+    : m_fd(-1), m_ring(nullptr), m_blockSize(options.blockSize), m_blockCount(options.blockCount), m_nextBlock(0),
+      m_metrics(trafficMetrics())
+{
+    for (size_t i = 0; i < flows.size(); ++i)
+    {
+        m_flowIndex.emplace(flowKey(flows[i].destination.s_addr, flows[i].port), i);
+    }
+
+    // Protocol 0 receives nothing until bind(), so no frame gets in before the filter and the ring are in place
+    m_fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (m_fd == -1)
+    {
+        throw std::runtime_error("Failed to create packet socket: " + std::string(strerror(errno)));
+    }
+    /*
+    socket(AF_PACKET, SOCK_RAW, protocol)
+    A packet socket sees whole link-layer frames, Ethernet header included (SOCK_DGRAM would strip it), for
+    the EtherType given in network byte order
+    */
+
+    try
+    {
+        compileFilter(flows).attach(m_fd);
+
+        int version = TPACKET_V3;
+        if (setsockopt(m_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+        {
+            throw std::runtime_error("Failed to select TPACKET_V3: " + std::string(strerror(errno)));
+        }
+        if (options.hardwareTimestamps)
+        {
+            int flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+            if (setsockopt(m_fd, SOL_PACKET, PACKET_TIMESTAMP, &flags, sizeof(flags)) == -1)
+            {
+                throw std::runtime_error("Failed to request hardware timestamps: " + std::string(strerror(errno)));
+            }
+        }
+
+        tpacket_req3 request{};
+        request.tp_block_size = static_cast<unsigned>(m_blockSize);
+        request.tp_block_nr = m_blockCount;
+        request.tp_frame_size = PACKET_RING_FRAME_SIZE;
+        request.tp_frame_nr = static_cast<unsigned>(m_blockSize / PACKET_RING_FRAME_SIZE * m_blockCount);
+        request.tp_retire_blk_tov = options.blockTimeoutMs;
+        if (setsockopt(m_fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) == -1)
+        {
+            throw std::runtime_error("Failed to set up the RX ring: " + std::string(strerror(errno)));
+        }
+        /*
+        setsockopt(SOL_PACKET, PACKET_RX_RING, struct tpacket_req3)
+        The kernel allocates tp_block_nr blocks of tp_block_size bytes. With TPACKET_V3 it packs frames by
+        their real length into the current block and retires the block to userspace when it is full or
+        tp_retire_blk_tov milliseconds after its first frame, so one wakeup covers many frames.
+        */
+
+        void* ring = mmap(nullptr, m_blockSize * m_blockCount, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          m_fd, 0);
+        if (ring == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map the RX ring: " + std::string(strerror(errno)));
+        }
+        m_ring = static_cast<char*>(ring);
+
+        sockaddr_ll address{};
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_IP);
+        if (!options.interfaceName.empty())
+        {
+            address.sll_ifindex = static_cast<int>(if_nametoindex(options.interfaceName.c_str()));
+            if (address.sll_ifindex == 0)
+            {
+                throw std::runtime_error("Unknown interface " + options.interfaceName);
+            }
+        }
+        if (bind(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            throw std::runtime_error("Failed to bind packet socket: " + std::string(strerror(errno)));
+        }
+        /*
+        bind(AF_PACKET): sll_protocol starts delivery of that EtherType; sll_ifindex 0 means every interface
+        */
+    }
+    catch (const std::exception&)
+    {
+        if (m_ring != nullptr)
+        {
+            munmap(m_ring, m_blockSize * m_blockCount);
+        }
+        close(m_fd);
+        throw;
+    }
+}
+
+PacketRing::~PacketRing()
+{
+    munmap(m_ring, m_blockSize * m_blockCount);
+    close(m_fd);
+}
+
+size_t PacketRing::receive(const Handler& handler)
+{
+    size_t delivered = 0;
+    while (true)
+    {
+        tpacket_block_desc* block = reinterpret_cast<tpacket_block_desc*>(m_ring + m_nextBlock * m_blockSize);
+        // Acquire: the frames must be read after the status that says they are complete
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        {
+            return delivered;
+        }
+
+        int64_t nowNs = realtimeNs(); // One clock read per block for the receive delay
+        const char* frame = reinterpret_cast<const char*>(block) + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i)
+        {
+            const tpacket3_hdr* header = reinterpret_cast<const tpacket3_hdr*>(frame);
+            PacketTimestamps timestamps;
+            int64_t frameNs = static_cast<int64_t>(header->tp_sec) * 1000000000 + header->tp_nsec;
+            (header->tp_status & TP_STATUS_TS_RAW_HARDWARE ? timestamps.hardwareNs : timestamps.softwareNs) = frameNs;
+            delivered += deliver(frame + header->tp_mac, header->tp_snaplen, timestamps, nowNs, handler);
+            frame += header->tp_next_offset;
+        }
+
+        // Release: the kernel may refill the block only once every frame in it has been handled
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        m_nextBlock = (m_nextBlock + 1) % m_blockCount;
+    }
+}
+
+bool PacketRing::deliver(const char* frame, size_t length, const PacketTimestamps& timestamps, int64_t nowNs,
+                         const Handler& handler)
+{
+    // The filter passed only unfragmented IPv4 UDP, but the frame may still be cut short by the snap length
+    if (length < ETH_HLEN + sizeof(iphdr))
+    {
+        return false;
+    }
+    // The kernel places the frame so that the IP header is aligned
+    const iphdr* ip = reinterpret_cast<const iphdr*>(frame + ETH_HLEN);
+    size_t ipLength = ip->ihl * 4;
+    size_t ipTotal = ntohs(ip->tot_len); // Short frames carry Ethernet padding after it
+    size_t captured = length - ETH_HLEN;
+    if (ip->version != 4 || ipLength < sizeof(iphdr) || ipTotal < ipLength + sizeof(udphdr) ||
+        captured < ipLength + sizeof(udphdr))
+    {
+        return false;
+    }
+
+    const udphdr* udp = reinterpret_cast<const udphdr*>(frame + ETH_HLEN + ipLength);
+    auto flow = m_flowIndex.find(flowKey(ip->daddr, ntohs(udp->dest)));
+    size_t udpLength = ntohs(udp->len);
+    if (flow == m_flowIndex.end() || udpLength < sizeof(udphdr) || udpLength > ipTotal - ipLength)
+    {
+        return false;
+    }
+
+    size_t payloadLength = udpLength - sizeof(udphdr);
+    size_t payloadCaptured = captured - ipLength - sizeof(udphdr);
+    sockaddr_in source{};
+    source.sin_family = AF_INET;
+    source.sin_port = udp->source;
+    source.sin_addr.s_addr = ip->saddr;
+    SocketAddress sender(source);
+    Datagram datagram{reinterpret_cast<const char*>(udp) + sizeof(udphdr), std::min(payloadLength, payloadCaptured),
+                      &sender, payloadCaptured < payloadLength, timestamps};
+
+    m_metrics.countReceived(datagram.length, timestamps.softwareNs, nowNs);
+    if (datagram.truncated)
+    {
+        m_metrics.truncated.add();
+    }
+    handler(flow->second, datagram);
+    return true;
+}
+
+uint64_t PacketRing::takeNewDrops()
+{
+    tpacket_stats_v3 stats{};
+    socklen_t length = sizeof(stats);
+    if (getsockopt(m_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == -1)
+    {
+        return 0;
+    }
+    /*
+    getsockopt(SOL_PACKET, PACKET_STATISTICS): frames passed by the filter (tp_packets, drops included) and
+    dropped for lack of ring space (tp_drops) since the previous call; reading resets both
+    */
+    if (stats.tp_drops != 0)
+    {
+        m_metrics.kernelDrops.add(stats.tp_drops);
+    }
+    return stats.tp_drops;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file packet_ring.h
+ * @brief UDP receive from a PACKET_MMAP TPACKET_V3 ring, bypassing the kernel UDP stack
+ *
+ * Even with recvmmsg, every datagram goes through the IP and UDP receive path, a socket lookup,
+ * its own skb on the socket queue and a copy per datagram. An AF_PACKET socket with a TPACKET_V3
+ * RX ring takes frames from the device layer instead:
+ * - A classic BPF filter built from the flows (IPv4 destination, UDP port and optionally the
+ *   sources) runs on every frame, so only the feed's packets are copied into the ring.
+ * - The ring is shared memory: the kernel fills blocks of many frames and hands a block over
+ *   when it is full or PacketRingOptions::blockTimeoutMs has passed. Reading needs no system call
+ *   while blocks are ready; poll()/epoll report when one is.
+ * - Ethernet, IPv4 and UDP headers are parsed here, and every payload is handed out as the same
+ *   Datagram the socket paths produce, with the kernel (or NIC) receive time of its frame.
+ * - PACKET_STATISTICS counts the frames the kernel had no room for in the ring.
+ *
+ * The multicast memberships still have to come from ordinary UDP sockets (see MulticastGroups): they make the
+ * host send IGMP reports and program the NIC's multicast filter. Attach SocketFilter::dropAll() to them so the
+ * UDP stack does not queue a second copy of every datagram.
+ *
+ * @note Needs CAP_NET_RAW (root)
+ * @note IP fragments and in-band VLAN tags are dropped by the filter; UDP checksums are not verified
+ * @note Ring memory is blockSize * blockCount bytes, locked in RAM by the kernel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "net/datagram_batch.h"
+#include "net/metrics.h"
+#include "net/socket_filter.h"
+
+#define PACKET_RING_BLOCK_SIZE (1 << 20) // Must be a multiple of the page size and hold the largest frame
+#define PACKET_RING_BLOCK_COUNT 64
+#define PACKET_RING_BLOCK_TIMEOUT_MS 1 // A block that is not full yet is handed over after this long
+
+// UDP datagrams to one destination address and port, from any source or from the given ones
+struct PacketFlow
+{
+    in_addr destination{};
+    uint16_t port = 0;            // Host byte order
+    std::vector<in_addr> sources; // Empty: any source
+};
+
+struct PacketRingOptions
+{
+    std::string interfaceName; // Empty: every interface
+    size_t blockSize = PACKET_RING_BLOCK_SIZE;
+    unsigned blockCount = PACKET_RING_BLOCK_COUNT;
+    unsigned blockTimeoutMs = PACKET_RING_BLOCK_TIMEOUT_MS;
+    bool hardwareTimestamps = false; // Ask for NIC receive times (the device must have them switched on)
+
+    // Handle --ring-interface IFACE, --ring-block-size BYTES, --ring-blocks N and --ring-timeout-ms MS at
+    // argv[index]. Returns false if the argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--ring-interface IFACE] [--ring-block-size BYTES] [--ring-blocks N] [--ring-timeout-ms MS]";
+    }
+};
+
+class PacketRing
+{
+public:
+    // Called with the index of the flow in the constructor's list and one of its datagrams
+    using Handler = std::function<void(size_t flow, const Datagram& datagram)>;
+
+    // Opens the packet socket, attaches the filter and maps the ring. Throws std::runtime_error naming the step
+    // that failed.
+    PacketRing(const std::vector<PacketFlow>& flows, const PacketRingOptions& options);
+    ~PacketRing();
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    // Readable (poll/epoll) when a block has been handed over
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    // Hand every datagram of the blocks handed over so far to handler and give the blocks back. Never blocks.
+    // Returns the number of datagrams delivered.
+    size_t receive(const Handler& handler);
+
+    // Frames dropped because the ring was full, since the last call
+    uint64_t takeNewDrops();
+
+    // The filter the constructor attaches: accepts IPv4 UDP frames for one of the flows
+    static SocketFilter compileFilter(const std::vector<PacketFlow>& flows);
+
+private:
+    int m_fd;
+    char* m_ring;
+    size_t m_blockSize;
+    unsigned m_blockCount;
+    unsigned m_nextBlock; // The kernel fills blocks in order, so this is the next one to come back
+    std::unordered_map<uint64_t, size_t> m_flowIndex; // destination << 16 | port -> flow
+    TrafficMetrics& m_metrics;
+
+    // Parse one frame and hand its payload over. Returns false if it is not a datagram of one of the flows.
+    bool deliver(const char* frame, size_t length, const PacketTimestamps& timestamps, int64_t nowNs,
+                 const Handler& handler);
+};
@@ -0,0 +1,214 @@
+/**
+ * @file receive_pipeline.cpp
+ * @brief Receive on one thread, process datagrams on a pool of worker threads
+ */
+
+#include "net/receive_pipeline.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+
+// Idle workers spin first (lowest latency), then yield, then sleep so an idle pipeline costs no CPU
+#define PIPELINE_SPIN_COUNT 64
+#define PIPELINE_YIELD_COUNT 256
+#define PIPELINE_IDLE_SLEEP_US 50
+
+static void backoff(unsigned& attempt)
+{
+    if (attempt < PIPELINE_SPIN_COUNT)
+    {
+        ++attempt;
+    }
+    else if (attempt < PIPELINE_YIELD_COUNT)
+    {
+        ++attempt;
+        std::this_thread::yield();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_IDLE_SLEEP_US));
+    }
+}
+
+std::ostream& operator<<(std::ostream& out, const PipelineStats& stats)
+{
+    return out << "received " << stats.received << ", processed " << stats.processed << ", queue depth "
+               << stats.queueDepth << " (max " << stats.maxQueueDepth << " of " << stats.queueCapacity << "), stalls "
+               << stats.stalls << ", dropped " << stats.dropped << ", kernel drops " << stats.kernelDrops;
+}
+
+ReceivePipeline::ReceivePipeline(int sockFd, const PipelineOptions& options, Handler handler)
+    : m_sockFd(sockFd), m_options(options), m_handler(std::move(handler)),
+      // Every queue slot, one datagram in each handler, and the batch being received
+      m_pool(options.bufferSize,
+             BufferPool::countFor(options.workers * (ringCapacity(options.queueCapacity) + 1) + options.batchSize,
+                                  options.workers + 1)),
+      m_nextWorker(0), m_stopping(false), m_received(0), m_stalls(0), m_dropped(0), m_maxQueueDepth(0),
+      m_kernelDrops(0)
+{
+    if (options.workers == 0 || options.batchSize == 0)
+    {
+        throw std::runtime_error("A receive pipeline needs at least one worker and a batch size of at least one");
+    }
+
+    for (unsigned i = 0; i < options.workers; ++i)
+    {
+        m_workers.push_back(std::make_unique<Worker>(options.queueCapacity));
+    }
+    for (unsigned i = 0; i < options.workers; ++i)
+    {
+        m_workers[i]->thread = std::thread(&ReceivePipeline::work, this, i);
+    }
+}
+
+ReceivePipeline::~ReceivePipeline()
+{
+    stop();
+    for (std::unique_ptr<Worker>& worker : m_workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void ReceivePipeline::run(const std::function<void(const PipelineStats&)>& report)
+{
+    // A filled buffer goes to a worker and its batch entry gets a fresh lease
+    DatagramBatch batch(m_sockFd, m_options.batchSize, m_pool);
+    TrafficMetrics& metrics = trafficMetrics();
+
+    auto lastReport = std::chrono::steady_clock::now();
+    while (!m_stopping.load(std::memory_order_acquire))
+    {
+        int count = batch.receive();
+        if (count == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                continue;
+            }
+            throw std::runtime_error("Failed to receive messages: " + std::string(strerror(errno)));
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            const Datagram& datagram = batch.datagrams()[i];
+            Descriptor descriptor{takeBuffer(batch, i), static_cast<uint32_t>(datagram.length), datagram.truncated,
+                                  *datagram.sender, datagram.timestamps};
+            // A dropped datagram's buffer goes straight back to the pool
+            dispatch(descriptor);
+        }
+        m_received.store(m_received.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        m_kernelDrops.store(batch.droppedPackets(), std::memory_order_relaxed);
+        size_t depth = 0;
+        for (const std::unique_ptr<Worker>& worker : m_workers)
+        {
+            depth += worker->queue.size();
+        }
+        metrics.queueDepth.set(static_cast<int64_t>(depth));
+
+        auto now = std::chrono::steady_clock::now();
+        if (report && now - lastReport >= std::chrono::seconds(1))
+        {
+            report(stats());
+            lastReport = now;
+        }
+    }
+}
+
+PipelineStats ReceivePipeline::stats() const
+{
+    PipelineStats stats;
+    stats.received = m_received.load(std::memory_order_relaxed);
+    stats.stalls = m_stalls.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.maxQueueDepth = m_maxQueueDepth.load(std::memory_order_relaxed);
+    stats.kernelDrops = m_kernelDrops.load(std::memory_order_relaxed);
+    for (const std::unique_ptr<Worker>& worker : m_workers)
+    {
+        stats.processed += worker->processed.load(std::memory_order_relaxed);
+        stats.queueDepth += worker->queue.size();
+        stats.queueCapacity = worker->queue.capacity();
+    }
+    return stats;
+}
+
+PacketBuffer ReceivePipeline::takeBuffer(DatagramBatch& batch, unsigned index)
+{
+    // The pool is sized so this only waits for a worker that is about to give a buffer back
+    PacketBuffer buffer;
+    unsigned attempt = 0;
+    while (!(buffer = batch.take(index)))
+    {
+        backoff(attempt);
+    }
+    return buffer;
+}
+
+bool ReceivePipeline::dispatch(Descriptor& descriptor)
+{
+    bool stalled = false;
+    unsigned attempt = 0;
+    while (true)
+    {
+        for (size_t tried = 0; tried < m_workers.size(); ++tried)
+        {
+            Worker& worker = *m_workers[m_nextWorker];
+            m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+            if (worker.queue.push(std::move(descriptor)))
+            {
+                size_t depth = worker.queue.size();
+                if (depth > m_maxQueueDepth.load(std::memory_order_relaxed))
+                {
+                    m_maxQueueDepth.store(depth, std::memory_order_relaxed);
+                }
+                return true;
+            }
+        }
+
+        // Every queue is full
+        if (!stalled)
+        {
+            stalled = true;
+            m_stalls.store(m_stalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        if (m_options.backpressure == Backpressure::Drop)
+        {
+            m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            trafficMetrics().backpressure.add();
+            descriptor.buffer.reset();
+            return false;
+        }
+        backoff(attempt);
+    }
+}
+
+void ReceivePipeline::work(unsigned index)
+{
+    Worker& worker = *m_workers[index];
+    Descriptor descriptor;
+    unsigned attempt = 0;
+    while (true)
+    {
+        if (!worker.queue.pop(descriptor))
+        {
+            // Stop only once the queue is empty, so every received datagram is handled
+            if (m_stopping.load(std::memory_order_acquire) && worker.queue.size() == 0)
+            {
+                return;
+            }
+            backoff(attempt);
+            continue;
+        }
+        attempt = 0;
+
+        Datagram datagram{descriptor.buffer.data(), descriptor.length, &descriptor.sender, descriptor.truncated,
+                          descriptor.timestamps};
+        m_handler(index, datagram);
+        descriptor.buffer.reset(); // Into this worker's free list, back to the shared stack when that is full
+        worker.processed.store(worker.processed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ * @file receive_pipeline.h
+ * @brief Receive on one thread, process datagrams on a pool of worker threads
+ *
+ * When the thread that calls recvmmsg also runs the handler, a slow handler leaves the socket
+ * unread and the kernel drops packets once the receive buffer is full. ReceivePipeline splits
+ * the two. The I/O thread only receives, straight into buffers leased from a BufferPool
+ * (DatagramBatch::take, no copy), and pushes a small descriptor per datagram onto the worker
+ * queues. Workers run the handler and release the buffer, which goes back to the pool through
+ * the worker's own free list:
+ *
+ *     I/O thread --SpscRing<Descriptor> per worker--> workers --BufferPool--> I/O thread
+ *
+ * Descriptors are spread round-robin, so with more than one worker datagrams from the same
+ * sender may be handled out of order. When every queue is full the I/O thread either waits for
+ * a worker (Backpressure::Block, the kernel queue absorbs the burst) or discards the datagram
+ * (Backpressure::Drop). Both cases are counted in PipelineStats next to the queue depth.
+ *
+ * The pool holds enough buffers for every queue slot, every datagram being handled, one
+ * receive batch and a full free list per thread, so the I/O thread never waits for a buffer.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "net/buffer_pool.h"
+#include "net/datagram_batch.h"
+#include "net/lockfree_ring.h"
+
+enum class Backpressure
+{
+    Block, // Wait until a worker has room
+    Drop   // Discard the datagram
+};
+
+struct PipelineOptions
+{
+    unsigned workers = 2;
+    size_t queueCapacity = 1024; // Descriptors per worker queue, rounded up to a power of two
+    unsigned batchSize = 64;     // Datagrams per recvmmsg call
+    size_t bufferSize = 1024;    // Bytes per pooled buffer; longer datagrams are truncated
+    Backpressure backpressure = Backpressure::Block;
+};
+
+struct PipelineStats
+{
+    uint64_t received = 0;    // Datagrams read from the socket
+    uint64_t processed = 0;   // Datagrams whose handler has returned
+    uint64_t stalls = 0;      // Datagrams that found every queue full (waited or dropped)
+    uint64_t dropped = 0;     // Datagrams discarded with Backpressure::Drop
+    size_t queueDepth = 0;    // Descriptors queued now, all workers together
+    size_t maxQueueDepth = 0; // Deepest any single worker queue has been
+    size_t queueCapacity = 0; // Per worker queue
+    uint32_t kernelDrops = 0; // SO_RXQ_OVFL, if the drop counter is enabled on the socket
+};
+
+// One line: "received N, processed N, queue depth D (max M of C), stalls S, dropped D, kernel drops K"
+std::ostream& operator<<(std::ostream& out, const PipelineStats& stats);
+
+class ReceivePipeline
+{
+public:
+    // Runs on a worker thread and must not throw. The datagram's buffer is reused once it returns.
+    using Handler = std::function<void(unsigned worker, const Datagram& datagram)>;
+
+    // Starts the workers
+    ReceivePipeline(int sockFd, const PipelineOptions& options, Handler handler);
+    // Asks run() to stop, then joins the workers once they have drained their queues
+    ~ReceivePipeline();
+
+    ReceivePipeline(const ReceivePipeline&) = delete;
+    ReceivePipeline& operator=(const ReceivePipeline&) = delete;
+
+    // Receive on the calling thread until stop(). report is called on this thread about once per second
+    // while datagrams arrive. Throws std::runtime_error if the socket fails.
+    void run(const std::function<void(const PipelineStats&)>& report = nullptr);
+
+    // Make run() return after its current receive (any thread)
+    void stop()
+    {
+        m_stopping.store(true, std::memory_order_release);
+    }
+
+    PipelineStats stats() const;
+
+private:
+    struct Descriptor
+    {
+        PacketBuffer buffer;
+        uint32_t length;
+        bool truncated;
+        SocketAddress sender;
+        PacketTimestamps timestamps;
+    };
+
+    struct Worker
+    {
+        explicit Worker(size_t capacity) : queue(capacity), processed(0)
+        {
+        }
+
+        SpscRing<Descriptor> queue;
+        alignas(LOCKFREE_CACHE_LINE) std::atomic<uint64_t> processed;
+        std::thread thread;
+    };
+
+    int m_sockFd;
+    PipelineOptions m_options;
+    Handler m_handler;
+    BufferPool m_pool;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    size_t m_nextWorker;
+    std::atomic<bool> m_stopping;
+
+    // Written by the I/O thread only; atomic so stats() can be read from any thread
+    std::atomic<uint64_t> m_received;
+    std::atomic<uint64_t> m_stalls;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<size_t> m_maxQueueDepth;
+    std::atomic<uint32_t> m_kernelDrops;
+
+    PacketBuffer takeBuffer(DatagramBatch& batch, unsigned index);
+    bool dispatch(Descriptor& descriptor);
+    void work(unsigned index);
+};
@@ -0,0 +1,428 @@
+/**
+ * @file retransmit.cpp
+ * @brief NACK-based recovery of lost multicast messages
+ */
+
+#include "net/retransmit.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+#include "net/timestamping.h"
+
+static uint64_t parseNumber(const std::string& arg, const std::string& value, uint64_t min, uint64_t max)
+{
+    char* end = nullptr;
+    unsigned long long number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < min || number > max)
+    {
+        throw std::runtime_error("Invalid value '" + value + "' for " + arg);
+    }
+    return number;
+}
+
+size_t encodeNack(const Nack& nack, char* out)
+{
+    uint16_t magic = htons(NACK_MAGIC);
+    uint32_t stream = htonl(nack.stream);
+    memcpy(out, &magic, sizeof(magic));
+    out[2] = NACK_VERSION;
+    out[3] = static_cast<char>(nack.rangeCount);
+    memcpy(out + 4, &stream, sizeof(stream));
+    char* range = out + NACK_HEADER_SIZE;
+    for (size_t i = 0; i < nack.rangeCount; ++i, range += NACK_RANGE_SIZE)
+    {
+        uint64_t first = htobe64(nack.ranges[i].first);
+        uint32_t count = htonl(nack.ranges[i].count);
+        memcpy(range, &first, sizeof(first));
+        memcpy(range + 8, &count, sizeof(count));
+    }
+    return NACK_HEADER_SIZE + nack.rangeCount * NACK_RANGE_SIZE;
+}
+
+bool decodeNack(const char* data, size_t length, Nack& nack)
+{
+    uint16_t magic;
+    if (length < NACK_HEADER_SIZE || (memcpy(&magic, data, sizeof(magic)), ntohs(magic)) != NACK_MAGIC ||
+        static_cast<uint8_t>(data[2]) != NACK_VERSION)
+    {
+        return false;
+    }
+    nack.rangeCount = static_cast<uint8_t>(data[3]);
+    if (nack.rangeCount > NACK_MAX_RANGES || length < NACK_HEADER_SIZE + nack.rangeCount * NACK_RANGE_SIZE)
+    {
+        return false;
+    }
+    uint32_t stream;
+    memcpy(&stream, data + 4, sizeof(stream));
+    nack.stream = ntohl(stream);
+    const char* range = data + NACK_HEADER_SIZE;
+    for (size_t i = 0; i < nack.rangeCount; ++i, range += NACK_RANGE_SIZE)
+    {
+        uint64_t first;
+        uint32_t count;
+        memcpy(&first, range, sizeof(first));
+        memcpy(&count, range + 8, sizeof(count));
+        nack.ranges[i].first = be64toh(first);
+        nack.ranges[i].count = ntohl(count);
+    }
+    return true;
+}
+
+RetransmitRing::RetransmitRing(size_t messages, size_t bytes) : m_data(bytes), m_head(0), m_oldest(0), m_next(0)
+{
+    size_t entries = 1;
+    while (entries < messages)
+    {
+        entries <<= 1;
+    }
+    m_entries.resize(entries);
+    m_mask = entries - 1;
+}
+
+void RetransmitRing::store(uint64_t sequence, const char* data, size_t length)
+{
+    if (sequence != m_next || length > m_data.size())
+    {
+        m_oldest = m_next = sequence;
+    }
+    if (length > m_data.size())
+    {
+        m_oldest = m_next = sequence + 1;
+        return;
+    }
+
+    // A datagram is never split across the end of the buffer: skip the rest of it instead
+    uint64_t position = m_head;
+    size_t offset = position % m_data.size();
+    if (offset + length > m_data.size())
+    {
+        position += m_data.size() - offset;
+        offset = 0;
+    }
+    uint64_t end = position + length;
+
+    // Drop the oldest datagrams while the entry table is full or their bytes are about to be overwritten
+    while (m_oldest < m_next && (m_next - m_oldest >= m_entries.size() ||
+                                 m_entries[m_oldest & m_mask].position + m_data.size() < end))
+    {
+        ++m_oldest;
+    }
+
+    memcpy(m_data.data() + offset, data, length);
+    Entry& entry = m_entries[sequence & m_mask];
+    entry.sequence = sequence;
+    entry.position = position;
+    entry.length = static_cast<uint32_t>(length);
+    m_head = end;
+    m_next = sequence + 1;
+}
+
+std::string_view RetransmitRing::find(uint64_t sequence) const
+{
+    if (sequence < m_oldest || sequence >= m_next)
+    {
+        return std::string_view();
+    }
+    const Entry& entry = m_entries[sequence & m_mask];
+    return std::string_view(m_data.data() + entry.position % m_data.size(), entry.length);
+}
+
+bool RetransmitOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--retransmit" && arg != "--retransmit-bytes" && arg != "--retransmit-rate" &&
+        arg != "--receiver-rate")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--retransmit")
+    {
+        messages = parseNumber(arg, value, 1, 1 << 24);
+    }
+    else if (arg == "--retransmit-bytes")
+    {
+        bytes = parseNumber(arg, value, 65536, 1ULL << 34);
+    }
+    else if (arg == "--retransmit-rate")
+    {
+        rate = parseNumber(arg, value, 1, 1ULL << 40);
+    }
+    else
+    {
+        receiverRate = parseNumber(arg, value, 1, 1ULL << 40);
+    }
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& out, const RetransmitStats& stats)
+{
+    return out << stats.nacks << " NACKs (" << stats.malformed << " malformed), " << stats.requested << " requested, "
+               << stats.retransmitted << " retransmitted (" << stats.bytes << " bytes, " << stats.systemCalls
+               << " calls), " << stats.unavailable << " unavailable, " << stats.limited << " rate limited";
+}
+
+// Replies in bytes per second
+static TokenBucket replyBucket(uint64_t rate)
+{
+    return TokenBucket(static_cast<double>(rate),
+                       std::max<double>(rate / RETRANSMIT_BURST_DIVISOR, RETRANSMIT_MIN_BURST));
+}
+
+RetransmitService::RetransmitService(int fd, uint32_t stream, const RetransmitOptions& options)
+    : m_fd(fd), m_stream(stream), m_options(options), m_ring(options.messages, options.bytes),
+      m_total(replyBucket(options.rate)), m_headers(RETRANSMIT_BATCH), m_iovecs(RETRANSMIT_BATCH),
+      m_addresses(RETRANSMIT_BATCH), m_queued(0)
+{
+    m_receivers.reserve(RETRANSMIT_MAX_RECEIVERS);
+}
+
+void RetransmitService::serve()
+{
+    char buffer[NACK_HEADER_SIZE + NACK_MAX_RANGES * NACK_RANGE_SIZE];
+    while (true)
+    {
+        SocketAddress requester;
+        socklen_t requesterLength = SocketAddress::capacity();
+        ssize_t length = recvfrom(m_fd, buffer, sizeof(buffer), MSG_DONTWAIT, requester.data(), &requesterLength);
+        /*
+        recvfrom(..., MSG_DONTWAIT, ...)
+        Non-blocking for this call only, so the publishing socket itself can stay blocking
+        return -1 with EAGAIN once no NACK is queued
+        */
+        if (length == -1)
+        {
+            break;
+        }
+
+        Nack nack;
+        if (!decodeNack(buffer, static_cast<size_t>(length), nack) || nack.stream != m_stream)
+        {
+            ++m_stats.malformed;
+            continue;
+        }
+        ++m_stats.nacks;
+        answer(nack, requester, realtimeNs());
+    }
+    flush();
+}
+
+RetransmitService::Receiver& RetransmitService::receiver(const SocketAddress& address, int64_t nowNs)
+{
+    Receiver* leastRecent = nullptr;
+    for (Receiver& receiver : m_receivers)
+    {
+        if (receiver.address == address)
+        {
+            receiver.lastSeenNs = nowNs;
+            return receiver;
+        }
+        if (leastRecent == nullptr || receiver.lastSeenNs < leastRecent->lastSeenNs)
+        {
+            leastRecent = &receiver;
+        }
+    }
+    if (m_receivers.size() < RETRANSMIT_MAX_RECEIVERS)
+    {
+        m_receivers.emplace_back();
+        leastRecent = &m_receivers.back();
+    }
+    *leastRecent = Receiver{address, replyBucket(m_options.receiverRate), nowNs};
+    return *leastRecent;
+}
+
+void RetransmitService::answer(const Nack& nack, const SocketAddress& requester, int64_t nowNs)
+{
+    Receiver& from = receiver(requester, nowNs);
+    for (size_t i = 0; i < nack.rangeCount; ++i)
+    {
+        const NackRange& range = nack.ranges[i];
+        m_stats.requested += range.count;
+        // Nothing before oldest() is held, so a huge range costs no more than the ring is long
+        uint64_t first = std::max(range.first, m_ring.oldest());
+        uint64_t end = std::min(range.first + range.count, m_ring.next());
+        m_stats.unavailable += range.count - (end > first ? end - first : 0);
+        for (uint64_t sequence = first; sequence < end; ++sequence)
+        {
+            std::string_view datagram = m_ring.find(sequence);
+            if (!from.bucket.take(nowNs, datagram.size()) || !m_total.take(nowNs, datagram.size()))
+            {
+                // Over budget: the rest of this NACK waits for the receiver to ask again
+                m_stats.limited += end - sequence;
+                for (size_t j = i + 1; j < nack.rangeCount; ++j)
+                {
+                    m_stats.limited += nack.ranges[j].count;
+                    m_stats.requested += nack.ranges[j].count;
+                }
+                return;
+            }
+
+            // The ring is not written while serving, so the batch points straight into it
+            m_addresses[m_queued] = requester;
+            m_iovecs[m_queued] = iovec{const_cast<char*>(datagram.data()), datagram.size()};
+            msghdr& msg = m_headers[m_queued].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = m_addresses[m_queued].data();
+            msg.msg_namelen = requester.size();
+            msg.msg_iov = &m_iovecs[m_queued];
+            msg.msg_iovlen = 1;
+            ++m_stats.retransmitted;
+            m_stats.bytes += datagram.size();
+            if (++m_queued == RETRANSMIT_BATCH)
+            {
+                flush();
+            }
+        }
+    }
+}
+
+void RetransmitService::flush()
+{
+    size_t sent = 0;
+    while (sent < m_queued)
+    {
+        int count = sendmmsg(m_fd, m_headers.data() + sent, m_queued - sent, 0);
+        /*
+        sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+        Every message carries its own destination in msg_name, so one call answers several receivers
+        return number of messages sent, which may be fewer than vlen
+        */
+        ++m_stats.systemCalls;
+        if (count <= 0)
+        {
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            // Not retried: the receiver will ask again
+            m_stats.retransmitted -= m_queued - sent;
+            break;
+        }
+        sent += count;
+    }
+    m_queued = 0;
+}
+
+bool NackOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg == "--nack")
+    {
+        enabled = true;
+        return true;
+    }
+    if (arg != "--nack-delay-us" && arg != "--nack-interval-us")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    std::chrono::microseconds micros(parseNumber(arg, value, arg == "--nack-delay-us" ? 0 : 1, 10000000));
+    (arg == "--nack-delay-us" ? delay : interval) = micros;
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& out, const NackStats& stats)
+{
+    return out << stats.nacks << " NACKs sent for " << stats.messages << " messages in " << stats.ranges
+               << " ranges, " << stats.errors << " errors";
+}
+
+// IPv6 with IPV6_V6ONLY off reaches IPv4 publishers through their IPv4-mapped address too
+static Socket openNackSocket()
+{
+    try
+    {
+        Socket socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC);
+        socket.apply(SocketOptions().v6Only(false));
+        return socket;
+    }
+    catch (const std::runtime_error&)
+    {
+        return Socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC); // IPv6 is disabled on this host
+    }
+}
+
+NackRequester::NackRequester(const NackOptions& options, unsigned maxStreams)
+    : m_socket(openNackSocket()), m_delayNs(std::chrono::nanoseconds(options.delay).count()),
+      m_intervalNs(std::chrono::nanoseconds(options.interval).count()), m_maxStreams(maxStreams)
+{
+    socklen_t length = sizeof(m_family);
+    getsockopt(m_socket.fd(), SOL_SOCKET, SO_DOMAIN, &m_family, &length);
+    m_streams.reserve(maxStreams);
+}
+
+NackRequester::Stream* NackRequester::find(uint32_t stream)
+{
+    for (Stream& entry : m_streams)
+    {
+        if (entry.stream == stream)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void NackRequester::observe(uint32_t stream, const SocketAddress& publisher)
+{
+    SocketAddress destination = m_family == AF_INET6 ? publisher.mapped() : publisher;
+    Stream* entry = find(stream);
+    if (entry == nullptr)
+    {
+        if (m_streams.size() == m_maxStreams)
+        {
+            return;
+        }
+        m_streams.push_back(Stream{stream, destination, 0});
+        return;
+    }
+    entry->publisher = destination;
+}
+
+void NackRequester::poll(int64_t nowNs, SequencerTable& sequencers)
+{
+    sequencers.forEach([&](const Sequencer& sequencer) {
+        Stream* entry = find(sequencer.stream());
+        if (entry == nullptr || !sequencer.hasHole() || nowNs - sequencer.holeSinceNs() < m_delayNs ||
+            nowNs - entry->lastNackNs < m_intervalNs)
+        {
+            return;
+        }
+
+        Nack nack;
+        nack.stream = sequencer.stream();
+        sequencer.forEachHole(NACK_MAX_RANGES, [&](uint64_t first, uint64_t count) {
+            NackRange& range = nack.ranges[nack.rangeCount++];
+            range.first = first;
+            range.count = static_cast<uint32_t>(std::min<uint64_t>(count, UINT32_MAX));
+            m_stats.messages += range.count;
+        });
+        char buffer[NACK_HEADER_SIZE + NACK_MAX_RANGES * NACK_RANGE_SIZE];
+        size_t length = encodeNack(nack, buffer);
+        entry->lastNackNs = nowNs;
+        if (sendto(m_socket.fd(), buffer, length, 0, entry->publisher.data(), entry->publisher.size()) == -1)
+        {
+            ++m_stats.errors;
+            return;
+        }
+        ++m_stats.nacks;
+        m_stats.ranges += nack.rangeCount;
+    });
+}
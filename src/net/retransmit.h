@@ -0,0 +1,264 @@
+/**
+ * @file retransmit.h
+ * @brief NACK-based recovery of lost multicast messages
+ *
+ * A receiver that finds a hole in a sequenced stream (see sequencer.h) asks the publisher for
+ * the missing messages over unicast instead of waiting for the hole to time out:
+ * - The publisher keeps the last datagrams it sent, header included, in a RetransmitRing that
+ *   is bounded both in messages and in bytes
+ * - NackRequester, on the receiver, sends a NACK listing the missing sequence ranges to the
+ *   address the stream arrives from, which is the publisher's own bound socket. It waits
+ *   nackDelay after a hole opens, since reordering often fills it anyway, and repeats at
+ *   most every nackInterval while the hole stays open. Its socket is dual-stack where the host
+ *   has IPv6, so one socket reaches IPv4 and IPv6 publishers
+ * - RetransmitService, on the publisher, reads the NACKs from that socket and sends the
+ *   requested datagrams back to the requester unchanged, many per sendmmsg() call. Replies
+ *   are metered by a token bucket per receiver and one for all of them together, so a single
+ *   lossy receiver cannot take over the publisher; what is over budget is dropped and asked
+ *   for again by the next NACK.
+ *
+ * Wire format of a NACK, network byte order:
+ *
+ *     magic u16 | version u8 | range count u8 | stream id u32 | (first sequence u64 | count u32) * range count
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/pacer.h"
+#include "net/sequencer.h"
+#include "net/socket.h"
+#include "net/socket_address.h"
+
+#define NACK_MAGIC 0x4E4B // "NK"
+#define NACK_VERSION 1
+#define NACK_HEADER_SIZE 8
+#define NACK_RANGE_SIZE 12
+#define NACK_MAX_RANGES 32
+#define RETRANSMIT_BATCH 64          // Datagrams per sendmmsg() call
+#define RETRANSMIT_MAX_RECEIVERS 64  // Receivers with their own token bucket; the least recent one is replaced
+#define RETRANSMIT_BURST_DIVISOR 10  // A bucket holds a tenth of a second at its rate
+#define RETRANSMIT_MIN_BURST 65536   // ...but always at least one datagram of any size
+
+struct NackRange
+{
+    uint64_t first = 0;
+    uint32_t count = 0;
+};
+
+struct Nack
+{
+    uint32_t stream = 0;
+    size_t rangeCount = 0;
+    NackRange ranges[NACK_MAX_RANGES];
+};
+
+// Write nack into out (at least NACK_HEADER_SIZE + NACK_MAX_RANGES * NACK_RANGE_SIZE bytes). Returns its length.
+size_t encodeNack(const Nack& nack, char* out);
+
+// Returns false if data is not a complete NACK of a known version
+bool decodeNack(const char* data, size_t length, Nack& nack);
+
+// The last datagrams of one stream, by sequence number. Storage is allocated once.
+class RetransmitRing
+{
+public:
+    // Holds at most messages datagrams and bytes bytes; the oldest ones are dropped to make room
+    RetransmitRing(size_t messages, size_t bytes);
+
+    // Keep a copy of the datagram with this sequence number. Sequence numbers are expected to be consecutive;
+    // any other one (a restart) empties the ring first.
+    void store(uint64_t sequence, const char* data, size_t length);
+
+    // The stored datagram, or an empty view if it is not held (any more)
+    std::string_view find(uint64_t sequence) const;
+
+    // Held sequence numbers are oldest() .. next() - 1
+    uint64_t oldest() const
+    {
+        return m_oldest;
+    }
+
+    uint64_t next() const
+    {
+        return m_next;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t sequence = 0;
+        uint64_t position = 0; // Running byte position; the offset in m_data is position % m_data.size()
+        uint32_t length = 0;
+    };
+
+    std::vector<Entry> m_entries;
+    std::vector<char> m_data;
+    uint64_t m_mask;
+    uint64_t m_head; // Running byte position of the next datagram
+    uint64_t m_oldest;
+    uint64_t m_next;
+};
+
+struct RetransmitOptions
+{
+    size_t messages = 0;          // 0: no retransmission
+    size_t bytes = 4 * 1024 * 1024;
+    uint64_t rate = 10000000;        // Bytes per second for all receivers together
+    uint64_t receiverRate = 2000000; // Bytes per second for any one receiver
+
+    bool enabled() const
+    {
+        return messages > 0;
+    }
+
+    // Handle --retransmit MESSAGES, --retransmit-bytes BYTES, --retransmit-rate BYTES_PER_S and
+    // --receiver-rate BYTES_PER_S at argv[index]. Returns false if the argument is not one of them;
+    // throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--retransmit MESSAGES [--retransmit-bytes BYTES] [--retransmit-rate BYTES_PER_S]"
+               " [--receiver-rate BYTES_PER_S]]";
+    }
+};
+
+struct RetransmitStats
+{
+    uint64_t nacks = 0;         // NACKs received
+    uint64_t malformed = 0;     // Datagrams on the socket that were not a NACK for this stream
+    uint64_t requested = 0;     // Messages asked for
+    uint64_t retransmitted = 0; // Messages sent again
+    uint64_t bytes = 0;
+    uint64_t unavailable = 0;   // Asked for but no longer (or never) held
+    uint64_t limited = 0;       // Asked for but over a rate limit
+    uint64_t systemCalls = 0;
+};
+
+// One line: "N NACKs (M malformed), R requested, T retransmitted (B bytes, C calls), U unavailable, L rate limited"
+std::ostream& operator<<(std::ostream& out, const RetransmitStats& stats);
+
+class RetransmitService
+{
+public:
+    // Answers NACKs for stream that arrive on fd, the socket the stream is published from, from the same socket
+    RetransmitService(int fd, uint32_t stream, const RetransmitOptions& options);
+
+    void store(uint64_t sequence, const char* data, size_t length)
+    {
+        m_ring.store(sequence, data, length);
+    }
+
+    // Read every NACK queued on the socket without blocking and send what they ask for, within the rate limits
+    void serve();
+
+    const RetransmitStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Receiver
+    {
+        SocketAddress address;
+        TokenBucket bucket;
+        int64_t lastSeenNs = 0;
+    };
+
+    int m_fd;
+    uint32_t m_stream;
+    RetransmitOptions m_options;
+    RetransmitRing m_ring;
+    TokenBucket m_total;
+    std::vector<Receiver> m_receivers; // At most RETRANSMIT_MAX_RECEIVERS
+    std::vector<mmsghdr> m_headers;    // Preallocated sendmmsg batch
+    std::vector<iovec> m_iovecs;
+    std::vector<SocketAddress> m_addresses;
+    size_t m_queued;
+    RetransmitStats m_stats;
+
+    Receiver& receiver(const SocketAddress& address, int64_t nowNs);
+    void answer(const Nack& nack, const SocketAddress& requester, int64_t nowNs);
+    void flush();
+};
+
+struct NackOptions
+{
+    bool enabled = false;
+    std::chrono::microseconds delay{200};     // How long a hole may stay open before the first NACK
+    std::chrono::microseconds interval{2000}; // Least time between NACKs of one stream
+
+    // Handle --nack, --nack-delay-us U and --nack-interval-us U at argv[index]. Returns false if the argument is
+    // not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--nack [--nack-delay-us U] [--nack-interval-us U]]";
+    }
+};
+
+struct NackStats
+{
+    uint64_t nacks = 0;
+    uint64_t ranges = 0;
+    uint64_t messages = 0; // Messages asked for
+    uint64_t errors = 0;   // NACKs that could not be sent
+};
+
+// One line: "N NACKs sent for M messages in R ranges, E errors"
+std::ostream& operator<<(std::ostream& out, const NackStats& stats);
+
+class NackRequester
+{
+public:
+    // Opens a non-blocking unicast socket, IPv6 with IPv4-mapped addresses or IPv4 only if the host has no IPv6;
+    // retransmitted datagrams arrive on it too (see fd())
+    NackRequester(const NackOptions& options, unsigned maxStreams);
+
+    // Readable when retransmitted datagrams arrive; feed those to the same SequencerTable
+    int fd() const
+    {
+        return m_socket.fd();
+    }
+
+    // Remember where the stream is published from, which is where its NACKs go
+    void observe(uint32_t stream, const SocketAddress& publisher);
+
+    // Send a NACK for every sequencer whose hole has been open for the delay and was not asked for within the
+    // interval. Call this often, e.g. from the receive loop's tick.
+    void poll(int64_t nowNs, SequencerTable& sequencers);
+
+    const NackStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Stream
+    {
+        uint32_t stream;
+        SocketAddress publisher; // In the socket's family
+        int64_t lastNackNs;
+    };
+
+    Socket m_socket;
+    int m_family; // Of m_socket
+    int64_t m_delayNs;
+    int64_t m_intervalNs;
+    std::vector<Stream> m_streams; // Capacity reserved up front
+    size_t m_maxStreams;
+    NackStats m_stats;
+
+    Stream* find(uint32_t stream);
+};
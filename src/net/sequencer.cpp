@@ -0,0 +1,137 @@
+/**
+ * @file sequencer.cpp
+ * @brief Sequence header, gap detection and A/B feed arbitration for datagram streams
+ */
+
+#include "net/sequencer.h"
+
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <endian.h>
+
+void encodeSequenceHeader(const SequenceHeader& header, char* out)
+{
+    uint16_t magic = htons(SEQUENCE_MAGIC);
+    uint32_t stream = htonl(header.stream);
+    uint64_t sequence = htobe64(header.sequence);
+    uint64_t sendTime = htobe64(static_cast<uint64_t>(header.sendTimeNs));
+    memcpy(out, &magic, sizeof(magic));
+    out[2] = SEQUENCE_VERSION;
+    out[3] = static_cast<char>(header.flags);
+    memcpy(out + 4, &stream, sizeof(stream));
+    memcpy(out + 8, &sequence, sizeof(sequence));
+    memcpy(out + 16, &sendTime, sizeof(sendTime));
+}
+
+bool decodeSequenceHeader(const char* data, size_t length, SequenceHeader& header)
+{
+    uint16_t magic;
+    if (length < SEQUENCE_HEADER_SIZE || (memcpy(&magic, data, sizeof(magic)), ntohs(magic)) != SEQUENCE_MAGIC ||
+        static_cast<uint8_t>(data[2]) != SEQUENCE_VERSION)
+    {
+        return false;
+    }
+    uint32_t stream;
+    uint64_t sequence;
+    uint64_t sendTime;
+    memcpy(&stream, data + 4, sizeof(stream));
+    memcpy(&sequence, data + 8, sizeof(sequence));
+    memcpy(&sendTime, data + 16, sizeof(sendTime));
+    header.flags = static_cast<uint8_t>(data[3]);
+    header.stream = ntohl(stream);
+    header.sequence = be64toh(sequence);
+    header.sendTimeNs = static_cast<int64_t>(be64toh(sendTime));
+    return true;
+}
+
+void SequencerStats::merge(const SequencerStats& other)
+{
+    received += other.received;
+    delivered += other.delivered;
+    reordered += other.reordered;
+    duplicates += other.duplicates;
+    late += other.late;
+    gaps += other.gaps;
+    lost += other.lost;
+    resets += other.resets;
+    maxBuffered = std::max(maxBuffered, other.maxBuffered);
+    for (size_t feed = 0; feed < SEQUENCER_MAX_FEEDS; ++feed)
+    {
+        firstArrivals[feed] += other.firstArrivals[feed];
+    }
+}
+
+std::ostream& operator<<(std::ostream& out, const SequencerStats& stats)
+{
+    out << "received " << stats.received << ", delivered " << stats.delivered << " (" << stats.reordered
+        << " reordered), duplicates " << stats.duplicates << ", late " << stats.late << ", gaps " << stats.gaps << " ("
+        << stats.lost << " lost), resets " << stats.resets << ", feed wins";
+    size_t feeds = SEQUENCER_MAX_FEEDS;
+    while (feeds > 1 && stats.firstArrivals[feeds - 1] == 0)
+    {
+        --feeds;
+    }
+    for (size_t feed = 0; feed < feeds; ++feed)
+    {
+        out << (feed == 0 ? " " : "/") << stats.firstArrivals[feed];
+    }
+    return out;
+}
+
+Sequencer::Sequencer(const SequencerOptions& options)
+    : m_slotSize(options.slotSize), m_maxDelayNs(std::chrono::nanoseconds(options.maxDelay).count()),
+      m_started(false), m_stream(0), m_next(0), m_buffered(0), m_end(0), m_holeSinceNs(0)
+{
+    if (options.window == 0)
+    {
+        throw std::runtime_error("A sequencer needs a window of at least one message");
+    }
+    size_t window = 1;
+    while (window < options.window)
+    {
+        window <<= 1;
+    }
+    m_slots.resize(window);
+    m_data.resize(window * m_slotSize);
+    m_mask = window - 1;
+}
+
+void Sequencer::reset(uint32_t stream, uint64_t next)
+{
+    for (Slot& slot : m_slots)
+    {
+        slot.state = SlotState::Empty;
+    }
+    m_started = true;
+    m_stream = stream;
+    m_next = next;
+    m_buffered = 0;
+    m_end = next;
+}
+
+uint64_t Sequencer::firstBuffered() const
+{
+    uint64_t sequence = m_next;
+    while (!isBuffered(sequence))
+    {
+        ++sequence;
+    }
+    return sequence;
+}
+
+SequencerTable::SequencerTable(const SequencerOptions& options)
+    : m_options(options), m_streams(options.maxStreams), m_used(0), m_rejected(0)
+{
+    m_sequencers.reserve(options.maxStreams);
+}
+
+SequencerStats SequencerTable::stats() const
+{
+    SequencerStats total;
+    for (size_t i = 0; i < m_used; ++i)
+    {
+        total.merge(m_sequencers[i].stats());
+    }
+    return total;
+}
@@ -0,0 +1,406 @@
+/**
+ * @file sequencer.h
+ * @brief Sequence header, gap detection and A/B feed arbitration for datagram streams
+ *
+ * UDP may lose, duplicate or reorder datagrams, and a bare payload gives the receiver no way
+ * to tell. A publisher that puts a SequenceHeader in front of every message (stream id,
+ * sequence number, send time) lets the receiver's Sequencer put each stream back in order:
+ * - A message with the next expected sequence number is delivered at once, without a copy
+ * - A message ahead of it is copied into a preallocated reorder window of `window` slots and
+ *   delivered as soon as the missing ones arrive
+ * - A hole is given up on, and reported as a gap, once a message would fall beyond the window
+ *   or the oldest buffered message has waited maxDelay (expire())
+ * - Copies of a message that was already delivered count as duplicates. Several feeds carrying
+ *   the same stream (A/B redundancy, e.g. one group per NIC) are merged this way: the first
+ *   copy to arrive wins, and stats().firstArrivals shows which feed won how often.
+ *
+ * push() and expire() never allocate: slots and their payload storage are sized up front, when
+ * SequencerTable sees the first message of a stream.
+ * A message whose header has SEQUENCE_FLAG_FIRST and sequence 0 marks a publisher restart and
+ * resets the stream, once the stream is more than a window past its own first message (a copy
+ * of that one from a slower feed is a duplicate). Streams are tracked by SequencerTable, up to
+ * maxStreams of them.
+ *
+ * Wire format, network byte order, SEQUENCE_HEADER_SIZE bytes before the payload:
+ *
+ *     magic u16 | version u8 | flags u8 | stream id u32 | sequence u64 | send time u64 (ns)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#define SEQUENCE_HEADER_SIZE 24
+#define SEQUENCE_MAGIC 0x5351 // "SQ"
+#define SEQUENCE_VERSION 1
+#define SEQUENCE_FLAG_FIRST 0x01 // First message of a publisher session
+#define SEQUENCER_MAX_FEEDS 8    // Feeds counted separately in firstArrivals; higher feed numbers share the last
+
+struct SequenceHeader
+{
+    uint8_t flags = 0;
+    uint32_t stream = 0;
+    uint64_t sequence = 0;
+    int64_t sendTimeNs = 0; // CLOCK_REALTIME at the publisher
+};
+
+// Write header into out (at least SEQUENCE_HEADER_SIZE bytes)
+void encodeSequenceHeader(const SequenceHeader& header, char* out);
+
+// Read the header at the start of data. Returns false if the message is too short, or does not start with a
+// header of a known version.
+bool decodeSequenceHeader(const char* data, size_t length, SequenceHeader& header);
+
+struct SequencerOptions
+{
+    unsigned window = 1024; // Reorder slots per stream, rounded up to a power of two
+    size_t slotSize = 9216; // Largest payload a slot holds; longer ones are cut when buffered
+    std::chrono::microseconds maxDelay{1000}; // How long a hole may hold back later messages
+    unsigned maxStreams = 16;
+};
+
+struct SequencerStats
+{
+    uint64_t received = 0;   // Messages pushed
+    uint64_t delivered = 0;  // Messages handed on, in order
+    uint64_t reordered = 0;  // Of those, how many waited in the window
+    uint64_t duplicates = 0; // Second and later copies of a delivered or buffered message
+    uint64_t late = 0;       // Messages that arrived after their hole was given up on (or a window behind)
+    uint64_t gaps = 0;       // Holes given up on
+    uint64_t lost = 0;       // Messages in those holes
+    uint64_t resets = 0;     // Publisher restarts
+    size_t maxBuffered = 0;  // Most messages held in the window at once
+    uint64_t firstArrivals[SEQUENCER_MAX_FEEDS] = {}; // Messages whose first copy came from each feed
+
+    void merge(const SequencerStats& other);
+};
+
+// One line: "received N, delivered N (R reordered), duplicates D, late L, gaps G (M lost), resets R, feed wins ..."
+std::ostream& operator<<(std::ostream& out, const SequencerStats& stats);
+
+// Orders one stream. deliver(const SequenceHeader&, std::string_view payload, unsigned feed) is called for every
+// message in sequence order and gap(uint32_t stream, uint64_t firstSequence, uint64_t count) for every hole given
+// up on. A delivered payload is only valid during the call.
+class Sequencer
+{
+public:
+    explicit Sequencer(const SequencerOptions& options);
+
+    template <typename Deliver, typename Gap>
+    void push(unsigned feed, const SequenceHeader& header, std::string_view payload, int64_t nowNs,
+              Deliver&& deliver, Gap&& gap)
+    {
+        ++m_stats.received;
+        uint64_t sequence = header.sequence;
+        // A first message again is a restart, unless it is the other feed's copy of the first one delivered
+        bool restart = (header.flags & SEQUENCE_FLAG_FIRST) && sequence == 0 && m_next != 0 &&
+                       !(m_slots[0].sequence == 0 && m_slots[0].state == SlotState::Delivered);
+        if (!m_started || restart)
+        {
+            m_stats.resets += restart;
+            reset(header.stream, sequence);
+        }
+
+        if (sequence < m_next)
+        {
+            // Behind the window: a copy of something delivered, or too late to be any use
+            const Slot& slot = m_slots[sequence & m_mask];
+            bool delivered = m_next - sequence <= m_slots.size() && slot.sequence == sequence &&
+                             slot.state == SlotState::Delivered;
+            ++(delivered ? m_stats.duplicates : m_stats.late);
+            return;
+        }
+        if (sequence - m_next >= m_slots.size())
+        {
+            advance(sequence - m_slots.size() + 1, deliver, gap);
+        }
+
+        Slot& slot = m_slots[sequence & m_mask];
+        if (sequence == m_next)
+        {
+            countArrival(feed);
+            deliver(header, payload, feed);
+            slot.sequence = sequence;
+            slot.state = SlotState::Delivered;
+            ++m_next;
+            ++m_stats.delivered;
+            drain(deliver);
+            return;
+        }
+
+        if (isBuffered(sequence))
+        {
+            ++m_stats.duplicates;
+            return;
+        }
+        countArrival(feed);
+        slot.sequence = sequence;
+        slot.state = SlotState::Buffered;
+        slot.header = header;
+        slot.feed = feed;
+        slot.arrivalNs = nowNs;
+        slot.length = static_cast<uint32_t>(std::min(payload.size(), m_slotSize));
+        memcpy(slotData(sequence), payload.data(), slot.length);
+        if (m_buffered++ == 0)
+        {
+            m_holeSinceNs = nowNs;
+        }
+        m_end = std::max(m_end, sequence + 1);
+        m_stats.maxBuffered = std::max(m_stats.maxBuffered, m_buffered);
+    }
+
+    // Give up on the hole in front of the window if the oldest message behind it has waited maxDelay
+    template <typename Deliver, typename Gap>
+    void expire(int64_t nowNs, Deliver&& deliver, Gap&& gap)
+    {
+        if (m_buffered > 0 && nowNs - m_holeSinceNs >= m_maxDelayNs)
+        {
+            advance(firstBuffered(), deliver, gap);
+        }
+    }
+
+    // Call fn(firstSequence, count) for up to maxRanges holes in sequence order, i.e. the messages still missing
+    // between the next expected one and the newest buffered one. Returns the number of ranges reported.
+    template <typename Fn>
+    size_t forEachHole(size_t maxRanges, Fn&& fn) const
+    {
+        size_t ranges = 0;
+        uint64_t sequence = m_next;
+        while (m_buffered > 0 && sequence < m_end && ranges < maxRanges)
+        {
+            uint64_t first = sequence;
+            while (sequence < m_end && !isBuffered(sequence))
+            {
+                ++sequence;
+            }
+            if (sequence > first)
+            {
+                fn(first, sequence - first);
+                ++ranges;
+            }
+            while (sequence < m_end && isBuffered(sequence))
+            {
+                ++sequence;
+            }
+        }
+        return ranges;
+    }
+
+    // Whether messages are waiting behind a hole, and since when
+    bool hasHole() const
+    {
+        return m_buffered > 0;
+    }
+
+    int64_t holeSinceNs() const
+    {
+        return m_holeSinceNs;
+    }
+
+    uint32_t stream() const
+    {
+        return m_stream;
+    }
+
+    // Sequence number expected next
+    uint64_t next() const
+    {
+        return m_next;
+    }
+
+    const SequencerStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    enum class SlotState : uint8_t
+    {
+        Empty,
+        Buffered, // Waiting for the messages before it
+        Delivered // Handed on; kept to recognise duplicates
+    };
+
+    struct Slot
+    {
+        uint64_t sequence = 0;
+        SlotState state = SlotState::Empty;
+        unsigned feed = 0;
+        uint32_t length = 0;
+        int64_t arrivalNs = 0;
+        SequenceHeader header;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<char> m_data; // slotSize bytes per slot
+    size_t m_slotSize;
+    uint64_t m_mask;
+    int64_t m_maxDelayNs;
+    bool m_started;
+    uint32_t m_stream;
+    uint64_t m_next;
+    size_t m_buffered;
+    uint64_t m_end;        // One past the newest buffered message
+    int64_t m_holeSinceNs; // Arrival of the oldest buffered message
+    SequencerStats m_stats;
+
+    char* slotData(uint64_t sequence)
+    {
+        return m_data.data() + (sequence & m_mask) * m_slotSize;
+    }
+
+    bool isBuffered(uint64_t sequence) const
+    {
+        const Slot& slot = m_slots[sequence & m_mask];
+        return slot.sequence == sequence && slot.state == SlotState::Buffered;
+    }
+
+    void countArrival(unsigned feed)
+    {
+        ++m_stats.firstArrivals[std::min(feed, static_cast<unsigned>(SEQUENCER_MAX_FEEDS - 1))];
+    }
+
+    void reset(uint32_t stream, uint64_t next);
+    uint64_t firstBuffered() const;
+
+    // Hand on buffered messages for as long as they are next in sequence
+    template <typename Deliver>
+    void drain(Deliver& deliver)
+    {
+        while (m_buffered > 0)
+        {
+            if (!isBuffered(m_next))
+            {
+                // A new hole: its clock starts with the oldest message now waiting behind it
+                m_holeSinceNs = m_slots[firstBuffered() & m_mask].arrivalNs;
+                return;
+            }
+            Slot& slot = m_slots[m_next & m_mask];
+            deliver(slot.header, std::string_view(slotData(m_next), slot.length), slot.feed);
+            slot.state = SlotState::Delivered;
+            --m_buffered;
+            ++m_next;
+            ++m_stats.delivered;
+            ++m_stats.reordered;
+        }
+    }
+
+    // Move the window so that it starts at target: buffered messages before it are delivered, holes reported
+    template <typename Deliver, typename Gap>
+    void advance(uint64_t target, Deliver& deliver, Gap& gap)
+    {
+        while (m_next < target)
+        {
+            if (m_buffered == 0)
+            {
+                reportGap(m_next, target - m_next, gap);
+                m_next = target;
+                break;
+            }
+            uint64_t holeStart = m_next;
+            while (m_next < target && !isBuffered(m_next))
+            {
+                ++m_next;
+            }
+            if (m_next > holeStart)
+            {
+                reportGap(holeStart, m_next - holeStart, gap);
+            }
+            drain(deliver);
+        }
+        drain(deliver);
+    }
+
+    template <typename Gap>
+    void reportGap(uint64_t first, uint64_t count, Gap& gap)
+    {
+        ++m_stats.gaps;
+        m_stats.lost += count;
+        gap(m_stream, first, count);
+    }
+};
+
+// A Sequencer per stream id, created with its window when the stream's first message arrives
+class SequencerTable
+{
+public:
+    explicit SequencerTable(const SequencerOptions& options);
+
+    // The stream's sequencer, claiming a free one for a new stream. nullptr if maxStreams are already in use.
+    Sequencer* find(uint32_t stream)
+    {
+        for (size_t i = 0; i < m_used; ++i)
+        {
+            if (m_streams[i] == stream)
+            {
+                return &m_sequencers[i];
+            }
+        }
+        if (m_used == m_streams.size())
+        {
+            return nullptr;
+        }
+        m_streams[m_used] = stream;
+        m_sequencers.emplace_back(m_options); // Within the reserved capacity: earlier sequencers do not move
+        return &m_sequencers[m_used++];
+    }
+
+    // Decode the header and push the message to its stream. Returns the stream's sequencer, or nullptr, counting
+    // the message, if it has no valid header or belongs to a stream beyond maxStreams.
+    template <typename Deliver, typename Gap>
+    Sequencer* push(unsigned feed, const char* data, size_t length, int64_t nowNs, Deliver&& deliver, Gap&& gap)
+    {
+        SequenceHeader header;
+        Sequencer* sequencer = nullptr;
+        if (!decodeSequenceHeader(data, length, header) || (sequencer = find(header.stream)) == nullptr)
+        {
+            ++m_rejected;
+            return nullptr;
+        }
+        sequencer->push(feed, header,
+                        std::string_view(data + SEQUENCE_HEADER_SIZE, length - SEQUENCE_HEADER_SIZE), nowNs,
+                        deliver, gap);
+        return sequencer;
+    }
+
+    template <typename Deliver, typename Gap>
+    void expire(int64_t nowNs, Deliver&& deliver, Gap&& gap)
+    {
+        for (size_t i = 0; i < m_used; ++i)
+        {
+            m_sequencers[i].expire(nowNs, deliver, gap);
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn)
+    {
+        for (size_t i = 0; i < m_used; ++i)
+        {
+            fn(m_sequencers[i]);
+        }
+    }
+
+    // Every stream together
+    SequencerStats stats() const;
+
+    // Messages without a valid header or for a stream beyond maxStreams
+    uint64_t rejected() const
+    {
+        return m_rejected;
+    }
+
+private:
+    SequencerOptions m_options;
+    std::vector<Sequencer> m_sequencers;
+    std::vector<uint32_t> m_streams;
+    size_t m_used;
+    uint64_t m_rejected;
+};
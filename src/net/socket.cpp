@@ -0,0 +1,280 @@
+/**
+ * @file socket.cpp
+ * @brief RAII socket and tunable socket options shared by the examples
+ */
+
+#include "net/socket.h"
+
+#include <climits>
+#include <fstream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// tos appears twice: the IPv4 and IPv6 header fields are set with different options
+const SocketOptions::Option SocketOptions::OPTIONS[] = {
+    {"reuseaddr", "SO_REUSEADDR", SOL_SOCKET, SO_REUSEADDR, false, AF_UNSPEC, &SocketOptions::m_reuseAddress},
+    {"reuseport", "SO_REUSEPORT", SOL_SOCKET, SO_REUSEPORT, false, AF_UNSPEC, &SocketOptions::m_reusePort},
+    {"rcvbuf", "SO_RCVBUF", SOL_SOCKET, SO_RCVBUF, false, AF_UNSPEC, &SocketOptions::m_receiveBuffer},
+    {"sndbuf", "SO_SNDBUF", SOL_SOCKET, SO_SNDBUF, false, AF_UNSPEC, &SocketOptions::m_sendBuffer},
+    {"nodelay", "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, true, AF_UNSPEC, &SocketOptions::m_noDelay},
+    {"quickack", "TCP_QUICKACK", IPPROTO_TCP, TCP_QUICKACK, true, AF_UNSPEC, &SocketOptions::m_quickAck},
+    {"busy_poll", "SO_BUSY_POLL", SOL_SOCKET, SO_BUSY_POLL, false, AF_UNSPEC, &SocketOptions::m_busyPoll},
+    {"prefer_busy_poll", "SO_PREFER_BUSY_POLL", SOL_SOCKET, SO_PREFER_BUSY_POLL, false, AF_UNSPEC,
+     &SocketOptions::m_preferBusyPoll},
+    {"busy_poll_budget", "SO_BUSY_POLL_BUDGET", SOL_SOCKET, SO_BUSY_POLL_BUDGET, false, AF_UNSPEC,
+     &SocketOptions::m_busyPollBudget},
+    {"incoming_cpu", "SO_INCOMING_CPU", SOL_SOCKET, SO_INCOMING_CPU, false, AF_UNSPEC, &SocketOptions::m_incomingCpu},
+    {"tos", "IP_TOS", IPPROTO_IP, IP_TOS, false, AF_INET, &SocketOptions::m_typeOfService},
+    {"tos", "IPV6_TCLASS", IPPROTO_IPV6, IPV6_TCLASS, false, AF_INET6, &SocketOptions::m_typeOfService},
+    {"zerocopy", "SO_ZEROCOPY", SOL_SOCKET, SO_ZEROCOPY, false, AF_UNSPEC, &SocketOptions::m_zeroCopy},
+    {"v6only", "IPV6_V6ONLY", IPPROTO_IPV6, IPV6_V6ONLY, false, AF_INET6, &SocketOptions::m_v6Only},
+};
+
+static std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool SocketOptions::set(const std::string& key, const std::string& value)
+{
+    char* end = nullptr;
+    errno = 0;
+    long number = strtol(value.c_str(), &end, 0);
+    if (value.empty() || *end != '\0' || errno == ERANGE || number < INT_MIN || number > INT_MAX)
+    {
+        return false;
+    }
+
+    for (const Option& option : OPTIONS)
+    {
+        if (key == option.key)
+        {
+            this->*option.value = static_cast<int>(number);
+            return true;
+        }
+    }
+    return false;
+}
+
+void SocketOptions::loadFile(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open socket config " + path + ": " + std::string(strerror(errno)));
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+        size_t separator = line.find('=');
+        if (separator == std::string::npos ||
+            !set(trim(line.substr(0, separator)), trim(line.substr(separator + 1))))
+        {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": invalid socket option '" + line +
+                                     "'");
+        }
+    }
+}
+
+bool SocketOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--socket-config" && arg != "--sockopt")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--socket-config")
+    {
+        loadFile(value);
+        return true;
+    }
+
+    size_t separator = value.find('=');
+    if (separator == std::string::npos || !set(value.substr(0, separator), value.substr(separator + 1)))
+    {
+        throw std::runtime_error("Invalid socket option '" + value + "'");
+    }
+    return true;
+}
+
+void SocketOptions::apply(int fd) const
+{
+    int type = 0;
+    bool typeKnown = false;
+    int family = AF_UNSPEC;
+    bool familyKnown = false;
+    for (const Option& option : OPTIONS)
+    {
+        const std::optional<int>& value = this->*option.value;
+        if (!value)
+        {
+            continue;
+        }
+
+        // TCP options are skipped on datagram and raw sockets so one config file can serve every example
+        if (option.streamOnly)
+        {
+            if (!typeKnown)
+            {
+                socklen_t length = sizeof(type);
+                getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length);
+                typeKnown = true;
+            }
+            if (type != SOCK_STREAM)
+            {
+                continue;
+            }
+        }
+
+        // Likewise IPv4 options on IPv6 sockets and the other way round
+        if (option.family != AF_UNSPEC)
+        {
+            if (!familyKnown)
+            {
+                socklen_t length = sizeof(family);
+                getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &family, &length);
+                familyKnown = true;
+            }
+            if (family != option.family)
+            {
+                continue;
+            }
+        }
+
+        int optionValue = *value;
+        if (setsockopt(fd, option.level, option.optionName, &optionValue, sizeof(optionValue)) == -1)
+        {
+            throw std::runtime_error("Failed to set " + std::string(option.name) + ": " +
+                                     std::string(strerror(errno)));
+        }
+        /*
+        setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
+        level: SOL_SOCKET: socket layer, IPPROTO_IP: IPv4 layer, IPPROTO_IPV6: IPv6 layer, IPPROTO_TCP: TCP layer
+        optname: SO_REUSEADDR - Reuse the address immediately after the program exits
+                 SO_REUSEPORT - Let several sockets bind the same port; the kernel spreads traffic across them
+                 SO_RCVBUF/SO_SNDBUF - Socket buffer sizes
+                 TCP_NODELAY - Disable Nagle's algorithm so small writes go out immediately
+                 SO_BUSY_POLL - Spin on the device queue for this many microseconds before sleeping in recv()
+                 IPV6_V6ONLY - 1: an IPv6 socket only speaks IPv6; 0: bound to :: it also accepts IPv4
+        optval: Pointer for the value of the option
+        optlen: Length of the option value
+
+        return 0 if success
+        return -1 if failed
+        */
+    }
+}
+
+Socket::Socket(int domain, int type, int protocol) : m_fd(socket(domain, type, protocol))
+{
+    if (m_fd == -1)
+    {
+        throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
+    }
+    /*
+    socket(int domain, int type, int protocol)
+    1st arg: Address Family
+        AF_INET: IPv4
+        AF_INET6: IPv6
+    2nd arg: Socket Type
+        SOCK_STREAM: TCP
+        SOCK_DGRAM: UDP
+        SOCK_RAW: raw IP packets
+    3rd arg: Protocol
+        0: default protocol
+
+    return socket descriptor if success
+    return -1 if failed
+    */
+}
+
+Socket::~Socket()
+{
+    close();
+}
+
+Socket::Socket(Socket&& other) noexcept : m_fd(other.release())
+{
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_fd = other.release();
+    }
+    return *this;
+}
+
+void Socket::close()
+{
+    if (m_fd != -1)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+Socket& Socket::bind(const SocketAddress& address)
+{
+    if (::bind(m_fd, address.data(), address.size()) == -1)
+    {
+        throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
+    }
+    /*
+    bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+    return 0 if success
+    return -1 if failed
+    */
+    return *this;
+}
+
+Socket& Socket::listen(int backlog)
+{
+    if (::listen(m_fd, backlog) == -1)
+    {
+        throw std::runtime_error("Failed to listen: " + std::string(strerror(errno)));
+    }
+    /*
+    listen(int sockfd, int backlog)
+    backlog: Length of the queue of completed connections waiting for accept().
+             A small backlog drops SYNs during connection storms; the kernel caps it at net.core.somaxconn.
+    return 0 if success
+    return -1 if failed
+    */
+    return *this;
+}
+
+Socket& Socket::connect(const SocketAddress& address)
+{
+    if (::connect(m_fd, address.data(), address.size()) == -1)
+    {
+        throw std::runtime_error("Failed to connect: " + std::string(strerror(errno)));
+    }
+    return *this;
+}
@@ -0,0 +1,215 @@
+/**
+ * @file socket.h
+ * @brief RAII socket and tunable socket options shared by the examples
+ *
+ * Every example used to repeat socket() + SO_REUSEADDR + SO_REUSEPORT + bind() with its own
+ * error handling. Socket owns the descriptor and throws std::runtime_error on failure;
+ * SocketOptions collects the options to set, from code, a config file or the command line:
+ *
+ *     SocketOptions options = SocketOptions().reuseAddress(true).reusePort(true);
+ *     options.loadFile("socket.conf");      // key = value lines
+ *     options.set("rcvbuf", "4194304");     // what --sockopt rcvbuf=4194304 does
+ *
+ *     Socket socket(AF_INET, SOCK_DGRAM);
+ *     socket.apply(options).bind(address);
+ *
+ * Config keys (integer values, booleans are 0 or 1):
+ * - reuseaddr, reuseport       SO_REUSEADDR, SO_REUSEPORT
+ * - rcvbuf, sndbuf             SO_RCVBUF, SO_SNDBUF in bytes (the kernel doubles and caps them at r/wmem_max)
+ * - nodelay, quickack          TCP_NODELAY, TCP_QUICKACK (ignored on non-TCP sockets)
+ * - busy_poll                  SO_BUSY_POLL in microseconds
+ * - prefer_busy_poll           SO_PREFER_BUSY_POLL: keep the NIC interrupt masked while the application polls
+ * - busy_poll_budget           SO_BUSY_POLL_BUDGET: packets per busy poll (above the default needs CAP_NET_ADMIN)
+ * - incoming_cpu               SO_INCOMING_CPU
+ * - tos                        IP_TOS, or IPV6_TCLASS on an IPv6 socket
+ * - zerocopy                   SO_ZEROCOPY
+ * - v6only                     IPV6_V6ONLY (ignored on IPv4 sockets): 0 lets an IPv6 socket bound to ::
+ *                              also serve IPv4, whose peers then appear as ::ffff:a.b.c.d
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/socket_address.h"
+
+class SocketOptions
+{
+public:
+    SocketOptions& reuseAddress(bool enable)
+    {
+        m_reuseAddress = enable;
+        return *this;
+    }
+
+    SocketOptions& reusePort(bool enable)
+    {
+        m_reusePort = enable;
+        return *this;
+    }
+
+    SocketOptions& receiveBuffer(int bytes)
+    {
+        m_receiveBuffer = bytes;
+        return *this;
+    }
+
+    SocketOptions& sendBuffer(int bytes)
+    {
+        m_sendBuffer = bytes;
+        return *this;
+    }
+
+    SocketOptions& noDelay(bool enable)
+    {
+        m_noDelay = enable;
+        return *this;
+    }
+
+    SocketOptions& quickAck(bool enable)
+    {
+        m_quickAck = enable;
+        return *this;
+    }
+
+    SocketOptions& busyPoll(int microseconds)
+    {
+        m_busyPoll = microseconds;
+        return *this;
+    }
+
+    SocketOptions& incomingCpu(int cpu)
+    {
+        m_incomingCpu = cpu;
+        return *this;
+    }
+
+    SocketOptions& typeOfService(int tos)
+    {
+        m_typeOfService = tos;
+        return *this;
+    }
+
+    SocketOptions& zeroCopy(bool enable)
+    {
+        m_zeroCopy = enable;
+        return *this;
+    }
+
+    SocketOptions& v6Only(bool enable)
+    {
+        m_v6Only = enable;
+        return *this;
+    }
+
+    // Leave IPV6_V6ONLY as the socket has it, e.g. for one bound already, where setting it fails with EINVAL
+    SocketOptions& keepV6Only()
+    {
+        m_v6Only.reset();
+        return *this;
+    }
+
+    // Set an option by its config key. Returns false for an unknown key or a value that is not an integer.
+    bool set(const std::string& key, const std::string& value);
+
+    // Read "key = value" lines ('#' starts a comment). Throws std::runtime_error naming the bad line.
+    void loadFile(const std::string& path);
+
+    // Consume "--socket-config FILE" or "--sockopt KEY=VALUE" at argv[index], advancing index past the value.
+    // Returns false if argv[index] is not a socket flag; throws std::runtime_error for an invalid one.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--socket-config FILE] [--sockopt KEY=VALUE]...";
+    }
+
+    // setsockopt() every option that was set. Throws std::runtime_error naming the option that failed.
+    void apply(int fd) const;
+
+private:
+    struct Option
+    {
+        const char* key;
+        const char* name;
+        int level;
+        int optionName;
+        bool streamOnly;
+        int family; // AF_UNSPEC: any socket; otherwise only sockets of this family
+        std::optional<int> SocketOptions::*value;
+    };
+    static const Option OPTIONS[];
+
+    std::optional<int> m_reuseAddress;
+    std::optional<int> m_reusePort;
+    std::optional<int> m_receiveBuffer;
+    std::optional<int> m_sendBuffer;
+    std::optional<int> m_noDelay;
+    std::optional<int> m_quickAck;
+    std::optional<int> m_busyPoll;
+    std::optional<int> m_preferBusyPoll;
+    std::optional<int> m_busyPollBudget;
+    std::optional<int> m_incomingCpu;
+    std::optional<int> m_typeOfService;
+    std::optional<int> m_zeroCopy;
+    std::optional<int> m_v6Only;
+};
+
+// Owning socket descriptor; closed on destruction
+class Socket
+{
+public:
+    Socket() : m_fd(-1)
+    {
+    }
+
+    // Throws std::runtime_error if socket() fails
+    Socket(int domain, int type, int protocol = 0);
+    ~Socket();
+
+    // Take ownership of an open descriptor, such as one received from another process
+    static Socket fromDescriptor(int fd)
+    {
+        Socket socket;
+        socket.m_fd = fd;
+        return socket;
+    }
+
+    Socket(Socket&& other) noexcept;
+    Socket& operator=(Socket&& other) noexcept;
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    // Give up ownership; the caller becomes responsible for closing the descriptor
+    int release()
+    {
+        int fd = m_fd;
+        m_fd = -1;
+        return fd;
+    }
+
+    void close();
+
+    // The calls below throw std::runtime_error with the failing system call and errno
+    Socket& apply(const SocketOptions& options)
+    {
+        options.apply(m_fd);
+        return *this;
+    }
+
+    Socket& bind(const SocketAddress& address);
+    Socket& listen(int backlog);
+    Socket& connect(const SocketAddress& address);
+
+private:
+    int m_fd;
+};
@@ -0,0 +1,198 @@
+/**
+ * @file socket_address.cpp
+ * @brief IPv4 or IPv6 socket address, in one type the examples can pass around
+ */
+
+#include "net/socket_address.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+
+SocketAddress::SocketAddress(const sockaddr* address, socklen_t length) : m_address{}
+{
+    memcpy(&m_address, address, std::min<size_t>(length, sizeof(m_address)));
+}
+
+SocketAddress SocketAddress::parse(const std::string& host, uint16_t port)
+{
+    SocketAddress address;
+    if (inet_pton(AF_INET, host.c_str(), &address.m_address.v4.sin_addr) == 1)
+    {
+        address.m_address.v4.sin_family = AF_INET;
+        address.m_address.v4.sin_port = htons(port);
+        return address;
+    }
+
+    // fe80::1%eth0: link-local addresses mean nothing without the interface they are on
+    size_t percent = host.find('%');
+    sockaddr_in6& v6 = address.m_address.v6;
+    if (inet_pton(AF_INET6, host.substr(0, percent).c_str(), &v6.sin6_addr) != 1)
+    {
+        throw std::runtime_error("Invalid address '" + host + "'");
+    }
+    if (percent != std::string::npos)
+    {
+        std::string scope = host.substr(percent + 1);
+        char* end = nullptr;
+        unsigned long index = strtoul(scope.c_str(), &end, 10);
+        v6.sin6_scope_id = !scope.empty() && *end == '\0' ? static_cast<uint32_t>(index)
+                                                          : if_nametoindex(scope.c_str());
+        if (v6.sin6_scope_id == 0)
+        {
+            throw std::runtime_error("Invalid interface '" + scope + "' in address '" + host + "'");
+        }
+    }
+    v6.sin6_family = AF_INET6;
+    v6.sin6_port = htons(port);
+    return address;
+}
+
+SocketAddress SocketAddress::parse(const std::string& text)
+{
+    std::string host;
+    std::string port;
+    if (!text.empty() && text[0] == '[')
+    {
+        size_t close = text.find(']');
+        if (close == std::string::npos || close + 1 >= text.size() || text[close + 1] != ':')
+        {
+            throw std::runtime_error("Address '" + text + "' needs [IPV6]:PORT");
+        }
+        host = text.substr(1, close - 1);
+        port = text.substr(close + 2);
+    }
+    else
+    {
+        // An IPv6 address has colons of its own, so without brackets only IPv4 can carry a port
+        size_t colon = text.find(':');
+        if (colon == std::string::npos || text.find(':', colon + 1) != std::string::npos)
+        {
+            throw std::runtime_error("Address '" + text + "' needs ADDRESS:PORT or [IPV6]:PORT");
+        }
+        host = text.substr(0, colon);
+        port = text.substr(colon + 1);
+    }
+
+    char* end = nullptr;
+    long number = strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || number < 0 || number > 65535)
+    {
+        throw std::runtime_error("Invalid port '" + port + "'");
+    }
+    return parse(host, static_cast<uint16_t>(number));
+}
+
+SocketAddress SocketAddress::any(int family, uint16_t port)
+{
+    SocketAddress address;
+    if (family == AF_INET6)
+    {
+        address.m_address.v6.sin6_family = AF_INET6;
+        address.m_address.v6.sin6_addr = in6addr_any;
+        address.m_address.v6.sin6_port = htons(port);
+    }
+    else
+    {
+        address.m_address.v4.sin_family = AF_INET;
+        address.m_address.v4.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.m_address.v4.sin_port = htons(port);
+    }
+    return address;
+}
+
+bool SocketAddress::isMulticast() const
+{
+    if (isIpv6())
+    {
+        return IN6_IS_ADDR_MULTICAST(&m_address.v6.sin6_addr);
+    }
+    return family() == AF_INET && IN_MULTICAST(ntohl(m_address.v4.sin_addr.s_addr));
+}
+
+SocketAddress SocketAddress::unmapped() const
+{
+    if (!isIpv6() || !IN6_IS_ADDR_V4MAPPED(&m_address.v6.sin6_addr))
+    {
+        return *this;
+    }
+    sockaddr_in v4{};
+    v4.sin_family = AF_INET;
+    v4.sin_port = m_address.v6.sin6_port;
+    memcpy(&v4.sin_addr, m_address.v6.sin6_addr.s6_addr + 12, sizeof(v4.sin_addr));
+    return SocketAddress(v4);
+}
+
+SocketAddress SocketAddress::mapped() const
+{
+    if (family() != AF_INET)
+    {
+        return *this;
+    }
+    sockaddr_in6 v6{};
+    v6.sin6_family = AF_INET6;
+    v6.sin6_port = m_address.v4.sin_port;
+    v6.sin6_addr.s6_addr[10] = 0xFF;
+    v6.sin6_addr.s6_addr[11] = 0xFF;
+    memcpy(v6.sin6_addr.s6_addr + 12, &m_address.v4.sin_addr, sizeof(m_address.v4.sin_addr));
+    return SocketAddress(v6);
+}
+
+std::string SocketAddress::host() const
+{
+    char text[INET6_ADDRSTRLEN + IF_NAMESIZE + 1];
+    if (isIpv6())
+    {
+        inet_ntop(AF_INET6, &m_address.v6.sin6_addr, text, sizeof(text));
+        std::string host = text;
+        if (m_address.v6.sin6_scope_id != 0)
+        {
+            char name[IF_NAMESIZE];
+            host += "%";
+            host += if_indextoname(m_address.v6.sin6_scope_id, name) != nullptr
+                        ? std::string(name)
+                        : std::to_string(m_address.v6.sin6_scope_id);
+        }
+        return host;
+    }
+    if (family() == AF_INET)
+    {
+        inet_ntop(AF_INET, &m_address.v4.sin_addr, text, sizeof(text));
+        return text;
+    }
+    return "(unspecified)";
+}
+
+std::string SocketAddress::toString() const
+{
+    if (isIpv6())
+    {
+        return "[" + host() + "]:" + std::to_string(port());
+    }
+    return host() + ":" + std::to_string(port());
+}
+
+bool SocketAddress::operator==(const SocketAddress& other) const
+{
+    if (family() != other.family())
+    {
+        return false;
+    }
+    if (isIpv6())
+    {
+        const sockaddr_in6& a = m_address.v6;
+        const sockaddr_in6& b = other.m_address.v6;
+        return a.sin6_port == b.sin6_port && a.sin6_scope_id == b.sin6_scope_id &&
+               memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
+    }
+    if (family() == AF_INET)
+    {
+        return m_address.v4.sin_port == other.m_address.v4.sin_port &&
+               m_address.v4.sin_addr.s_addr == other.m_address.v4.sin_addr.s_addr;
+    }
+    return true;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file socket_address.h
+ * @brief IPv4 or IPv6 socket address, in one type the examples can pass around
+ *
+ * sockaddr_in only holds IPv4, so every class that kept one was IPv4-only. SocketAddress holds
+ * a sockaddr_in or a sockaddr_in6 in a union and passes either to the socket calls, which take
+ * a sockaddr* and a length:
+ *
+ *     SocketAddress address = SocketAddress::parse("[ff15::1]:5000");
+ *     Socket socket(address.family(), SOCK_DGRAM);
+ *     sendto(socket.fd(), data, length, 0, address.data(), address.size());
+ *
+ *     SocketAddress sender;
+ *     socklen_t length = SocketAddress::capacity();
+ *     recvfrom(fd, buffer, size, 0, sender.data(), &length);
+ *
+ * - It is 28 bytes (sizeof(sockaddr_in6)), trivially copyable and needs no allocation, so batch
+ *   receivers keep one per slot as msg_name just as they kept a sockaddr_in.
+ * - The length is not stored: size() follows from the family the kernel or the caller wrote.
+ * - It converts implicitly from sockaddr_in, so IPv4 code that builds a sockaddr_in keeps working.
+ * - A dual-stack socket (AF_INET6 with IPV6_V6ONLY off) reports IPv4 peers as ::ffff:a.b.c.d;
+ *   unmapped() turns them back into an IPv4 address for printing and comparison, and mapped()
+ *   turns an IPv4 address into the form such a socket sends to.
+ *
+ * Text forms are numeric: "10.0.0.1:5000", "[fd00::2]:5000", "[fe80::1%eth0]:5000".
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+class SocketAddress
+{
+public:
+    // AF_UNSPEC, all zero
+    SocketAddress() : m_address{}
+    {
+    }
+
+    SocketAddress(const sockaddr_in& address) : m_address{}
+    {
+        m_address.v4 = address;
+    }
+
+    SocketAddress(const sockaddr_in6& address) : m_address{}
+    {
+        m_address.v6 = address;
+    }
+
+    // What accept(), recvfrom() or getsockname() filled in; bytes beyond capacity() are ignored
+    SocketAddress(const sockaddr* address, socklen_t length);
+
+    // A numeric IPv4 or IPv6 address (IPv6 with an optional %INTERFACE or %INDEX scope) and a port.
+    // Throws std::runtime_error if host is not an address.
+    static SocketAddress parse(const std::string& host, uint16_t port);
+
+    // "ADDRESS:PORT" or "[IPV6]:PORT". Throws std::runtime_error naming what is wrong.
+    static SocketAddress parse(const std::string& text);
+
+    // The wildcard address (0.0.0.0 or ::) of family, for bind()
+    static SocketAddress any(int family, uint16_t port);
+
+    // AF_INET, AF_INET6 or AF_UNSPEC
+    int family() const
+    {
+        return m_address.base.sa_family;
+    }
+
+    bool isIpv6() const
+    {
+        return family() == AF_INET6;
+    }
+
+    // In host byte order
+    uint16_t port() const
+    {
+        return ntohs(isIpv6() ? m_address.v6.sin6_port : m_address.v4.sin_port);
+    }
+
+    void setPort(uint16_t port)
+    {
+        (isIpv6() ? m_address.v6.sin6_port : m_address.v4.sin_port) = htons(port);
+    }
+
+    const sockaddr* data() const
+    {
+        return &m_address.base;
+    }
+
+    sockaddr* data()
+    {
+        return &m_address.base;
+    }
+
+    // The length to pass with data(): that of the family's sockaddr
+    socklen_t size() const
+    {
+        return isIpv6() ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    }
+
+    // The length to offer the kernel when it fills in an address of either family
+    static constexpr socklen_t capacity()
+    {
+        return sizeof(Storage);
+    }
+
+    const sockaddr_in& ipv4() const
+    {
+        return m_address.v4;
+    }
+
+    const sockaddr_in6& ipv6() const
+    {
+        return m_address.v6;
+    }
+
+    bool isMulticast() const;
+
+    // ::ffff:a.b.c.d as the IPv4 address a.b.c.d; any other address unchanged
+    SocketAddress unmapped() const;
+
+    // The reverse: an IPv4 address as ::ffff:a.b.c.d, for a dual-stack socket to send to; IPv6 unchanged
+    SocketAddress mapped() const;
+
+    // The address without the port: "10.0.0.1", "fd00::2", "fe80::1%eth0"
+    std::string host() const;
+
+    // As accepted by parse(): "10.0.0.1:5000", "[fd00::2]:5000"
+    std::string toString() const;
+
+    // Same family, address, port and (IPv6) scope
+    bool operator==(const SocketAddress& other) const;
+
+private:
+    // The largest member first, so {} zeroes all of it
+    union Storage
+    {
+        sockaddr_in6 v6;
+        sockaddr_in v4;
+        sockaddr base;
+    };
+
+    Storage m_address;
+};
+
+static_assert(sizeof(SocketAddress) == sizeof(sockaddr_in6));
@@ -0,0 +1,36 @@
+/**
+ * @file socket_filter.cpp
+ * @brief Classic BPF socket filters (SO_ATTACH_FILTER)
+ */
+
+#include "net/socket_filter.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+SocketFilter SocketFilter::dropAll()
+{
+    SocketFilter filter;
+    filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+    return filter;
+}
+
+void SocketFilter::attach(int fd) const
+{
+    sock_fprog program{};
+    program.len = static_cast<unsigned short>(m_program.size());
+    program.filter = const_cast<sock_filter*>(m_program.data());
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+    {
+        throw std::runtime_error("Failed to attach socket filter: " + std::string(strerror(errno)));
+    }
+    /*
+    setsockopt(SOL_SOCKET, SO_ATTACH_FILTER, struct sock_fprog)
+    The kernel validates the program and copies it; the socket then only queues packets it returns non-zero
+    for, truncated to that many bytes. Packets already queued are not filtered again.
+    */
+}
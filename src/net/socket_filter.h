@@ -0,0 +1,66 @@
+/**
+ * @file socket_filter.h
+ * @brief Classic BPF socket filters (SO_ATTACH_FILTER)
+ *
+ * A socket filter is a small program the kernel runs on every packet before it is queued to the
+ * socket. Packets it rejects are dropped in the kernel, without a copy or a wakeup of the
+ * receiving process. A program is a list of sock_filter instructions from linux/filter.h:
+ * loads into the accumulator A or index register X, compares with conditional jumps that skip
+ * forward by a number of instructions, and a return whose value is the number of bytes to keep
+ * (0 drops the packet). Offsets count from the first byte the socket would receive: the link
+ * header on a SOCK_RAW packet socket, the IP header on a raw IP socket.
+ *
+ *     SocketFilter filter;
+ *     filter.statement(BPF_LD | BPF_B | BPF_ABS, 9);                 // A = IP protocol
+ *     filter.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 1);     // UDP: next, else skip one
+ *     filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_ACCEPT);
+ *     filter.statement(BPF_RET | BPF_K, SOCKET_FILTER_DROP);
+ *     filter.attach(fd);
+ *
+ * @note The kernel checks the program when it is attached: jumps must stay inside it and it must end in a return
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <linux/filter.h>
+
+#define SOCKET_FILTER_ACCEPT 0xFFFFFFFF // Return value keeping the whole packet
+#define SOCKET_FILTER_DROP 0
+#define SOCKET_FILTER_MAX_JUMP 255 // jt and jf are 8-bit instruction counts
+
+class SocketFilter
+{
+public:
+    // A program that drops every packet: keeps a socket open, e.g. for its group memberships, while another
+    // socket receives its traffic
+    static SocketFilter dropAll();
+
+    // Append a load, store, ALU operation or return
+    SocketFilter& statement(uint16_t code, uint32_t k)
+    {
+        m_program.push_back(BPF_STMT(code, k));
+        return *this;
+    }
+
+    // Append a conditional jump that skips jt instructions if it holds and jf otherwise
+    SocketFilter& jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+    {
+        m_program.push_back(BPF_JUMP(code, k, jt, jf));
+        return *this;
+    }
+
+    size_t size() const
+    {
+        return m_program.size();
+    }
+
+    // Replace whatever filter fd has. Throws std::runtime_error if the kernel rejects the program.
+    void attach(int fd) const;
+
+private:
+    std::vector<sock_filter> m_program;
+};
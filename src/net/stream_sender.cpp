@@ -0,0 +1,468 @@
+/**
+ * @file stream_sender.cpp
+ * @brief Non-blocking, pipelined TCP sender that coalesces frames into scatter-gather sends
+ */
+
+#include "net/stream_sender.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net/metrics.h"
+
+#define STREAM_WAIT_TIMEOUT_MS 100 // Upper bound on one epoll wait, so a lost wakeup only costs a retry
+#define ZEROCOPY_CONTROL_SIZE 128  // Room for one IP_RECVERR message
+
+bool StreamSenderOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg == "--cork")
+    {
+        cork = true;
+        return true;
+    }
+    if (arg == "--msg-more")
+    {
+        more = true;
+        return true;
+    }
+    if (arg == "--zerocopy")
+    {
+        zeroCopy = true;
+        return true;
+    }
+    if (arg != "--zerocopy-threshold")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    char* end = nullptr;
+    unsigned long long threshold = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0')
+    {
+        throw std::runtime_error("Invalid zero-copy threshold '" + value + "'");
+    }
+    zeroCopyThreshold = threshold;
+    return true;
+}
+
+StreamSender::StreamSender(int sockFd, const StreamSenderOptions& options)
+    : m_sockFd(sockFd), m_epollFd(-1), m_options(options), m_nextBlockId(0), m_carry(0), m_pendingHead(0),
+      m_queuedOffset(0), m_sentOffset(0), m_corked(false), m_firstZeroCopy(0)
+{
+    // A line that reaches the end of a block must fit in the next one together with a full frame
+    m_options.maxPayload = std::max<size_t>(m_options.maxPayload, 1);
+    m_options.blockSize = std::max(m_options.blockSize, 2 * m_options.maxPayload);
+
+    int flags = fcntl(sockFd, F_GETFL);
+    if (flags == -1 || fcntl(sockFd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        throw std::runtime_error("Failed to make the socket non-blocking: " + std::string(strerror(errno)));
+    }
+
+    if (m_options.zeroCopy)
+    {
+        int enable = 1;
+        if (setsockopt(sockFd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1)
+        {
+            throw std::runtime_error("Failed to set socket options: SO_ZEROCOPY " + std::string(strerror(errno)));
+        }
+        /*
+        SO_ZEROCOPY (Linux 4.14+): Allow MSG_ZEROCOPY on this socket. Without it the flag is ignored.
+        */
+    }
+
+    m_epollFd = epoll_create1(0);
+    if (m_epollFd == -1)
+    {
+        throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+    }
+    // Edge-triggered: one wakeup each time send buffer space frees up after EAGAIN. EPOLLERR (zero-copy
+    // completions on the error queue) is always reported.
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLOUT | EPOLLET;
+    event.data.fd = sockFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, sockFd, &event) == -1)
+    {
+        close(m_epollFd);
+        throw std::runtime_error("Failed to add the socket to epoll: " + std::string(strerror(errno)));
+    }
+
+    m_pending.reserve(2 * STREAM_MAX_IOVECS);
+}
+
+StreamSender::~StreamSender()
+{
+    close(m_epollFd);
+}
+
+void StreamSender::send(int inputFd)
+{
+    bool finished = false;
+    while (true)
+    {
+        // Keep reading while the socket is busy, so input and network overlap, up to the watermark
+        if (!finished && m_queuedOffset - m_sentOffset < m_options.highWatermark)
+        {
+            finished = !readBlock(inputFd);
+        }
+
+        bool drained = flush();
+        reapCompletions();
+        releaseBlocks(finished);
+
+        if (finished && drained && m_zeroCopySends.empty())
+        {
+            return;
+        }
+        bool inputBlocked = finished || m_queuedOffset - m_sentOffset >= m_options.highWatermark;
+        if ((!drained && inputBlocked) || (drained && finished))
+        {
+            waitForSocket();
+        }
+    }
+}
+
+bool StreamSender::readBlock(int inputFd)
+{
+    std::unique_ptr<char[]> data;
+    if (m_spareBlocks.empty())
+    {
+        data.reset(new char[m_options.blockSize]);
+    }
+    else
+    {
+        data = std::move(m_spareBlocks.back());
+        m_spareBlocks.pop_back();
+    }
+    if (m_carry > 0)
+    {
+        const Block& previous = m_blocks.back();
+        memcpy(data.get(), previous.data.get() + previous.length - m_carry, m_carry);
+    }
+
+    m_blocks.push_back(Block{m_nextBlockId++, std::move(data), m_carry, {}, m_queuedOffset, 0});
+    Block& block = m_blocks.back();
+    m_carry = 0;
+
+    ssize_t bytesRead;
+    do
+    {
+        bytesRead = read(inputFd, block.data.get() + block.length, m_options.blockSize - block.length);
+    } while (bytesRead == -1 && errno == EINTR);
+    if (bytesRead == -1)
+    {
+        throw std::runtime_error("Failed to read input: " + std::string(strerror(errno)));
+    }
+    bool endOfInput = bytesRead == 0;
+    block.length += static_cast<size_t>(bytesRead);
+
+    // One frame per line; the payloads stay where read() put them
+    const char* line = block.data.get();
+    const char* end = line + block.length;
+    while (line < end)
+    {
+        const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+        const char* lineEnd = newline != nullptr ? newline : end;
+        while (static_cast<size_t>(lineEnd - line) > m_options.maxPayload ||
+               (newline == nullptr && static_cast<size_t>(lineEnd - line) == m_options.maxPayload))
+        {
+            queueFrame(block, line, m_options.maxPayload);
+            line += m_options.maxPayload;
+        }
+        if (newline == nullptr && !endOfInput)
+        {
+            m_carry = end - line; // Completed by the next read
+            break;
+        }
+        if (lineEnd > line)
+        {
+            queueFrame(block, line, lineEnd - line);
+        }
+        line = newline != nullptr ? newline + 1 : end;
+    }
+    return !endOfInput;
+}
+
+void StreamSender::queueFrame(Block& block, const char* payload, size_t length)
+{
+    block.headers.emplace_back();
+    char* header = block.headers.back().data();
+    size_t headerLength = encodeFrameHeader(FRAME_TYPE_TEXT, static_cast<uint32_t>(length), header);
+
+    m_pending.push_back(iovec{header, headerLength});
+    m_pending.push_back(iovec{const_cast<char*>(payload), length});
+    m_queuedOffset += headerLength + length;
+    block.end = m_queuedOffset;
+    ++m_stats.frames;
+    trafficMetrics().packetsSent.add();
+}
+
+bool StreamSender::flush()
+{
+    while (m_pendingHead < m_pending.size())
+    {
+        size_t count = std::min<size_t>(m_pending.size() - m_pendingHead, STREAM_MAX_IOVECS);
+        size_t offered = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            offered += m_pending[m_pendingHead + i].iov_len;
+        }
+
+        if (m_options.cork && !m_corked)
+        {
+            setCork(true);
+        }
+        int flags = MSG_NOSIGNAL;
+        if (m_options.more && m_pendingHead + count < m_pending.size())
+        {
+            flags |= MSG_MORE;
+        }
+        bool zeroCopy = m_options.zeroCopy && offered >= m_options.zeroCopyThreshold;
+        if (zeroCopy)
+        {
+            flags |= MSG_ZEROCOPY;
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &m_pending[m_pendingHead];
+        msg.msg_iovlen = count;
+        ssize_t bytesSent = sendmsg(m_sockFd, &msg, flags);
+        /*
+        sendmsg(int sockfd, const struct msghdr *msg, int flags)
+        writev() with flags: every iovec is sent in order as one contiguous piece of the stream
+        MSG_MORE: More data follows; do not push a partial segment yet (per-call TCP_CORK)
+        MSG_ZEROCOPY: Pin the pages and send from them; completion is reported on the error queue
+        MSG_NOSIGNAL: Return EPIPE instead of raising SIGPIPE when the peer has gone
+        return number of bytes sent if success, possibly fewer than offered on a non-blocking socket
+        return -1 with EAGAIN if the send buffer is full, ENOBUFS if too many zero-copy sends are outstanding
+        */
+        if (bytesSent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || (zeroCopy && errno == ENOBUFS))
+            {
+                ++m_stats.wouldBlock;
+                trafficMetrics().wouldBlock.add();
+                return false;
+            }
+            trafficMetrics().errors.add();
+            throw std::runtime_error("Failed to send: " + std::string(strerror(errno)));
+        }
+
+        ++m_stats.sendCalls;
+        if (static_cast<size_t>(bytesSent) < offered)
+        {
+            ++m_stats.partialSends;
+        }
+        if (zeroCopy)
+        {
+            ++m_stats.zeroCopySends;
+            recordZeroCopy(m_sentOffset, m_sentOffset + bytesSent);
+        }
+        advance(static_cast<size_t>(bytesSent));
+    }
+
+    // Queue empty: push out the partial segment that cork held back
+    if (m_corked)
+    {
+        setCork(false);
+    }
+    return true;
+}
+
+void StreamSender::advance(size_t bytes)
+{
+    m_sentOffset += bytes;
+    m_stats.bytes += bytes;
+    trafficMetrics().bytesSent.add(bytes);
+    while (bytes > 0)
+    {
+        iovec& iov = m_pending[m_pendingHead];
+        if (bytes < iov.iov_len)
+        {
+            // Partial write: the rest of this iovec goes first in the next call
+            iov.iov_base = static_cast<char*>(iov.iov_base) + bytes;
+            iov.iov_len -= bytes;
+            break;
+        }
+        bytes -= iov.iov_len;
+        ++m_pendingHead;
+    }
+
+    // Compact once the sent prefix dominates, so the queue does not grow without bound
+    if (m_pendingHead == m_pending.size())
+    {
+        m_pending.clear();
+        m_pendingHead = 0;
+    }
+    else if (m_pendingHead > m_pending.size() / 2)
+    {
+        m_pending.erase(m_pending.begin(), m_pending.begin() + m_pendingHead);
+        m_pendingHead = 0;
+    }
+}
+
+void StreamSender::recordZeroCopy(uint64_t from, uint64_t to)
+{
+    // Blocks hold consecutive stream ranges, each ending at Block::end
+    uint64_t firstBlock = 0;
+    uint64_t lastBlock = 0;
+    bool found = false;
+    for (Block& block : m_blocks)
+    {
+        if (block.end <= from)
+        {
+            continue;
+        }
+        if (!found)
+        {
+            firstBlock = block.id;
+            found = true;
+        }
+        lastBlock = block.id;
+        ++block.zeroCopies;
+        if (block.end >= to)
+        {
+            break;
+        }
+    }
+    if (m_zeroCopySends.empty())
+    {
+        m_firstZeroCopy = static_cast<uint32_t>(m_stats.zeroCopySends - 1);
+    }
+    m_zeroCopySends.push_back(ZeroCopySend{firstBlock, lastBlock, false});
+}
+
+void StreamSender::reapCompletions()
+{
+    char control[ZEROCOPY_CONTROL_SIZE];
+    while (!m_zeroCopySends.empty())
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(m_sockFd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return;
+        }
+        /*
+        MSG_ERRQUEUE: Zero-copy completions arrive as a sock_extended_err with ee_origin SO_EE_ORIGIN_ZEROCOPY.
+        ee_info..ee_data is the inclusive range of completed sends, numbered by a per-socket counter that starts
+        at 0 and counts every successful MSG_ZEROCOPY send. SO_EE_CODE_ZEROCOPY_COPIED: the kernel copied the
+        data after all (e.g. over loopback), so zero-copy bought nothing for those sends
+        */
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            bool copied = error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+            for (uint32_t sequence = error.ee_info;; ++sequence)
+            {
+                completeZeroCopy(sequence, copied);
+                if (sequence == error.ee_data)
+                {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void StreamSender::completeZeroCopy(uint32_t sequence, bool copied)
+{
+    uint32_t index = sequence - m_firstZeroCopy;
+    if (index >= m_zeroCopySends.size() || m_zeroCopySends[index].completed)
+    {
+        return;
+    }
+    ZeroCopySend& completed = m_zeroCopySends[index];
+    completed.completed = true;
+    ++m_stats.zeroCopyCompletions;
+    if (copied)
+    {
+        ++m_stats.zeroCopyCopied;
+    }
+    for (Block& block : m_blocks)
+    {
+        if (block.id >= completed.firstBlock && block.id <= completed.lastBlock)
+        {
+            --block.zeroCopies;
+        }
+    }
+
+    while (!m_zeroCopySends.empty() && m_zeroCopySends.front().completed)
+    {
+        m_zeroCopySends.pop_front();
+        ++m_firstZeroCopy;
+    }
+}
+
+void StreamSender::releaseBlocks(bool finished)
+{
+    // The newest block stays until the next read, which copies its unterminated last line
+    while (m_blocks.size() > (finished ? 0 : 1))
+    {
+        Block& block = m_blocks.front();
+        if (block.end > m_sentOffset || block.zeroCopies > 0)
+        {
+            return;
+        }
+        m_spareBlocks.push_back(std::move(block.data));
+        m_blocks.pop_front();
+    }
+}
+
+void StreamSender::setCork(bool enable)
+{
+    int value = enable ? 1 : 0;
+    if (setsockopt(m_sockFd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == -1)
+    {
+        throw std::runtime_error("Failed to set socket options: TCP_CORK " + std::string(strerror(errno)));
+    }
+    /*
+    TCP_CORK: While set, only full segments are sent. Clearing it sends the remainder at once.
+    The kernel uncorks by itself after 200 ms.
+    */
+    m_corked = enable;
+}
+
+void StreamSender::waitForSocket()
+{
+    epoll_event event;
+    if (epoll_wait(m_epollFd, &event, 1, STREAM_WAIT_TIMEOUT_MS) == -1 && errno != EINTR)
+    {
+        throw std::runtime_error("Failed to wait for the socket: " + std::string(strerror(errno)));
+    }
+}
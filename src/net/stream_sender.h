@@ -0,0 +1,135 @@
+/**
+ * @file stream_sender.h
+ * @brief Non-blocking, pipelined TCP sender that coalesces frames into scatter-gather sends
+ *
+ * One send() per message costs a system call each and, with Nagle disabled, a small segment
+ * each. StreamSender reads its input in large blocks, frames every line in place and queues two
+ * iovecs per frame (header, payload) without copying the payload. Queued frames go out with one
+ * sendmsg() per IOV_MAX iovecs - writev() plus send flags - on a non-blocking socket:
+ * - Partial writes advance the queue by the bytes the kernel took; EAGAIN waits for EPOLLOUT
+ * - Input keeps being read while the socket is full, until highWatermark bytes are queued
+ * - TCP_CORK (cork) or MSG_MORE (more) hold back partial segments until the queue drains
+ * - MSG_ZEROCOPY (zeroCopy) sends from the input blocks without copying them into the kernel.
+ *   A block is only reused once the kernel has reported on the error queue that every
+ *   zero-copy send covering it has completed
+ *
+ * Each input line becomes one FRAME_TYPE_TEXT frame (see framing.h). Empty lines are skipped
+ * and lines longer than maxPayload are split into several frames.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "net/framing.h"
+
+#define STREAM_MAX_IOVECS 1024 // IOV_MAX: iovecs per sendmsg call
+
+struct StreamSenderOptions
+{
+    size_t blockSize = 1024 * 1024;        // Input read per call; at least twice maxPayload
+    size_t maxPayload = 65536 - FRAME_MAX_HEADER_SIZE;
+    size_t highWatermark = 8 * 1024 * 1024; // Queued unsent bytes at which input reading pauses
+    bool cork = false;
+    bool more = false;
+    bool zeroCopy = false;
+    size_t zeroCopyThreshold = 16 * 1024; // Smaller sends are copied: page pinning costs more than the copy
+
+    // Handle --cork, --msg-more, --zerocopy and --zerocopy-threshold BYTES at argv[index]. Returns false if the
+    // argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--cork] [--msg-more] [--zerocopy] [--zerocopy-threshold BYTES]";
+    }
+};
+
+struct StreamSenderStats
+{
+    uint64_t frames = 0;
+    uint64_t bytes = 0;              // Frame bytes accepted by the kernel
+    uint64_t sendCalls = 0;          // Successful sendmsg calls
+    uint64_t partialSends = 0;       // Calls that took fewer bytes than offered
+    uint64_t wouldBlock = 0;         // Calls that failed with EAGAIN (send buffer full)
+    uint64_t zeroCopySends = 0;      // Calls flagged MSG_ZEROCOPY
+    uint64_t zeroCopyCompletions = 0;
+    uint64_t zeroCopyCopied = 0;     // Completions where the kernel copied after all (SO_EE_CODE_ZEROCOPY_COPIED)
+};
+
+class StreamSender
+{
+public:
+    // Switches sockFd (a connected TCP socket) to non-blocking mode and enables SO_ZEROCOPY if requested.
+    // Throws std::runtime_error on failure.
+    StreamSender(int sockFd, const StreamSenderOptions& options);
+    ~StreamSender();
+
+    StreamSender(const StreamSender&) = delete;
+    StreamSender& operator=(const StreamSender&) = delete;
+
+    // Send every line of inputFd until end of file, returning once the kernel has taken all of it and every
+    // zero-copy completion has been reaped. Throws std::runtime_error if reading or sending fails.
+    void send(int inputFd);
+
+    const StreamSenderStats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Block
+    {
+        uint64_t id;
+        std::unique_ptr<char[]> data;
+        size_t length; // Bytes of input in data
+        // Frame headers queued from this block; a deque never moves its elements, so the iovecs stay valid
+        std::deque<std::array<char, FRAME_MAX_HEADER_SIZE>> headers;
+        uint64_t end;        // Stream offset just past this block's last queued byte
+        unsigned zeroCopies; // Zero-copy sends covering this block that have not completed yet
+    };
+
+    struct ZeroCopySend
+    {
+        uint64_t firstBlock;
+        uint64_t lastBlock;
+        bool completed;
+    };
+
+    int m_sockFd;
+    int m_epollFd;
+    StreamSenderOptions m_options;
+    StreamSenderStats m_stats;
+
+    std::deque<Block> m_blocks;
+    std::vector<std::unique_ptr<char[]>> m_spareBlocks;
+    uint64_t m_nextBlockId;
+    size_t m_carry; // Unterminated last line of the newest block, moved to the front of the next one
+
+    std::vector<iovec> m_pending; // Queue of iovecs from m_pendingHead on
+    size_t m_pendingHead;
+    uint64_t m_queuedOffset; // Stream offsets: bytes queued and bytes sent
+    uint64_t m_sentOffset;
+    bool m_corked;
+
+    std::deque<ZeroCopySend> m_zeroCopySends; // Indexed by the kernel's send counter from m_firstZeroCopy on
+    uint32_t m_firstZeroCopy;
+
+    bool readBlock(int inputFd);
+    void queueFrame(Block& block, const char* payload, size_t length);
+    bool flush();
+    void advance(size_t bytes);
+    void recordZeroCopy(uint64_t from, uint64_t to);
+    void reapCompletions();
+    void completeZeroCopy(uint32_t sequence, bool copied);
+    void releaseBlocks(bool finished);
+    void setCork(bool enable);
+    void waitForSocket();
+};
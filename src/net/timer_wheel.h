@@ -0,0 +1,310 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hashed and hierarchical timer wheels for large numbers of timeouts
+ *
+ * Timers are hashed by deadline tick into slotCount buckets. Scheduling is O(1) and advancing
+ * the wheel only visits the slots whose tick has passed, so ten thousand in-flight timeouts
+ * cost the same per tick as ten. Deadlines further out than one revolution stay in their slot
+ * until the wheel comes around to their tick.
+ *
+ * HierarchicalTimerWheel keeps levels of 64 slots instead, each level's slots 64 times wider
+ * than the one below, and cascades timers down a level as the wheel reaches their slot. Any
+ * deadline fits without wrapping, and occupancy bitmaps let advance() jump straight to the next
+ * due slot, so it suits fine ticks (microseconds) and a caller that sleeps until nextExpiry()
+ * instead of waking every tick.
+ *
+ * Timers are not cancelled individually: when the awaited event arrives first, the caller
+ * forgets it, and the handler ignores the stale expiry (for example by carrying a generation
+ * number in the value).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define TIMER_WHEEL_LEVEL_BITS 6 // 64 slots per level, one bit each in a uint64_t occupancy mask
+#define TIMER_WHEEL_LEVELS 8     // 2^48 ticks: years at a microsecond tick
+
+template <typename T>
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(std::chrono::nanoseconds tick, size_t slotCount, Clock::time_point start = Clock::now())
+        : m_tick(tick), m_start(start), m_slots(slotCount), m_currentTick(0), m_size(0)
+    {
+    }
+
+    // Deadlines in the past fire on the next advance()
+    void schedule(Clock::time_point deadline, T value)
+    {
+        uint64_t tick = tickOf(deadline);
+        if (tick < m_currentTick)
+        {
+            tick = m_currentTick;
+        }
+        m_slots[tick % m_slots.size()].push_back(Entry{tick, std::move(value)});
+        ++m_size;
+    }
+
+    // Invoke handler(T&) for every timer whose tick has passed at now. Returns the number fired.
+    template <typename Handler>
+    size_t advance(Clock::time_point now, Handler&& handler)
+    {
+        uint64_t nowTick = tickOf(now);
+        size_t fired = 0;
+        for (; m_currentTick < nowTick && m_size > 0; ++m_currentTick)
+        {
+            std::vector<Entry>& slot = m_slots[m_currentTick % m_slots.size()];
+            for (size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].tick > m_currentTick)
+                {
+                    ++i;
+                    continue;
+                }
+                T value = std::move(slot[i].value);
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+                --m_size;
+                ++fired;
+                handler(value);
+            }
+        }
+        if (m_size == 0 && m_currentTick < nowTick)
+        {
+            m_currentTick = nowTick;
+        }
+        return fired;
+    }
+
+    // When the next slot is due; a poll()/epoll_wait() timeout that wakes the caller for advance()
+    Clock::time_point nextTick() const
+    {
+        return m_start + m_tick * (m_currentTick + 1);
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t tick;
+        T value;
+    };
+
+    std::chrono::nanoseconds m_tick;
+    Clock::time_point m_start;
+    std::vector<std::vector<Entry>> m_slots;
+    uint64_t m_currentTick; // Slots before this tick have been expired
+    size_t m_size;
+
+    uint64_t tickOf(Clock::time_point time) const
+    {
+        return time <= m_start ? 0 : static_cast<uint64_t>((time - m_start) / m_tick);
+    }
+};
+
+template <typename T>
+class HierarchicalTimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit HierarchicalTimerWheel(std::chrono::nanoseconds tick, Clock::time_point start = Clock::now())
+        : m_tick(tick), m_start(start), m_occupied{}, m_currentTick(0), m_size(0)
+    {
+    }
+
+    // Deadlines in the past fire on the next advance()
+    void schedule(Clock::time_point deadline, T value)
+    {
+        place(Entry{std::max(tickOf(deadline), m_currentTick), std::move(value)});
+        ++m_size;
+    }
+
+    // Invoke handler(T&) for every timer whose tick has passed at now. Returns the number fired.
+    template <typename Handler>
+    size_t advance(Clock::time_point now, Handler&& handler)
+    {
+        uint64_t nowTick = tickOf(now);
+        size_t fired = 0;
+        while (m_currentTick < nowTick && m_size > 0)
+        {
+            fired += expire(handler);
+            uint64_t next = nextSlotTick();
+            if (next > nowTick)
+            {
+                break;
+            }
+            // Skipping the empty ticks in between is safe: no slot of any level comes due before next
+            m_currentTick = next;
+            cascade();
+        }
+        if (m_currentTick < nowTick)
+        {
+            m_currentTick = nowTick;
+        }
+        return fired;
+    }
+
+    // The earliest time advance() can have work: exact for timers due within 64 ticks, otherwise when the
+    // next cascade brings them closer. Clock::time_point::max() when no timers are pending.
+    Clock::time_point nextExpiry() const
+    {
+        if (m_size == 0)
+        {
+            return Clock::time_point::max();
+        }
+        uint64_t current = m_currentTick & SLOT_MASK;
+        if (m_occupied[0] & (~0ULL << current))
+        {
+            // Level 0 slots hold one tick each, and timers fire once their tick has passed
+            uint64_t slot = static_cast<uint64_t>(__builtin_ctzll(m_occupied[0] >> current << current));
+            uint64_t tick = (m_currentTick & ~SLOT_MASK) + slot;
+            return m_start + m_tick * (tick + 1);
+        }
+        return m_start + m_tick * nextSlotTick();
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    static constexpr uint64_t SLOTS = 1ULL << TIMER_WHEEL_LEVEL_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+
+    struct Entry
+    {
+        uint64_t tick;
+        T value;
+    };
+
+    std::chrono::nanoseconds m_tick;
+    Clock::time_point m_start;
+    std::vector<Entry> m_slots[TIMER_WHEEL_LEVELS][SLOTS];
+    uint64_t m_occupied[TIMER_WHEEL_LEVELS]; // Bit s: slot s of the level holds timers
+    std::vector<Entry> m_overflow;           // Timers beyond the top level's current turn
+    std::vector<Entry> m_expiring;           // The slot being expired, so handlers can schedule into it
+    uint64_t m_currentTick;                  // Ticks before this one have been expired
+    size_t m_size;
+
+    uint64_t tickOf(Clock::time_point time) const
+    {
+        return time <= m_start ? 0 : static_cast<uint64_t>((time - m_start) / m_tick);
+    }
+
+    static unsigned shift(unsigned level)
+    {
+        return level * TIMER_WHEEL_LEVEL_BITS;
+    }
+
+    // A timer goes in the level of the highest digit where its tick differs from the current one: that digit is
+    // larger, so the slot is ahead of the wheel's position within the current turn of the level
+    void place(Entry entry)
+    {
+        uint64_t differing = entry.tick ^ m_currentTick;
+        if (differing >> shift(TIMER_WHEEL_LEVELS))
+        {
+            m_overflow.push_back(std::move(entry)); // Beyond the top level's turn
+            return;
+        }
+        unsigned level = 0;
+        if (differing != 0)
+        {
+            level = static_cast<unsigned>(63 - __builtin_clzll(differing)) / TIMER_WHEEL_LEVEL_BITS;
+        }
+        uint64_t slot = (entry.tick >> shift(level)) & SLOT_MASK;
+        m_slots[level][slot].push_back(std::move(entry));
+        m_occupied[level] |= 1ULL << slot;
+    }
+
+    // Fire the level 0 slot of the current tick, including timers handlers schedule into it meanwhile
+    template <typename Handler>
+    size_t expire(Handler& handler)
+    {
+        uint64_t slot = m_currentTick & SLOT_MASK;
+        size_t fired = 0;
+        while (m_occupied[0] & (1ULL << slot))
+        {
+            m_expiring.swap(m_slots[0][slot]);
+            m_occupied[0] &= ~(1ULL << slot);
+            for (Entry& entry : m_expiring)
+            {
+                --m_size;
+                ++fired;
+                handler(entry.value);
+            }
+            m_expiring.clear();
+        }
+        return fired;
+    }
+
+    // Move the timers of every higher-level slot that starts at the current tick down, top level first, so
+    // timers cascade all the way in one step
+    void cascade()
+    {
+        if ((m_currentTick & ((1ULL << shift(TIMER_WHEEL_LEVELS)) - 1)) == 0 && !m_overflow.empty())
+        {
+            std::vector<Entry> entries;
+            entries.swap(m_overflow);
+            for (Entry& entry : entries)
+            {
+                place(std::move(entry));
+            }
+        }
+        for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; --level)
+        {
+            if ((m_currentTick & ((1ULL << shift(level)) - 1)) != 0)
+            {
+                continue;
+            }
+            uint64_t slot = (m_currentTick >> shift(level)) & SLOT_MASK;
+            if ((m_occupied[level] & (1ULL << slot)) == 0)
+            {
+                continue;
+            }
+            std::vector<Entry> entries;
+            entries.swap(m_slots[level][slot]);
+            m_occupied[level] &= ~(1ULL << slot);
+            for (Entry& entry : entries)
+            {
+                place(std::move(entry));
+            }
+        }
+    }
+
+    // The first tick after the current one where a slot of some level comes due (UINT64_MAX if none)
+    uint64_t nextSlotTick() const
+    {
+        uint64_t next = UINT64_MAX;
+        if (!m_overflow.empty())
+        {
+            next = (m_currentTick | ((1ULL << shift(TIMER_WHEEL_LEVELS)) - 1)) + 1;
+        }
+        for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+        {
+            uint64_t current = (m_currentTick >> shift(level)) & SLOT_MASK;
+            uint64_t ahead = current == SLOT_MASK ? 0 : m_occupied[level] & (~0ULL << (current + 1));
+            if (ahead == 0)
+            {
+                continue;
+            }
+            uint64_t turn = m_currentTick >> shift(level + 1) << shift(level + 1);
+            uint64_t tick = turn + (static_cast<uint64_t>(__builtin_ctzll(ahead)) << shift(level));
+            next = std::min(next, tick);
+        }
+        return next;
+    }
+};
@@ -0,0 +1,191 @@
+/**
+ * @file timestamping.cpp
+ * @brief Kernel and hardware packet timestamps with SO_TIMESTAMPING
+ */
+
+#include "net/timestamping.h"
+
+#include <stdexcept>
+#include <string.h>
+#include <time.h>
+
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+
+// Room for SCM_TIMESTAMPING plus the IP_RECVERR/IPV6_RECVERR message that carries the OPT_ID key
+#define ERRQUEUE_CONTROL_SIZE 256
+
+static int64_t toNs(const timespec& time)
+{
+    return static_cast<int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+}
+
+int64_t realtimeNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return toNs(now);
+}
+
+bool parseTimestamps(const msghdr& msg, PacketTimestamps& timestamps)
+{
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&msg), cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            /*
+            struct scm_timestamping { struct timespec ts[3]; }
+            ts[0]: Software timestamp
+            ts[1]: Unused (formerly hardware converted to system time)
+            ts[2]: Raw hardware timestamp
+            A field is zero when that timestamp was not generated
+            */
+            scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            timestamps.softwareNs = toNs(stamps.ts[0]);
+            timestamps.hardwareNs = toNs(stamps.ts[2]);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readTransmitTimestamp(int fd, uint32_t& key, PacketTimestamps& timestamps)
+{
+    char data[64];
+    char control[ERRQUEUE_CONTROL_SIZE];
+    while (true)
+    {
+        iovec iov{data, sizeof(data)};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return false;
+        }
+        /*
+        MSG_ERRQUEUE: Read from the socket error queue instead of the receive queue. TX timestamps are
+        queued there as an SCM_TIMESTAMPING message plus a sock_extended_err with ee_origin
+        SO_EE_ORIGIN_TIMESTAMPING, whose ee_data holds the OPT_ID key of the send
+        */
+
+        bool haveKey = false;
+        bool haveTimestamps = parseTimestamps(msg, timestamps);
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            bool recvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recvErr)
+            {
+                continue;
+            }
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                key = error.ee_data;
+                haveKey = true;
+            }
+        }
+        // Anything else on the error queue (ICMP errors with IP_RECVERR) is skipped
+        if (haveKey && haveTimestamps)
+        {
+            return true;
+        }
+    }
+}
+
+bool TimestampOptions::parseArgument(int argc, char** argv, int& index)
+{
+    std::string arg = argv[index];
+    if (arg != "--timestamps" && arg != "--timestamp-interface")
+    {
+        return false;
+    }
+    if (index + 1 >= argc)
+    {
+        throw std::runtime_error(arg + " requires a value");
+    }
+
+    std::string value = argv[++index];
+    if (arg == "--timestamp-interface")
+    {
+        interface = value;
+    }
+    else if (value == "none" || value == "software" || value == "hardware")
+    {
+        source = value == "none"       ? TimestampSource::None
+                 : value == "software" ? TimestampSource::Software
+                                       : TimestampSource::Hardware;
+    }
+    else
+    {
+        throw std::runtime_error("Invalid timestamp source '" + value + "'");
+    }
+    return true;
+}
+
+void TimestampOptions::apply(int fd) const
+{
+    if (source == TimestampSource::None)
+    {
+        return;
+    }
+
+    unsigned flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+    if (transmit)
+    {
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+    if (source == TimestampSource::Hardware)
+    {
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+        if (transmit)
+        {
+            flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+        }
+    }
+    /*
+    SOF_TIMESTAMPING_{RX,TX}_{SOFTWARE,HARDWARE}: Which timestamps to generate
+    SOF_TIMESTAMPING_SOFTWARE / RAW_HARDWARE: Which timestamps to report in control messages
+    SOF_TIMESTAMPING_OPT_ID: Tag each TX timestamp with a counter that increments per send
+    SOF_TIMESTAMPING_OPT_TSONLY: Return only the timestamp on the error queue, not a copy of the packet
+    */
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+    {
+        throw std::runtime_error("Failed to set SO_TIMESTAMPING: " + std::string(strerror(errno)));
+    }
+
+    if (source != TimestampSource::Hardware || interface.empty())
+    {
+        return;
+    }
+
+    // Without this the NIC does not stamp anything; PTP daemons such as ptp4l may have done it already
+    hwtstamp_config config;
+    memset(&config, 0, sizeof(config));
+    config.tx_type = transmit ? HWTSTAMP_TX_ON : HWTSTAMP_TX_OFF;
+    config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+    ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface.c_str(), sizeof(request.ifr_name) - 1);
+    request.ifr_data = reinterpret_cast<char*>(&config);
+    if (ioctl(fd, SIOCSHWTSTAMP, &request) == -1)
+    {
+        throw std::runtime_error("Failed to enable hardware timestamping on " + interface + ": " +
+                                 std::string(strerror(errno)));
+    }
+    /*
+    SIOCSHWTSTAMP: Configure the device. The driver writes back the rx_filter it applied, which on
+    some NICs covers PTP packets only; other packets then carry software timestamps only
+    */
+}
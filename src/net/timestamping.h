@@ -0,0 +1,99 @@
+/**
+ * @file timestamping.h
+ * @brief Kernel and hardware packet timestamps with SO_TIMESTAMPING
+ *
+ * Reading the clock in userspace after recvfrom() returns adds the scheduler wakeup and the
+ * time spent in the application to every latency sample. With SO_TIMESTAMPING the kernel stamps
+ * each packet itself and hands the time over as a control message:
+ * - RX software: when the packet entered the network stack (CLOCK_REALTIME)
+ * - RX/TX hardware: when the NIC saw it on the wire (the NIC's PTP clock), once the device has
+ *   been switched to hardware timestamping with SIOCSHWTSTAMP
+ * - TX software: when the driver handed the packet to the device. TX timestamps come back on
+ *   the socket error queue (recvmsg with MSG_ERRQUEUE), tagged with a per-socket send counter
+ *   (SOF_TIMESTAMPING_OPT_ID) so they can be matched with the packet that was sent
+ *
+ *     TimestampOptions options;           // --timestamps software|hardware [--timestamp-interface eth0]
+ *     options.apply(socket.fd());
+ *     ...
+ *     PacketTimestamps timestamps;
+ *     parseTimestamps(msg, timestamps);   // after recvmsg() with TIMESTAMP_CONTROL_SIZE bytes of msg_control
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+// Control buffer space for one SCM_TIMESTAMPING message
+#define TIMESTAMP_CONTROL_SIZE CMSG_SPACE(sizeof(struct scm_timestamping))
+
+struct PacketTimestamps
+{
+    int64_t softwareNs = 0; // Kernel timestamp, CLOCK_REALTIME nanoseconds; 0 if none
+    int64_t hardwareNs = 0; // NIC timestamp, PTP clock nanoseconds; 0 if none
+
+    // Take every timestamp other carries: software and hardware TX timestamps arrive as separate messages
+    void merge(const PacketTimestamps& other)
+    {
+        softwareNs = other.softwareNs != 0 ? other.softwareNs : softwareNs;
+        hardwareNs = other.hardwareNs != 0 ? other.hardwareNs : hardwareNs;
+    }
+};
+
+// Time from one timestamp to another: hardware when both have it (same NIC clock), else software. -1 if unknown.
+inline int64_t elapsedNs(const PacketTimestamps& from, const PacketTimestamps& to)
+{
+    if (from.hardwareNs != 0 && to.hardwareNs != 0)
+    {
+        return to.hardwareNs - from.hardwareNs;
+    }
+    if (from.softwareNs != 0 && to.softwareNs != 0)
+    {
+        return to.softwareNs - from.softwareNs;
+    }
+    return -1;
+}
+
+// CLOCK_REALTIME now, comparable with software timestamps
+int64_t realtimeNs();
+
+// Extract SCM_TIMESTAMPING from a received message. Returns false if the message carries none.
+bool parseTimestamps(const msghdr& msg, PacketTimestamps& timestamps);
+
+// Read one TX timestamp from the error queue without blocking. key is the SOF_TIMESTAMPING_OPT_ID
+// counter of the send it belongs to (0 for the first send on the socket). Returns false when the queue is empty.
+bool readTransmitTimestamp(int fd, uint32_t& key, PacketTimestamps& timestamps);
+
+enum class TimestampSource
+{
+    None,
+    Software,
+    Hardware // Also reports software timestamps, for packets the NIC did not stamp (e.g. loopback)
+};
+
+struct TimestampOptions
+{
+    TimestampSource source = TimestampSource::None;
+    bool transmit = false;  // Also stamp sent packets and queue the timestamps on the error queue
+    std::string interface;  // With Hardware: enable timestamping on this NIC (needs CAP_NET_ADMIN)
+
+    bool enabled() const
+    {
+        return source != TimestampSource::None;
+    }
+
+    // Handle --timestamps none|software|hardware and --timestamp-interface IFACE at argv[index]. Returns
+    // false if the argument is not one of them; throws std::runtime_error on an invalid value.
+    bool parseArgument(int argc, char** argv, int& index);
+
+    static const char* usage()
+    {
+        return "[--timestamps none|software|hardware] [--timestamp-interface IFACE]";
+    }
+
+    // Enable SO_TIMESTAMPING on fd. Throws std::runtime_error on failure.
+    void apply(int fd) const;
+};
@@ -0,0 +1,355 @@
+/**
+ * @file udp_endpoint.h
+ * @brief UDP sockets configured at compile time from policy types
+ *
+ * The examples describe their sockets with #define constants (TTL, loopback, buffer size) that
+ * are turned into setsockopt() calls and branches at run time, and DatagramBatch sizes its
+ * recvmmsg arrays from run-time arguments. Here the same choices are template arguments:
+ * - A role says what the socket sends to: UnicastRole, BroadcastRole (SO_BROADCAST) or
+ *   MulticastRole<Ttl, Loopback> (IP_MULTICAST_TTL, IP_MULTICAST_LOOP, or IPV6_MULTICAST_HOPS and
+ *   IPV6_MULTICAST_LOOP on an IPv6 socket).
+ * - BatchRecv<N> and BufSize<B> give the receive batch depth and the largest datagram received
+ *   whole. FixedDatagramBatch<N, B> holds N headers and N buffers of B bytes in one allocation,
+ *   and its receive loop runs over a constant count (a plain recvmsg when N is 1).
+ * - Policies are checked by static_assert: one role at most, a batch depth recvmmsg accepts, a
+ *   buffer no larger than a UDP payload, batch memory within UDP_MAX_BATCH_MEMORY and a TTL that
+ *   fits the option. Combinations that cannot work fail to compile instead of at run time.
+ * - Policies are plain types with static members, so there is no virtual dispatch; the options
+ *   are applied once, in the constructor.
+ * withBatchSize() maps a run-time --batch value onto the sizes compiled in (UDP_FIXED_BATCH_SIZES),
+ * so command line flags keep working and other sizes fall back to DatagramBatch.
+ *
+ *     using Feed = UdpEndpoint<MulticastRole<32, true>, BatchRecv<64>, BufSize<9216>>;
+ *     Feed endpoint(socketOptions);   // socket(), SocketOptions, then the role's options
+ *     Feed endpoint6(socketOptions, AF_INET6);
+ *     endpoint.bind(address);
+ *     int count = endpoint.batch().receive();
+ *
+ *     withBatchSize<UDP_FIXED_BATCH_SIZES>(batchSize, [&]<unsigned N>() { run(FixedDatagramBatch<N, 9216>(fd)); });
+ *
+ * @note Addresses, ports and the address family stay run-time values: they come from flags and config files
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "net/datagram_batch.h"
+#include "net/metrics.h"
+#include "net/socket.h"
+#include "net/timestamping.h"
+
+#define UDP_MAX_PAYLOAD 65507           // 65535 minus the IPv4 and UDP headers (IPv6 allows 65527)
+#define UDP_MAX_BATCH 1024              // UIO_MAXIOV: recvmmsg takes at most this many messages per call
+#define UDP_MAX_BATCH_MEMORY (16 << 20) // Largest batch depth * buffer size a FixedDatagramBatch allocates
+#define UDP_MAX_TTL 255
+#define UDP_FIXED_BATCH_SIZES 1, 8, 16, 32, 64, 128, 256, 512, 1024 // Depths with a compiled-in receive loop
+
+// Policy kinds: every policy names one of them as its Kind
+struct RolePolicy
+{
+};
+struct BatchPolicy
+{
+};
+struct BufferPolicy
+{
+};
+
+template <typename P>
+concept UdpPolicy = std::is_same_v<typename P::Kind, RolePolicy> || std::is_same_v<typename P::Kind, BatchPolicy> ||
+                    std::is_same_v<typename P::Kind, BufferPolicy>;
+
+// Throws std::runtime_error naming the option
+inline void setUdpOption(int fd, int level, int name, const void* value, socklen_t length, const char* optionName)
+{
+    if (setsockopt(fd, level, name, value, length) == -1)
+    {
+        throw std::runtime_error("Failed to set socket options: " + std::string(optionName) + " " + strerror(errno));
+    }
+}
+
+// Roles are applied to a socket of the given family, AF_INET or AF_INET6
+
+// Datagrams to single hosts; nothing beyond the SocketOptions
+struct UnicastRole
+{
+    using Kind = RolePolicy;
+
+    static void apply(int, int)
+    {
+    }
+};
+
+struct BroadcastRole
+{
+    using Kind = RolePolicy;
+
+    static void apply(int fd, int family)
+    {
+        if (family != AF_INET)
+        {
+            throw std::runtime_error("IPv6 has no broadcast: send to the all-nodes multicast group ff02::1 instead");
+        }
+        int opt = 1;
+        setUdpOption(fd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt), "SO_BROADCAST");
+        /*
+        SO_BROADCAST: Without it, sending to a broadcast address fails with EACCES
+        */
+    }
+};
+
+// Ttl 0: same host, 1: same subnet, over 1: routed to other subnets. Loopback delivers to receivers on this host.
+template <unsigned Ttl = 1, bool Loopback = true>
+struct MulticastRole
+{
+    static_assert(Ttl <= UDP_MAX_TTL, "IP_MULTICAST_TTL is one byte: Ttl must be at most 255");
+    static_assert(Ttl > 0 || Loopback, "Ttl 0 keeps datagrams on this host, and without loopback nobody receives them");
+
+    using Kind = RolePolicy;
+    static constexpr unsigned char ttl = Ttl;
+    static constexpr bool loopback = Loopback;
+
+    static void apply(int fd, int family)
+    {
+        if (family == AF_INET6)
+        {
+            int hops = ttl;
+            setUdpOption(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops), "IPV6_MULTICAST_HOPS");
+            unsigned int loop = loopback ? 1 : 0;
+            setUdpOption(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop), "IPV6_MULTICAST_LOOP");
+            /*
+            IPV6_MULTICAST_HOPS, IPV6_MULTICAST_LOOP: The same for IPv6, where both take an int. How far a
+            group reaches is also limited by its scope (ff02:: link, ff05:: site, ff0e:: global).
+            */
+            return;
+        }
+        unsigned char value = ttl;
+        setUdpOption(fd, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value), "IP_MULTICAST_TTL");
+        value = loopback ? 1 : 0;
+        setUdpOption(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof(value), "IP_MULTICAST_LOOP");
+        /*
+        IP_MULTICAST_TTL: Hop limit of the datagrams this socket sends to a group (default 1)
+        IP_MULTICAST_LOOP: Also deliver them to group members on this host (default on)
+        */
+    }
+};
+
+// Receive up to N datagrams per call
+template <unsigned N>
+struct BatchRecv
+{
+    static_assert(N >= 1 && N <= UDP_MAX_BATCH, "BatchRecv<N>: recvmmsg takes 1 to UIO_MAXIOV (1024) messages");
+
+    using Kind = BatchPolicy;
+    static constexpr unsigned size = N;
+};
+
+// Receive datagrams of up to B bytes whole
+template <size_t B>
+struct BufSize
+{
+    static_assert(B >= 1 && B <= UDP_MAX_PAYLOAD, "BufSize<B>: a UDP payload is 1 to 65507 bytes");
+
+    using Kind = BufferPolicy;
+    static constexpr size_t size = B;
+};
+
+template <typename Kind, typename... Policies>
+inline constexpr unsigned policyCount = (0U + ... + (std::is_same_v<typename Policies::Kind, Kind> ? 1U : 0U));
+
+// The first of Policies of the given kind, or Default
+template <typename Kind, typename Default, typename... Policies>
+struct FindPolicy
+{
+    using type = Default;
+};
+
+template <typename Kind, typename Default, typename First, typename... Rest>
+struct FindPolicy<Kind, Default, First, Rest...>
+{
+    using type = std::conditional_t<std::is_same_v<typename First::Kind, Kind>, First,
+                                    typename FindPolicy<Kind, Default, Rest...>::type>;
+};
+
+// DatagramBatch with its depth and buffer size fixed at compile time: the same receive() and datagrams(), with
+// every array in one allocation and no pool
+template <unsigned BatchSize, size_t BufferSize>
+class FixedDatagramBatch
+{
+public:
+    static_assert(BatchSize >= 1 && BatchSize <= UDP_MAX_BATCH, "Batch depth must be 1 to UIO_MAXIOV (1024)");
+    static_assert(BufferSize >= 1 && BufferSize <= UDP_MAX_PAYLOAD, "Buffer size must be 1 to 65507 bytes");
+    static_assert(static_cast<uint64_t>(BatchSize) * BufferSize <= UDP_MAX_BATCH_MEMORY,
+                  "Batch depth * buffer size exceeds UDP_MAX_BATCH_MEMORY");
+
+    static constexpr size_t controlSize = CMSG_SPACE(sizeof(uint32_t)) + TIMESTAMP_CONTROL_SIZE;
+
+    explicit FixedDatagramBatch(int sockFd)
+        : m_sockFd(sockFd), m_storage(new Storage)
+    {
+        Storage& storage = *m_storage;
+        for (unsigned i = 0; i < BatchSize; ++i)
+        {
+            storage.iovecs[i].iov_base = &storage.buffers[i * BufferSize];
+            storage.iovecs[i].iov_len = BufferSize;
+
+            msghdr& msg = storage.headers[i].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &storage.senders[i];
+            msg.msg_iov = &storage.iovecs[i];
+            msg.msg_iovlen = 1;
+            msg.msg_control = &storage.control[i * controlSize];
+
+            storage.datagrams[i].data = &storage.buffers[i * BufferSize];
+            storage.datagrams[i].sender = &storage.senders[i];
+        }
+    }
+
+    FixedDatagramBatch(const FixedDatagramBatch&) = delete;
+    FixedDatagramBatch& operator=(const FixedDatagramBatch&) = delete;
+
+    // Receive up to BatchSize datagrams with one system call. Returns the count, or -1 with errno set.
+    int receive(int flags = MSG_WAITFORONE)
+    {
+        Storage& storage = *m_storage;
+        int count;
+        if constexpr (BatchSize == 1)
+        {
+            // MSG_WAITFORONE only means something to recvmmsg
+            msghdr& msg = storage.headers[0].msg_hdr;
+            msg.msg_namelen = SocketAddress::capacity();
+            msg.msg_controllen = controlSize;
+            ssize_t length = recvmsg(m_sockFd, &msg, flags & ~MSG_WAITFORONE);
+            storage.headers[0].msg_len = length > 0 ? static_cast<unsigned>(length) : 0;
+            count = length == -1 ? -1 : 1;
+        }
+        else
+        {
+            // The kernel overwrites the name and control lengths, so restore them before every call
+            for (mmsghdr& header : storage.headers)
+            {
+                header.msg_hdr.msg_namelen = SocketAddress::capacity();
+                header.msg_hdr.msg_controllen = controlSize;
+            }
+            count = recvmmsg(m_sockFd, storage.headers.data(), BatchSize, flags, nullptr);
+        }
+        return m_accounting.complete(count, storage.headers.data(), storage.datagrams.data());
+    }
+
+    const Datagram* datagrams() const
+    {
+        return m_storage->datagrams.data();
+    }
+
+    static constexpr unsigned batchSize()
+    {
+        return BatchSize;
+    }
+
+    static constexpr size_t bufferSize()
+    {
+        return BufferSize;
+    }
+
+    // Total packets the kernel dropped on this socket (SO_RXQ_OVFL, see DatagramBatch::enableDropCounter())
+    uint32_t droppedPackets() const
+    {
+        return m_accounting.droppedPackets();
+    }
+
+    // Drops reported since the previous call
+    uint32_t takeNewDrops()
+    {
+        return m_accounting.takeNewDrops();
+    }
+
+private:
+    struct Storage
+    {
+        std::array<mmsghdr, BatchSize> headers;
+        std::array<iovec, BatchSize> iovecs;
+        std::array<SocketAddress, BatchSize> senders;
+        std::array<Datagram, BatchSize> datagrams;
+        alignas(cmsghdr) std::array<char, BatchSize * controlSize> control;
+        alignas(64) std::array<char, BatchSize * BufferSize> buffers;
+    };
+
+    int m_sockFd;
+    std::unique_ptr<Storage> m_storage; // Left uninitialized: the buffers are only read after the kernel fills them
+    BatchAccounting m_accounting;
+};
+
+// An IPv4 or IPv6 UDP socket set up from Policies: at most one role (default UnicastRole), and BatchRecv<N> with an
+// optional BufSize<B> (default UDP_MAX_PAYLOAD) to receive through a FixedDatagramBatch
+template <UdpPolicy... Policies>
+class UdpEndpoint
+{
+public:
+    static_assert(policyCount<RolePolicy, Policies...> <= 1,
+                  "UdpEndpoint takes one role: UnicastRole, BroadcastRole or MulticastRole");
+    static_assert(policyCount<BatchPolicy, Policies...> <= 1, "UdpEndpoint takes one BatchRecv");
+    static_assert(policyCount<BufferPolicy, Policies...> <= 1, "UdpEndpoint takes one BufSize");
+    static_assert(policyCount<BufferPolicy, Policies...> == 0 || policyCount<BatchPolicy, Policies...> == 1,
+                  "BufSize sizes receive buffers, which only BatchRecv allocates");
+
+    using Role = typename FindPolicy<RolePolicy, UnicastRole, Policies...>::type;
+    static constexpr bool receives = policyCount<BatchPolicy, Policies...> == 1;
+    static constexpr unsigned batchSize = FindPolicy<BatchPolicy, BatchRecv<1>, Policies...>::type::size;
+    static constexpr size_t bufferSize = FindPolicy<BufferPolicy, BufSize<UDP_MAX_PAYLOAD>, Policies...>::type::size;
+    using Batch = FixedDatagramBatch<batchSize, bufferSize>;
+
+    // Creates a socket of family (AF_INET or AF_INET6) and applies options, then the role's options. Throws
+    // std::runtime_error.
+    explicit UdpEndpoint(const SocketOptions& options = SocketOptions(), int family = AF_INET)
+        : m_socket(family, SOCK_DGRAM)
+    {
+        m_socket.apply(options);
+        Role::apply(m_socket.fd(), family);
+        if constexpr (receives)
+        {
+            m_batch = std::make_unique<Batch>(m_socket.fd());
+        }
+    }
+
+    int fd() const
+    {
+        return m_socket.fd();
+    }
+
+    // Throws std::runtime_error
+    UdpEndpoint& bind(const SocketAddress& address)
+    {
+        m_socket.bind(address);
+        return *this;
+    }
+
+    Batch& batch()
+        requires receives
+    {
+        return *m_batch;
+    }
+
+private:
+    Socket m_socket;
+    std::unique_ptr<Batch> m_batch; // Only with BatchRecv
+};
+
+// Call f.template operator()<N>() with the N of Sizes equal to batchSize. Returns false, without calling f, if
+// batchSize was not compiled in.
+template <unsigned... Sizes, typename F>
+bool withBatchSize(unsigned batchSize, F&& f)
+{
+    return ((batchSize == Sizes ? (f.template operator()<Sizes>(), true) : false) || ...);
+}